@@ -549,6 +549,18 @@ static void count_stream_stats_kernel(struct packet_stream *ps) {
 		RTPE_STATS_ADD(x ## _kernel, diff_ ## x);		\
 	} while (0)
 
+// adds what the kernel has counted since the last call to the global delay histogram
+void call_kernel_delay_stats(struct packet_stream *ps, const struct rtpengine_stats *st) {
+	for (unsigned int j = 0; j < RTPE_NUM_DELAY_BUCKETS; j++) {
+		if (st->delay_hist[j] > ps->kernel_delay_hist[j])
+			RTPE_STATS_ADD(kernel_delay[j], st->delay_hist[j] - ps->kernel_delay_hist[j]);
+		ps->kernel_delay_hist[j] = st->delay_hist[j];
+	}
+	if (st->delay_hist_sum > ps->kernel_delay_hist_sum)
+		RTPE_STATS_ADD(kernel_delay_sum, st->delay_hist_sum - ps->kernel_delay_hist_sum);
+	ps->kernel_delay_hist_sum = st->delay_hist_sum;
+}
+
 void call_timer(void *ptr) {
 	struct iterator_helper hlp;
 	GList *i;
@@ -612,6 +624,8 @@ void call_timer(void *ptr) {
 		DS(bytes);
 		DS(errors);
 
+		call_kernel_delay_stats(ps, &ke->stats);
+
 
 		if (ke->stats.packets != atomic64_get(&ps->kernel_stats.packets)) {
 			atomic64_set(&ps->last_packet, rtpe_now.tv_sec);
@@ -1259,7 +1273,7 @@ enum call_stream_state call_stream_state_machine(struct packet_stream *ps) {
 			static const str fake_rtp = STR_CONST_INIT("\x80\x7f\xff\xff\x00\x00\x00\x00"
 					"\x00\x00\x00\x00");
 			struct stream_fd *sfd = l->data;
-			socket_sendto(&sfd->socket, fake_rtp.s, fake_rtp.len, &ps->endpoint);
+			poller_sendto(&sfd->socket, fake_rtp.s, fake_rtp.len, &ps->endpoint, NULL, NULL);
 		}
 		ret = CSS_PIERCE_NAT;
 	}
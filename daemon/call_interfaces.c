@@ -1493,7 +1493,7 @@ void call_ng_free_flags(struct sdp_ng_flags *flags) {
 	g_queue_clear_full(&flags->codec_mask, free);
 }
 
-static enum load_limit_reasons call_offer_session_limit(void) {
+static enum load_limit_reasons call_offer_session_limit(const struct sdp_ng_flags *flags) {
 	enum load_limit_reasons ret = LOAD_LIMIT_NONE;
 
 	rwlock_lock_r(&rtpe_config.config_lock);
@@ -1540,6 +1540,19 @@ static enum load_limit_reasons call_offer_session_limit(void) {
 		}
 	}
 
+	// only offers that explicitly ask for transcoding are subject to this limit
+	if (ret == LOAD_LIMIT_NONE && rtpe_config.transcode_limit
+			&& (flags->codec_transcode.length || flags->codec_accept.length))
+	{
+		// load in millionths of a CPU core, limit in hundredths
+		uint64_t load = codeclib_transcoding_load();
+		if (load >= (uint64_t) rtpe_config.transcode_limit * 10000) {
+			ilog(LOG_WARN, "Transcoding capacity exhausted (%.2f > %.2f CPU cores)",
+					(double) load / 1000000.0, (double) rtpe_config.transcode_limit / 100.0);
+			ret = LOAD_LIMIT_TRANSCODING;
+		}
+	}
+
 	rwlock_unlock_r(&rtpe_config.config_lock);
 
 	return ret;
@@ -1709,7 +1722,7 @@ static const char *call_offer_answer_ng(struct ng_buffer *ngbuf, bencode_item_t
 	}
 
 	if (opmode == OP_OFFER && !call) {
-		enum load_limit_reasons limit = call_offer_session_limit();
+		enum load_limit_reasons limit = call_offer_session_limit(&flags);
 		if (limit != LOAD_LIMIT_NONE) {
 			if (!flags.supports_load_limit)
 				errstr = "Parallel session limit reached"; // legacy protocol
@@ -2102,6 +2115,8 @@ static void ng_stats_ssrc(bencode_item_t *dict, struct ssrc_hash *ht) {
 		bencode_item_t *ent = bencode_dictionary_add_dictionary(dict, tmp);
 
 		bencode_dictionary_add_integer(ent, "cumulative loss", se->packets_lost);
+		if (se->audio_level >= 0)
+			bencode_dictionary_add_integer(ent, "audio level", se->audio_level);
 
 		int mos_samples = se->stats_blocks.length - se->no_mos_count;
 		if (mos_samples < 1) mos_samples = 1;
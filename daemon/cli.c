@@ -98,6 +98,7 @@ static void cli_incoming_list_deletedelay(str *instr, struct cli_writer *cw);
 static void cli_incoming_list_interfaces(str *instr, struct cli_writer *cw);
 static void cli_incoming_list_jsonstats(str *instr, struct cli_writer *cw);
 static void cli_incoming_list_transcoders(str *instr, struct cli_writer *cw);
+static void cli_incoming_list_codeccosts(str *instr, struct cli_writer *cw);
 
 static void cli_incoming_call_info(str *instr, struct cli_writer *cw);
 static void cli_incoming_call_terminate(str *instr, struct cli_writer *cw);
@@ -169,6 +170,7 @@ static const cli_handler_t cli_list_handlers[] = {
 	{ "interfaces",			cli_incoming_list_interfaces		},
 	{ "jsonstats",			cli_incoming_list_jsonstats		},
 	{ "transcoders",		cli_incoming_list_transcoders		},
+	{ "codeccosts",			cli_incoming_list_codeccosts		},
 	{ NULL, },
 };
 static const cli_handler_t cli_call_handlers[] = {
@@ -1693,6 +1695,12 @@ static void cli_incoming_list_transcoders(str *instr, struct cli_writer *cw) {
 			char *chain = l->data;
 			struct codec_stats *stats_entry = g_hash_table_lookup(rtpe_codec_stats, chain);
 			cw->cw_printf(cw, "%s: %i transcoders\n", chain, g_atomic_int_get(&stats_entry->num_transcoders));
+			if (rtpe_config.transcode_threads > 0)
+				cw->cw_printf(cw, "     %.3f s CPU time, latency p50/p90/p99 " UINT64F "/" UINT64F "/" UINT64F " us\n",
+						(double) atomic64_get(&stats_entry->cpu_time_us) / 1000000.0,
+						codec_stats_latency_pct(stats_entry, 50),
+						codec_stats_latency_pct(stats_entry, 90),
+						codec_stats_latency_pct(stats_entry, 99));
 			if (g_atomic_int_get(&stats_entry->last_tv_sec[idx]) != last_tv_sec)
 				continue;
 			cw->cw_printf(cw, "     " UINT64F " packets/s\n", atomic64_get(&stats_entry->packets_input[idx]));
@@ -1706,6 +1714,32 @@ static void cli_incoming_list_transcoders(str *instr, struct cli_writer *cw) {
 	g_list_free(chains);
 }
 
+static void cli_incoming_list_codeccosts(str *instr, struct cli_writer *cw) {
+#ifdef WITH_TRANSCODING
+	cw->cw_printf(cw, "Estimated transcoding load: %.3f CPU cores\n",
+			(double) codeclib_transcoding_load() / 1000000.0);
+	if (rtpe_config.transcode_limit)
+		cw->cw_printf(cw, "Maximum transcoding load: %.2f CPU cores\n",
+				(double) rtpe_config.transcode_limit / 100.0);
+
+	const codec_def_t *def;
+	for (unsigned int i = 0; (def = codec_def_get(i)); i++) {
+		int decs = g_atomic_int_get(&def->cost.active_decoders);
+		int encs = g_atomic_int_get(&def->cost.active_encoders);
+		uint64_t dec_cost = codec_decode_cost_ppm(def);
+		uint64_t enc_cost = codec_encode_cost_ppm(def);
+		if (!decs && !encs && !dec_cost && !enc_cost)
+			continue;
+		cw->cw_printf(cw, "%s: %i decoders at %.3f%% CPU, %i encoders at %.3f%% CPU\n",
+				def->rtpname,
+				decs, (double) dec_cost / 10000.0,
+				encs, (double) enc_cost / 10000.0);
+	}
+#else
+	cw->cw_printf(cw, "Transcoding not supported\n");
+#endif
+}
+
 static void cli_incoming_list_controltos(str *instr, struct cli_writer *cw) {
 	rwlock_lock_r(&rtpe_config.config_lock);
 	cw->cw_printf(cw, "%d\n", rtpe_config.control_tos);
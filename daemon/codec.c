@@ -94,8 +94,12 @@ static GList *__codec_store_delete_link(GList *link, struct codec_store *cs) {
 #include <spandsp/super_tone_rx.h>
 #include <spandsp/logging.h>
 #include <spandsp/dtmf.h>
+#include <math.h>
 #include "resample.h"
 #include "dtmf_rx_fillin.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 
@@ -125,6 +129,26 @@ struct dtx_packet {
 			struct transcode_packet *packet, struct media_packet *mp);
 };
 
+// packets are handed to the transcoding workers through a bounded ring per decoder SSRC
+// handler. A handler with queued packets sits in the run queue of its worker, so the
+// media thread only takes the worker's lock when it finds the handler idle.
+#define TRANSCODE_QUEUE_LEN 64 // power of 2
+#define TRANSCODE_RUN_BATCH 16
+
+struct transcode_worker {
+	mutex_t lock;
+	cond_t cond;
+	GQueue handlers; // struct codec_ssrc_handler, each holds a reference
+};
+struct transcode_job {
+	struct transcode_packet *packet;
+	struct media_packet mp;
+	struct call *call; // holds reference
+	struct codec_ssrc_handler *input_handler; // holds reference
+	int (*job_func)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
+			struct transcode_packet *packet, struct media_packet *mp);
+};
+
 typedef int (*encoder_input_func_t)(encoder_t *enc, AVFrame *frame,
 		int (*callback)(encoder_t *, void *u1, void *u2), void *u1, void *u2);
 typedef int (*packet_input_func_t)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
@@ -190,7 +214,7 @@ struct codec_ssrc_handler {
 	struct dtmf_event dtmf_state; // state tracker for DTMF actions
 
 	// silence detection
-	GQueue silence_events;
+	GArray *silence_events; // struct silence_event
 
 	// DTMF audio suppression
 	unsigned long dtmf_start_ts;
@@ -199,6 +223,17 @@ struct codec_ssrc_handler {
 
 	uint64_t skip_pts;
 
+	// protected by call->master_lock: set when the handler is shut down so that
+	// jobs still queued to a transcoding worker are discarded
+	bool stopped;
+
+	// transcoding worker queue: written by the media threads under the SSRC lock
+	// (job_head) and by the worker (job_tail) only
+	struct transcode_job **jobs;
+	unsigned int job_head, job_tail;
+	int job_scheduled; // in the worker's run queue, or being run
+	unsigned int jobs_dropped;
+
 	unsigned int rtp_mark:1;
 };
 struct transcode_packet {
@@ -239,6 +274,7 @@ static struct ssrc_entry *__ssrc_handler_transcode_new(void *p);
 static struct ssrc_entry *__ssrc_handler_new(void *p);
 static void __ssrc_handler_stop(void *p, void *dummy);
 static void __free_ssrc_handler(void *);
+static void transcode_job_free(struct transcode_job *job);
 INLINE struct codec_handler *codec_handler_lookup(GHashTable *ht, int pt, struct call_media *sink);
 
 static void __transcode_packet_free(struct transcode_packet *);
@@ -258,6 +294,10 @@ static int __buffer_dtx(struct dtx_buffer *dtxb, struct codec_ssrc_handler *ch,
 			struct transcode_packet *packet,
 			struct media_packet *mp));
 static void __dtx_shutdown(struct dtx_buffer *dtxb);
+static int __transcode_worker_queue(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
+		struct transcode_packet *packet, struct media_packet *mp,
+		int (*job_func)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
+			struct transcode_packet *packet, struct media_packet *mp));
 static struct codec_handler *__input_handler(struct codec_handler *h, struct media_packet *mp);
 
 static void __delay_frame_process(struct delay_buffer *, struct delay_frame *dframe);
@@ -2530,6 +2570,204 @@ static int __buffer_dtx(struct dtx_buffer *dtxb, struct codec_ssrc_handler *deco
 	return ret;
 }
 
+static struct transcode_worker *transcode_workers;
+static unsigned int num_transcode_workers;
+static unsigned int transcode_jobs_queued;
+
+static void transcode_job_free(struct transcode_job *job) {
+	if (job->packet)
+		__transcode_packet_free(job->packet);
+	media_packet_release(&job->mp);
+	if (job->input_handler)
+		obj_put(&job->input_handler->h);
+	if (job->call)
+		obj_put(job->call);
+	g_slice_free1(sizeof(*job), job);
+}
+
+// takes over the reference held by the caller
+static void __transcode_worker_schedule(struct codec_ssrc_handler *ch) {
+	// all packets from one SSRC go to the same worker to keep them in sequence
+	struct transcode_worker *w = &transcode_workers[ch->h.ssrc % num_transcode_workers];
+
+	mutex_lock(&w->lock);
+	g_queue_push_tail(&w->handlers, ch);
+	cond_signal(&w->cond);
+	mutex_unlock(&w->lock);
+}
+
+// SSRC is locked
+static int __transcode_worker_queue(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
+		struct transcode_packet *packet, struct media_packet *mp,
+		int (*job_func)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
+			struct transcode_packet *packet, struct media_packet *mp))
+{
+	if (!num_transcode_workers)
+		return 0;
+	if (!packet || !mp->call || !mp->sfd || !mp->ssrc_in || !mp->ssrc_out)
+		return 0;
+
+	if (!ch->jobs)
+		ch->jobs = g_new0(struct transcode_job *, TRANSCODE_QUEUE_LEN);
+
+	unsigned int head = ch->job_head;
+	if (G_UNLIKELY(head - __atomic_load_n(&ch->job_tail, __ATOMIC_ACQUIRE) >= TRANSCODE_QUEUE_LEN)) {
+		// worker can't keep up. Decoding here instead would reorder the packets
+		if (!ch->jobs_dropped++)
+			ilogs(transcoding, LOG_WARN | LOG_FLAG_LIMIT, "Transcoding queue full, dropping packets");
+		__transcode_packet_free(packet);
+		return 1;
+	}
+
+	struct transcode_job *job = g_slice_alloc0(sizeof(*job));
+	job->packet = packet;
+	job->job_func = job_func;
+	job->call = obj_get(mp->call);
+	job->input_handler = obj_get(&input_ch->h);
+	media_packet_copy(&job->mp, mp);
+
+	ch->jobs[head & (TRANSCODE_QUEUE_LEN - 1)] = job;
+	__atomic_store_n(&ch->job_head, head + 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&transcode_jobs_queued, 1, __ATOMIC_RELAXED);
+
+	if (!__atomic_exchange_n(&ch->job_scheduled, 1, __ATOMIC_SEQ_CST))
+		__transcode_worker_schedule(obj_get(&ch->h));
+
+	return 1;
+}
+
+// worker only
+static struct transcode_job *__transcode_job_pop(struct codec_ssrc_handler *ch) {
+	unsigned int tail = ch->job_tail;
+	if (tail == __atomic_load_n(&ch->job_head, __ATOMIC_SEQ_CST))
+		return NULL;
+	struct transcode_job *job = ch->jobs[tail & (TRANSCODE_QUEUE_LEN - 1)];
+	__atomic_store_n(&ch->job_tail, tail + 1, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&transcode_jobs_queued, 1, __ATOMIC_RELAXED);
+	return job;
+}
+
+static void __transcode_job_run(struct codec_ssrc_handler *ch, struct transcode_job *job) {
+	struct media_packet *mp = &job->mp;
+	struct call *call = job->call;
+
+	log_info_call(call);
+
+	rwlock_lock_r(&call->master_lock);
+
+	if (ch->stopped || job->input_handler->stopped) {
+		ilogs(transcoding, LOG_DEBUG, "Discarding queued RTP packet for stopped transcoder");
+		goto out;
+	}
+
+	struct codec_stats *stats_entry = ch->handler->stats_entry;
+
+	__ssrc_lock_both(mp);
+
+	// estimate from the codec library's sampled CPU time accounting
+	uint64_t cpu_start = codec_cost_thread_ns;
+
+	int ret = job->job_func(ch, job->input_handler, job->packet, mp);
+	if (ret == 1)
+		job->packet = NULL; // consumed
+	else if (ret)
+		ilogs(transcoding, LOG_WARN | LOG_FLAG_LIMIT, "Decoder error while processing RTP packet");
+
+	if (stats_entry)
+		atomic64_add(&stats_entry->cpu_time_us, (codec_cost_thread_ns - cpu_start) / 1000);
+
+	__ssrc_unlock_both(mp);
+
+	if (mp->packets_out.length && ret == 0) {
+		struct sink_handler *sh = &mp->sink;
+		struct packet_stream *sink = sh->sink;
+
+		if (!sink)
+			media_socket_dequeue(mp, NULL); // just free
+		else {
+			if (sh->handler && media_packet_encrypt(sh->handler->out->rtp_crypt, sink, mp))
+				ilogs(transcoding, LOG_ERR | LOG_FLAG_LIMIT, "Error encrypting transcoded RTP media");
+
+			mutex_lock(&sink->out_lock);
+			if (media_socket_dequeue(mp, sink))
+				ilogs(transcoding, LOG_ERR | LOG_FLAG_LIMIT,
+						"Error sending transcoded media to RTP sink");
+			mutex_unlock(&sink->out_lock);
+		}
+	}
+
+	if (stats_entry) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		codec_stats_add_latency(stats_entry, timeval_diff(&now, &mp->tv));
+	}
+
+out:
+	rwlock_unlock_r(&call->master_lock);
+	log_info_pop();
+}
+
+// runs the queued packets of one handler, consumes the reference held by the run queue
+static void __transcode_worker_run(struct codec_ssrc_handler *ch) {
+	unsigned int num = 0;
+
+	while (1) {
+		struct transcode_job *job;
+		while ((job = __transcode_job_pop(ch))) {
+			__transcode_job_run(ch, job);
+			transcode_job_free(job);
+			if (++num >= TRANSCODE_RUN_BATCH) {
+				// more to do, give the others a turn first
+				__transcode_worker_schedule(ch);
+				return;
+			}
+		}
+
+		// a media thread queueing a packet after this schedules the handler again,
+		// so check once more for packets queued before
+		__atomic_store_n(&ch->job_scheduled, 0, __ATOMIC_SEQ_CST);
+		if (ch->job_tail == __atomic_load_n(&ch->job_head, __ATOMIC_SEQ_CST))
+			break;
+		if (__atomic_exchange_n(&ch->job_scheduled, 1, __ATOMIC_SEQ_CST))
+			break; // scheduled again already
+	}
+
+	obj_put(&ch->h);
+}
+
+unsigned int codec_workers_queue_depth(void) {
+	return __atomic_load_n(&transcode_jobs_queued, __ATOMIC_RELAXED);
+}
+
+void codec_worker_loop(void *p) {
+	struct transcode_worker *w = &transcode_workers[GPOINTER_TO_UINT(p)];
+
+	struct thread_waker waker = { .lock = &w->lock, .cond = &w->cond };
+	thread_waker_add(&waker);
+
+	mutex_lock(&w->lock);
+
+	while (!rtpe_shutdown) {
+		struct codec_ssrc_handler *ch = g_queue_pop_head(&w->handlers);
+		if (!ch) {
+			cond_wait(&w->cond, &w->lock);
+			continue;
+		}
+		mutex_unlock(&w->lock);
+
+		gettimeofday(&rtpe_now, NULL);
+
+		__transcode_worker_run(ch);
+
+		log_info_reset();
+
+		mutex_lock(&w->lock);
+	}
+
+	mutex_unlock(&w->lock);
+	thread_waker_del(&waker);
+}
+
 static void delay_frame_free(struct delay_frame *dframe) {
 	av_frame_free(&dframe->frame);
 	g_free(dframe->mp.raw.s);
@@ -3253,6 +3491,7 @@ static void __delay_buffer_setup(struct delay_buffer **dbufp,
 }
 static void __ssrc_handler_stop(void *p, void *arg) {
 	struct codec_ssrc_handler *ch = p;
+	ch->stopped = true;
 	if (ch->dtx_buffer) {
 		mutex_lock(&ch->dtx_buffer->lock);
 		__dtx_shutdown(ch->dtx_buffer);
@@ -3279,37 +3518,115 @@ void codec_handlers_stop(GQueue *q) {
 
 
 
-static void silence_event_free(void *p) {
-	g_slice_free1(sizeof(struct silence_event), p);
+// Silence detection and level measurement work on blocks of up to 64 samples. The sample
+// kernels produce a bit mask of silent samples plus the signal energy, without branching
+// on individual samples. Silence events are then derived from the transitions in the mask.
+
+#define SILENCE_BLOCK 64
+
+static bool silence_ongoing(struct codec_ssrc_handler *ch) {
+	if (!ch->silence_events || !ch->silence_events->len)
+		return false;
+	struct silence_event *last = &g_array_index(ch->silence_events, struct silence_event,
+			ch->silence_events->len - 1);
+	return last->end == 0;
+}
+
+static void silence_mask_events(struct codec_ssrc_handler *ch, uint64_t silent, unsigned int num,
+		uint64_t pts)
+{
+	uint64_t all = (num == SILENCE_BLOCK) ? ~0ULL : (1ULL << num) - 1;
+	bool in_silence = silence_ongoing(ch);
+	unsigned int pos = 0;
+
+	while (pos < num) {
+		// samples that differ from the current state
+		uint64_t change = (in_silence ? ~silent : silent) & all & (~0ULL << pos);
+		if (!change)
+			break;
+		pos = __builtin_ctzll(change);
+
+		if (in_silence) {
+			// close off event
+			struct silence_event *last = &g_array_index(ch->silence_events, struct silence_event,
+					ch->silence_events->len - 1);
+			last->end = pts + pos;
+		}
+		else {
+			// new event
+			if (!ch->silence_events)
+				ch->silence_events = g_array_new(FALSE, FALSE, sizeof(struct silence_event));
+			struct silence_event ev = { .start = pts + pos };
+			g_array_append_val(ch->silence_events, ev);
+		}
+		in_silence = !in_silence;
+	}
+}
+
+// returns the mask of silent samples, adds the sum of squares to `energy`
+static uint64_t silence_mask_int16_t(const int16_t *s, unsigned int num, int16_t thres, double *energy) {
+	uint64_t mask = 0;
+	uint64_t sum = 0;
+	unsigned int i = 0;
+
+#if defined(__SSE2__)
+	const __m128i hi = _mm_set1_epi16(thres);
+	const __m128i lo = _mm_set1_epi16(-thres);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+
+	for (; i + 8 <= num; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+		__m128i loud = _mm_or_si128(_mm_cmpgt_epi16(v, hi), _mm_cmplt_epi16(v, lo));
+		uint64_t loud_bits = _mm_movemask_epi8(_mm_packs_epi16(loud, zero));
+		mask |= (~loud_bits & 0xff) << i;
+		// squares of two samples can't exceed 2^31, so they fit into unsigned 32 bits
+		__m128i sq = _mm_madd_epi16(v, v);
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i *) lanes, acc);
+	sum = lanes[0] + lanes[1];
+#endif
+
+	for (; i < num; i++) {
+		mask |= (uint64_t) ((s[i] <= thres) & (s[i] >= -thres)) << i;
+		sum += (int32_t) s[i] * s[i];
+	}
+
+	*energy += (double) sum / (32768.0 * 32768.0);
+	return mask;
 }
 
+#define __silence_mask_type(type, scale) \
+static uint64_t silence_mask_ ## type(const type *s, unsigned int num, type thres, double *energy) { \
+	uint64_t mask = 0; \
+	double sum = 0; \
+	for (unsigned int i = 0; i < num; i++) { \
+		mask |= (uint64_t) ((s[i] <= thres) & (s[i] >= -thres)) << i; \
+		double d = s[i] * (scale); \
+		sum += d * d; \
+	} \
+	*energy += sum; \
+	return mask; \
+}
+
+__silence_mask_type(double, 1.0)
+__silence_mask_type(float, 1.0)
+__silence_mask_type(int32_t, 1.0 / 2147483648.0)
+
 #define __silence_detect_type(type) \
-static void __silence_detect_ ## type(struct codec_ssrc_handler *ch, AVFrame *frame, type thres) { \
-	type *s = (void *) frame->data[0]; \
-	struct silence_event *last = g_queue_peek_tail(&ch->silence_events); \
- \
-	if (last && last->end) /* last event finished? */ \
-		last = NULL; \
- \
-	for (unsigned int i = 0; i < frame->nb_samples; i++) { \
-		if (s[i] <= thres && s[1] >= -thres) { \
-			/* silence */ \
-			if (!last) { \
-				/* new event */ \
-				last = g_slice_alloc0(sizeof(*last)); \
-				last->start = frame->pts + i; \
-				g_queue_push_tail(&ch->silence_events, last); \
-			} \
-		} \
-		else { \
-			/* not silence */ \
-			if (last && !last->end) { \
-				/* close off event */ \
-				last->end = frame->pts + i; \
-				last = NULL; \
-			} \
-		} \
+static double __silence_detect_ ## type(struct codec_ssrc_handler *ch, AVFrame *frame, type thres) { \
+	const type *s = (void *) frame->data[0]; \
+	double energy = 0; \
+	for (unsigned int i = 0; i < frame->nb_samples; i += SILENCE_BLOCK) { \
+		unsigned int num = MIN(SILENCE_BLOCK, frame->nb_samples - i); \
+		uint64_t mask = silence_mask_ ## type(s + i, num, thres, &energy); \
+		silence_mask_events(ch, mask, num, frame->pts + i); \
 	} \
+	return energy; \
 }
 
 __silence_detect_type(double)
@@ -3317,34 +3634,60 @@ __silence_detect_type(float)
 __silence_detect_type(int32_t)
 __silence_detect_type(int16_t)
 
-static void __silence_detect(struct codec_ssrc_handler *ch, AVFrame *frame) {
+// RFC 6464 audio level: 0 to 127 as -dBov
+static int audio_level_from_energy(double energy, unsigned int samples) {
+	if (!samples)
+		return 127;
+	double ms = energy / samples;
+	if (ms <= 1e-13) // below -127 dBov
+		return 127;
+	long level = lrint(-10.0 * log10(ms));
+	if (level < 0)
+		return 0;
+	if (level > 127)
+		return 127;
+	return level;
+}
+
+// single pass over the decoded samples for silence detection and audio level. Both
+// are only computed for handlers that have a CN output to replace silence with.
+static void __silence_detect(struct codec_ssrc_handler *ch, AVFrame *frame, struct ssrc_ctx *ssrc_in) {
 	if (!rtpe_config.silence_detect_int)
 		return;
 	if (ch->handler->cn_payload_type < 0)
 		return;
+
+	double energy;
+
 	switch (frame->format) {
 		case AV_SAMPLE_FMT_DBL:
-			__silence_detect_double(ch, frame, rtpe_config.silence_detect_double);
+			energy = __silence_detect_double(ch, frame, rtpe_config.silence_detect_double);
 			break;
 		case AV_SAMPLE_FMT_FLT:
-			__silence_detect_float(ch, frame, rtpe_config.silence_detect_double);
+			energy = __silence_detect_float(ch, frame, rtpe_config.silence_detect_double);
 			break;
 		case AV_SAMPLE_FMT_S32:
-			__silence_detect_int32_t(ch, frame, rtpe_config.silence_detect_int);
+			energy = __silence_detect_int32_t(ch, frame, rtpe_config.silence_detect_int);
 			break;
 		case AV_SAMPLE_FMT_S16:
-			__silence_detect_int16_t(ch, frame, rtpe_config.silence_detect_int >> 16);
+			energy = __silence_detect_int16_t(ch, frame,
+					MIN(rtpe_config.silence_detect_int >> 16, INT16_MAX));
 			break;
 		default:
-			ilogs(transcoding, LOG_WARN | LOG_FLAG_LIMIT, "Unsupported sample format %i for silence detection",
+			ilogs(transcoding, LOG_WARN | LOG_FLAG_LIMIT,
+					"Unsupported sample format %i for silence detection",
 					frame->format);
+			return;
 	}
+
+	if (ssrc_in)
+		ssrc_in->parent->audio_level = audio_level_from_energy(energy, frame->nb_samples);
 }
-static int is_silence_event(str *inout, GQueue *events, uint64_t pts, uint64_t duration) {
+static int is_silence_event(str *inout, GArray *events, uint64_t pts, uint64_t duration) {
 	uint64_t end = pts + duration;
 
-	while (events->length) {
-		struct silence_event *first = g_queue_peek_head(events);
+	while (events && events->len) {
+		struct silence_event *first = &g_array_index(events, struct silence_event, 0);
 		if (first->start > pts) // future event
 			return 0;
 		if (!first->end) // ongoing event
@@ -3352,14 +3695,12 @@ static int is_silence_event(str *inout, GQueue *events, uint64_t pts, uint64_t d
 		if (first->end > end) // event finished with end in the future
 			goto silence;
 		// event has ended: remove it
-		g_queue_pop_head(events);
+		uint64_t first_end = first->end;
+		g_array_remove_index(events, 0);
 		// does the event fill the entire span?
-		if (first->end == end) {
-			silence_event_free(first);
+		if (first_end == end)
 			goto silence;
-		}
 		// keep going, there might be more
-		silence_event_free(first);
 	}
 	return 0;
 
@@ -3472,8 +3813,14 @@ static void __free_ssrc_handler(void *chp) {
 		dtmf_rx_free(ch->dtmf_dsp);
 	resample_shutdown(&ch->dtmf_resampler);
 	g_queue_clear_full(&ch->dtmf_events, dtmf_event_free);
-	g_queue_clear_full(&ch->silence_events, silence_event_free);
+	if (ch->silence_events)
+		g_array_free(ch->silence_events, TRUE);
 	dtx_buffer_stop(&ch->dtx_buffer);
+	if (ch->jobs) {
+		while (ch->job_tail != ch->job_head)
+			transcode_job_free(ch->jobs[ch->job_tail++ & (TRANSCODE_QUEUE_LEN - 1)]);
+		g_free(ch->jobs);
+	}
 }
 
 static int packet_encoded_rtp(encoder_t *enc, void *u1, void *u2) {
@@ -3531,7 +3878,7 @@ static int packet_encoded_rtp(encoder_t *enc, void *u1, void *u2) {
 				repeats = 2; // DTMF end event
 		}
 		else {
-			if (is_silence_event(&inout, &ch->silence_events, enc->avpkt->pts, enc->avpkt->duration))
+			if (is_silence_event(&inout, ch->silence_events, enc->avpkt->pts, enc->avpkt->duration))
 				payload_type = ch->handler->cn_payload_type;
 		}
 
@@ -3657,7 +4004,7 @@ static int packet_decoded_common(decoder_t *decoder, AVFrame *frame, void *u1, v
 	}
 
 	__dtmf_detect(ch, frame);
-	__silence_detect(ch, frame);
+	__silence_detect(ch, frame, mp->ssrc_in);
 
 	// locking deliberately ignored
 	if (mp->media_out)
@@ -3719,6 +4066,8 @@ static int packet_decode(struct codec_ssrc_handler *ch, struct codec_ssrc_handle
 
 	if (__buffer_dtx(input_ch->dtx_buffer, ch, input_ch, packet, mp, __rtp_decode))
 		ret = 1; // consumed
+	else if (__transcode_worker_queue(ch, input_ch, packet, mp, __rtp_decode))
+		ret = 1; // consumed
 	else {
 		ilogs(transcoding, LOG_DEBUG, "Decoding RTP packet now");
 		ret = __rtp_decode(ch, input_ch, packet, mp);
@@ -4932,9 +5281,33 @@ static void codec_timers_run(void *p) {
 
 void codecs_init(void) {
 	timerthread_init(&codec_timers_thread, codec_timers_run);
+
+#ifdef WITH_TRANSCODING
+	if (rtpe_config.transcode_threads > 0) {
+		num_transcode_workers = rtpe_config.transcode_threads;
+		transcode_workers = g_new0(struct transcode_worker, num_transcode_workers);
+		for (unsigned int i = 0; i < num_transcode_workers; i++) {
+			mutex_init(&transcode_workers[i].lock);
+			cond_init(&transcode_workers[i].cond);
+		}
+	}
+#endif
 }
 void codecs_cleanup(void) {
 	timerthread_free(&codec_timers_thread);
+
+#ifdef WITH_TRANSCODING
+	for (unsigned int i = 0; i < num_transcode_workers; i++) {
+		struct transcode_worker *w = &transcode_workers[i];
+		struct codec_ssrc_handler *ch;
+		while ((ch = g_queue_pop_head(&w->handlers)))
+			obj_put(&ch->h);
+		mutex_destroy(&w->lock);
+	}
+	g_free(transcode_workers);
+	transcode_workers = NULL;
+	num_transcode_workers = 0;
+#endif
 }
 void codec_timers_loop(void *p) {
 	timerthread_run(&codec_timers_thread);
@@ -33,6 +33,7 @@ const char magic_load_limit_strings[__LOAD_LIMIT_MAX][64] = {
 	[LOAD_LIMIT_CPU] = "CPU usage limit exceeded",
 	[LOAD_LIMIT_LOAD] = "Load limit exceeded",
 	[LOAD_LIMIT_BW] = "Bandwidth limit exceeded",
+	[LOAD_LIMIT_TRANSCODING] = "Transcoding capacity exhausted",
 };
 const char *ng_command_strings[NGC_COUNT] = {
 	"ping", "offer", "answer", "delete", "query", "list", "start recording",
@@ -850,7 +850,7 @@ int dtls(struct stream_fd *sfd, const str *s, const endpoint_t *fsin) {
 
 		if (fsin) {
 			ilogs(srtp, LOG_DEBUG, "Sending DTLS packet");
-			socket_sendto(&sfd->socket, buf, ret, fsin);
+			poller_sendto_copy(&sfd->socket, buf, ret, fsin);
 		}
 	}
 
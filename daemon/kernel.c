@@ -8,11 +8,13 @@
 #include <unistd.h>
 #include <glib.h>
 #include <errno.h>
+#include <assert.h>
 
 #include "xt_RTPENGINE.h"
 
 #include "aux.h"
 #include "log.h"
+#include "xdp.h"
 
 
 
@@ -24,6 +26,15 @@
 
 struct kernel_interface kernel;
 
+static mutex_t kernel_batch_lock = MUTEX_STATIC_INIT;
+static struct rtpengine_message *kernel_batch_msg;
+static unsigned int kernel_batch_seq; // protected by kernel_batch_lock
+static mutex_t kernel_write_lock = MUTEX_STATIC_INIT;
+static cond_t kernel_write_cond = COND_STATIC_INIT;
+static unsigned int kernel_batch_written; // protected by kernel_write_lock
+static __thread struct rtpengine_message *kernel_batch_spare;
+static __thread unsigned int kernel_batch_depth;
+
 
 
 
@@ -91,6 +102,13 @@ fail:
 	return -1;
 }
 
+static struct rtpengine_message *kernel_batch_msg_new(void) {
+	struct rtpengine_message *msg = g_malloc0(sizeof(*msg)
+			+ RTPE_MAX_BATCH_OPS * sizeof(struct rtpengine_batch_op));
+	msg->cmd = REMG_BATCH;
+	return msg;
+}
+
 int kernel_setup_table(unsigned int id) {
 	if (kernel.is_wanted)
 		abort();
@@ -116,68 +134,206 @@ int kernel_setup_table(unsigned int id) {
 
 	kernel.fd = fd;
 	kernel.table = id;
+	kernel_batch_msg = kernel_batch_msg_new();
 	kernel.is_open = 1;
 
 	return 0;
 }
 
+int kernel_setup_xdp(char **interfaces, int queues) {
+	if (kernel.is_open)
+		abort();
 
-int kernel_add_stream(struct rtpengine_target_info *mti) {
-	struct rtpengine_message msg;
-	int ret;
+	kernel.is_wanted = 1;
 
-	if (!kernel.is_open)
+	if (xdp_init(interfaces, queues)) {
+		ilog(LOG_ERR, "FAILED TO SET UP AF_XDP DATA PLANE (%s), KERNEL FORWARDING DISABLED",
+				strerror(errno));
 		return -1;
+	}
 
-	msg.cmd = REMG_ADD_TARGET;
-	msg.u.target = *mti;
+	kernel.fd = -1;
+	kernel.xdp = 1;
+	kernel.is_open = 1;
 
-	// coverity[uninit_use_in_call : FALSE]
-	ret = write(kernel.fd, &msg, sizeof(msg));
-	if (ret > 0)
-		return 0;
+	return 0;
+}
 
-	ilog(LOG_ERROR, "Failed to push relay stream to kernel: %s", strerror(errno));
-	return -1;
+
+static const char *kernel_op_err(unsigned int cmd) {
+	switch (cmd) {
+		case REMG_ADD_TARGET:
+			return "Failed to push relay stream to kernel";
+		case REMG_ADD_DESTINATION:
+			return "Failed to push relay stream destination to kernel";
+		case REMG_DEL_TARGET:
+			return "Failed to delete relay stream from kernel";
+	}
+	return "Failed to execute kernel operation";
 }
 
-int kernel_add_destination(struct rtpengine_destination_info *mdi) {
-	struct rtpengine_message msg;
-	int ret;
+static void kernel_batch_write(struct rtpengine_message *msg) {
+	struct rtpengine_batch_op *ops = (void *) msg->data;
+	unsigned int num = msg->u.batch.num_ops;
+	size_t len = sizeof(*msg) + num * sizeof(*ops);
+	ssize_t ret;
+
+	ret = read(kernel.fd, msg, len);
+	msg->u.batch.num_ops = 0;
+
+	if (ret == (ssize_t) len) {
+		for (unsigned int i = 0; i < num; i++) {
+			if (ops[i].result)
+				ilog(LOG_ERROR, "%s: %s", kernel_op_err(ops[i].cmd), strerror(-ops[i].result));
+		}
+		return;
+	}
+
+	// the batch as a whole was rejected: retry one by one to preserve the ordering
+	ilog(LOG_WARNING, "Failed to push batch of %u operations to kernel (%s), retrying individually",
+			num, strerror(errno));
+
+	for (unsigned int i = 0; i < num; i++) {
+		struct rtpengine_message single;
+		ZERO(single);
+		single.cmd = ops[i].cmd;
+		if (ops[i].cmd == REMG_ADD_DESTINATION)
+			single.u.destination = ops[i].u.destination;
+		else
+			single.u.target = ops[i].u.target;
+		// coverity[uninit_use_in_call : FALSE]
+		ret = write(kernel.fd, &single, sizeof(single));
+		if (ret <= 0)
+			ilog(LOG_ERROR, "%s: %s", kernel_op_err(ops[i].cmd), strerror(errno));
+	}
+}
+
+// waits until all batches numbered below `seq` have been written
+static void kernel_batch_wait(unsigned int seq) {
+	mutex_lock(&kernel_write_lock);
+	while ((int) (kernel_batch_written - seq) < 0)
+		cond_wait(&kernel_write_cond, &kernel_write_lock);
+	mutex_unlock(&kernel_write_lock);
+}
+
+// Must be called with kernel_batch_lock held, which is released. The queued
+// operations are swapped out for this thread's spare buffer, so that other
+// threads can keep queueing while the batch is pushed to the kernel. Batches
+// are numbered while the lock is held and written strictly in that order.
+// Returns only once everything queued before, including batches other threads
+// have taken out but not written yet, has reached the kernel.
+static void kernel_batch_flush_unlock(void) {
+	struct rtpengine_message *msg = kernel_batch_msg;
+
+	if (!msg->u.batch.num_ops) {
+		unsigned int seq = kernel_batch_seq;
+		mutex_unlock(&kernel_batch_lock);
+		kernel_batch_wait(seq);
+		return;
+	}
+
+	if (!kernel_batch_spare)
+		kernel_batch_spare = kernel_batch_msg_new();
+	kernel_batch_msg = kernel_batch_spare;
+	kernel_batch_spare = msg;
+	unsigned int seq = kernel_batch_seq++;
 
+	mutex_unlock(&kernel_batch_lock);
+
+	kernel_batch_wait(seq);
+
+	kernel_batch_write(msg);
+
+	mutex_lock(&kernel_write_lock);
+	kernel_batch_written++;
+	cond_broadcast(&kernel_write_cond);
+	mutex_unlock(&kernel_write_lock);
+}
+
+static void kernel_batch_flush(void) {
+	if (!kernel.is_open || kernel.xdp)
+		return;
+	mutex_lock(&kernel_batch_lock);
+	kernel_batch_flush_unlock();
+}
+
+// Appends one operation to the shared queue. Outside of a batch section the
+// queue is flushed straight away, which also pushes out anything queued
+// before by other threads, so the kernel always sees operations in the order
+// in which they were made.
+static int kernel_batch_add(struct rtpengine_batch_op *op) {
 	if (!kernel.is_open)
 		return -1;
 
-	msg.cmd = REMG_ADD_DESTINATION;
-	msg.u.destination = *mdi;
+	mutex_lock(&kernel_batch_lock);
 
-	// coverity[uninit_use_in_call : FALSE]
-	ret = write(kernel.fd, &msg, sizeof(msg));
-	if (ret > 0)
-		return 0;
+	while (kernel_batch_msg->u.batch.num_ops >= RTPE_MAX_BATCH_OPS) {
+		kernel_batch_flush_unlock();
+		mutex_lock(&kernel_batch_lock);
+	}
 
-	ilog(LOG_ERROR, "Failed to push relay stream destination to kernel: %s", strerror(errno));
-	return -1;
+	struct rtpengine_message *msg = kernel_batch_msg;
+	struct rtpengine_batch_op *ops = (void *) msg->data;
+
+	op->result = 0;
+	ops[msg->u.batch.num_ops++] = *op;
+
+	if (!kernel_batch_depth)
+		kernel_batch_flush_unlock();
+	else
+		mutex_unlock(&kernel_batch_lock);
+
+	return 0;
 }
 
+void kernel_batch_start(void) {
+	kernel_batch_depth++;
+}
 
-int kernel_del_stream(const struct re_address *a) {
-	struct rtpengine_message msg;
-	int ret;
+void kernel_batch_end(void) {
+	assert(kernel_batch_depth > 0);
+	if (--kernel_batch_depth)
+		return;
+	kernel_batch_flush();
+}
 
-	if (!kernel.is_open)
-		return -1;
 
-	ZERO(msg);
-	msg.cmd = REMG_DEL_TARGET;
-	msg.u.target.local = *a;
+int kernel_add_stream(struct rtpengine_target_info *mti) {
+	struct rtpengine_batch_op op;
 
-	ret = write(kernel.fd, &msg, sizeof(msg));
-	if (ret > 0)
-		return 0;
+	if (kernel.xdp)
+		return xdp_add_target(mti);
 
-	ilog(LOG_ERROR, "Failed to delete relay stream from kernel: %s", strerror(errno));
-	return -1;
+	op.cmd = REMG_ADD_TARGET;
+	op.u.target = *mti;
+
+	return kernel_batch_add(&op);
+}
+
+int kernel_add_destination(struct rtpengine_destination_info *mdi) {
+	struct rtpengine_batch_op op;
+
+	if (kernel.xdp)
+		return xdp_add_destination(mdi);
+
+	op.cmd = REMG_ADD_DESTINATION;
+	op.u.destination = *mdi;
+
+	return kernel_batch_add(&op);
+}
+
+
+int kernel_del_stream(const struct re_address *a) {
+	struct rtpengine_batch_op op;
+
+	if (kernel.xdp)
+		return xdp_del_target(a);
+
+	ZERO(op);
+	op.cmd = REMG_DEL_TARGET;
+	op.u.target.local = *a;
+
+	return kernel_batch_add(&op);
 }
 
 GList *kernel_list() {
@@ -189,6 +345,10 @@ GList *kernel_list() {
 
 	if (!kernel.is_open)
 		return NULL;
+	if (kernel.xdp)
+		return xdp_list();
+
+	kernel_batch_flush();
 
 	sprintf(str, PREFIX "/%u/blist", kernel.table);
 	fd = open(str, O_RDONLY);
@@ -214,9 +374,11 @@ unsigned int kernel_add_call(const char *id) {
 	struct rtpengine_message msg;
 	int ret;
 
-	if (!kernel.is_open)
+	if (!kernel.is_open || kernel.xdp)
 		return UNINIT_IDX;
 
+	kernel_batch_flush();
+
 	ZERO(msg);
 	msg.cmd = REMG_ADD_CALL;
 	snprintf(msg.u.call.call_id, sizeof(msg.u.call.call_id), "%s", id);
@@ -231,9 +393,11 @@ int kernel_del_call(unsigned int idx) {
 	struct rtpengine_message msg;
 	int ret;
 
-	if (!kernel.is_open)
+	if (!kernel.is_open || kernel.xdp)
 		return -1;
 
+	kernel_batch_flush();
+
 	ZERO(msg);
 	msg.cmd = REMG_DEL_CALL;
 	msg.u.call.call_idx = idx;
@@ -248,9 +412,11 @@ unsigned int kernel_add_intercept_stream(unsigned int call_idx, const char *id)
 	struct rtpengine_message msg;
 	int ret;
 
-	if (!kernel.is_open)
+	if (!kernel.is_open || kernel.xdp)
 		return UNINIT_IDX;
 
+	kernel_batch_flush();
+
 	ZERO(msg);
 	msg.cmd = REMG_ADD_STREAM;
 	msg.u.stream.call_idx = call_idx;
@@ -268,6 +434,10 @@ int kernel_update_stats(const struct re_address *a, struct rtpengine_stats_info
 
 	if (!kernel.is_open)
 		return -1;
+	if (kernel.xdp)
+		return xdp_update_stats(a, out);
+
+	kernel_batch_flush();
 
 	ZERO(msg);
 	msg.cmd = REMG_GET_RESET_STATS;
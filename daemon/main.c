@@ -46,6 +46,9 @@
 #include "statistics.h"
 #include "graphite.h"
 #include "codeclib.h"
+#ifdef WITH_TRANSCODING
+#include "resample.h"
+#endif
 #include "load.h"
 #include "ssllib.h"
 #include "media_player.h"
@@ -54,6 +57,7 @@
 #include "websocket.h"
 #include "codec.h"
 #include "mqtt.h"
+#include "xdp.h"
 #include "janus.h"
 
 
@@ -72,6 +76,8 @@ struct control_ng *rtpe_control_ng_tcp[2];
 struct rtpengine_config rtpe_config = {
 	// non-zero defaults
 	.kernel_table = -1,
+	.xdp_queues = 1,
+	.io_uring_buffers = 1024,
 	.max_sessions = -1,
 	.delete_delay = 30,
 	.redis_subscribed_keyspaces = G_QUEUE_INIT,
@@ -97,6 +103,7 @@ struct rtpengine_config rtpe_config = {
 	.mqtt_keepalive = 30,
 	.mqtt_publish_interval = 5000,
 	.dtmf_digit_delay = 2500,
+	.rec_pcap_buffer = 256,
 	.common = {
 		.log_levels = {
 			[log_level_index_internals] = -1,
@@ -436,6 +443,7 @@ static void options(int *argc, char ***argv) {
 	int codecs = 0;
 	double max_load = 0;
 	double max_cpu = 0;
+	double max_transcoding = 0;
 	AUTO_CLEANUP_GBUF(dtmf_udp_ep);
 	AUTO_CLEANUP_GBUF(endpoint_learning);
 	AUTO_CLEANUP_GBUF(dtls_sig);
@@ -455,6 +463,10 @@ static void options(int *argc, char ***argv) {
 	GOptionEntry e[] = {
 		{ "table",	't', 0, G_OPTION_ARG_INT,	&rtpe_config.kernel_table,		"Kernel table to use",		"INT"		},
 		{ "no-fallback",'F', 0, G_OPTION_ARG_NONE,	&rtpe_config.no_fallback,	"Only start when kernel module is available", NULL },
+#ifdef HAVE_XDP
+		{ "xdp-interface",0,0,	G_OPTION_ARG_STRING_ARRAY,&rtpe_config.xdp_interfaces,"Network interface for the XDP data plane","NAME"},
+		{ "xdp-queues",	0,0,	G_OPTION_ARG_INT,	&rtpe_config.xdp_queues,	"Number of receive queues per XDP interface","INT"},
+#endif
 		{ "interface",	'i', 0, G_OPTION_ARG_STRING_ARRAY,&if_a,	"Local interface for RTP",	"[NAME/]IP[!IP]"},
 		{ "save-interface-ports",'S', 0, G_OPTION_ARG_NONE,	&rtpe_config.save_interface_ports,	"Bind ports only on first available interface of desired family", NULL },
 		{ "subscribe-keyspace", 'k', 0, G_OPTION_ARG_STRING_ARRAY,&ks_a,	"Subscription keyspace list",	"INT INT ..."},
@@ -475,6 +487,7 @@ static void options(int *argc, char ***argv) {
 		{ "offer-timeout",0,0,	G_OPTION_ARG_INT,	&rtpe_config.offer_timeout,	"Timeout for incomplete one-sided calls",	"SECS"		},
 		{ "port-min",	'm', 0, G_OPTION_ARG_INT,	&rtpe_config.port_min,	"Lowest port to use for RTP",	"INT"		},
 		{ "port-max",	'M', 0, G_OPTION_ARG_INT,	&rtpe_config.port_max,	"Highest port to use for RTP",	"INT"		},
+		{ "socket-pool",0, 0,	G_OPTION_ARG_INT,	&rtpe_config.socket_pool,"Number of pre-bound port pairs to keep per interface address","INT"},
 		{ "redis",	'r', 0, G_OPTION_ARG_STRING,	&redisps,	"Connect to Redis database",	"[PW@]IP:PORT/INT"	},
 		{ "redis-write",'w', 0, G_OPTION_ARG_STRING,    &redisps_write, "Connect to Redis write database",      "[PW@]IP:PORT/INT"       },
 		{ "redis-num-threads", 0, 0, G_OPTION_ARG_INT, &rtpe_config.redis_num_threads, "Number of Redis restore threads",      "INT"       },
@@ -501,12 +514,19 @@ static void options(int *argc, char ***argv) {
 		{ "xmlrpc-format",'x', 0, G_OPTION_ARG_INT,	&rtpe_config.fmt,	"XMLRPC timeout request format to use. 0: SEMS DI, 1: call-id only, 2: Kamailio",	"INT"	},
 		{ "num-threads",  0, 0, G_OPTION_ARG_INT,	&rtpe_config.num_threads,	"Number of worker threads to create",	"INT"	},
 		{ "media-num-threads",  0, 0, G_OPTION_ARG_INT,	&rtpe_config.media_num_threads,	"Number of worker threads for media playback",	"INT"	},
+#ifdef WITH_TRANSCODING
+		{ "transcode-threads",  0, 0, G_OPTION_ARG_INT,	&rtpe_config.transcode_threads,	"Number of worker threads for offloaded transcoding",	"INT"	},
+		{ "fast-resampler", 0, 0, G_OPTION_ARG_NONE,	&resample_fast_path,	"Use built-in resampler for integer sample rate ratios",	NULL	},
+#endif
 		{ "delete-delay",  'd', 0, G_OPTION_ARG_INT,    &rtpe_config.delete_delay,  "Delay for deleting a session from memory.",    "INT"   },
 		{ "sip-source",  0,  0, G_OPTION_ARG_NONE,	&sip_source,	"Use SIP source address by default",	NULL	},
 		{ "dtls-passive", 0, 0, G_OPTION_ARG_NONE,	&dtls_passive_def,"Always prefer DTLS passive role",	NULL	},
 		{ "max-sessions", 0, 0, G_OPTION_ARG_INT,	&rtpe_config.max_sessions,	"Limit of maximum number of sessions",	"INT"	},
 		{ "max-load",	0, 0,	G_OPTION_ARG_DOUBLE,	&max_load,	"Reject new sessions if load averages exceeds this value",	"FLOAT"	},
 		{ "max-cpu",	0, 0,	G_OPTION_ARG_DOUBLE,	&max_cpu,	"Reject new sessions if CPU usage (in percent) exceeds this value",	"FLOAT"	},
+#ifdef WITH_TRANSCODING
+		{ "max-transcoding",0, 0,	G_OPTION_ARG_DOUBLE,	&max_transcoding,	"Reject new sessions requiring transcoding if the estimated transcoding load (in CPU cores) exceeds this value",	"FLOAT"	},
+#endif
 		{ "max-bandwidth",0, 0,	G_OPTION_ARG_INT64,	&rtpe_config.bw_limit,	"Reject new sessions if bandwidth usage (in bytes per second) exceeds this value",	"INT"	},
 		{ "homer",	0,  0, G_OPTION_ARG_STRING,	&homerp,	"Address of Homer server for RTCP stats","IP46|HOSTNAME:PORT"},
 		{ "homer-protocol",0,0,G_OPTION_ARG_STRING,	&homerproto,	"Transport protocol for Homer (default udp)",	"udp|tcp"	},
@@ -514,6 +534,9 @@ static void options(int *argc, char ***argv) {
 		{ "recording-dir", 0, 0, G_OPTION_ARG_STRING,	&rtpe_config.spooldir,	"Directory for storing pcap and metadata files", "FILE"	},
 		{ "recording-method",0, 0, G_OPTION_ARG_STRING,	&rtpe_config.rec_method,	"Strategy for call recording",		"pcap|proc|all"	},
 		{ "recording-format",0, 0, G_OPTION_ARG_STRING,	&rtpe_config.rec_format,	"File format for stored pcap files",	"raw|eth"	},
+		{ "recording-pcap-rotate",0,0,G_OPTION_ARG_INT,	&rtpe_config.rec_pcap_rotate,	"Record all calls into shared pcap files, starting a new one after this many seconds",	"SECONDS"	},
+		{ "recording-metadata-socket",0,0,G_OPTION_ARG_STRING,	&rtpe_config.rec_meta_socket,	"Send recording metadata through the recording daemon's socket",	"PATH"	},
+		{ "recording-pcap-buffer",0,0,G_OPTION_ARG_INT,	&rtpe_config.rec_pcap_buffer,	"Memory for pcap recording data waiting to be written",	"MB"	},
 #ifdef WITH_IPTABLES_OPTION
 		{ "iptables-chain",0,0,	G_OPTION_ARG_STRING,	&rtpe_config.iptables_chain,"Add explicit firewall rules to this iptables chain","STRING" },
 #endif
@@ -545,6 +568,10 @@ static void options(int *argc, char ***argv) {
 		{ "http-threads", 0,0,	G_OPTION_ARG_INT,	&rtpe_config.http_threads,"Number of worker threads for HTTP and WS","INT"},
 		{ "software-id", 0,0,	G_OPTION_ARG_STRING,	&rtpe_config.software_id,"Identification string of this software presented to external systems","STRING"},
 		{ "poller-per-thread", 0,0,	G_OPTION_ARG_NONE,	&rtpe_config.poller_per_thread,	"Use poller per thread",	NULL },
+#ifdef HAVE_LIBURING
+		{ "io-uring",	0,0,	G_OPTION_ARG_NONE,	&rtpe_config.io_uring,	"Use io_uring for media sockets",	NULL },
+		{ "io-uring-buffers",0,0,	G_OPTION_ARG_INT,	&rtpe_config.io_uring_buffers,"Number of receive buffers per io_uring poller","INT"},
+#endif
 #ifdef WITH_TRANSCODING
 		{ "dtx-delay",	0,0,	G_OPTION_ARG_INT,	&rtpe_config.dtx_delay,	"Delay in milliseconds to trigger DTX handling","INT"},
 		{ "max-dtx",	0,0,	G_OPTION_ARG_INT,	&rtpe_config.max_dtx,	"Maximum duration of DTX handling",	"INT"},
@@ -758,6 +785,7 @@ static void options(int *argc, char ***argv) {
 		trust_address_def = 1;
 
 	rtpe_config.cpu_limit = max_cpu * 100;
+	rtpe_config.transcode_limit = max_transcoding * 100;
 	rtpe_config.load_limit = max_load * 100;
 
 	if (rtpe_config.mysql_query) {
@@ -815,6 +843,21 @@ static void options(int *argc, char ***argv) {
 	if (rtpe_config.jb_length < 0)
 		die("Invalid negative jitter buffer size");
 
+	if (rtpe_config.socket_pool < 0 || rtpe_config.socket_pool > 0x8000)
+		die("Invalid --socket-pool (%i)", rtpe_config.socket_pool);
+
+	if (rtpe_config.rec_pcap_rotate < 0)
+		die("Invalid --recording-pcap-rotate (%i)", rtpe_config.rec_pcap_rotate);
+	if (rtpe_config.rec_pcap_buffer < 1 || rtpe_config.rec_pcap_buffer > 65536)
+		die("Invalid --recording-pcap-buffer (%i)", rtpe_config.rec_pcap_buffer);
+
+	if (rtpe_config.io_uring) {
+		if (rtpe_config.io_uring_buffers < 1 || rtpe_config.io_uring_buffers > 32768)
+			die("Invalid --io-uring-buffers (%i)", rtpe_config.io_uring_buffers);
+		// each ring belongs to one thread
+		rtpe_config.poller_per_thread = 1;
+	}
+
 	if (silence_detect > 0) {
 		rtpe_config.silence_detect_double = silence_detect / 100.0;
 		rtpe_config.silence_detect_int = (int) ((silence_detect / 100.0) * UINT32_MAX);
@@ -896,6 +939,7 @@ void fill_initial_rtpe_cfg(struct rtpengine_config* ini_rtpe_cfg) {
 	ini_rtpe_cfg->kernel_table = rtpe_config.kernel_table;
 	ini_rtpe_cfg->max_sessions = rtpe_config.max_sessions;
 	ini_rtpe_cfg->cpu_limit = rtpe_config.cpu_limit;
+	ini_rtpe_cfg->transcode_limit = rtpe_config.transcode_limit;
 	ini_rtpe_cfg->load_limit = rtpe_config.load_limit;
 	ini_rtpe_cfg->bw_limit = rtpe_config.bw_limit;
 	ini_rtpe_cfg->timeout = rtpe_config.timeout;
@@ -919,6 +963,7 @@ void fill_initial_rtpe_cfg(struct rtpengine_config* ini_rtpe_cfg) {
 	ini_rtpe_cfg->no_redis_required = rtpe_config.no_redis_required;
 	ini_rtpe_cfg->num_threads = rtpe_config.num_threads;
 	ini_rtpe_cfg->media_num_threads = rtpe_config.media_num_threads;
+	ini_rtpe_cfg->transcode_threads = rtpe_config.transcode_threads;
 	ini_rtpe_cfg->fmt = rtpe_config.fmt;
 	ini_rtpe_cfg->log_format = rtpe_config.log_format;
 	ini_rtpe_cfg->redis_allowed_errors = rtpe_config.redis_allowed_errors;
@@ -988,6 +1033,7 @@ static void options_free(void) {
 	g_free(rtpe_config.spooldir);
 	g_free(rtpe_config.rec_method);
 	g_free(rtpe_config.rec_format);
+	g_free(rtpe_config.rec_meta_socket);
 	g_free(rtpe_config.iptables_chain);
 	g_free(rtpe_config.scheduling);
 	g_free(rtpe_config.idle_scheduling);
@@ -998,6 +1044,7 @@ static void options_free(void) {
 	g_free(rtpe_config.dtls_ciphers);
 	g_strfreev(rtpe_config.http_ifs);
 	g_strfreev(rtpe_config.https_ifs);
+	g_strfreev(rtpe_config.xdp_interfaces);
 	g_free(rtpe_config.https_cert);
 	g_free(rtpe_config.https_key);
 	g_free(rtpe_config.software_id);
@@ -1067,17 +1114,17 @@ static void init_everything(void) {
 static void create_everything(void) {
 	struct timeval tmp_tv;
 
-	if (rtpe_config.kernel_table < 0)
-		goto no_kernel;
-	if (kernel_setup_table(rtpe_config.kernel_table)) {
-		if (rtpe_config.no_fallback) {
-			ilog(LOG_CRIT, "Userspace fallback disallowed - exiting");
-			exit(-1);
-		}
-		goto no_kernel;
+	if (rtpe_config.kernel_table >= 0 && !kernel_setup_table(rtpe_config.kernel_table))
+		goto kernel_done;
+	if (rtpe_config.xdp_interfaces && rtpe_config.xdp_interfaces[0]
+			&& !kernel_setup_xdp(rtpe_config.xdp_interfaces, rtpe_config.xdp_queues))
+		goto kernel_done;
+	if (kernel.is_wanted && rtpe_config.no_fallback) {
+		ilog(LOG_CRIT, "Userspace fallback disallowed - exiting");
+		exit(-1);
 	}
 
-no_kernel:
+kernel_done:
 	rtpe_poller = poller_new();
 	if (!rtpe_poller)
 		die("poller creation failed");
@@ -1291,6 +1338,9 @@ int main(int argc, char **argv) {
 			rtpe_config.idle_priority, "poller timer");
 	thread_create_detach_prio(load_thread, NULL, rtpe_config.idle_scheduling, rtpe_config.idle_priority, "load monitor");
 
+	if (selected_recording_method && selected_recording_method->writer_loop)
+		thread_create_detach(selected_recording_method->writer_loop, NULL, "pcap writer");
+
 	if (!is_addr_unspecified(&rtpe_config.redis_ep.address) && initial_rtpe_config.redis_delete_async)
 		thread_create_detach(redis_delete_async_loop, NULL, "redis async");
 
@@ -1299,6 +1349,11 @@ int main(int argc, char **argv) {
 
 	do_redis_restore();
 
+	// after the restore, which needs its ports back
+	if (rtpe_config.socket_pool)
+		thread_create_detach_prio(port_pool_loop, NULL, rtpe_config.idle_scheduling,
+				rtpe_config.idle_priority, "socket pool");
+
 	if (!is_addr_unspecified(&rtpe_config.graphite_ep.address))
 		thread_create_detach(graphite_loop, NULL, "graphite");
 
@@ -1309,6 +1364,9 @@ int main(int argc, char **argv) {
 
 	thread_create_detach(ice_thread_run, NULL, "ICE");
 
+	if (kernel.xdp)
+		xdp_launch();
+
 	websocket_start();
 
 	service_notify("READY=1\n");
@@ -1339,6 +1397,12 @@ int main(int argc, char **argv) {
 				rtpe_config.priority, "codec timer");
 	}
 
+#ifdef WITH_TRANSCODING
+	for (idx = 0; idx < rtpe_config.transcode_threads; ++idx)
+		thread_create_detach_prio(codec_worker_loop, GUINT_TO_POINTER(idx), rtpe_config.scheduling,
+				rtpe_config.priority, "transcoder");
+#endif
+
 
 	// reap threads as they shut down during run time
 	threads_join_all(false);
@@ -1358,6 +1422,9 @@ int main(int argc, char **argv) {
 
 	threads_join_all(true);
 
+	if (kernel.xdp)
+		xdp_free();
+
 	if (!is_addr_unspecified(&rtpe_config.redis_ep.address) && initial_rtpe_config.redis_delete_async)
 		redis_async_event_base_action(rtpe_redis_write, EVENT_BASE_FREE);
 
@@ -17,6 +17,7 @@
 #include "main.h"
 #include "rtcp.h"
 #include "fix_frame_channel_layout.h"
+#include "poller.h"
 
 
 
@@ -182,13 +183,11 @@ static void send_timer_rtcp(struct send_timer *st, struct ssrc_ctx *ssrc_out) {
 }
 
 
-static bool __send_timer_send_1(struct rtp_header *rh, struct packet_stream *sink, struct codec_packet *cp) {
-	struct stream_fd *sink_fd = sink->selected_sfd;
-
-	if (!sink_fd || sink_fd->socket.fd == -1)
-		return false;
-
-	log_info_stream_fd(sink->selected_sfd);
+// hands over the packet, which is released once it has gone out
+static void __send_timer_send_1(struct rtp_header *rh, struct packet_stream *sink, struct stream_fd *sink_fd,
+		struct codec_packet *cp)
+{
+	log_info_stream_fd(sink_fd);
 
 	if (rh) {
 		ilog(LOG_DEBUG, "Forward to sink endpoint: local %s -> remote %s%s%s "
@@ -205,37 +204,41 @@ static bool __send_timer_send_1(struct rtp_header *rh, struct packet_stream *sin
 				endpoint_print_buf(&sink_fd->socket.local),
 				FMT_M(endpoint_print_buf(&sink->endpoint)));
 
-	socket_sendto(&sink_fd->socket,
-			cp->s.s, cp->s.len, &sink->endpoint);
+	poller_sendto(&sink_fd->socket,
+			cp->s.s, cp->s.len, &sink->endpoint, codec_packet_free, cp);
 
 	log_info_pop();
-
-	return true;
 }
 
 static void __send_timer_send_common(struct send_timer *st, struct codec_packet *cp) {
-	if (!__send_timer_send_1(cp->rtp, st->sink, cp))
-		goto out;
+	struct stream_fd *sink_fd = st->sink->selected_sfd;
 
-	if (cp->ssrc_out && cp->rtp) {
-		atomic64_inc(&cp->ssrc_out->packets);
-		atomic64_add(&cp->ssrc_out->octets, cp->s.len);
+	if (!sink_fd || sink_fd->socket.fd == -1) {
+		codec_packet_free(cp);
+		return;
+	}
+
+	// the packet may be gone once sent: keep our own reference for the RTCP check
+	struct ssrc_ctx *ssrc_out = cp->ssrc_out;
+	ssrc_ctx_hold(ssrc_out);
+	if (ssrc_out && cp->rtp) {
+		atomic64_inc(&ssrc_out->packets);
+		atomic64_add(&ssrc_out->octets, cp->s.len);
 		if (cp->ts)
-			atomic64_set(&cp->ssrc_out->last_ts, cp->ts);
+			atomic64_set(&ssrc_out->last_ts, cp->ts);
 		else
-			atomic64_set(&cp->ssrc_out->last_ts, ntohl(cp->rtp->timestamp));
-		payload_tracker_add(&cp->ssrc_out->tracker, cp->rtp->m_pt & 0x7f);
+			atomic64_set(&ssrc_out->last_ts, ntohl(cp->rtp->timestamp));
+		payload_tracker_add(&ssrc_out->tracker, cp->rtp->m_pt & 0x7f);
 	}
 
+	__send_timer_send_1(cp->rtp, st->sink, sink_fd, cp);
+
 	// do we send RTCP?
-	struct ssrc_ctx *ssrc_out = cp->ssrc_out;
 	if (ssrc_out && ssrc_out->next_rtcp.tv_sec) {
 		if (timeval_diff(&ssrc_out->next_rtcp, &rtpe_now) < 0)
 			send_timer_rtcp(st, ssrc_out);
 	}
-
-out:
-	codec_packet_free(cp);
+	ssrc_ctx_put(&ssrc_out);
 }
 
 static void send_timer_send_lock(struct send_timer *st, struct codec_packet *cp) {
@@ -4,6 +4,7 @@
 #include <glib.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <unistd.h>
 #include "str.h"
 #include "ice.h"
 #include "socket.h"
@@ -701,7 +702,11 @@ static void __interface_append(struct intf_config *ifa, sockfamily_t *fam, bool
 		spec->port_pool.min = ifa->port_min;
 		spec->port_pool.max = ifa->port_max;
 		spec->port_pool.free_ports = spec->port_pool.max - spec->port_pool.min + 1;
-		mutex_init(&spec->port_pool.free_list_lock);
+		if (rtpe_config.socket_pool > 0) {
+			spec->port_pool.pooled_fds = g_new(int, spec->port_pool.free_ports);
+			for (unsigned int i = 0; i < spec->port_pool.free_ports; i++)
+				spec->port_pool.pooled_fds[i] = -1;
+		}
 		g_hash_table_insert(__intf_spec_addr_type_hash, &spec->local_address, spec);
 	}
 
@@ -795,6 +800,27 @@ struct local_intf *get_any_interface_address(const struct logical_intf *lif, soc
 
 
 
+// takes over a pre-bound socket, which stays marked in ports_used
+static bool get_pooled_port(socket_t *r, unsigned int port, struct intf_spec *spec) {
+	struct port_pool *pp = &spec->port_pool;
+
+	if (!pp->pooled_fds || port < pp->min || port > pp->max)
+		return false;
+	if (!bit_array_clear(pp->pooled, port))
+		return false;
+
+	ZERO(*r);
+	r->fd = pp->pooled_fds[port - pp->min];
+	pp->pooled_fds[port - pp->min] = -1;
+	r->family = spec->local_address.addr.family;
+	r->local.address = spec->local_address.addr;
+	r->local.port = port;
+	g_atomic_int_add(&pp->num_pooled, -1);
+
+	__C_DBG("port %d taken from socket pool", port);
+	return true;
+}
+
 static int get_port(socket_t *r, unsigned int port, struct intf_spec *spec, const str *label) {
 	struct port_pool *pp;
 
@@ -802,20 +828,23 @@ static int get_port(socket_t *r, unsigned int port, struct intf_spec *spec, cons
 
 	pp = &spec->port_pool;
 
-	if (bit_array_set(pp->ports_used, port)) {
-		__C_DBG("port %d in use", port);
-		return -1;
-	}
-	__C_DBG("port %d locked", port);
+	if (!get_pooled_port(r, port, spec)) {
+		if (bit_array_set(pp->ports_used, port)) {
+			__C_DBG("port %d in use", port);
+			return -1;
+		}
+		__C_DBG("port %d locked", port);
 
-	if (open_socket(r, SOCK_DGRAM, port, &spec->local_address.addr)) {
-		__C_DBG("couldn't open port %d", port);
-		bit_array_clear(pp->ports_used, port);
-		return -1;
+		if (open_socket(r, SOCK_DGRAM, port, &spec->local_address.addr)) {
+			__C_DBG("couldn't open port %d", port);
+			bit_array_clear(pp->ports_used, port);
+			return -1;
+		}
+
+		socket_timestamping(r);
 	}
 
 	iptables_add_rule(r, label);
-	socket_timestamping(r);
 
 	g_atomic_int_dec_and_test(&pp->free_ports);
 	__C_DBG("%d free ports remaining on interface %s", pp->free_ports,
@@ -835,14 +864,6 @@ static void release_port_now(socket_t *r, struct intf_spec *spec) {
 		iptables_del_rule(r);
 		bit_array_clear(pp->ports_used, port);
 		g_atomic_int_inc(&pp->free_ports);
-		if ((port & 1) == 0) {
-			mutex_lock(&pp->free_list_lock);
-			if (!bit_array_isset(pp->free_list_used, port)) {
-				g_queue_push_tail(&pp->free_list, GUINT_TO_POINTER(port));
-				bit_array_set(pp->free_list_used, port);
-			}
-			mutex_unlock(&pp->free_list_lock);
-		}
 	} else {
 		__C_DBG("port %u is NOT released", port);
 	}
@@ -870,12 +891,33 @@ void release_closed_sockets(void) {
 
 
 
+static int get_ports(GQueue *out, unsigned int num_ports, unsigned int port,
+		struct intf_spec *spec, const str *label)
+{
+	socket_t *sk;
+
+	for (unsigned int i = 0; i < num_ports; i++) {
+		sk = g_slice_alloc0(sizeof(*sk));
+		// fd=0 is a valid file descriptor that may be closed
+		// accidentally by free_port if previously bounded
+		sk->fd = -1;
+		g_queue_push_tail(out, sk);
+
+		if (port + i > 0xffff || get_port(sk, port + i, spec, label)) {
+			while ((sk = g_queue_pop_head(out)))
+				free_port(sk, spec);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 /* puts list of socket_t into "out" */
 int __get_consecutive_ports(GQueue *out, unsigned int num_ports, unsigned int wanted_start_port,
 		struct intf_spec *spec, const str *label)
 {
-	int i, cycle = 0;
-	socket_t *sk;
+	unsigned int start, tries;
 	int port;
 	struct port_pool *pp;
 
@@ -887,79 +929,108 @@ int __get_consecutive_ports(GQueue *out, unsigned int num_ports, unsigned int wa
 	__C_DBG("wanted_start_port=%d", wanted_start_port);
 
 	if (wanted_start_port > 0) {
+		if (get_ports(out, num_ports, wanted_start_port, spec, label))
+			goto fail;
 		port = wanted_start_port;
-		__C_DBG("port=%d", port);
-	} else {
-		port = g_atomic_int_get(&pp->last_used);
-		__C_DBG("before randomization port=%d", port);
+		goto done;
+	}
+
+	start = g_atomic_int_get(&pp->last_used);
+	__C_DBG("before randomization port=%u", start);
 #if PORT_RANDOM_MIN && PORT_RANDOM_MAX
-		port += PORT_RANDOM_MIN + (ssl_random() % (PORT_RANDOM_MAX - PORT_RANDOM_MIN));
+	start += PORT_RANDOM_MIN + (ssl_random() % (PORT_RANDOM_MAX - PORT_RANDOM_MIN));
 #endif
-		__C_DBG("after  randomization port=%d", port);
-
-		// debug msg if port is in the given interval
-		if (bit_array_isset(pp->ports_used, port)) {
-			__C_DBG("port %d is USED in port pool", port);
-			mutex_lock(&pp->free_list_lock);
-			unsigned int fport = GPOINTER_TO_UINT(g_queue_pop_head(&pp->free_list));
-			if (fport)
-				bit_array_clear(pp->free_list_used, fport);
-			mutex_unlock(&pp->free_list_lock);
-			if (fport) {
-				port = fport;
-				__C_DBG("Picked port %u from free list", port);
-			}
-		} else {
-			__C_DBG("port %d is NOT USED in port pool", port);
-		}
+	__C_DBG("after  randomization port=%u", start);
+
+	// Pre-bound sockets first, then any free ports. A candidate can be taken by
+	// another thread or be bound outside of rtpengine, in which case the search
+	// moves on past it. Each attempt advances, so this is bounded by the range.
+	for (tries = pp->max - pp->min + 1; tries > 0; tries--) {
+		port = -1;
+		if (pp->pooled_fds)
+			port = bit_array_find_run(NULL, pp->pooled, num_ports, start, pp->min, pp->max);
+		if (port < 0)
+			port = bit_array_find_run(pp->ports_used, NULL, num_ports, start, pp->min, pp->max);
+		if (port < 0)
+			break;
+
+		__C_DBG("trying ports %d..", port);
+		if (!get_ports(out, num_ports, port, spec, label))
+			goto done;
+
+		start = port + (num_ports > 1 ? 2 : 1);
 	}
 
-	while (1) {
-		__C_DBG("cycle=%d, port=%d", cycle, port);
-		if (!wanted_start_port) {
-			if (port < pp->min)
-				port = pp->min;
-			if (num_ports > 1 && (port & 1))
-				port++;
-		}
+fail:
+	ilog(LOG_ERR, "Failed to get %u consecutive ports on interface %s for media relay (last error: %s)",
+			num_ports, sockaddr_print_buf(&spec->local_address.addr), strerror(errno));
+	return -1;
 
-		for (i = 0; i < num_ports; i++) {
-			sk = g_slice_alloc0(sizeof(*sk));
-			// fd=0 is a valid file descriptor that may be closed
-			// accidentally by free_port if previously bounded
-			sk->fd = -1;
-			g_queue_push_tail(out, sk);
-
-			if (!wanted_start_port && port > pp->max) {
-				port = 0;
-				cycle++;
-				goto release_restart;
-			}
+done:
+	g_atomic_int_set(&pp->last_used, port + num_ports);
 
-			if (get_port(sk, port++, spec, label))
-				goto release_restart;
-		}
-		break;
+	__C_DBG("Opened ports %u.. on interface %s for media relay",
+		((socket_t *) out->head->data)->local.port, sockaddr_print_buf(&spec->local_address.addr));
+	return 0;
+}
 
-release_restart:
-		while ((sk = g_queue_pop_head(out)))
-			free_port(sk, spec);
+// binds pairs of sockets until the pool holds --socket-pool pairs or the range runs out
+static void port_pool_fill(struct intf_spec *spec) {
+	struct port_pool *pp = &spec->port_pool;
+	unsigned int target = rtpe_config.socket_pool * 2;
+	unsigned int tries = (pp->max - pp->min + 1) / 2;
+	socket_t s[2];
+	int port;
 
-		if (cycle >= 2 || wanted_start_port > 0)
-			goto fail;
+	while (g_atomic_int_get(&pp->num_pooled) < target && tries--) {
+		if (rtpe_shutdown)
+			return;
+
+		port = bit_array_find_run(pp->ports_used, NULL, 2, pp->pool_next, pp->min, pp->max);
+		if (port < 0)
+			return;
+		pp->pool_next = port + 2;
+
+		if (bit_array_set(pp->ports_used, port))
+			continue;
+		if (bit_array_set(pp->ports_used, port + 1)) {
+			bit_array_clear(pp->ports_used, port);
+			continue;
+		}
+
+		if (open_socket(&s[0], SOCK_DGRAM, port, &spec->local_address.addr))
+			goto release;
+		if (open_socket(&s[1], SOCK_DGRAM, port + 1, &spec->local_address.addr)) {
+			close_socket(&s[0]);
+			goto release;
+		}
+		socket_timestamping(&s[0]);
+		socket_timestamping(&s[1]);
+
+		pp->pooled_fds[port - pp->min] = s[0].fd;
+		pp->pooled_fds[port + 1 - pp->min] = s[1].fd;
+		g_atomic_int_add(&pp->num_pooled, 2);
+		bit_array_set(pp->pooled, port);
+		bit_array_set(pp->pooled, port + 1);
+		continue;
+
+release:
+		__C_DBG("couldn't pre-bind ports %d/%d", port, port + 1);
+		bit_array_clear(pp->ports_used, port);
+		bit_array_clear(pp->ports_used, port + 1);
 	}
+}
 
-	/* success */
-	g_atomic_int_set(&pp->last_used, port);
+void port_pool_loop(void *dummy) {
+	GList *specs = g_hash_table_get_values(__intf_spec_addr_type_hash);
 
-	__C_DBG("Opened ports %u.. on interface %s for media relay",
-		((socket_t *) out->head->data)->local.port, sockaddr_print_buf(&spec->local_address.addr));
-	return 0;
+	while (!rtpe_shutdown) {
+		for (GList *l = specs; l; l = l->next)
+			port_pool_fill(l->data);
+		usleep(100000);
+	}
 
-fail:
-	ilog(LOG_ERR, "Failed to get %u consecutive ports on interface %s for media relay (last error: %s)",
-			num_ports, sockaddr_print_buf(&spec->local_address.addr), strerror(errno));
-	return -1;
+	g_list_free(specs);
 }
 
 /* puts a list of "struct intf_list" into "out", containing socket_t list */
@@ -1401,12 +1472,14 @@ void kernelize(struct packet_stream *stream) {
 				"lack of sinks");
 	}
 
+	kernel_batch_start();
 	kernel_add_stream(&reti);
 	struct rtpengine_destination_info *redi;
 	while ((redi = g_queue_pop_head(&outputs))) {
 		kernel_add_destination(redi);
 		g_slice_free1(sizeof(*redi), redi);
 	}
+	kernel_batch_end();
 
 	PS_SET(stream, KERNELIZED);
 	return;
@@ -2640,6 +2713,30 @@ out:
 }
 
 
+// The packet must be located at buf + RTP_BUFFER_HEAD_ROOM, in a buffer of
+// RTP_BUFFER_SIZE. Sets `update` if the call needs to be written to Redis.
+static void stream_fd_packet(struct packet_handler_ctx *phc, char *buf, int len, bool *update) {
+	int ret;
+
+	if (len >= MAX_RTP_PACKET_SIZE)
+		ilog(LOG_WARNING | LOG_FLAG_LIMIT, "UDP packet possibly truncated");
+
+	str_init_len(&phc->s, buf + RTP_BUFFER_HEAD_ROOM, len);
+
+	if (phc->mp.sfd->stream && phc->mp.sfd->stream->jb) {
+		ret = buffer_packet(&phc->mp, &phc->s);
+		if (ret == 1)
+			ret = stream_packet(phc);
+	}
+	else
+		ret = stream_packet(phc);
+
+	if (G_UNLIKELY(ret < 0))
+		ilog(LOG_WARNING | LOG_FLAG_LIMIT, "Write error on media socket: %s", strerror(-ret));
+	else if (phc->update)
+		*update = true;
+}
+
 static void stream_fd_readable(int fd, void *p, uintptr_t u) {
 	struct stream_fd *sfd = p;
 	char buf[RTP_BUFFER_SIZE];
@@ -2697,23 +2794,8 @@ static void stream_fd_readable(int fd, void *p, uintptr_t u) {
 			stream_fd_closed(fd, sfd, 0);
 			goto done;
 		}
-		if (ret >= MAX_RTP_PACKET_SIZE)
-			ilog(LOG_WARNING | LOG_FLAG_LIMIT, "UDP packet possibly truncated");
-
-		str_init_len(&phc.s, buf + RTP_BUFFER_HEAD_ROOM, ret);
-
-		if (sfd->stream && sfd->stream->jb) {
-			ret = buffer_packet(&phc.mp, &phc.s);
-			if (ret == 1)
-				ret = stream_packet(&phc);
-		}
-		else
-			ret = stream_packet(&phc);
 
-		if (G_UNLIKELY(ret < 0))
-			ilog(LOG_WARNING | LOG_FLAG_LIMIT, "Write error on media socket: %s", strerror(-ret));
-		else if (phc.update)
-			update = true;
+		stream_fd_packet(&phc, buf, ret, &update);
 	}
 
 	// no strike
@@ -2732,6 +2814,45 @@ done:
 
 
 
+// io_uring variant: the packet has already been received by the poller, into a
+// buffer laid out for stream_fd_packet(), so it's processed in place
+static void stream_fd_recv(int fd, void *p, char *data, size_t len, const void *sin,
+		const struct timeval *tv)
+{
+	struct stream_fd *sfd = p;
+	bool update = false;
+	struct call *ca = sfd->call;
+
+	if (sfd->socket.fd != fd)
+		return;
+
+	struct packet_handler_ctx phc;
+	ZERO(phc);
+	phc.mp.sfd = sfd;
+	phc.mp.tv = *tv;
+
+	if (ca) {
+		rwlock_lock_r(&ca->master_lock);
+		if (sfd->socket.fd != fd) {
+			rwlock_unlock_r(&ca->master_lock);
+			return;
+		}
+	}
+	// the source address lives in the head room: convert it before that's reused
+	sfd->socket.family->sockaddr2endpoint(&phc.mp.fsin, sin);
+	if (ca)
+		rwlock_unlock_r(&ca->master_lock);
+
+	log_info_stream_fd(sfd);
+	stream_fd_packet(&phc, data - RTP_BUFFER_HEAD_ROOM, len, &update);
+	if (ca && update)
+		redis_update_onekey(ca, rtpe_redis_write);
+	log_info_pop();
+}
+
+
+
+
 static void stream_fd_free(void *p) {
 	struct stream_fd *f = p;
 
@@ -2762,6 +2883,8 @@ struct stream_fd *stream_fd_new(socket_t *fd, struct call *call, const struct lo
 	pi.obj = &sfd->obj;
 	pi.readable = stream_fd_readable;
 	pi.closed = stream_fd_closed;
+	if (rtpe_config.io_uring)
+		pi.recv = stream_fd_recv;
 
 	if (sfd->socket.fd != -1) {
 		if (rtpe_config.poller_per_thread)
@@ -2872,7 +2995,13 @@ void interfaces_free(void) {
 	for (GList *l = ll; l; l = l->next) {
 		struct intf_spec *spec = l->data;
 		struct port_pool *pp = &spec->port_pool;
-		g_queue_clear(&pp->free_list);
+		if (pp->pooled_fds) {
+			for (unsigned int i = 0; i <= pp->max - pp->min; i++) {
+				if (pp->pooled_fds[i] != -1)
+					close(pp->pooled_fds[i]);
+			}
+			g_free(pp->pooled_fds);
+		}
 		g_slice_free1(sizeof(*spec), spec);
 	}
 	g_list_free(ll);
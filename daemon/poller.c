@@ -15,11 +15,75 @@
 #include <main.h>
 #include <redis.h>
 #include <hiredis/adapters/libevent.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
 
 #include "aux.h"
 #include "obj.h"
 #include "log_funcs.h"
+#include "kernel.h"
+#include "call.h"
+
+
+
+#ifdef HAVE_LIBURING
+
+#define URING_ENTRIES		1024
+#define URING_BGID		0
+#define URING_CTRL_SIZE		CMSG_SPACE(sizeof(struct timeval))
+#define URING_HDR_SIZE		(sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in6) \
+					+ URING_CTRL_SIZE)
+// Each receive buffer is laid out like RTP_BUFFER_SIZE buffers elsewhere. The
+// kernel is handed the part starting URING_HDR_SIZE bytes before the head room
+// ends, so that the recvmsg header lands in the head room and the payload right
+// behind it, with the tail room left unused after it.
+#define URING_BUF_SLOT		RTP_BUFFER_SIZE
+#define URING_BUF_OFFSET	(RTP_BUFFER_HEAD_ROOM - URING_HDR_SIZE)
+#define URING_BUF_SIZE		(URING_HDR_SIZE + MAX_RTP_PACKET_SIZE)
+
+_Static_assert(URING_HDR_SIZE <= RTP_BUFFER_HEAD_ROOM, "recvmsg header doesn't fit into RTP head room");
+
+enum uring_req_type {
+	URING_RECV = 1,		// multishot recvmsg into the buffer ring
+	URING_POLL,		// multishot poll for items without `recv`
+	URING_POLLOUT,		// one-shot poll for blocked writeable items
+	URING_SEND,
+};
+
+struct uring_req {
+	enum uring_req_type		type;
+};
+
+struct uring_send {
+	struct uring_req		req;
+	struct uring_send		*next;		// free list
+	struct msghdr			mh;
+	struct iovec			iov;
+	struct sockaddr_storage		sin;
+	void				(*release)(void *);
+	void				*release_ptr;
+	int				bid;		// receive buffer holding the data, or -1
+};
+
+struct uring_engine {
+	struct io_uring			ring;
+	mutex_t				sq_lock;	// items are added and removed from any thread
+
+	// only touched by the thread running the poller
+	struct io_uring_buf_ring	*buf_ring;
+	char				*bufs;
+	unsigned int			num_bufs;
+	unsigned int			*buf_refs;	// receive in progress plus sends still using it
+	struct msghdr			recv_mh;	// layout template for multishot recvmsg
+	struct uring_send		*free_sends;
+};
+
+// the io_uring poller run by this thread, if any
+static __thread struct poller *poller_thread_uring;
+
+#endif
 
 
 
@@ -36,6 +100,12 @@ struct poller_item_int {
 
 	unsigned int			blocked:1;
 	unsigned int			error:1;
+
+#ifdef HAVE_LIBURING
+	struct uring_req		req;
+	struct uring_req		wreq;		// POLLOUT while blocked
+	int				removed;	// atomic
+#endif
 };
 
 struct poller {
@@ -49,6 +119,10 @@ struct poller {
 	mutex_t				timers_add_del_lock; /* nested below timers_lock */
 	GSList				*timers_add;
 	GSList				*timers_del;
+
+#ifdef HAVE_LIBURING
+	struct uring_engine		*uring;		// used instead of epoll if set
+#endif
 };
 
 struct poller_map {
@@ -56,6 +130,15 @@ struct poller_map {
 	GHashTable			*table;
 };
 
+#ifdef HAVE_LIBURING
+static struct poller *poller_uring_new(void);
+static void poller_uring_free(struct poller *);
+static void poller_uring_arm(struct poller *, struct poller_item_int *);
+static void poller_uring_cancel(struct poller *, struct poller_item_int *);
+static void poller_uring_arm_pollout(struct poller *, struct poller_item_int *);
+static int poller_uring_poll(struct poller *, int);
+#endif
+
 struct poller_map *poller_map_new(void) {
 	struct poller_map *p;
 
@@ -69,13 +152,18 @@ struct poller_map *poller_map_new(void) {
 
 void poller_map_add(struct poller_map *map) {
 	pthread_t tid = -1;
-	struct poller *p;
+	struct poller *p = NULL;
 	if (!map)
 		return;
 	tid = pthread_self();
 
 	mutex_lock(&map->lock);
-	p = poller_new();
+#ifdef HAVE_LIBURING
+	if (rtpe_config.io_uring)
+		p = poller_uring_new();
+	if (!p)
+#endif
+		p = poller_new();
 	g_hash_table_insert(map->table, (gpointer)tid, p);
 	mutex_unlock(&map->lock);
 }
@@ -150,6 +238,10 @@ void poller_free(struct poller **pp) {
 	if (p->fd != -1)
 		close(p->fd);
 	p->fd = -1;
+#ifdef HAVE_LIBURING
+	if (p->uring)
+		poller_uring_free(p);
+#endif
 	if (p->items)
 		free(p->items);
 	free(p);
@@ -203,11 +295,16 @@ static int __poller_add_item(struct poller *p, struct poller_item *i, int has_lo
 	if (i->fd < p->items_size && p->items[i->fd])
 		goto fail;
 
-	ZERO(e);
-	e.events = epoll_events(i, NULL);
-	e.data.fd = i->fd;
-	if (epoll_ctl(p->fd, EPOLL_CTL_ADD, i->fd, &e))
-		abort();
+#ifdef HAVE_LIBURING
+	if (!p->uring)
+#endif
+	{
+		ZERO(e);
+		e.events = epoll_events(i, NULL);
+		e.data.fd = i->fd;
+		if (epoll_ctl(p->fd, EPOLL_CTL_ADD, i->fd, &e))
+			abort();
+	}
 
 	if (i->fd >= p->items_size) {
 		u = p->items_size;
@@ -223,6 +320,11 @@ static int __poller_add_item(struct poller *p, struct poller_item *i, int has_lo
 
 	mutex_unlock(&p->lock);
 
+#ifdef HAVE_LIBURING
+	if (p->uring)
+		poller_uring_arm(p, ip);
+#endif
+
 	if (i->timer)
 		poller_add_timer(p, poller_fd_timer, &ip->obj);
 
@@ -258,6 +360,11 @@ int poller_del_item(struct poller *p, int fd) {
 	if (!p->items || !(it = p->items[fd]))
 		goto fail;
 
+#ifdef HAVE_LIBURING
+	if (p->uring)
+		poller_uring_cancel(p, it);
+	else
+#endif
 	if (epoll_ctl(p->fd, EPOLL_CTL_DEL, fd, NULL))
 		abort();
 
@@ -302,6 +409,7 @@ int poller_update_item(struct poller *p, struct poller_item *i) {
 	np->item.readable = i->readable;
 	np->item.writeable = i->writeable;
 	np->item.closed = i->closed;
+	np->item.recv = i->recv;
 	/* updating timer is not supported */
 
 	mutex_unlock(&p->lock);
@@ -384,6 +492,11 @@ int poller_poll(struct poller *p, int timeout) {
 	if (!p)
 		return -1;
 
+#ifdef HAVE_LIBURING
+	if (p->uring)
+		return poller_uring_poll(p, timeout);
+#endif
+
 	mutex_lock(&p->lock);
 
 	mutex_unlock(&p->lock);
@@ -402,6 +515,10 @@ int poller_poll(struct poller *p, int timeout) {
 
 	gettimeofday(&rtpe_now, NULL);
 
+	// kernel target changes made while handling these events are pushed
+	// out together once they've all been processed
+	kernel_batch_start();
+
 	for (i = 0; i < ret; i++) {
 		ev = &evs[i];
 
@@ -450,6 +567,10 @@ next:
 	}
 
 
+	mutex_unlock(&p->lock);
+	kernel_batch_end();
+	return ret;
+
 out:
 	mutex_unlock(&p->lock);
 	return ret;
@@ -472,6 +593,17 @@ void poller_blocked(struct poller *p, void *fdp) {
 	if (!p->items[fd]->item.writeable)
 		goto fail;
 
+#ifdef HAVE_LIBURING
+	if (p->uring) {
+		// wait for POLLOUT once, unless we're already waiting
+		if (!p->items[fd]->blocked) {
+			p->items[fd]->blocked = 1;
+			poller_uring_arm_pollout(p, p->items[fd]);
+		}
+		goto fail;
+	}
+#endif
+
 	p->items[fd]->blocked = 1;
 
 	ZERO(e);
@@ -615,9 +747,448 @@ void poller_loop(void *d) {
 void poller_loop2(void *d) {
 	struct poller *p = d;
 
+#ifdef HAVE_LIBURING
+	if (p->uring)
+		poller_thread_uring = p;
+#endif
+
 	while (!rtpe_shutdown) {
 		int ret = poller_poll(p, 10000);
 		if (ret < 0)
 			usleep(20 * 1000);
 	}
 }
+
+
+
+#ifdef HAVE_LIBURING
+
+static struct poller *poller_uring_new(void) {
+	struct uring_engine *u;
+	struct poller *p;
+	int ret;
+
+	u = g_slice_alloc0(sizeof(*u));
+	mutex_init(&u->sq_lock);
+
+	ret = io_uring_queue_init(URING_ENTRIES, &u->ring, 0);
+	if (ret) {
+		ilog(LOG_ERR, "Failed to set up io_uring, falling back to epoll: %s", strerror(-ret));
+		goto err_free;
+	}
+
+	// the buffer ring size must be a power of two
+	u->num_bufs = 1;
+	while (u->num_bufs < rtpe_config.io_uring_buffers)
+		u->num_bufs <<= 1;
+
+	u->buf_ring = io_uring_setup_buf_ring(&u->ring, u->num_bufs, URING_BGID, 0, &ret);
+	if (!u->buf_ring) {
+		ilog(LOG_ERR, "Failed to set up io_uring buffer ring, falling back to epoll: %s",
+				strerror(-ret));
+		goto err_ring;
+	}
+	u->bufs = g_malloc((size_t) u->num_bufs * URING_BUF_SLOT);
+	u->buf_refs = g_new0(unsigned int, u->num_bufs);
+	for (unsigned int i = 0; i < u->num_bufs; i++)
+		io_uring_buf_ring_add(u->buf_ring, u->bufs + (size_t) i * URING_BUF_SLOT + URING_BUF_OFFSET,
+				URING_BUF_SIZE, i, io_uring_buf_ring_mask(u->num_bufs), i);
+	io_uring_buf_ring_advance(u->buf_ring, u->num_bufs);
+
+	u->recv_mh.msg_namelen = sizeof(struct sockaddr_in6);
+	u->recv_mh.msg_controllen = URING_CTRL_SIZE;
+
+	p = malloc(sizeof(*p));
+	memset(p, 0, sizeof(*p));
+	gettimeofday(&rtpe_now, NULL);
+	p->fd = -1;
+	p->uring = u;
+	mutex_init(&p->lock);
+	mutex_init(&p->timers_lock);
+	mutex_init(&p->timers_add_del_lock);
+
+	return p;
+
+err_ring:
+	io_uring_queue_exit(&u->ring);
+err_free:
+	mutex_destroy(&u->sq_lock);
+	g_slice_free1(sizeof(*u), u);
+	return NULL;
+}
+
+// Items still armed at this point keep their reference, as we're shutting down.
+static void poller_uring_free(struct poller *p) {
+	struct uring_engine *u = p->uring;
+
+	io_uring_free_buf_ring(&u->ring, u->buf_ring, u->num_bufs, URING_BGID);
+	io_uring_queue_exit(&u->ring);
+	g_free(u->bufs);
+	g_free(u->buf_refs);
+	while (u->free_sends) {
+		struct uring_send *us = u->free_sends;
+		u->free_sends = us->next;
+		g_slice_free1(sizeof(*us), us);
+	}
+	mutex_destroy(&u->sq_lock);
+	g_slice_free1(sizeof(*u), u);
+	p->uring = NULL;
+}
+
+// sq_lock must be held
+static struct io_uring_sqe *poller_uring_sqe(struct uring_engine *u) {
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+	if (sqe)
+		return sqe;
+	// full: push out what we have and try again
+	io_uring_submit(&u->ring);
+	return io_uring_get_sqe(&u->ring);
+}
+
+// Starts a multishot receive (or poll) on the item. The request holds a
+// reference to the item until its final completion. `removed` is checked under
+// sq_lock, which poller_uring_cancel() sets it under: either the cancellation
+// is submitted after this request and finds it, or nothing is armed.
+static void poller_uring_arm(struct poller *p, struct poller_item_int *ip) {
+	struct uring_engine *u = p->uring;
+
+	mutex_lock(&u->sq_lock);
+
+	if (g_atomic_int_get(&ip->removed)) {
+		mutex_unlock(&u->sq_lock);
+		return;
+	}
+
+	struct io_uring_sqe *sqe = poller_uring_sqe(u);
+	if (!sqe) {
+		mutex_unlock(&u->sq_lock);
+		ilog(LOG_ERR | LOG_FLAG_LIMIT, "io_uring submission queue full, cannot poll fd %i",
+				ip->item.fd);
+		return;
+	}
+
+	if (ip->item.recv) {
+		io_uring_prep_recvmsg_multishot(sqe, ip->item.fd, &u->recv_mh, 0);
+		sqe->flags |= IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BGID;
+		ip->req.type = URING_RECV;
+	}
+	else {
+		io_uring_prep_poll_multishot(sqe, ip->item.fd, POLLIN);
+		ip->req.type = URING_POLL;
+	}
+	io_uring_sqe_set_data(sqe, &ip->req);
+	obj_hold(ip);
+
+	// the item may have been added from another thread: don't wait for the
+	// next batch
+	io_uring_submit(&u->ring);
+
+	mutex_unlock(&u->sq_lock);
+}
+
+// p->lock is held. Waits for the item to become writeable again, holding a
+// reference until completion.
+static void poller_uring_arm_pollout(struct poller *p, struct poller_item_int *ip) {
+	struct uring_engine *u = p->uring;
+
+	mutex_lock(&u->sq_lock);
+
+	if (g_atomic_int_get(&ip->removed)) {
+		mutex_unlock(&u->sq_lock);
+		ip->blocked = 0;
+		return;
+	}
+
+	struct io_uring_sqe *sqe = poller_uring_sqe(u);
+	if (!sqe) {
+		mutex_unlock(&u->sq_lock);
+		ilog(LOG_ERR | LOG_FLAG_LIMIT, "io_uring submission queue full, cannot poll fd %i",
+				ip->item.fd);
+		ip->blocked = 0;
+		return;
+	}
+
+	io_uring_prep_poll_add(sqe, ip->item.fd, POLLOUT);
+	ip->wreq.type = URING_POLLOUT;
+	io_uring_sqe_set_data(sqe, &ip->wreq);
+	obj_hold(ip);
+	io_uring_submit(&u->ring);
+
+	mutex_unlock(&u->sq_lock);
+}
+
+// p->lock is held
+static void poller_uring_cancel(struct poller *p, struct poller_item_int *ip) {
+	struct uring_engine *u = p->uring;
+
+	mutex_lock(&u->sq_lock);
+	g_atomic_int_set(&ip->removed, 1);
+	struct io_uring_sqe *sqe = poller_uring_sqe(u);
+	if (sqe) {
+		io_uring_prep_cancel(sqe, &ip->req, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+	if (ip->blocked) {
+		sqe = poller_uring_sqe(u);
+		if (sqe) {
+			io_uring_prep_cancel(sqe, &ip->wreq, 0);
+			io_uring_sqe_set_data(sqe, NULL);
+		}
+	}
+	io_uring_submit(&u->ring);
+	mutex_unlock(&u->sq_lock);
+}
+
+// drops a reference to a receive buffer, handing it back to the kernel once unused
+static void poller_uring_buf_put(struct uring_engine *u, unsigned int bid) {
+	if (--u->buf_refs[bid])
+		return;
+	io_uring_buf_ring_add(u->buf_ring, u->bufs + (size_t) bid * URING_BUF_SLOT + URING_BUF_OFFSET,
+			URING_BUF_SIZE, bid, io_uring_buf_ring_mask(u->num_bufs), 0);
+	io_uring_buf_ring_advance(u->buf_ring, 1);
+}
+
+static void poller_uring_recv(struct poller *p, struct poller_item_int *ip, struct io_uring_cqe *cqe) {
+	struct uring_engine *u = p->uring;
+
+	if (cqe->res < 0) {
+		if (cqe->res == -ENOBUFS)
+			ilog(LOG_WARN | LOG_FLAG_LIMIT, "io_uring receive buffers exhausted, "
+					"consider raising --io-uring-buffers");
+		else if (cqe->res != -ECANCELED && !g_atomic_int_get(&ip->removed)) {
+			ip->error = 1;
+			ip->item.closed(ip->item.fd, ip->item.obj, ip->item.uintp);
+		}
+		return;
+	}
+	if (!(cqe->flags & IORING_CQE_F_BUFFER))
+		return;
+
+	unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	char *buf = u->bufs + (size_t) bid * URING_BUF_SLOT + URING_BUF_OFFSET;
+	u->buf_refs[bid] = 1;
+
+	struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(buf, cqe->res, &u->recv_mh);
+	if (out && !g_atomic_int_get(&ip->removed)) {
+		struct timeval tv = {0,};
+		for (struct cmsghdr *cm = io_uring_recvmsg_cmsg_firsthdr(out, &u->recv_mh); cm;
+				cm = io_uring_recvmsg_cmsg_nexthdr(out, &u->recv_mh, cm))
+		{
+			if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_TIMESTAMP) {
+				tv = *((struct timeval *) CMSG_DATA(cm));
+				break;
+			}
+		}
+		if (G_UNLIKELY((out->flags & MSG_TRUNC)))
+			ilog(LOG_WARNING | LOG_FLAG_LIMIT, "Kernel indicates that data was truncated");
+
+		ip->item.recv(ip->item.fd, ip->item.obj,
+				io_uring_recvmsg_payload(out, &u->recv_mh),
+				io_uring_recvmsg_payload_length(out, cqe->res, &u->recv_mh),
+				io_uring_recvmsg_name(out), &tv);
+	}
+
+	// hand the buffer back, unless sends made from it are still in flight
+	poller_uring_buf_put(u, bid);
+}
+
+static void poller_uring_pollin(struct poller *p, struct poller_item_int *ip, struct io_uring_cqe *cqe) {
+	if (cqe->res == -ECANCELED || g_atomic_int_get(&ip->removed))
+		return;
+	if (ip->error) // from poller_error()
+		ip->item.closed(ip->item.fd, ip->item.obj, ip->item.uintp);
+	else if (cqe->res < 0 || (cqe->res & (POLLERR | POLLHUP))) {
+		ip->error = 1;
+		ip->item.closed(ip->item.fd, ip->item.obj, ip->item.uintp);
+	}
+	else if (cqe->res & POLLIN)
+		ip->item.readable(ip->item.fd, ip->item.obj, ip->item.uintp);
+}
+
+static void poller_uring_pollout(struct poller *p, struct poller_item_int *ip, struct io_uring_cqe *cqe) {
+	if (cqe->res == -ECANCELED || g_atomic_int_get(&ip->removed))
+		return;
+	if (ip->error || cqe->res < 0 || (cqe->res & (POLLERR | POLLHUP))) {
+		ip->error = 1;
+		ip->item.closed(ip->item.fd, ip->item.obj, ip->item.uintp);
+		return;
+	}
+
+	mutex_lock(&p->lock);
+	ip->blocked = 0;
+	mutex_unlock(&p->lock);
+
+	if (ip->item.writeable)
+		ip->item.writeable(ip->item.fd, ip->item.obj, ip->item.uintp);
+}
+
+static void poller_uring_cqe(struct poller *p, struct io_uring_cqe *cqe) {
+	struct uring_req *req = io_uring_cqe_get_data(cqe);
+
+	if (!req) // cancellation
+		return;
+
+	if (req->type == URING_SEND) {
+		struct uring_send *us = (void *) req;
+		if (cqe->res < 0)
+			ilog(LOG_DEBUG | LOG_FLAG_LIMIT, "Error when sending message. Error: %s",
+					strerror(-cqe->res));
+		if (us->release)
+			us->release(us->release_ptr);
+		if (us->bid >= 0)
+			poller_uring_buf_put(p->uring, us->bid);
+		us->next = p->uring->free_sends;
+		p->uring->free_sends = us;
+		return;
+	}
+
+	if (req->type == URING_POLLOUT) {
+		struct poller_item_int *ip = (void *) ((char *) req
+				- G_STRUCT_OFFSET(struct poller_item_int, wreq));
+		poller_uring_pollout(p, ip, cqe);
+		log_info_reset();
+		obj_put(ip);
+		return;
+	}
+
+	struct poller_item_int *ip = (void *) ((char *) req - G_STRUCT_OFFSET(struct poller_item_int, req));
+
+	if (req->type == URING_RECV)
+		poller_uring_recv(p, ip, cqe);
+	else
+		poller_uring_pollin(p, ip, cqe);
+	log_info_reset();
+
+	if ((cqe->flags & IORING_CQE_F_MORE))
+		return;
+
+	// multishot request has ended, e.g. because of running out of buffers
+	if (!g_atomic_int_get(&ip->removed) && !ip->error)
+		poller_uring_arm(p, ip);
+	obj_put(ip);
+}
+
+static int poller_uring_poll(struct poller *p, int timeout) {
+	struct uring_engine *u = p->uring;
+	struct io_uring_cqe *cqe;
+	struct __kernel_timespec ts = {
+		.tv_sec = timeout / 1000,
+		.tv_nsec = (timeout % 1000) * 1000000LL,
+	};
+	unsigned int head, num = 0;
+	int ret;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	ret = io_uring_wait_cqe_timeout(&u->ring, &cqe, &ts);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	if (ret == -ETIME || ret == -EINTR)
+		return 0;
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	gettimeofday(&rtpe_now, NULL);
+
+	kernel_batch_start();
+
+	io_uring_for_each_cqe(&u->ring, head, cqe) {
+		poller_uring_cqe(p, cqe);
+		num++;
+	}
+	io_uring_cq_advance(&u->ring, num);
+
+	kernel_batch_end();
+
+	// everything sent while handling this batch goes out in one go
+	mutex_lock(&u->sq_lock);
+	if (io_uring_sq_ready(&u->ring))
+		io_uring_submit(&u->ring);
+	mutex_unlock(&u->sq_lock);
+
+	return num;
+}
+
+#endif
+
+
+// Sends through the io_uring of the current thread if there is one, without
+// copying the data. `release(ptr)`, if given, is called once the buffer is no
+// longer needed: when the send has completed, or right away if it was made
+// through a regular sendto(). Data inside one of the poller's own receive
+// buffers keeps that buffer from being reused until then.
+ssize_t poller_sendto(socket_t *s, const void *buf, size_t len, const endpoint_t *ep,
+		void (*release)(void *), void *ptr)
+{
+#ifdef HAVE_LIBURING
+	struct poller *p = poller_thread_uring;
+	if (p) {
+		struct uring_engine *u = p->uring;
+
+		struct uring_send *us = u->free_sends;
+		if (us)
+			u->free_sends = us->next;
+		else
+			us = g_slice_alloc(sizeof(*us));
+
+		us->req.type = URING_SEND;
+		us->iov.iov_base = (void *) buf;
+		us->iov.iov_len = len;
+		ZERO(us->mh);
+		us->mh.msg_iov = &us->iov;
+		us->mh.msg_iovlen = 1;
+		s->family->endpoint2sockaddr(&us->sin, ep);
+		us->mh.msg_name = &us->sin;
+		us->mh.msg_namelen = s->family->sockaddr_size;
+		us->release = release;
+		us->release_ptr = ptr;
+		us->bid = -1;
+		const char *b = buf;
+		if (b >= u->bufs && b < u->bufs + (size_t) u->num_bufs * URING_BUF_SLOT)
+			us->bid = (b - u->bufs) / URING_BUF_SLOT;
+
+		mutex_lock(&u->sq_lock);
+		struct io_uring_sqe *sqe = poller_uring_sqe(u);
+		if (sqe) {
+			io_uring_prep_sendmsg(sqe, s->fd, &us->mh, 0);
+			io_uring_sqe_set_data(sqe, &us->req);
+		}
+		mutex_unlock(&u->sq_lock);
+
+		if (sqe) {
+			if (us->bid >= 0)
+				u->buf_refs[us->bid]++;
+			return len;
+		}
+
+		us->next = u->free_sends;
+		u->free_sends = us;
+	}
+#endif
+	ssize_t ret = socket_sendto(s, buf, len, ep);
+	if (release)
+		release(ptr);
+	return ret;
+}
+
+// For data that doesn't stay around until the send completes: it's gathered
+// into a copy if the send is queued, or sent out straight away otherwise.
+// Either way it goes out in order with what was sent through poller_sendto().
+ssize_t poller_sendiov(socket_t *s, const struct iovec *iov, unsigned int iovlen, const endpoint_t *ep) {
+#ifdef HAVE_LIBURING
+	if (poller_thread_uring) {
+		size_t len = 0;
+		for (unsigned int i = 0; i < iovlen; i++)
+			len += iov[i].iov_len;
+		char *buf = g_malloc(len), *pos = buf;
+		for (unsigned int i = 0; i < iovlen; i++) {
+			memcpy(pos, iov[i].iov_base, iov[i].iov_len);
+			pos += iov[i].iov_len;
+		}
+		return poller_sendto(s, buf, len, ep, g_free, buf);
+	}
+#endif
+	return socket_sendiov(s, iov, iovlen, ep);
+}
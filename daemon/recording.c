@@ -12,6 +12,9 @@
 #include <unistd.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "xt_RTPENGINE.h"
 
@@ -21,15 +24,69 @@
 #include "rtplib.h"
 #include "cdr.h"
 #include "log.h"
+#include "main.h"
 
 
 
+// pcap data is put into memory segments and written out by a separate thread,
+// once a segment is full, or at least once per REC_PCAP_FLUSH_INTERVAL
+#define REC_PCAP_SEGMENT (16 << 10) // per-call files
+#define REC_PCAP_CAPTURE_SEGMENT (1 << 20) // shared capture files
+#define REC_PCAP_FLUSH_INTERVAL 1000000 // us
+
+
 struct rec_pcap_format {
 	int linktype;
 	int headerlen;
 	void (*header)(unsigned char *, struct packet_stream *);
 };
 
+struct rec_pcap_filehdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct rec_pcap_pkthdr {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+struct rec_pcap_meta_move {
+	char *from;
+	char *to;
+};
+
+struct rec_pcap_segment {
+	struct rec_pcap_file *file; // holds a reference
+	GQueue meta_moves; // rec_pcap_meta_move, done once the segment is written
+	size_t len;
+	size_t size;
+	unsigned char buf[];
+};
+
+struct rec_pcap_file {
+	struct obj obj;
+	mutex_t lock;
+	struct rec_pcap_segment *seg; // being filled, protected by lock
+	size_t seg_size;
+	int fd; // written to by the writer thread only
+	bool write_error;
+	char *path;
+	GList link; // in rec_pcap_files while open
+	unsigned int gen; // capture files only
+	time_t opened;
+	// metadata file to be moved into place once the pcap is complete
+	char *meta_from;
+	char *meta_to;
+};
+
 
 
 static int check_main_spool_dir(const char *spoolpath);
@@ -54,6 +111,11 @@ static void sdp_after_pcap(struct recording *, GString *str, struct call_monolog
 static void dump_packet_pcap(struct media_packet *mp, const str *s);
 static void finish_pcap(struct call *);
 static void response_pcap(struct recording *, bencode_item_t *);
+static void rec_pcap_writer_loop(void *);
+static void rec_capture_init(struct recording *);
+static bool rec_capture_meta_move(const char *from, const char *to);
+static void rec_capture_rotate(void);
+static void rec_pcap_writer_shutdown(void);
 
 // proc methods
 static void proc_init(struct call *);
@@ -70,6 +132,7 @@ static void setup_monologue_proc(struct call_monologue *);
 static void kernel_info_proc(struct packet_stream *, struct rtpengine_target_info *);
 
 static void rec_pcap_eth_header(unsigned char *, struct packet_stream *);
+static int rec_pcap_meta_move(const char *from, const char *to);
 
 #define append_meta_chunk_str(r, str, f...) append_meta_chunk(r, (str)->s, (str)->len, f)
 #define append_meta_chunk_s(r, str, f...) append_meta_chunk(r, (str), strlen(str), f)
@@ -94,6 +157,7 @@ const struct recording_method methods[] = {
 		.setup_monologue = NULL,
 		.stream_kernel_info = NULL,
 		.response = response_pcap,
+		.writer_loop = rec_pcap_writer_loop,
 	},
 	{
 		.name = "proc",
@@ -130,6 +194,7 @@ const struct recording_method methods[] = {
 		.setup_monologue = setup_monologue_proc,
 		.stream_kernel_info = kernel_info_proc,
 		.response = response_pcap,
+		.writer_loop = rec_pcap_writer_loop,
 	},
 };
 
@@ -150,6 +215,28 @@ static char *spooldir = NULL;
 const struct recording_method *selected_recording_method;
 static const struct rec_pcap_format *rec_pcap_format;
 
+// segments waiting to be written
+static mutex_t rec_pcap_lock = MUTEX_STATIC_INIT;
+static cond_t rec_pcap_cond = COND_STATIC_INIT;
+static GQueue rec_pcap_queue = G_QUEUE_INIT;
+static bool rec_pcap_writer_running;
+static atomic64 rec_pcap_buffered; // bytes held in segments
+static atomic64 rec_pcap_dropped;
+
+// open pcap files, for the writer to pick up partly filled segments
+static mutex_t rec_pcap_files_lock = MUTEX_STATIC_INIT;
+static GQueue rec_pcap_files = G_QUEUE_INIT;
+
+// multi-call capture file currently written into
+static rwlock_t rec_capture_lock;
+static struct rec_pcap_file *rec_capture;
+
+// connection to the recording daemon's metadata socket
+static mutex_t rec_meta_sock_lock = MUTEX_STATIC_INIT;
+static int rec_meta_sock = -1;
+static time_t rec_meta_sock_retry;
+static bool rec_meta_sock_failed;
+
 
 
 /**
@@ -158,6 +245,8 @@ static const struct rec_pcap_format *rec_pcap_format;
  */
 
 void recording_fs_free(void) {
+	rec_pcap_writer_shutdown();
+
 	if (spooldir)
 		free(spooldir);
 
@@ -207,6 +296,13 @@ found:
 		ilog(LOG_ERR, "Please run `mkdir %s` and start rtpengine again.", spooldir);
 		exit(-1);
 	}
+
+	rwlock_init(&rec_capture_lock);
+	if (rtpe_config.rec_pcap_rotate && selected_recording_method->writer_loop) {
+		rec_capture_rotate();
+		if (!rec_capture)
+			exit(-1);
+	}
 }
 
 static int check_create_dir(const char *dir, const char *desc, mode_t creat_mode) {
@@ -425,6 +521,268 @@ void detect_setup_recording(struct call *call, const str *recordcall) {
 		ilog(LOG_INFO, "\"record-call\" flag "STR_FORMAT" is invalid flag.", STR_FMT(recordcall));
 }
 
+static struct rec_pcap_segment *rec_pcap_segment_new(struct rec_pcap_file *f, size_t size) {
+	if (atomic64_get(&rec_pcap_buffered) + size > (uint64_t) rtpe_config.rec_pcap_buffer << 20)
+		return NULL;
+	struct rec_pcap_segment *seg = g_malloc(sizeof(*seg) + size);
+	seg->file = obj_get(f);
+	g_queue_init(&seg->meta_moves);
+	seg->len = 0;
+	seg->size = size;
+	atomic64_add(&rec_pcap_buffered, size);
+	return seg;
+}
+
+static void rec_pcap_meta_move_free(void *p) {
+	struct rec_pcap_meta_move *m = p;
+	g_free(m->from);
+	g_free(m->to);
+	g_slice_free1(sizeof(*m), m);
+}
+
+static void rec_pcap_segment_free(struct rec_pcap_segment *seg) {
+	g_queue_clear_full(&seg->meta_moves, rec_pcap_meta_move_free);
+	atomic64_add(&rec_pcap_buffered, -seg->size);
+	obj_put(seg->file);
+	g_free(seg);
+}
+
+// runs in the writer thread, or in whichever thread hands over a segment while
+// there's no writer
+static void rec_pcap_segment_write(struct rec_pcap_segment *seg) {
+	struct rec_pcap_file *f = seg->file;
+	size_t pos = 0;
+
+	while (pos < seg->len && f->fd != -1) {
+		ssize_t ret = write(f->fd, seg->buf + pos, seg->len - pos);
+		if (ret > 0) {
+			pos += ret;
+			continue;
+		}
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (!f->write_error)
+			ilog(LOG_ERR, "Failed to write to pcap file '%s%s%s': %s", FMT_M(f->path),
+					ret < 0 ? strerror(errno) : "no space");
+		f->write_error = true;
+		break;
+	}
+
+	for (GList *l = seg->meta_moves.head; l; l = l->next) {
+		struct rec_pcap_meta_move *m = l->data;
+		rec_pcap_meta_move(m->from, m->to);
+	}
+
+	rec_pcap_segment_free(seg);
+}
+
+// file must be locked. hands the segment being filled over to the writer
+static void rec_pcap_file_queue(struct rec_pcap_file *f) {
+	struct rec_pcap_segment *seg = f->seg;
+	if (!seg)
+		return;
+	f->seg = NULL;
+
+	mutex_lock(&rec_pcap_lock);
+	if (rec_pcap_writer_running) {
+		g_queue_push_tail(&rec_pcap_queue, seg);
+		cond_signal(&rec_pcap_cond);
+		mutex_unlock(&rec_pcap_lock);
+		return;
+	}
+	mutex_unlock(&rec_pcap_lock);
+
+	rec_pcap_segment_write(seg);
+}
+
+static int rec_pcap_meta_move(const char *from, const char *to) {
+	int ret = rename(from, to);
+	if (ret != 0) {
+		ilog(LOG_ERROR, "Could not move metadata file \"%s\" to \"%s/metadata/\"",
+				 from, spooldir);
+	} else {
+		ilog(LOG_INFO, "Moved metadata file \"%s\" to \"%s/metadata\"",
+				 from, spooldir);
+	}
+	return ret;
+}
+
+// called once the last segment is written
+static void rec_pcap_file_free(void *p) {
+	struct rec_pcap_file *f = p;
+	if (f->fd != -1)
+		close(f->fd);
+	if (f->meta_from)
+		rec_pcap_meta_move(f->meta_from, f->meta_to);
+	g_free(f->meta_from);
+	g_free(f->meta_to);
+	g_free(f->path);
+	mutex_destroy(&f->lock);
+}
+
+static struct rec_pcap_file *rec_pcap_file_open(const char *path, size_t seg_size) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd == -1) {
+		ilog(LOG_ERR, "Failed to open pcap file '%s%s%s': %s", FMT_M(path), strerror(errno));
+		return NULL;
+	}
+
+	struct rec_pcap_filehdr hdr = {
+		.magic = 0xa1b2c3d4,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = 65535,
+		.linktype = rec_pcap_format->linktype,
+	};
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		ilog(LOG_ERR, "Failed to write to pcap file '%s%s%s': %s", FMT_M(path), strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	struct rec_pcap_file *f = obj_alloc0("rec_pcap_file", sizeof(*f), rec_pcap_file_free);
+	mutex_init(&f->lock);
+	f->fd = fd;
+	f->path = g_strdup(path);
+	f->seg_size = seg_size;
+	f->opened = rtpe_now.tv_sec;
+	f->link.data = f;
+
+	mutex_lock(&rec_pcap_files_lock);
+	g_queue_push_tail_link(&rec_pcap_files, &f->link);
+	mutex_unlock(&rec_pcap_files_lock);
+
+	return f;
+}
+
+// releases the reference held by the owner. the file is closed once the writer
+// is done with it
+static void rec_pcap_file_close(struct rec_pcap_file *f) {
+	mutex_lock(&rec_pcap_files_lock);
+	g_queue_unlink(&rec_pcap_files, &f->link);
+	mutex_unlock(&rec_pcap_files_lock);
+
+	mutex_lock(&f->lock);
+	rec_pcap_file_queue(f);
+	mutex_unlock(&f->lock);
+
+	obj_put(f);
+}
+
+// hands all partly filled segments over to the writer
+static void rec_pcap_flush_all(void) {
+	mutex_lock(&rec_pcap_files_lock);
+	for (GList *l = rec_pcap_files.head; l; l = l->next) {
+		struct rec_pcap_file *f = l->data;
+		mutex_lock(&f->lock);
+		rec_pcap_file_queue(f);
+		mutex_unlock(&f->lock);
+	}
+	mutex_unlock(&rec_pcap_files_lock);
+}
+
+// opens a new multi-call capture file, then closes the previous one
+static void rec_capture_rotate(void) {
+	static unsigned int gen;
+
+	char tbuf[32];
+	struct tm tm;
+	time_t now = rtpe_now.tv_sec ? : time(NULL);
+	localtime_r(&now, &tm);
+	strftime(tbuf, sizeof(tbuf), "%Y%m%d-%H%M%S", &tm);
+
+	char *path = g_strdup_printf("%s/pcaps/capture-%s-%u.pcap", spooldir, tbuf, ++gen);
+	struct rec_pcap_file *f = rec_pcap_file_open(path, REC_PCAP_CAPTURE_SEGMENT);
+	if (f) {
+		f->opened = now;
+		f->gen = gen;
+		ilog(LOG_INFO, "Writing capture file: %s", path);
+	}
+	g_free(path);
+	if (!f)
+		return; // keep using the old one
+
+	rwlock_lock_w(&rec_capture_lock);
+	struct rec_pcap_file *old = rec_capture;
+	rec_capture = f;
+	rwlock_unlock_w(&rec_capture_lock);
+
+	if (old)
+		rec_pcap_file_close(old);
+}
+
+static void rec_pcap_writer_loop(void *p) {
+	struct thread_waker waker = { .lock = &rec_pcap_lock, .cond = &rec_pcap_cond };
+	thread_waker_add(&waker);
+
+	mutex_lock(&rec_pcap_lock);
+	rec_pcap_writer_running = true;
+
+	struct timeval now, next_flush;
+	gettimeofday(&next_flush, NULL);
+	timeval_add_usec(&next_flush, REC_PCAP_FLUSH_INTERVAL);
+
+	while (!rtpe_shutdown || rec_pcap_queue.length) {
+		struct rec_pcap_segment *seg = g_queue_pop_head(&rec_pcap_queue);
+		if (seg) {
+			mutex_unlock(&rec_pcap_lock);
+			rec_pcap_segment_write(seg);
+			mutex_lock(&rec_pcap_lock);
+		}
+
+		gettimeofday(&now, NULL);
+		if (timeval_cmp(&now, &next_flush) >= 0) {
+			mutex_unlock(&rec_pcap_lock);
+
+			rec_pcap_flush_all();
+
+			if (rtpe_config.rec_pcap_rotate && rec_capture
+					&& now.tv_sec - rec_capture->opened >= rtpe_config.rec_pcap_rotate)
+				rec_capture_rotate();
+
+			uint64_t dropped = atomic64_get_set(&rec_pcap_dropped, 0);
+			if (dropped)
+				ilog(LOG_WARN, "Dropped %" PRIu64 " packets from pcap recordings, "
+						"as %i MB of data are waiting to be written",
+						dropped, rtpe_config.rec_pcap_buffer);
+
+			next_flush = now;
+			timeval_add_usec(&next_flush, REC_PCAP_FLUSH_INTERVAL);
+			mutex_lock(&rec_pcap_lock);
+			continue;
+		}
+
+		if (!seg && !rtpe_shutdown)
+			cond_timedwait(&rec_pcap_cond, &rec_pcap_lock, &next_flush);
+	}
+
+	// from here on, segments are written by whoever hands them over
+	rec_pcap_writer_running = false;
+	mutex_unlock(&rec_pcap_lock);
+
+	thread_waker_del(&waker);
+}
+
+// writes out everything still buffered
+static void rec_pcap_writer_shutdown(void) {
+	mutex_lock(&rec_pcap_lock);
+	rec_pcap_writer_running = false;
+	GQueue q = rec_pcap_queue;
+	g_queue_init(&rec_pcap_queue);
+	mutex_unlock(&rec_pcap_lock);
+
+	struct rec_pcap_segment *seg;
+	while ((seg = g_queue_pop_head(&q)))
+		rec_pcap_segment_write(seg);
+
+	rec_pcap_flush_all();
+
+	if (rec_capture) {
+		rec_pcap_file_close(rec_capture);
+		rec_capture = NULL;
+	}
+}
+
 static void rec_pcap_init(struct call *call) {
 	struct recording *recording = call->recording;
 
@@ -433,9 +791,14 @@ static void rec_pcap_init(struct call *call) {
 	mutex_init(&recording->u.pcap.recording_lock);
 	meta_setup_file(recording);
 
+	if (rtpe_config.rec_pcap_rotate) {
+		rec_capture_init(recording);
+		return;
+	}
+
 	// set up pcap file
 	char *pcap_path = recording_setup_file(recording);
-	if (pcap_path != NULL && recording->u.pcap.recording_pdumper != NULL
+	if (pcap_path != NULL && recording->u.pcap.file != NULL
 	    && recording->u.pcap.meta_fp) {
 		// Write the location of the PCAP file to the metadata file
 		fprintf(recording->u.pcap.meta_fp, "%s\n\n", pcap_path);
@@ -541,6 +904,12 @@ static int rec_pcap_meta_finish_file(struct call *call) {
 	// Print metadata
 	if (call->metadata.len)
 		fprintf(recording->u.pcap.meta_fp, "\n\n"STR_FORMAT"\n", STR_FMT(&call->metadata));
+	if (recording->u.pcap.capture_files.length > 1) {
+		// the first one is at the top
+		fprintf(recording->u.pcap.meta_fp, "\n\ncapture files:\n");
+		for (GList *l = recording->u.pcap.capture_files.head; l; l = l->next)
+			fprintf(recording->u.pcap.meta_fp, "%s\n", (char *) l->data);
+	}
 	fclose(recording->u.pcap.meta_fp);
 	recording->u.pcap.meta_fp = NULL;
 
@@ -564,14 +933,18 @@ static int rec_pcap_meta_finish_file(struct call *call) {
 	char new_metapath[prefix_len + fn_len + ext_len + 1];
 	snprintf(new_metapath, prefix_len+fn_len+1, "%s/metadata/%s", spooldir, meta_filename);
 	snprintf(new_metapath + prefix_len+fn_len, ext_len+1, ".txt");
-	return_code = return_code || rename(recording->meta_filepath_pcap, new_metapath);
-	if (return_code != 0) {
-		ilog(LOG_ERROR, "Could not move metadata file \"%s\" to \"%s/metadata/\"",
-				 recording->meta_filepath_pcap, spooldir);
-	} else {
-		ilog(LOG_INFO, "Moved metadata file \"%s\" to \"%s/metadata\"",
-				 recording->meta_filepath_pcap, spooldir);
+
+	struct rec_pcap_file *f = recording->u.pcap.file;
+	if (f) {
+		// moved by the writer once the pcap is complete
+		mutex_lock(&f->lock);
+		f->meta_from = g_strdup(recording->meta_filepath_pcap);
+		f->meta_to = g_strdup(new_metapath);
+		mutex_unlock(&f->lock);
 	}
+	else if (!rtpe_config.rec_pcap_rotate
+			|| !rec_capture_meta_move(recording->meta_filepath_pcap, new_metapath))
+		return_code = rec_pcap_meta_move(recording->meta_filepath_pcap, new_metapath);
 
 	mutex_destroy(&recording->u.pcap.recording_lock);
 
@@ -587,17 +960,14 @@ static char *recording_setup_file(struct recording *recording) {
 
 	if (!spooldir)
 		return NULL;
-	if (recording->u.pcap.recording_pd || recording->u.pcap.recording_pdumper)
+	if (recording->u.pcap.file)
 		return NULL;
 
 	recording_path = file_path_str(recording->meta_prefix, "/pcaps/", ".pcap");
 	recording->u.pcap.recording_path = recording_path;
 
-	recording->u.pcap.recording_pd = pcap_open_dead(rec_pcap_format->linktype, 65535);
-	recording->u.pcap.recording_pdumper = pcap_dump_open(recording->u.pcap.recording_pd, recording_path);
-	if (recording->u.pcap.recording_pdumper == NULL) {
-		pcap_close(recording->u.pcap.recording_pd);
-		recording->u.pcap.recording_pd = NULL;
+	recording->u.pcap.file = rec_pcap_file_open(recording_path, REC_PCAP_SEGMENT);
+	if (recording->u.pcap.file == NULL) {
 		ilog(LOG_INFO, "Failed to write recording file: %s", recording_path);
 	} else {
 		ilog(LOG_INFO, "Writing recording file: %s", recording_path);
@@ -607,17 +977,17 @@ static char *recording_setup_file(struct recording *recording) {
 }
 
 /**
- * Flushes PCAP file, closes the dumper and descriptors, and frees object memory.
+ * Hands the rest of the PCAP file to the writer, which closes it once
+ * everything is written, and frees object memory.
  */
 static void rec_pcap_recording_finish_file(struct recording *recording) {
-	if (recording->u.pcap.recording_pdumper != NULL) {
-		pcap_dump_flush(recording->u.pcap.recording_pdumper);
-		pcap_dump_close(recording->u.pcap.recording_pdumper);
-		free(recording->u.pcap.recording_path);
-	}
-	if (recording->u.pcap.recording_pd != NULL) {
-		pcap_close(recording->u.pcap.recording_pd);
+	if (recording->u.pcap.file != NULL) {
+		rec_pcap_file_close(recording->u.pcap.file);
+		recording->u.pcap.file = NULL;
 	}
+	free(recording->u.pcap.recording_path);
+	recording->u.pcap.recording_path = NULL;
+	g_queue_clear_full(&recording->u.pcap.capture_files, g_free);
 }
 
 // "out" must be at least inp->len + MAX_PACKET_HEADER_LEN bytes
@@ -645,43 +1015,130 @@ static void rec_pcap_eth_header(unsigned char *pkt, struct packet_stream *stream
 /**
  * Write out a PCAP packet with payload string.
  * A fair amount extraneous of packet data is spoofed.
+ * The packet is built in place in the file's current segment.
  */
-static void stream_pcap_dump(struct media_packet *mp, const str *s) {
-	pcap_dumper_t *pdumper = mp->call->recording->u.pcap.recording_pdumper;
-	if (!pdumper)
-		return;
+static void stream_pcap_dump(struct rec_pcap_file *f, struct media_packet *mp, const str *s) {
+	size_t max_len = sizeof(struct rec_pcap_pkthdr) + rec_pcap_format->headerlen
+		+ MAX_PACKET_HEADER_LEN + s->len;
+
+	mutex_lock(&f->lock);
+
+	if (f->seg && f->seg->len + max_len > f->seg->size)
+		rec_pcap_file_queue(f);
+	if (!f->seg) {
+		f->seg = rec_pcap_segment_new(f, MAX(f->seg_size, max_len));
+		if (!f->seg) {
+			mutex_unlock(&f->lock);
+			atomic64_inc(&rec_pcap_dropped);
+			return;
+		}
+	}
 
-	unsigned char pkt[s->len + MAX_PACKET_HEADER_LEN + rec_pcap_format->headerlen];
+	unsigned char *out = f->seg->buf + f->seg->len;
+	unsigned char *pkt = out + sizeof(struct rec_pcap_pkthdr);
 	unsigned int pkt_len = fake_ip_header(pkt + rec_pcap_format->headerlen, mp, s) + rec_pcap_format->headerlen;
 	if (rec_pcap_format->header)
 		rec_pcap_format->header(pkt, mp->stream);
 
 	// Set up PCAP packet header
-	struct pcap_pkthdr header;
-	ZERO(header);
-	header.ts = rtpe_now;
-	header.caplen = pkt_len;
-	header.len = pkt_len;
+	struct rec_pcap_pkthdr header = {
+		.ts_sec = rtpe_now.tv_sec,
+		.ts_usec = rtpe_now.tv_usec,
+		.caplen = pkt_len,
+		.len = pkt_len,
+	};
+	memcpy(out, &header, sizeof(header));
+	f->seg->len += sizeof(header) + pkt_len;
+
+	mutex_unlock(&f->lock);
+}
+
+// recording_lock must be held
+static void rec_capture_note(struct recording *recording, struct rec_pcap_file *f) {
+	recording->u.pcap.capture_gen = f->gen;
+	g_queue_push_tail(&recording->u.pcap.capture_files, g_strdup(f->path));
+}
+
+static void rec_capture_init(struct recording *recording) {
+	rwlock_lock_r(&rec_capture_lock);
+	struct rec_pcap_file *f = rec_capture;
+	if (f) {
+		rec_capture_note(recording, f);
+		// Write the location of the first capture file to the metadata file
+		if (recording->u.pcap.meta_fp)
+			fprintf(recording->u.pcap.meta_fp, "%s\n\n", f->path);
+	}
+	rwlock_unlock_r(&rec_capture_lock);
+}
+
+// the call's last packets may still be buffered in the capture file's current
+// segment or waiting for the writer, so the metadata file is moved by the writer
+// after that segment. returns false if there's nothing to wait for
+static bool rec_capture_meta_move(const char *from, const char *to) {
+	bool ret = false;
+
+	rwlock_lock_r(&rec_capture_lock);
+	struct rec_pcap_file *f = rec_capture;
+	if (f) {
+		mutex_lock(&f->lock);
+		// an empty segment still goes through the writer queue in order
+		if (!f->seg)
+			f->seg = rec_pcap_segment_new(f, 0);
+		if (f->seg) {
+			struct rec_pcap_meta_move *m = g_slice_alloc(sizeof(*m));
+			m->from = g_strdup(from);
+			m->to = g_strdup(to);
+			g_queue_push_tail(&f->seg->meta_moves, m);
+			ret = true;
+		}
+		mutex_unlock(&f->lock);
+	}
+	rwlock_unlock_r(&rec_capture_lock);
+
+	return ret;
+}
 
-	// Write the packet to the PCAP file
-	// Casting quiets compiler warning.
-	pcap_dump((unsigned char *)pdumper, &header, pkt);
+// recording_lock must be held
+static void rec_capture_dump(struct recording *recording, struct media_packet *mp, const str *s) {
+	rwlock_lock_r(&rec_capture_lock);
+	struct rec_pcap_file *f = rec_capture;
+	if (f) {
+		if (recording->u.pcap.capture_gen != f->gen)
+			rec_capture_note(recording, f);
+		stream_pcap_dump(f, mp, s);
+	}
+	rwlock_unlock_r(&rec_capture_lock);
 }
 
 static void dump_packet_pcap(struct media_packet *mp, const str *s) {
 	struct recording *recording = mp->call->recording;
 	mutex_lock(&recording->u.pcap.recording_lock);
-	stream_pcap_dump(mp, s);
+	if (rtpe_config.rec_pcap_rotate)
+		rec_capture_dump(recording, mp, s);
+	else if (recording->u.pcap.file)
+		stream_pcap_dump(recording->u.pcap.file, mp, s);
 	recording->u.pcap.packet_num++;
 	mutex_unlock(&recording->u.pcap.recording_lock);
 }
 
 static void finish_pcap(struct call *call) {
-	rec_pcap_recording_finish_file(call->recording);
+	// the pcap file takes care of moving the metadata file, so this goes first
 	rec_pcap_meta_finish_file(call);
+	rec_pcap_recording_finish_file(call->recording);
 }
 
 static void response_pcap(struct recording *recording, bencode_item_t *output) {
+	if (rtpe_config.rec_pcap_rotate) {
+		mutex_lock(&recording->u.pcap.recording_lock);
+		if (recording->u.pcap.capture_files.length) {
+			bencode_item_t *recordings = bencode_dictionary_add_list(output, "recordings");
+			for (GList *l = recording->u.pcap.capture_files.head; l; l = l->next)
+				bencode_list_add_string(recordings, l->data);
+		}
+		mutex_unlock(&recording->u.pcap.recording_lock);
+		return;
+	}
+
 	if (!recording->u.pcap.recording_path)
 		return;
 
@@ -732,29 +1189,101 @@ static int open_proc_meta_file(struct recording *recording) {
 	return fd;
 }
 
+// mutex must be held
+static int rec_meta_sock_connect(void) {
+	if (rec_meta_sock != -1)
+		return 0;
+	if (rtpe_now.tv_sec < rec_meta_sock_retry)
+		return -1;
+
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", rtpe_config.rec_meta_socket);
+
+	rec_meta_sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (rec_meta_sock != -1 && !connect(rec_meta_sock, (struct sockaddr *) &sun, sizeof(sun))) {
+		ilog(LOG_INFO, "Connected to recording metadata socket '%s'", rtpe_config.rec_meta_socket);
+		rec_meta_sock_failed = false;
+		return 0;
+	}
+
+	if (!rec_meta_sock_failed)
+		ilog(LOG_WARN, "Failed to connect to recording metadata socket '%s', "
+				"using metadata files: %s", rtpe_config.rec_meta_socket, strerror(errno));
+	rec_meta_sock_failed = true;
+	if (rec_meta_sock != -1)
+		close(rec_meta_sock);
+	rec_meta_sock = -1;
+	rec_meta_sock_retry = rtpe_now.tv_sec + 1;
+	return -1;
+}
+
+// Sends metadata to the recording daemon, preceded by the name of the metadata
+// file it belongs to. Returns 0 on success. Once this has failed for a call, its
+// metadata goes to the file, so that it isn't processed out of order.
+static int rec_meta_send(struct recording *recording, struct iovec *iov, int iovcnt, size_t len) {
+	if (!rtpe_config.rec_meta_socket || recording->u.proc.meta_file)
+		return -1;
+
+	char name[strlen(recording->meta_prefix) + 7];
+	iov[0].iov_len = snprintf(name, sizeof(name), "%s.meta\n", recording->meta_prefix);
+	iov[0].iov_base = name;
+	len += iov[0].iov_len;
+
+	int ret = -1;
+
+	mutex_lock(&rec_meta_sock_lock);
+	if (!rec_meta_sock_connect()) {
+		struct msghdr mh = { .msg_iov = iov, .msg_iovlen = iovcnt };
+		ssize_t sent = sendmsg(rec_meta_sock, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent == len)
+			ret = 0;
+		else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EMSGSIZE))
+			ilog(LOG_WARN, "Failed to send recording metadata to socket, using metadata file: %s",
+					strerror(errno));
+		else {
+			ilog(LOG_WARN, "Lost connection to recording metadata socket: %s",
+					sent == -1 ? strerror(errno) : "short write");
+			close(rec_meta_sock);
+			rec_meta_sock = -1;
+		}
+	}
+	mutex_unlock(&rec_meta_sock_lock);
+
+	if (ret)
+		recording->u.proc.meta_file = true;
+	else
+		recording->u.proc.meta_sent = true;
+
+	return ret;
+}
+
 static int vappend_meta_chunk_iov(struct recording *recording, struct iovec *in_iov, int iovcnt,
 		unsigned int str_len, const char *label_fmt, va_list ap)
 {
-	int fd = open_proc_meta_file(recording);
-	if (fd == -1)
-		return -1;
-
 	char label[128];
 	int lablen = vsnprintf(label, sizeof(label), label_fmt, ap);
 	char infix[128];
 	int inflen = snprintf(infix, sizeof(infix), "\n%u:\n", str_len);
 
-	// use writev for an atomic write
-	struct iovec iov[iovcnt + 3];
-	iov[0].iov_base = label;
-	iov[0].iov_len = lablen;
-	iov[1].iov_base = infix;
-	iov[1].iov_len = inflen;
-	memcpy(&iov[2], in_iov, iovcnt * sizeof(*iov));
-	iov[iovcnt + 2].iov_base = "\n\n";
-	iov[iovcnt + 2].iov_len = 2;
-
-	if (writev(fd, iov, iovcnt + 3) != (str_len + lablen + inflen + 2))
+	// use writev for an atomic write. the first one is reserved for the
+	// name of the metadata file, which only goes to the socket
+	struct iovec iov[iovcnt + 4];
+	iov[1].iov_base = label;
+	iov[1].iov_len = lablen;
+	iov[2].iov_base = infix;
+	iov[2].iov_len = inflen;
+	memcpy(&iov[3], in_iov, iovcnt * sizeof(*iov));
+	iov[iovcnt + 3].iov_base = "\n\n";
+	iov[iovcnt + 3].iov_len = 2;
+
+	if (!rec_meta_send(recording, iov, iovcnt + 4, str_len + lablen + inflen + 2))
+		return 0;
+
+	int fd = open_proc_meta_file(recording);
+	if (fd == -1)
+		return -1;
+
+	if (writev(fd, iov + 1, iovcnt + 3) != (str_len + lablen + inflen + 2))
 		ilog(LOG_WARN, "writev return value incorrect");
 
 	close(fd); // this triggers the inotify
@@ -781,7 +1310,7 @@ static void proc_init(struct call *call) {
 	struct recording *recording = call->recording;
 
 	recording->u.proc.call_idx = UNINIT_IDX;
-	if (!kernel.is_open) {
+	if (!kernel.is_open || kernel.xdp) {
 		ilog(LOG_WARN, "Call recording through /proc interface requested, but kernel table not open");
 		return;
 	}
@@ -827,6 +1356,16 @@ static void finish_proc(struct call *call) {
 		struct packet_stream *ps = l->data;
 		ps->recording.u.proc.stream_idx = UNINIT_IDX;
 	}
+	if (recording->u.proc.meta_sent) {
+		// just the name tells the recording daemon that the call is gone. if
+		// that fails, an empty file is deleted instead
+		struct iovec iov[1];
+		if (rec_meta_send(recording, iov, 1, 0)) {
+			int fd = open_proc_meta_file(recording);
+			if (fd != -1)
+				close(fd);
+		}
+	}
 	unlink(recording->meta_filepath_proc);
 }
 
@@ -864,6 +1403,9 @@ static void setup_stream_proc(struct packet_stream *stream) {
 		return;
 	}
 	ilog(LOG_DEBUG, "kernel stream idx is %u", stream->recording.u.proc.stream_idx);
+	// must precede the interface, for the recording daemon to pick the packets up from the ring
+	append_meta_chunk_null(recording, "STREAM %u KERNEL-INDEX %u", stream->unique_id,
+			stream->recording.u.proc.stream_idx);
 	append_meta_chunk(recording, buf, len, "STREAM %u interface", stream->unique_id);
 }
 
@@ -17,6 +17,7 @@
 #include "ssrc.h"
 #include "sdp.h"
 #include "log_funcs.h"
+#include "poller.h"
 
 
 
@@ -1557,6 +1558,10 @@ void rtcp_receiver_reports(GQueue *out, struct ssrc_hash *hash, struct call_mono
 }
 
 
+static void rtcp_sr_free(void *p) {
+	g_string_free(p, TRUE);
+}
+
 // call must be locked in R
 void rtcp_send_report(struct call_media *media, struct ssrc_ctx *ssrc_out) {
 	// figure out where to send it
@@ -1609,8 +1614,8 @@ void rtcp_send_report(struct call_media *media, struct ssrc_ctx *ssrc_out) {
 		crypt_handler->out->rtcp_crypt(&rtcp_packet, ps, NULL, NULL, NULL, ssrc_out);
 	}
 
-	socket_sendto(&ps->selected_sfd->socket, rtcp_packet.s, rtcp_packet.len, &ps->endpoint);
-	g_string_free(sr, TRUE);
+	poller_sendto(&ps->selected_sfd->socket, rtcp_packet.s, rtcp_packet.len, &ps->endpoint,
+			rtcp_sr_free, sr); // consumes sr
 
 	GQueue *sinks = ps->rtp_sinks.length ? &ps->rtp_sinks : &ps->rtcp_sinks;
 	for (GList *l = sinks->head; l; l = l->next) {
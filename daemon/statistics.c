@@ -4,6 +4,8 @@
 #include "graphite.h"
 #include "main.h"
 #include "control_ng.h"
+#include "codec.h"
+#include "kernel.h"
 
 
 struct timeval rtpe_started;
@@ -213,6 +215,11 @@ void statistics_update_oneway(struct call* c) {
 		last->prom_name = name; \
 		last->prom_type = type; \
 	} while (0)
+#define PROMSFX(sfx) \
+	do { \
+		struct stats_metric *last = g_queue_peek_tail(ret); \
+		last->prom_suffix = sfx; \
+	} while (0)
 #define PROMLAB(fmt, ...) \
 	do { \
 		struct stats_metric *last = g_queue_peek_tail(ret); \
@@ -351,6 +358,15 @@ GQueue *statistics_gather_metrics(void) {
 	METRIC("sessionstotal", "Total sessions", UINT64F, UINT64F, cur_sessions);
 	METRIC("transcodedmedia", "Transcoded media", UINT64F, UINT64F, atomic64_get(&rtpe_stats_gauge.transcoded_media));
 	PROM("transcoded_media", "gauge");
+	if (rtpe_config.transcode_limit) {
+		METRIC("transcodingload", "Estimated transcoding load (CPU cores)", "%.3f", "%.3f",
+				(double) codeclib_transcoding_load() / 1000000.0);
+		PROM("transcoding_load", "gauge");
+	}
+	if (rtpe_config.transcode_threads > 0) {
+		METRIC("transcodequeue", "Packets queued for transcoding", "%u", "%u", codec_workers_queue_depth());
+		PROM("transcode_queue_length", "gauge");
+	}
 
 	METRIC("packetrate_user", "Packets per second (userspace)", UINT64F, UINT64F,
 			atomic64_get(&rtpe_stats.intv.packets_user));
@@ -460,6 +476,48 @@ GQueue *statistics_gather_metrics(void) {
 			atomic64_get(&rtpe_stats_cumulative.bytes_kernel) +
 			atomic64_get(&rtpe_stats_cumulative.bytes_user));
 
+	// only the kernel module measures forwarding delays
+	if (kernel.is_open && !kernel.xdp) {
+		METRIC("kerneldelay_p50", "Kernel forwarding delay 50th percentile (us)", UINT64F, UINT64F,
+				stats_hist_pct(rtpe_stats_cumulative.kernel_delay, RTPE_NUM_DELAY_BUCKETS, 50));
+		METRIC("kerneldelay_p90", "Kernel forwarding delay 90th percentile (us)", UINT64F, UINT64F,
+				stats_hist_pct(rtpe_stats_cumulative.kernel_delay, RTPE_NUM_DELAY_BUCKETS, 90));
+		METRIC("kerneldelay_p99", "Kernel forwarding delay 99th percentile (us)", UINT64F, UINT64F,
+				stats_hist_pct(rtpe_stats_cumulative.kernel_delay, RTPE_NUM_DELAY_BUCKETS, 99));
+
+		uint64_t delay_total = 0;
+		for (int i = 0; i < RTPE_NUM_DELAY_BUCKETS; i++)
+			delay_total += atomic64_get(&rtpe_stats_cumulative.kernel_delay[i]);
+		METRIC("kerneldelay_count", "Packets with measured kernel forwarding delay", UINT64F, UINT64F,
+				delay_total);
+		PROM("kernel_delay_seconds", "histogram");
+		PROMSFX("_count");
+		METRICva("kerneldelay_sum", "Sum of kernel forwarding delays", "%.6f", "%.6f seconds",
+				(double) atomic64_get(&rtpe_stats_cumulative.kernel_delay_sum) / 1000000.0);
+		PROM("kernel_delay_seconds", "histogram");
+		PROMSFX("_sum");
+
+		// cumulative buckets, the last one without upper bound
+		HEADER("kerneldelay", NULL);
+		HEADER("[", NULL);
+		uint64_t delay_packets = 0;
+		for (int i = 0; i < RTPE_NUM_DELAY_BUCKETS; i++) {
+			delay_packets += atomic64_get(&rtpe_stats_cumulative.kernel_delay[i]);
+			HEADER("{", NULL);
+			if (i < RTPE_NUM_DELAY_BUCKETS - 1)
+				METRICs("le_us", UINT64F, 2ULL << i);
+			METRICs("packets", UINT64F, delay_packets);
+			PROM("kernel_delay_seconds", "histogram");
+			PROMSFX("_bucket");
+			if (i < RTPE_NUM_DELAY_BUCKETS - 1)
+				PROMLAB("le=\"%.6f\"", (double) (2ULL << i) / 1000000.0);
+			else
+				PROMLAB("le=\"+Inf\"");
+			HEADER("}", NULL);
+		}
+		HEADER("]", NULL);
+	}
+
 	METRIC("zerowaystreams", "Total number of streams with no relayed packets", UINT64F, UINT64F, atomic64_get(&rtpe_stats_cumulative.nopacket_relayed_sess));
 	PROM("zero_packet_streams_total", "counter");
 	METRIC("onewaystreams", "Total number of 1-way streams", UINT64F, UINT64F,atomic64_get(&rtpe_stats_cumulative.oneway_stream_sess));
@@ -477,6 +535,23 @@ GQueue *statistics_gather_metrics(void) {
 	double variance = num_sessions ? fabs((double) total_duration / (double) num_sessions - ((double) avg_us / 1000.0) * ((double) avg_us / 1000.0)) : 0.0;
 	METRICva("totalcallsduration_stddev", "Total calls duration standard deviation", "%.6f", "%.6f seconds", sqrt(variance) / 1000.0);
 
+#ifdef WITH_TRANSCODING
+	uint64_t buffer_allocs = codeclib_frame_stats_get(&codeclib_frame_stats.buffer_allocs);
+	uint64_t buffer_gets = codeclib_frame_stats_get(&codeclib_frame_stats.buffer_gets);
+	METRIC("transcodeframeallocs", "Total audio frames allocated for transcoding", UINT64F, UINT64F,
+			codeclib_frame_stats_get(&codeclib_frame_stats.frame_allocs));
+	PROM("transcode_frame_allocs_total", "counter");
+	METRIC("transcodeframereuses", "Total audio frames recycled for transcoding", UINT64F, UINT64F,
+			codeclib_frame_stats_get(&codeclib_frame_stats.frame_reuses));
+	PROM("transcode_frame_reuses_total", "counter");
+	METRIC("transcodebufferallocs", "Total audio sample buffers allocated for transcoding", UINT64F, UINT64F,
+			buffer_allocs);
+	PROM("transcode_buffer_allocs_total", "counter");
+	METRIC("transcodebufferreuses", "Total audio sample buffers recycled for transcoding", UINT64F, UINT64F,
+			buffer_gets - buffer_allocs);
+	PROM("transcode_buffer_reuses_total", "counter");
+#endif
+
 	calls_dur_iv = (double) atomic64_get_na(&rtpe_stats_graphite_interval.total_calls_duration_intv) / 1000000.0;
 	min_sess_iv = atomic64_get(&rtpe_stats_gauge_graphite_min_max_interval.min.total_sessions);
 	max_sess_iv = atomic64_get(&rtpe_stats_gauge_graphite_min_max_interval.max.total_sessions);
@@ -727,6 +802,14 @@ GQueue *statistics_gather_metrics(void) {
 		METRICs("samples", UINT64F, atomic64_get(&stats_entry->pcm_samples[2]));
 		PROM("transcode_samples_total", "counter");
 		PROMLAB("chain=\"%s\"", chain);
+		if (rtpe_config.transcode_threads > 0) {
+			METRICs("cputime", "%.6f", (double) atomic64_get(&stats_entry->cpu_time_us) / 1000000.0);
+			PROM("transcode_cpu_seconds_total", "counter");
+			PROMLAB("chain=\"%s\"", chain);
+			METRICs("latency_p50", UINT64F, codec_stats_latency_pct(stats_entry, 50));
+			METRICs("latency_p90", UINT64F, codec_stats_latency_pct(stats_entry, 90));
+			METRICs("latency_p99", UINT64F, codec_stats_latency_pct(stats_entry, 99));
+		}
 		HEADER("}", "");
 	}
 
@@ -734,6 +817,37 @@ GQueue *statistics_gather_metrics(void) {
 	g_list_free(chains);
 	HEADER("]", "");
 
+	HEADER("codeccosts", NULL);
+	HEADER("[", "");
+#ifdef WITH_TRANSCODING
+	const codec_def_t *def;
+	for (unsigned int i = 0; (def = codec_def_get(i)); i++) {
+		int decs = g_atomic_int_get(&def->cost.active_decoders);
+		int encs = g_atomic_int_get(&def->cost.active_encoders);
+		uint64_t dec_cost = codec_decode_cost_ppm(def);
+		uint64_t enc_cost = codec_encode_cost_ppm(def);
+		if (!decs && !encs && !dec_cost && !enc_cost)
+			continue;
+		HEADER("{", "");
+		METRICsva("codec", "\"%s\"", def->rtpname);
+		METRICs("decoders", "%i", decs);
+		PROM("codec_decoders", "gauge");
+		PROMLAB("codec=\"%s\"", def->rtpname);
+		METRICs("encoders", "%i", encs);
+		PROM("codec_encoders", "gauge");
+		PROMLAB("codec=\"%s\"", def->rtpname);
+		// CPU usage per instance in millionths of a core
+		METRICs("decodecost", UINT64F, dec_cost);
+		PROM("codec_decode_cost_ppm", "gauge");
+		PROMLAB("codec=\"%s\"", def->rtpname);
+		METRICs("encodecost", UINT64F, enc_cost);
+		PROM("codec_encode_cost_ppm", "gauge");
+		PROMLAB("codec=\"%s\"", def->rtpname);
+		HEADER("}", "");
+	}
+#endif
+	HEADER("]", "");
+
 	HEADER("}", NULL);
 
 	return ret;
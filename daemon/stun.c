@@ -14,6 +14,7 @@
 #include "log.h"
 #include "ice.h"
 #include "ssllib.h"
+#include "poller.h"
 
 
 
@@ -421,7 +422,7 @@ static void stun_error_len(struct stream_fd *sfd, const endpoint_t *sin,
 	fingerprint(&mh, &fp);
 
 	output_finish_src(&mh);
-	socket_sendmsg(&sfd->socket, &mh, sin);
+	poller_sendiov(&sfd->socket, mh.msg_iov, mh.msg_iovlen, sin);
 }
 
 #define stun_error(sfd, sin, req, code, reason) \
@@ -522,7 +523,7 @@ static int stun_binding_success(struct stream_fd *sfd, struct header *req, struc
 	fingerprint(&mh, &fp);
 
 	output_finish_src(&mh);
-	socket_sendmsg(&sfd->socket, &mh, sin);
+	poller_sendiov(&sfd->socket, mh.msg_iov, mh.msg_iovlen, sin);
 
 	return 0;
 }
@@ -706,7 +707,7 @@ int stun_binding_request(const endpoint_t *dst, uint32_t transaction[3], str *pw
 	fingerprint(&mh, &fp);
 
 	output_finish_src(&mh);
-	socket_sendmsg(sock, &mh, dst);
+	poller_sendiov(sock, mh.msg_iov, mh.msg_iovlen, dst);
 
 	return 0;
 }
@@ -15,6 +15,7 @@
 #include "str.h"
 #include "media_player.h"
 #include "log_funcs.h"
+#include "poller.h"
 
 
 
@@ -226,7 +227,7 @@ static int t38_gateway_handler(t38_core_state_t *stat, void *user_data, const ui
 	if (sfd) {
 		for (int i = 0; i < count; i++) {
 			ilog(LOG_DEBUG, "Sending %u UDPTL bytes", (unsigned int) s->len);
-			socket_sendto(&sfd->socket, s->str, s->len, &ps->endpoint);
+			poller_sendto_copy(&sfd->socket, s->str, s->len, &ps->endpoint);
 		}
 	}
 	else
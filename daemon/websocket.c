@@ -344,7 +344,8 @@ static const char *websocket_http_metrics(struct websocket_message *wm) {
 			g_hash_table_insert(metric_types, (void *) m->prom_name, (void *) 0x1);
 		}
 
-		g_string_append_printf(outp, "rtpengine_%s", m->prom_name);
+		g_string_append_printf(outp, "rtpengine_%s%s", m->prom_name,
+				m->prom_suffix ? m->prom_suffix : "");
 		if (m->prom_label)
 			g_string_append_printf(outp, "{%s}", m->prom_label);
 		g_string_append_printf(outp, " %s\n", m->value_short);
@@ -0,0 +1,1043 @@
+#ifdef HAVE_XDP
+
+#include "xdp.h"
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <xdp/xsk.h>
+#include "aux.h"
+#include "log.h"
+#include "main.h"
+#include "rtplib.h"
+#include "xdp_filter.h"
+#include "xdp_filter.skel.h"
+
+
+
+
+#define XDP_NUM_FRAMES		4096
+#define XDP_FRAME_SIZE		XSK_UMEM__DEFAULT_FRAME_SIZE
+#define XDP_BATCH		64
+#define XDP_TX_BATCH		256
+#define XDP_NEIGH_CACHE		64
+
+// worst case of Ethernet + VLAN + IPv6 + UDP
+#define XDP_MAX_HEADER		(14 + 4 + 40 + 8)
+
+
+
+
+struct xdp_interface {
+	char			name[IF_NAMESIZE];
+	int			ifindex;
+	unsigned char		mac[ETH_ALEN];
+	bool			attached;
+};
+
+struct xdp_socket {
+	struct xdp_interface	*intf;
+	unsigned int		queue;
+
+	struct xsk_socket	*xsk;
+	struct xsk_umem		*umem;
+	void			*buffer;
+	struct xsk_ring_prod	fill;
+	struct xsk_ring_cons	comp;
+	struct xsk_ring_cons	rx;
+	struct xsk_ring_prod	tx;
+
+	// owned by the socket's thread only
+	uint64_t		free_frames[XDP_NUM_FRAMES];
+	unsigned int		num_free;
+	struct xdp_desc		tx_descs[XDP_TX_BATCH];
+	unsigned int		num_tx;
+	struct re_address	neigh_cache[XDP_NEIGH_CACHE];
+};
+
+// L2 next hop, learned from received packets
+struct xdp_neigh {
+	struct re_address	addr;		// port is always zero
+	int			ifindex;
+	unsigned char		mac[ETH_ALEN];
+	bool			vlan;		// reached through an 802.1Q tagged link
+	uint16_t		vlan_tci;	// network byte order
+};
+
+struct xdp_target {
+	struct rtpengine_target_info	info;
+	struct rtpengine_output_info	*outputs;
+	unsigned int			num_filled;
+	bool				unsupported;
+	bool				offloaded;
+	bool				counted;	// has an entry in the counters map
+
+	// everything else is counted by the XDP program
+	atomic64			errors;
+
+	// SSRC counters as of the last xdp_update_stats()
+	uint64_t			ssrc_packets[RTPE_NUM_SSRC_TRACKING];
+	uint64_t			ssrc_bytes[RTPE_NUM_SSRC_TRACKING];
+	uint32_t			ext_seq[RTPE_NUM_SSRC_TRACKING];
+};
+
+// a received packet, split up
+struct xdp_packet {
+	unsigned char		*frame;
+	unsigned int		len;
+	const struct ethhdr	*eth;
+	bool			vlan;
+	uint16_t		vlan_tci;	// network byte order
+	struct re_address	src;
+	struct re_address	dst;
+	unsigned char		*payload;
+	unsigned int		payload_len;
+};
+
+
+
+
+static struct xdp_filter *xdp_skel;
+static struct xdp_interface *xdp_interfaces;
+static unsigned int xdp_num_interfaces;
+static struct xdp_socket **xdp_sockets;
+static unsigned int xdp_num_sockets;
+static int xdp_raw_fds[2] = { -1, -1 };
+static int xdp_num_cpus;
+
+// forwarding threads hold this in R for a whole batch
+static rwlock_t xdp_lock;
+static GHashTable *xdp_targets;
+static rwlock_t xdp_neigh_lock;
+static GHashTable *xdp_neighs;
+
+
+
+
+static guint re_address_hash(gconstpointer p) {
+	const struct re_address *a = p;
+	guint ret = a->family ^ (a->port << 16);
+	for (unsigned int i = 0; i < G_N_ELEMENTS(a->u.u32); i++)
+		ret ^= a->u.u32[i];
+	return ret;
+}
+static gboolean re_address_eq(gconstpointer ap, gconstpointer bp) {
+	const struct re_address *a = ap, *b = bp;
+	return a->family == b->family && a->port == b->port && !memcmp(a->u.u8, b->u.u8, sizeof(a->u.u8));
+}
+
+static void xdp_target_free(void *p) {
+	struct xdp_target *t = p;
+	g_free(t->outputs);
+	g_slice_free1(sizeof(*t), t);
+}
+static void xdp_neigh_free(void *p) {
+	g_slice_free1(sizeof(struct xdp_neigh), p);
+}
+
+
+
+
+static uint32_t csum_add(uint32_t sum, const void *buf, unsigned int len) {
+	const uint8_t *b = buf;
+	while (len >= 2) {
+		sum += (b[0] << 8) | b[1];
+		b += 2;
+		len -= 2;
+	}
+	if (len)
+		sum += b[0] << 8;
+	return sum;
+}
+static uint16_t csum_fold(uint32_t sum) {
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return htons(~sum & 0xffff);
+}
+
+// Writes IP and UDP headers right in front of the payload and returns a
+// pointer to the start of the IP header.
+static unsigned char *xdp_ip_udp_header(unsigned char *payload, unsigned int len,
+		const struct rtpengine_output_info *o)
+{
+	struct udphdr *uh = (void *) (payload - sizeof(*uh));
+	unsigned int udp_len = sizeof(*uh) + len;
+	uint32_t sum;
+
+	uh->source = htons(o->src_addr.port);
+	uh->dest = htons(o->dst_addr.port);
+	uh->len = htons(udp_len);
+	uh->check = 0;
+
+	if (o->src_addr.family == AF_INET) {
+		struct iphdr *ih = (void *) ((unsigned char *) uh - sizeof(*ih));
+		ZERO(*ih);
+		ih->ihl = 5;
+		ih->version = 4;
+		ih->tos = o->tos;
+		ih->tot_len = htons(sizeof(*ih) + udp_len);
+		ih->frag_off = htons(IP_DF);
+		ih->ttl = 64;
+		ih->protocol = IPPROTO_UDP;
+		ih->saddr = o->src_addr.u.ipv4;
+		ih->daddr = o->dst_addr.u.ipv4;
+		ih->check = csum_fold(csum_add(0, ih, sizeof(*ih)));
+
+		sum = csum_add(0, &ih->saddr, 8) + IPPROTO_UDP + udp_len;
+		sum = csum_add(sum, uh, udp_len);
+		uh->check = csum_fold(sum) ? : 0xffff;
+
+		return (unsigned char *) ih;
+	}
+
+	struct ip6_hdr *ih = (void *) ((unsigned char *) uh - sizeof(*ih));
+	ih->ip6_flow = htonl(0x60000000 | (o->tos << 20));
+	ih->ip6_plen = htons(udp_len);
+	ih->ip6_nxt = IPPROTO_UDP;
+	ih->ip6_hlim = 64;
+	memcpy(&ih->ip6_src, o->src_addr.u.ipv6, 16);
+	memcpy(&ih->ip6_dst, o->dst_addr.u.ipv6, 16);
+
+	sum = csum_add(0, &ih->ip6_src, 32) + IPPROTO_UDP + udp_len;
+	sum = csum_add(sum, uh, udp_len);
+	uh->check = csum_fold(sum) ? : 0xffff;
+
+	return (unsigned char *) ih;
+}
+
+
+
+
+static uint64_t xdp_frame_alloc(struct xdp_socket *xs) {
+	if (!xs->num_free)
+		return (uint64_t) -1;
+	return xs->free_frames[--xs->num_free];
+}
+static void xdp_frame_free(struct xdp_socket *xs, uint64_t addr) {
+	assert(xs->num_free < XDP_NUM_FRAMES);
+	xs->free_frames[xs->num_free++] = addr & ~((uint64_t) XDP_FRAME_SIZE - 1);
+}
+
+static void xdp_refill(struct xdp_socket *xs) {
+	unsigned int num = xsk_prod_nb_free(&xs->fill, xs->num_free);
+	uint32_t idx;
+
+	if (num > xs->num_free)
+		num = xs->num_free;
+	if (!num)
+		return;
+	if (xsk_ring_prod__reserve(&xs->fill, num, &idx) != num)
+		return;
+	for (unsigned int i = 0; i < num; i++)
+		*xsk_ring_prod__fill_addr(&xs->fill, idx++) = xdp_frame_alloc(xs);
+	xsk_ring_prod__submit(&xs->fill, num);
+}
+
+static void xdp_complete_tx(struct xdp_socket *xs) {
+	uint32_t idx;
+	unsigned int num = xsk_ring_cons__peek(&xs->comp, XDP_TX_BATCH, &idx);
+	if (!num)
+		return;
+	for (unsigned int i = 0; i < num; i++)
+		xdp_frame_free(xs, *xsk_ring_cons__comp_addr(&xs->comp, idx++));
+	xsk_ring_cons__release(&xs->comp, num);
+}
+
+static void xdp_tx_flush(struct xdp_socket *xs) {
+	uint32_t idx;
+
+	if (!xs->num_tx)
+		return;
+
+	if (xsk_ring_prod__reserve(&xs->tx, xs->num_tx, &idx) != xs->num_tx) {
+		// ring full: drop the lot
+		for (unsigned int i = 0; i < xs->num_tx; i++)
+			xdp_frame_free(xs, xs->tx_descs[i].addr);
+		xs->num_tx = 0;
+		return;
+	}
+	for (unsigned int i = 0; i < xs->num_tx; i++)
+		*xsk_ring_prod__tx_desc(&xs->tx, idx++) = xs->tx_descs[i];
+	xsk_ring_prod__submit(&xs->tx, xs->num_tx);
+	xs->num_tx = 0;
+
+	if (xsk_ring_prod__needs_wakeup(&xs->tx))
+		sendto(xsk_socket__fd(xs->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+static void xdp_tx_queue(struct xdp_socket *xs, unsigned char *start, unsigned int len) {
+	if (xs->num_tx >= XDP_TX_BATCH)
+		xdp_tx_flush(xs);
+	xs->tx_descs[xs->num_tx++] = (struct xdp_desc) {
+		.addr = start - (unsigned char *) xs->buffer,
+		.len = len,
+	};
+}
+
+
+
+
+static void xdp_learn_neigh(struct xdp_socket *xs, const struct xdp_packet *p) {
+	struct re_address key = p->src;
+	key.port = 0;
+	struct re_address *cached = &xs->neigh_cache[re_address_hash(&key) % XDP_NEIGH_CACHE];
+
+	if (re_address_eq(cached, &key))
+		return;
+
+	rwlock_lock_w(&xdp_neigh_lock);
+	struct xdp_neigh *n = g_hash_table_lookup(xdp_neighs, &key);
+	if (!n) {
+		n = g_slice_alloc0(sizeof(*n));
+		n->addr = key;
+		g_hash_table_insert(xdp_neighs, &n->addr, n);
+	}
+	n->ifindex = xs->intf->ifindex;
+	memcpy(n->mac, p->eth->h_source, ETH_ALEN);
+	n->vlan = p->vlan;
+	n->vlan_tci = p->vlan_tci;
+	rwlock_unlock_w(&xdp_neigh_lock);
+
+	*cached = key;
+}
+
+// Sends out the payload, which must be located in one of the socket's UMEM
+// frames. The frame is consumed in any case.
+static bool xdp_send(struct xdp_socket *xs, unsigned char *payload, unsigned int len,
+		const struct rtpengine_output_info *o)
+{
+	unsigned char *iph = xdp_ip_udp_header(payload, len, o);
+	unsigned int ip_len = payload + len - iph;
+	unsigned char mac[ETH_ALEN];
+	bool have_mac = false, vlan = false;
+	uint16_t vlan_tci = 0;
+
+	struct re_address key = o->dst_addr;
+	key.port = 0;
+	rwlock_lock_r(&xdp_neigh_lock);
+	struct xdp_neigh *n = g_hash_table_lookup(xdp_neighs, &key);
+	if (n && n->ifindex == xs->intf->ifindex) {
+		memcpy(mac, n->mac, ETH_ALEN);
+		have_mac = true;
+		vlan = n->vlan;
+		vlan_tci = n->vlan_tci;
+	}
+	rwlock_unlock_r(&xdp_neigh_lock);
+
+	if (have_mac) {
+		uint16_t proto = htons(o->dst_addr.family == AF_INET ? ETH_P_IP : ETH_P_IPV6);
+		unsigned char *l2 = iph;
+		if (vlan) {
+			// replies go out with the tag the peer's packets came in with
+			l2 -= 4;
+			memcpy(l2, &vlan_tci, 2);
+			memcpy(l2 + 2, &proto, 2);
+			proto = htons(ETH_P_8021Q);
+		}
+		struct ethhdr *eth = (void *) (l2 - sizeof(*eth));
+		memcpy(eth->h_dest, mac, ETH_ALEN);
+		memcpy(eth->h_source, xs->intf->mac, ETH_ALEN);
+		eth->h_proto = proto;
+		xdp_tx_queue(xs, (unsigned char *) eth, payload + len - (unsigned char *) eth);
+		return true;
+	}
+
+	// unknown next hop or different interface: let the kernel route it
+	int fd = xdp_raw_fds[o->dst_addr.family == AF_INET ? 0 : 1];
+	ssize_t ret;
+	if (o->dst_addr.family == AF_INET) {
+		struct sockaddr_in sin = {
+			.sin_family = AF_INET,
+			.sin_addr.s_addr = o->dst_addr.u.ipv4,
+		};
+		ret = sendto(fd, iph, ip_len, MSG_DONTWAIT, (struct sockaddr *) &sin, sizeof(sin));
+	}
+	else {
+		struct sockaddr_in6 sin6 = {
+			.sin6_family = AF_INET6,
+		};
+		memcpy(&sin6.sin6_addr, o->dst_addr.u.ipv6, 16);
+		ret = sendto(fd, iph, ip_len, MSG_DONTWAIT, (struct sockaddr *) &sin6, sizeof(sin6));
+	}
+	xdp_frame_free(xs, payload - (unsigned char *) xs->buffer);
+	return ret == ip_len;
+}
+
+static int xdp_pt_idx(const struct rtpengine_target_info *i, unsigned char pt) {
+	unsigned int lo = 0, hi = i->num_payload_types;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (i->payload_types[mid].pt_num == pt)
+			return mid;
+		if (i->payload_types[mid].pt_num < pt)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return -1;
+}
+
+static bool xdp_parse(struct xdp_packet *p, unsigned char *frame, unsigned int len) {
+	unsigned char *end = frame + len;
+	unsigned char *nxt;
+	struct udphdr *uh;
+	uint16_t proto;
+
+	ZERO(*p);
+	p->frame = frame;
+	p->len = len;
+	p->eth = (void *) frame;
+	if (len < sizeof(*p->eth))
+		return false;
+	proto = p->eth->h_proto;
+	nxt = frame + sizeof(*p->eth);
+	if (proto == htons(ETH_P_8021Q)) {
+		if (nxt + 4 > end)
+			return false;
+		p->vlan = true;
+		memcpy(&p->vlan_tci, nxt, 2);
+		proto = *(uint16_t *) (nxt + 2);
+		nxt += 4;
+	}
+
+	if (proto == htons(ETH_P_IP)) {
+		struct iphdr *ih = (void *) nxt;
+		if ((unsigned char *) (ih + 1) > end)
+			return false;
+		p->src.family = p->dst.family = AF_INET;
+		p->src.u.ipv4 = ih->saddr;
+		p->dst.u.ipv4 = ih->daddr;
+		uh = (void *) (ih + 1);
+	}
+	else if (proto == htons(ETH_P_IPV6)) {
+		struct ip6_hdr *ih = (void *) nxt;
+		if ((unsigned char *) (ih + 1) > end)
+			return false;
+		p->src.family = p->dst.family = AF_INET6;
+		memcpy(p->src.u.ipv6, &ih->ip6_src, 16);
+		memcpy(p->dst.u.ipv6, &ih->ip6_dst, 16);
+		uh = (void *) (ih + 1);
+	}
+	else
+		return false;
+
+	if ((unsigned char *) (uh + 1) > end)
+		return false;
+	if (ntohs(uh->len) < sizeof(*uh))
+		return false;
+	p->src.port = ntohs(uh->source);
+	p->dst.port = ntohs(uh->dest);
+	p->payload = (unsigned char *) (uh + 1);
+	p->payload_len = ntohs(uh->len) - sizeof(*uh);
+	if (p->payload + p->payload_len > end)
+		return false;
+
+	return true;
+}
+
+// Packets have already been counted by the XDP program. Lock must be held in R.
+static void xdp_handle_packet(struct xdp_socket *xs, uint64_t addr, unsigned int len) {
+	struct xdp_packet p;
+	struct xdp_target *t;
+	int pt_idx = -2, ssrc_idx = -1;
+	struct rtp_header *rtp = NULL;
+
+	if (!xdp_parse(&p, xsk_umem__get_data(xs->buffer, addr), len))
+		goto drop;
+
+	t = g_hash_table_lookup(xdp_targets, &p.dst);
+	if (!t || !t->offloaded)
+		goto drop;
+
+	if (p.payload_len >= sizeof(*rtp) && t->info.rtp) {
+		rtp = (void *) p.payload;
+		pt_idx = xdp_pt_idx(&t->info, rtp->m_pt & 0x7f);
+		for (unsigned int i = 0; i < RTPE_NUM_SSRC_TRACKING; i++) {
+			if (t->info.ssrc[i] == rtp->ssrc) {
+				ssrc_idx = i;
+				break;
+			}
+		}
+	}
+
+	if (t->info.non_forwarding || !t->info.num_destinations)
+		goto drop;
+
+	xdp_learn_neigh(xs, &p);
+
+	if (pt_idx >= 0 && t->info.payload_types[pt_idx].replace_pattern_len) {
+		const struct rtpengine_payload_type *rpt = &t->info.payload_types[pt_idx];
+		unsigned char *pl = p.payload + sizeof(*rtp);
+		unsigned int pl_len = p.payload_len - sizeof(*rtp);
+		for (unsigned int i = 0; i < pl_len; i += rpt->replace_pattern_len)
+			memcpy(pl + i, rpt->replace_pattern, MIN(rpt->replace_pattern_len, pl_len - i));
+	}
+
+	for (unsigned int i = 0; i < t->info.num_destinations; i++) {
+		const struct rtpengine_output_info *o = &t->outputs[i];
+		bool last = (i == t->info.num_destinations - 1);
+		unsigned char *payload = p.payload;
+
+		if (!last) {
+			// copy into a new frame, leaving room for the headers
+			uint64_t frame = xdp_frame_alloc(xs);
+			if (frame == (uint64_t) -1) {
+				atomic64_inc(&t->errors);
+				continue;
+			}
+			payload = (unsigned char *) xs->buffer + frame + XDP_PACKET_HEADROOM + XDP_MAX_HEADER;
+			memcpy(payload, p.payload, p.payload_len);
+		}
+
+		if (rtp && o->ssrc_subst && ssrc_idx != -1 && o->ssrc_out[ssrc_idx])
+			((struct rtp_header *) payload)->ssrc = o->ssrc_out[ssrc_idx];
+
+		if (!xdp_send(xs, payload, p.payload_len, o))
+			atomic64_inc(&t->errors);
+	}
+	return;
+
+drop:
+	xdp_frame_free(xs, addr);
+}
+
+static void xdp_loop(void *arg) {
+	struct xdp_socket *xs = arg;
+	struct pollfd pfd = {
+		.fd = xsk_socket__fd(xs->xsk),
+		.events = POLLIN,
+	};
+	uint32_t idx;
+
+	while (!rtpe_shutdown) {
+		xdp_complete_tx(xs);
+		xdp_refill(xs);
+
+		unsigned int num = xsk_ring_cons__peek(&xs->rx, XDP_BATCH, &idx);
+		if (!num) {
+			poll(&pfd, 1, 100);
+			continue;
+		}
+
+		rwlock_lock_r(&xdp_lock);
+		for (unsigned int i = 0; i < num; i++) {
+			const struct xdp_desc *d = xsk_ring_cons__rx_desc(&xs->rx, idx++);
+			xdp_handle_packet(xs, d->addr, d->len);
+		}
+		rwlock_unlock_r(&xdp_lock);
+
+		xsk_ring_cons__release(&xs->rx, num);
+		xdp_tx_flush(xs);
+	}
+}
+
+
+
+
+static void xdp_filter_key(struct xdp_filter_key *key, const struct re_address *a) {
+	ZERO(*key);
+	key->family = a->family;
+	key->port = a->port;
+	memcpy(key->addr, a->u.u8, sizeof(key->addr));
+}
+
+// Whether the XDP program can send out the target's packets by itself:
+// exactly one destination, same address family, and nothing to do to the
+// payload besides SSRC substitution.
+static bool xdp_can_forward(const struct xdp_target *t) {
+	if (t->info.num_destinations != 1)
+		return false;
+	const struct rtpengine_output_info *o = &t->outputs[0];
+	if (o->src_addr.family != t->info.local.family || o->rtcp_only)
+		return false;
+	for (unsigned int i = 0; i < t->info.num_payload_types; i++) {
+		if (t->info.payload_types[i].replace_pattern_len)
+			return false;
+	}
+	return true;
+}
+
+// lock must be held in W
+static void xdp_filter_update(struct xdp_target *t) {
+	struct xdp_filter_key key;
+	xdp_filter_key(&key, &t->info.local);
+
+	int fd = bpf_map__fd(xdp_skel->maps.targets);
+
+	// non-forwarding targets need to see their packets in the regular sockets
+	bool want = !t->unsupported && t->num_filled == t->info.num_destinations
+		&& (!t->info.non_forwarding || t->info.blackhole);
+
+	struct xdp_filter_value val;
+	ZERO(val);
+	memset(val.pt_idx, XDP_FILTER_PT_NONE, sizeof(val.pt_idx));
+
+	if (t->info.non_forwarding || !t->info.num_destinations)
+		val.flags |= XDP_FILTER_F_DROP;
+	else if (xdp_can_forward(t)) {
+		const struct rtpengine_output_info *o = &t->outputs[0];
+		val.flags |= XDP_FILTER_F_FORWARD;
+		memcpy(val.out.src_addr, o->src_addr.u.u8, sizeof(val.out.src_addr));
+		memcpy(val.out.dst_addr, o->dst_addr.u.u8, sizeof(val.out.dst_addr));
+		val.out.src_port = htons(o->src_addr.port);
+		val.out.dst_port = htons(o->dst_addr.port);
+		val.out.tos = o->tos;
+		if (o->ssrc_subst)
+			memcpy(val.out.ssrc_out, o->ssrc_out, sizeof(val.out.ssrc_out));
+	}
+	else if (!xdp_num_sockets)
+		want = false; // nobody to hand the packets to
+
+	if (!want) {
+		if (t->offloaded)
+			bpf_map_delete_elem(fd, &key);
+		t->offloaded = false;
+		return;
+	}
+
+	if (t->info.rtp)
+		val.flags |= XDP_FILTER_F_RTP;
+	if (t->info.rtcp_mux)
+		val.flags |= XDP_FILTER_F_RTCP_MUX;
+	if (t->info.src_mismatch != MSM_IGNORE && t->info.expected_src.family) {
+		val.flags |= XDP_FILTER_F_SRC;
+		memcpy(val.src_addr, t->info.expected_src.u.u8, sizeof(val.src_addr));
+		val.src_port = t->info.expected_src.port;
+	}
+	memcpy(val.ssrc, t->info.ssrc, sizeof(val.ssrc));
+	for (unsigned int i = 0; i < t->info.num_payload_types && i < XDP_FILTER_NUM_PT; i++)
+		val.pt_idx[t->info.payload_types[i].pt_num & 0x7f] = i;
+
+	if (!t->counted) {
+		// all CPUs start out zeroed
+		struct xdp_filter_counters *zero = g_new0(struct xdp_filter_counters, xdp_num_cpus);
+		if (bpf_map_update_elem(bpf_map__fd(xdp_skel->maps.counters), &key, zero, BPF_ANY))
+			ilog(LOG_WARN, "Failed to add XDP counters entry: %s", strerror(errno));
+		else
+			t->counted = true;
+		g_free(zero);
+	}
+
+	if (bpf_map_update_elem(fd, &key, &val, BPF_ANY)) {
+		ilog(LOG_ERR, "Failed to add XDP filter entry: %s", strerror(errno));
+		if (t->offloaded)
+			bpf_map_delete_elem(fd, &key);
+		t->offloaded = false;
+		return;
+	}
+	t->offloaded = true;
+}
+
+// lock must be held in W
+static void xdp_target_remove(struct xdp_target *t) {
+	t->unsupported = true;
+	xdp_filter_update(t);
+	if (t->counted) {
+		struct xdp_filter_key key;
+		xdp_filter_key(&key, &t->info.local);
+		bpf_map_delete_elem(bpf_map__fd(xdp_skel->maps.counters), &key);
+	}
+	g_hash_table_remove(xdp_targets, &t->info.local);
+}
+
+// Sums up the per-CPU counters of a target. For the last seen sequence number
+// and timestamp, the CPU that has seen the most packets of the SSRC wins.
+static bool xdp_counters_get(const struct xdp_target *t, struct xdp_filter_counters *out) {
+	ZERO(*out);
+	if (!t->counted)
+		return false;
+
+	struct xdp_filter_key key;
+	xdp_filter_key(&key, &t->info.local);
+	struct xdp_filter_counters *cpus = g_new(struct xdp_filter_counters, xdp_num_cpus);
+	if (bpf_map_lookup_elem(bpf_map__fd(xdp_skel->maps.counters), &key, cpus)) {
+		g_free(cpus);
+		return false;
+	}
+
+	uint64_t most[XDP_FILTER_NUM_SSRC] = {0,};
+	for (int c = 0; c < xdp_num_cpus; c++) {
+		const struct xdp_filter_counters *p = &cpus[c];
+		if (!p->packets)
+			continue;
+		out->packets += p->packets;
+		out->bytes += p->bytes;
+		out->in_tos = p->in_tos;
+		for (unsigned int i = 0; i < XDP_FILTER_NUM_PT; i++) {
+			out->pt_packets[i] += p->pt_packets[i];
+			out->pt_bytes[i] += p->pt_bytes[i];
+		}
+		for (unsigned int i = 0; i < XDP_FILTER_NUM_SSRC; i++) {
+			out->ssrc_packets[i] += p->ssrc_packets[i];
+			out->ssrc_bytes[i] += p->ssrc_bytes[i];
+			if (p->ssrc_packets[i] > most[i]) {
+				most[i] = p->ssrc_packets[i];
+				out->ssrc_seq[i] = p->ssrc_seq[i];
+				out->ssrc_ts[i] = p->ssrc_ts[i];
+			}
+		}
+	}
+	g_free(cpus);
+	return true;
+}
+
+int xdp_add_target(const struct rtpengine_target_info *i) {
+	if (i->decrypt.cipher != REC_NULL || i->decrypt.hmac != REH_NULL || i->do_intercept) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	if (i->num_destinations > RTPE_MAX_FORWARD_DESTINATIONS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct xdp_target *t = g_slice_alloc0(sizeof(*t));
+	t->info = *i;
+	t->outputs = g_new0(struct rtpengine_output_info, i->num_destinations ? : 1);
+
+	rwlock_lock_w(&xdp_lock);
+	struct xdp_target *old = g_hash_table_lookup(xdp_targets, &i->local);
+	if (old)
+		xdp_target_remove(old);
+	g_hash_table_insert(xdp_targets, &t->info.local, t);
+	xdp_filter_update(t);
+	rwlock_unlock_w(&xdp_lock);
+
+	return 0;
+}
+
+int xdp_add_destination(const struct rtpengine_destination_info *i) {
+	int ret = -1;
+
+	rwlock_lock_w(&xdp_lock);
+
+	errno = ENOENT;
+	struct xdp_target *t = g_hash_table_lookup(xdp_targets, &i->local);
+	if (!t)
+		goto out;
+	errno = EINVAL;
+	if (i->num >= t->info.num_destinations)
+		goto out;
+	if (i->output.src_addr.family != i->output.dst_addr.family)
+		goto out;
+
+	if (i->output.encrypt.cipher != REC_NULL || i->output.encrypt.hmac != REH_NULL) {
+		// leave the whole target to the regular sockets
+		t->unsupported = true;
+		xdp_filter_update(t);
+		errno = ENOTSUP;
+		goto out;
+	}
+
+	if (!t->outputs[i->num].dst_addr.family)
+		t->num_filled++;
+	t->outputs[i->num] = i->output;
+	xdp_filter_update(t);
+	ret = 0;
+
+out:
+	rwlock_unlock_w(&xdp_lock);
+	return ret;
+}
+
+int xdp_del_target(const struct re_address *a) {
+	rwlock_lock_w(&xdp_lock);
+	struct xdp_target *t = g_hash_table_lookup(xdp_targets, a);
+	if (t)
+		xdp_target_remove(t);
+	rwlock_unlock_w(&xdp_lock);
+
+	if (!t) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+GList *xdp_list(void) {
+	GList *ret = NULL;
+	GHashTableIter iter;
+	gpointer value;
+
+	rwlock_lock_r(&xdp_lock);
+	g_hash_table_iter_init(&iter, xdp_targets);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct xdp_target *t = value;
+		struct rtpengine_list_entry *e = g_slice_alloc0(sizeof(*e));
+		struct xdp_filter_counters c;
+		xdp_counters_get(t, &c);
+		e->target = t->info;
+		e->stats.packets = c.packets;
+		e->stats.bytes = c.bytes;
+		e->stats.errors = atomic64_get(&t->errors);
+		e->stats.in_tos = c.in_tos;
+		for (unsigned int i = 0; i < t->info.num_payload_types && i < XDP_FILTER_NUM_PT; i++) {
+			e->rtp_stats[i].packets = c.pt_packets[i];
+			e->rtp_stats[i].bytes = c.pt_bytes[i];
+		}
+		for (unsigned int i = 0; i < t->info.num_destinations
+				&& i < RTPE_MAX_FORWARD_DESTINATIONS; i++)
+			e->outputs[i] = t->outputs[i];
+		ret = g_list_prepend(ret, e);
+	}
+	rwlock_unlock_r(&xdp_lock);
+
+	return ret;
+}
+
+// Like the kernel module, reports the SSRC counters since the last call.
+int xdp_update_stats(const struct re_address *a, struct rtpengine_stats_info *out) {
+	rwlock_lock_w(&xdp_lock);
+	struct xdp_target *t = g_hash_table_lookup(xdp_targets, a);
+	if (!t) {
+		rwlock_unlock_w(&xdp_lock);
+		errno = ENOENT;
+		return -1;
+	}
+
+	struct xdp_filter_counters c;
+	xdp_counters_get(t, &c);
+
+	ZERO(*out);
+	out->local = *a;
+	memcpy(out->ssrc, t->info.ssrc, sizeof(out->ssrc));
+	for (unsigned int i = 0; i < RTPE_NUM_SSRC_TRACKING; i++) {
+		struct rtpengine_ssrc_stats *o = &out->ssrc_stats[i];
+		if (c.ssrc_packets[i] <= t->ssrc_packets[i])
+			continue;
+		o->basic_stats.packets = c.ssrc_packets[i] - t->ssrc_packets[i];
+		o->basic_stats.bytes = c.ssrc_bytes[i] - t->ssrc_bytes[i];
+		t->ssrc_packets[i] = c.ssrc_packets[i];
+		t->ssrc_bytes[i] = c.ssrc_bytes[i];
+
+		// extend the sequence number
+		uint32_t old = t->ext_seq[i];
+		uint32_t ext = (old & 0xffff0000) | c.ssrc_seq[i];
+		if (ext < old && old - ext > 0x8000)
+			ext += 0x10000;
+		if (ext > old || !old)
+			t->ext_seq[i] = ext;
+		o->ext_seq = t->ext_seq[i];
+		o->timestamp = c.ssrc_ts[i];
+	}
+	rwlock_unlock_w(&xdp_lock);
+
+	return 0;
+}
+
+
+
+
+static struct xdp_socket *xdp_socket_new(struct xdp_interface *intf, unsigned int queue) {
+	struct xdp_socket *xs = g_slice_alloc0(sizeof(*xs));
+	xs->intf = intf;
+	xs->queue = queue;
+
+	size_t size = (size_t) XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	if (posix_memalign(&xs->buffer, getpagesize(), size)) {
+		xs->buffer = NULL;
+		goto err;
+	}
+
+	int ret = xsk_umem__create(&xs->umem, xs->buffer, size, &xs->fill, &xs->comp, NULL);
+	if (ret) {
+		errno = -ret;
+		goto err;
+	}
+
+	struct xsk_socket_config cfg = {
+		.rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+		.tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+		.libxdp_flags = XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD,
+		.bind_flags = XDP_USE_NEED_WAKEUP,
+	};
+	ret = xsk_socket__create(&xs->xsk, intf->name, queue, xs->umem, &xs->rx, &xs->tx, &cfg);
+	if (ret) {
+		errno = -ret;
+		goto err;
+	}
+	ret = xsk_socket__update_xskmap(xs->xsk, bpf_map__fd(xdp_skel->maps.xsks));
+	if (ret) {
+		errno = -ret;
+		goto err;
+	}
+
+	for (unsigned int i = 0; i < XDP_NUM_FRAMES; i++)
+		xdp_frame_free(xs, (uint64_t) i * XDP_FRAME_SIZE);
+	xdp_refill(xs);
+
+	return xs;
+
+err:
+	ilog(LOG_ERR, "Failed to create AF_XDP socket on interface '%s' queue %u: %s",
+			intf->name, queue, strerror(errno));
+	if (xs->xsk)
+		xsk_socket__delete(xs->xsk);
+	if (xs->umem)
+		xsk_umem__delete(xs->umem);
+	free(xs->buffer);
+	g_slice_free1(sizeof(*xs), xs);
+	return NULL;
+}
+
+static void xdp_socket_free(struct xdp_socket *xs) {
+	xsk_socket__delete(xs->xsk);
+	xsk_umem__delete(xs->umem);
+	free(xs->buffer);
+	g_slice_free1(sizeof(*xs), xs);
+}
+
+static int xdp_interface_init(struct xdp_interface *intf, const char *name) {
+	struct ifreq ifr;
+	int fd, ret;
+
+	snprintf(intf->name, sizeof(intf->name), "%s", name);
+	intf->ifindex = if_nametoindex(name);
+	if (!intf->ifindex)
+		return -1;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		return -1;
+	ZERO(ifr);
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+	ret = ioctl(fd, SIOCGIFHWADDR, &ifr);
+	close(fd);
+	if (ret)
+		return -1;
+	memcpy(intf->mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+	ret = bpf_xdp_attach(intf->ifindex, bpf_program__fd(xdp_skel->progs.rtpengine_xdp),
+			XDP_FLAGS_UPDATE_IF_NOEXIST, NULL);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+	intf->attached = true;
+
+	return 0;
+}
+
+int xdp_init(char **interfaces, int queues) {
+	if (queues < 0 || queues > XDP_FILTER_MAX_QUEUES) {
+		ilog(LOG_ERR, "Invalid number of XDP queues (%i)", queues);
+		return -1;
+	}
+
+	rwlock_init(&xdp_lock);
+	rwlock_init(&xdp_neigh_lock);
+	xdp_targets = g_hash_table_new_full(re_address_hash, re_address_eq, NULL, xdp_target_free);
+	xdp_neighs = g_hash_table_new_full(re_address_hash, re_address_eq, NULL, xdp_neigh_free);
+
+	// IPPROTO_RAW implies that we supply the IP header
+	xdp_raw_fds[0] = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+	xdp_raw_fds[1] = socket(AF_INET6, SOCK_RAW, IPPROTO_RAW);
+	if (xdp_raw_fds[0] == -1 || xdp_raw_fds[1] == -1) {
+		ilog(LOG_ERR, "Failed to create raw sockets for XDP fallback: %s", strerror(errno));
+		goto err;
+	}
+
+	xdp_num_cpus = libbpf_num_possible_cpus();
+	if (xdp_num_cpus <= 0) {
+		ilog(LOG_ERR, "Failed to get number of possible CPUs for XDP");
+		goto err;
+	}
+
+	xdp_skel = xdp_filter__open_and_load();
+	if (!xdp_skel) {
+		ilog(LOG_ERR, "Failed to load XDP filter program: %s", strerror(errno));
+		goto err;
+	}
+
+	xdp_num_interfaces = g_strv_length(interfaces);
+	xdp_interfaces = g_new0(struct xdp_interface, xdp_num_interfaces);
+	xdp_sockets = g_new0(struct xdp_socket *, xdp_num_interfaces * queues);
+
+	for (unsigned int i = 0; i < xdp_num_interfaces; i++) {
+		struct xdp_interface *intf = &xdp_interfaces[i];
+		if (xdp_interface_init(intf, interfaces[i])) {
+			ilog(LOG_ERR, "Failed to attach XDP program to interface '%s': %s",
+					interfaces[i], strerror(errno));
+			goto err;
+		}
+		uint32_t ifindex = intf->ifindex;
+		if (bpf_map_update_elem(bpf_map__fd(xdp_skel->maps.egress), &ifindex, &ifindex, BPF_ANY)) {
+			ilog(LOG_ERR, "Failed to add XDP egress interface '%s': %s",
+					interfaces[i], strerror(errno));
+			goto err;
+		}
+		for (int q = 0; q < queues; q++) {
+			struct xdp_socket *xs = xdp_socket_new(intf, q);
+			if (!xs)
+				goto err;
+			xdp_sockets[xdp_num_sockets++] = xs;
+		}
+	}
+
+	ilog(LOG_INFO, "XDP data plane running on %u interface(s) with %i AF_XDP queue(s) each",
+			xdp_num_interfaces, queues);
+
+	return 0;
+
+err:
+	xdp_free();
+	return -1;
+}
+
+void xdp_launch(void) {
+	for (unsigned int i = 0; i < xdp_num_sockets; i++)
+		thread_create_detach_prio(xdp_loop, xdp_sockets[i], rtpe_config.scheduling,
+				rtpe_config.priority, "XDP");
+}
+
+void xdp_free(void) {
+	for (unsigned int i = 0; i < xdp_num_sockets; i++)
+		xdp_socket_free(xdp_sockets[i]);
+	xdp_num_sockets = 0;
+	g_free(xdp_sockets);
+	xdp_sockets = NULL;
+
+	for (unsigned int i = 0; i < xdp_num_interfaces; i++) {
+		if (xdp_interfaces[i].attached)
+			bpf_xdp_detach(xdp_interfaces[i].ifindex, 0, NULL);
+	}
+	xdp_num_interfaces = 0;
+	g_free(xdp_interfaces);
+	xdp_interfaces = NULL;
+
+	if (xdp_skel)
+		xdp_filter__destroy(xdp_skel);
+	xdp_skel = NULL;
+
+	for (unsigned int i = 0; i < G_N_ELEMENTS(xdp_raw_fds); i++) {
+		if (xdp_raw_fds[i] != -1)
+			close(xdp_raw_fds[i]);
+		xdp_raw_fds[i] = -1;
+	}
+
+	if (xdp_targets) {
+		g_hash_table_destroy(xdp_targets);
+		g_hash_table_destroy(xdp_neighs);
+		rwlock_destroy(&xdp_lock);
+		rwlock_destroy(&xdp_neigh_lock);
+	}
+	xdp_targets = NULL;
+	xdp_neighs = NULL;
+}
+
+#endif
@@ -0,0 +1,335 @@
+// XDP program for the XDP data plane. Packets for known media targets with a
+// single plain destination are rewritten and sent out again right here.
+// Other known media goes to the AF_XDP socket of the receiving queue.
+// Everything else (signalling, STUN, DTLS, unknown payload types or SSRCs)
+// continues to the normal sockets.
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <linux/in.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include "xdp_filter.h"
+
+#ifndef AF_INET
+#define AF_INET		2
+#endif
+#ifndef AF_INET6
+#define AF_INET6	10
+#endif
+
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, XDP_FILTER_MAX_TARGETS);
+	__type(key, struct xdp_filter_key);
+	__type(value, struct xdp_filter_value);
+} targets SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, XDP_FILTER_MAX_TARGETS);
+	__type(key, struct xdp_filter_key);
+	__type(value, struct xdp_filter_counters);
+} counters SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_XSKMAP);
+	__uint(max_entries, XDP_FILTER_MAX_QUEUES);
+	__type(key, __u32);
+	__type(value, __u32);
+} xsks SEC(".maps");
+
+// interfaces we may redirect to, keyed by ifindex
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, XDP_FILTER_MAX_QUEUES);
+	__type(key, __u32);
+	__type(value, __u32);
+} egress SEC(".maps");
+
+
+struct vlan_hdr {
+	__be16		tci;
+	__be16		proto;
+};
+
+struct rtp_info {
+	int		is_rtp;
+	int		pt_idx;
+	int		ssrc_idx;
+};
+
+
+// returns 0 if the packet should be left alone
+static __always_inline int rtp_matches(const struct xdp_filter_value *v, const __u8 *rtp, void *end,
+		struct rtp_info *ri)
+{
+	ri->is_rtp = 0;
+	ri->pt_idx = -1;
+	ri->ssrc_idx = -1;
+
+	if ((void *) (rtp + 12) > end)
+		return 0;
+	// plain UDP targets forward anything
+	if (!(v->flags & XDP_FILTER_F_RTP))
+		return 1;
+	if ((rtp[0] & 0xc0) != 0x80)
+		return 0;
+
+	__u8 pt = rtp[1] & 0x7f;
+	if (pt >= 72 && pt <= 76) // RTCP
+		return (v->flags & XDP_FILTER_F_RTCP_MUX) ? 0 : 1;
+	ri->pt_idx = v->pt_idx[pt];
+	if (ri->pt_idx == XDP_FILTER_PT_NONE)
+		return 0;
+	ri->is_rtp = 1;
+
+	if (!v->ssrc[0])
+		return 1;
+	__u32 ssrc = *(__u32 *) (rtp + 8);
+	for (int i = 0; i < XDP_FILTER_NUM_SSRC; i++) {
+		if (v->ssrc[i] == ssrc) {
+			ri->ssrc_idx = i;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static __always_inline void count(struct xdp_filter_counters *c, const struct rtp_info *ri,
+		const __u8 *rtp, __u32 len, __u8 tos)
+{
+	c->packets++;
+	c->bytes += len;
+	c->in_tos = tos;
+
+	if (!ri->is_rtp)
+		return;
+	if (ri->pt_idx >= 0 && ri->pt_idx < XDP_FILTER_NUM_PT) {
+		c->pt_packets[ri->pt_idx]++;
+		c->pt_bytes[ri->pt_idx] += len;
+	}
+	if (ri->ssrc_idx >= 0 && ri->ssrc_idx < XDP_FILTER_NUM_SSRC) {
+		c->ssrc_packets[ri->ssrc_idx]++;
+		c->ssrc_bytes[ri->ssrc_idx] += len;
+		c->ssrc_seq[ri->ssrc_idx] = bpf_ntohs(*(__u16 *) (rtp + 2));
+		c->ssrc_ts[ri->ssrc_idx] = bpf_ntohl(*(__u32 *) (rtp + 4));
+	}
+}
+
+static __always_inline __u16 csum_fold(__u32 sum) {
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static __always_inline void ipv4_csum(struct iphdr *ih) {
+	__u16 *p = (__u16 *) ih;
+	__u32 sum = 0;
+
+	ih->check = 0;
+#pragma unroll
+	for (int i = 0; i < sizeof(*ih) / 2; i++)
+		sum += p[i];
+	ih->check = csum_fold(sum);
+}
+
+// Rewrites the packet in place for the one destination of the target and
+// returns the XDP action to send it out, or -1 to leave it to the AF_XDP
+// path. `uh` and `rtp` have been bounds checked by the caller.
+static __always_inline int forward(struct xdp_md *ctx, struct ethhdr *eth, void *iph, struct udphdr *uh,
+		__u8 *rtp, const struct xdp_filter_value *v, const struct rtp_info *ri, __u16 family)
+{
+	const struct xdp_filter_output *o = &v->out;
+	struct bpf_fib_lookup fib = { 0 };
+	__u32 old[10], new[10];
+	__u32 ssrc_old = 0, ssrc_new = 0;
+	__u32 sum;
+
+	fib.ifindex = ctx->ingress_ifindex;
+	fib.l4_protocol = IPPROTO_UDP;
+	fib.sport = o->src_port;
+	fib.dport = o->dst_port;
+	fib.tot_len = bpf_ntohs(uh->len);
+	if (family == AF_INET) {
+		fib.family = AF_INET;
+		fib.tot_len += sizeof(struct iphdr);
+		fib.tos = o->tos;
+		__builtin_memcpy(&fib.ipv4_src, o->src_addr, 4);
+		__builtin_memcpy(&fib.ipv4_dst, o->dst_addr, 4);
+	}
+	else {
+		fib.family = AF_INET6;
+		fib.tot_len += sizeof(struct ipv6hdr);
+		__builtin_memcpy(fib.ipv6_src, o->src_addr, 16);
+		__builtin_memcpy(fib.ipv6_dst, o->dst_addr, 16);
+	}
+
+	// no neighbour entry yet or some other trouble: let userspace deal with it
+	if (bpf_fib_lookup(ctx, &fib, sizeof(fib), 0) != BPF_FIB_LKUP_RET_SUCCESS)
+		return -1;
+	if (fib.ifindex != ctx->ingress_ifindex && !bpf_map_lookup_elem(&egress, &fib.ifindex))
+		return -1;
+
+	if (ri->ssrc_idx >= 0 && ri->ssrc_idx < XDP_FILTER_NUM_SSRC && o->ssrc_out[ri->ssrc_idx]) {
+		ssrc_old = *(__u32 *) (rtp + 8);
+		ssrc_new = o->ssrc_out[ri->ssrc_idx];
+		*(__u32 *) (rtp + 8) = ssrc_new;
+	}
+
+	if (family == AF_INET) {
+		struct iphdr *ih = iph;
+
+		__builtin_memcpy(&old[0], &ih->saddr, 8);
+		__builtin_memcpy(&old[2], &uh->source, 4);
+		__builtin_memcpy(&ih->saddr, o->src_addr, 4);
+		__builtin_memcpy(&ih->daddr, o->dst_addr, 4);
+		uh->source = o->src_port;
+		uh->dest = o->dst_port;
+		__builtin_memcpy(&new[0], &ih->saddr, 8);
+		__builtin_memcpy(&new[2], &uh->source, 4);
+
+		ih->tos = o->tos;
+		ih->ttl = 64;
+		ipv4_csum(ih);
+
+		// a zero UDP checksum means none over IPv4
+		if (uh->check) {
+			sum = bpf_csum_diff(old, 12, new, 12, ~((__u32) uh->check) & 0xffff);
+			sum = bpf_csum_diff(&ssrc_old, 4, &ssrc_new, 4, sum);
+			uh->check = csum_fold(sum) ? : 0xffff;
+		}
+	}
+	else {
+		struct ipv6hdr *ih = iph;
+
+		__builtin_memcpy(&old[0], &ih->saddr, 32);
+		__builtin_memcpy(&old[8], &uh->source, 4);
+		__builtin_memcpy(&ih->saddr, o->src_addr, 16);
+		__builtin_memcpy(&ih->daddr, o->dst_addr, 16);
+		uh->source = o->src_port;
+		uh->dest = o->dst_port;
+		__builtin_memcpy(&new[0], &ih->saddr, 32);
+		__builtin_memcpy(&new[8], &uh->source, 4);
+
+		ih->priority = o->tos >> 4;
+		ih->flow_lbl[0] = (ih->flow_lbl[0] & 0x0f) | (o->tos << 4);
+		ih->hop_limit = 64;
+
+		sum = bpf_csum_diff(old, 36, new, 36, ~((__u32) uh->check) & 0xffff);
+		sum = bpf_csum_diff(&ssrc_old, 4, &ssrc_new, 4, sum);
+		uh->check = csum_fold(sum) ? : 0xffff;
+	}
+
+	__builtin_memcpy(eth->h_dest, fib.dmac, ETH_ALEN);
+	__builtin_memcpy(eth->h_source, fib.smac, ETH_ALEN);
+
+	if (fib.ifindex == ctx->ingress_ifindex)
+		return XDP_TX;
+	return bpf_redirect(fib.ifindex, 0);
+}
+
+SEC("xdp")
+int rtpengine_xdp(struct xdp_md *ctx) {
+	void *data = (void *) (long) ctx->data;
+	void *end = (void *) (long) ctx->data_end;
+	struct ethhdr *eth = data;
+	struct xdp_filter_key key = { 0 };
+	__u32 src[4] = { 0 };
+	struct udphdr *uh;
+	struct rtp_info ri;
+	int vlan = 0;
+	__u8 tos;
+	__u16 proto;
+	void *nxt, *iph;
+
+	if ((void *) (eth + 1) > end)
+		return XDP_PASS;
+	proto = eth->h_proto;
+	nxt = eth + 1;
+
+	if (proto == bpf_htons(ETH_P_8021Q)) {
+		struct vlan_hdr *vh = nxt;
+		if ((void *) (vh + 1) > end)
+			return XDP_PASS;
+		proto = vh->proto;
+		nxt = vh + 1;
+		vlan = 1;
+	}
+	iph = nxt;
+
+	if (proto == bpf_htons(ETH_P_IP)) {
+		struct iphdr *ih = nxt;
+		if ((void *) (ih + 1) > end)
+			return XDP_PASS;
+		if (ih->protocol != IPPROTO_UDP || ih->ihl != 5)
+			return XDP_PASS;
+		if (ih->frag_off & bpf_htons(0x3fff))
+			return XDP_PASS;
+		key.family = AF_INET;
+		__builtin_memcpy(key.addr, &ih->daddr, 4);
+		__builtin_memcpy(src, &ih->saddr, 4);
+		tos = ih->tos;
+		uh = (void *) (ih + 1);
+	}
+	else if (proto == bpf_htons(ETH_P_IPV6)) {
+		struct ipv6hdr *ih = nxt;
+		if ((void *) (ih + 1) > end)
+			return XDP_PASS;
+		if (ih->nexthdr != IPPROTO_UDP)
+			return XDP_PASS;
+		key.family = AF_INET6;
+		__builtin_memcpy(key.addr, &ih->daddr, 16);
+		__builtin_memcpy(src, &ih->saddr, 16);
+		tos = (ih->priority << 4) | (ih->flow_lbl[0] >> 4);
+		uh = (void *) (ih + 1);
+	}
+	else
+		return XDP_PASS;
+
+	if ((void *) (uh + 1) > end)
+		return XDP_PASS;
+	__u32 len = bpf_ntohs(uh->len);
+	if (len < sizeof(*uh) || (void *) uh + len > end)
+		return XDP_PASS;
+	len -= sizeof(*uh);
+	key.port = bpf_ntohs(uh->dest);
+
+	struct xdp_filter_value *v = bpf_map_lookup_elem(&targets, &key);
+	if (!v)
+		return XDP_PASS;
+
+	if (v->flags & XDP_FILTER_F_SRC) {
+		if (v->src_port != bpf_ntohs(uh->source))
+			return XDP_PASS;
+		const __u32 *exp = (const __u32 *) v->src_addr;
+		if (exp[0] != src[0] || exp[1] != src[1] || exp[2] != src[2] || exp[3] != src[3])
+			return XDP_PASS;
+	}
+
+	__u8 *rtp = (void *) (uh + 1);
+	if (!rtp_matches(v, rtp, end, &ri))
+		return XDP_PASS;
+
+	struct xdp_filter_counters *c = bpf_map_lookup_elem(&counters, &key);
+	if (c)
+		count(c, &ri, rtp, len, tos);
+
+	if (v->flags & XDP_FILTER_F_DROP)
+		return XDP_DROP;
+
+	if ((v->flags & XDP_FILTER_F_FORWARD) && !vlan) {
+		int ret = forward(ctx, eth, iph, uh, rtp, v, &ri, key.family);
+		if (ret >= 0)
+			return ret;
+	}
+
+	// the userspace side doesn't count these again
+	return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+}
+
+char _license[] SEC("license") = "GPL";
@@ -412,6 +412,64 @@ INLINE bool bit_array_set(volatile unsigned int *name, unsigned int bit) {
 INLINE bool bit_array_clear(volatile unsigned int *name, unsigned int bit) {
 	return bf_clear(&name[bit / (sizeof(int) * 8)], 1U << (bit % (sizeof(int) * 8)));
 }
+/* Finds a run of `num` bits within [min, max] which are all clear in `clr` and all set in `set`
+ * (either may be NULL), starting at `start` and wrapping around to `min`. Runs longer than one
+ * bit start on an even bit. Works through a whole word per step. Returns the first bit of the
+ * run or -1. Nothing is locked, so the caller still has to claim the bits. */
+INLINE int bit_array_find_run(const volatile unsigned int *clr, const volatile unsigned int *set,
+		unsigned int num, unsigned int start, unsigned int min, unsigned int max)
+{
+	const unsigned int wbits = sizeof(int) * 8;
+
+	if (!num || min > max || max - min + 1 < num)
+		return -1;
+	if (start < min || start > max)
+		start = min;
+
+	unsigned int first = min / wbits, last = max / wbits, w = start / wbits;
+
+	// one extra step to get back to the bits below `start` in its own word
+	for (unsigned int n = 0; n <= last - first + 1; n++) {
+		unsigned int base = w * wbits;
+		unsigned int avail = ~0U;
+		if (clr)
+			avail &= ~g_atomic_int_get(&clr[w]);
+		if (set)
+			avail &= g_atomic_int_get(&set[w]);
+		if (base < min)
+			avail &= ~0U << (min - base);
+		if (max - base < wbits - 1)
+			avail &= ~0U >> (wbits - 1 - (max - base));
+		if (n == 0 && start > base)
+			avail &= ~0U << (start - base);
+
+		unsigned int cand = avail;
+		if (num > 1)
+			cand &= (avail >> 1) & (unsigned int) 0x5555555555555555ULL;
+
+		while (cand) {
+			unsigned int bit = base + __builtin_ctz(cand);
+			cand &= cand - 1;
+			if (num <= 2)
+				return bit;
+			if (bit + num - 1 > max)
+				break;
+			unsigned int i;
+			for (i = 2; i < num; i++) {
+				if (clr && bit_array_isset(clr, bit + i))
+					break;
+				if (set && !bit_array_isset(set, bit + i))
+					break;
+			}
+			if (i == num)
+				return bit;
+		}
+
+		w = (w == last) ? first : w + 1;
+	}
+
+	return -1;
+}
 
 
 
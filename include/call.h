@@ -344,6 +344,8 @@ struct packet_stream {
 
 	struct stream_stats	stats;
 	struct stream_stats	kernel_stats;
+	uint64_t		kernel_delay_hist[RTPE_NUM_DELAY_BUCKETS]; /* last seen, timer thread only */
+	uint64_t		kernel_delay_hist_sum; /* last seen, timer thread only */
 	unsigned char		in_tos_tclass;
 	atomic64		last_packet;
 	GHashTable		*rtp_stats;	/* LOCK: call->master_lock */
@@ -690,6 +692,7 @@ int call_stream_address46(char *o, struct packet_stream *ps, enum stream_address
 
 void add_total_calls_duration_in_interval(struct timeval *interval_tv);
 void call_timer(void *ptr);
+void call_kernel_delay_stats(struct packet_stream *ps, const struct rtpengine_stats *st);
 
 void __rtp_stats_update(GHashTable *dst, struct codec_store *);
 int __init_stream(struct packet_stream *ps);
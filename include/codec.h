@@ -140,6 +140,8 @@ void codec_decoder_skip_pts(struct codec_ssrc_handler *ch, uint64_t);
 uint64_t codec_decoder_unskip_pts(struct codec_ssrc_handler *ch);
 void codec_tracker_update(struct codec_store *);
 void codec_handlers_stop(GQueue *);
+void codec_worker_loop(void *);
+unsigned int codec_workers_queue_depth(void);
 
 #else
 
@@ -152,6 +154,7 @@ INLINE void codec_handler_free(struct codec_handler **handler) { }
 INLINE void codec_tracker_update(struct codec_store *cs) { }
 INLINE void codec_handlers_stop(GQueue *q) { }
 INLINE void ensure_codec_def(struct rtp_payload_type *pt, struct call_media *media) { }
+INLINE unsigned int codec_workers_queue_depth(void) { return 0; }
 
 #endif
 
@@ -28,16 +28,20 @@ struct kernel_interface {
 	int fd;
 	int is_open;
 	int is_wanted;
+	int xdp; // AF_XDP data plane instead of the kernel module
 };
 extern struct kernel_interface kernel;
 
 
 
 int kernel_setup_table(unsigned int);
+int kernel_setup_xdp(char **interfaces, int queues);
 
 int kernel_add_stream(struct rtpengine_target_info *);
 int kernel_add_destination(struct rtpengine_destination_info *);
 int kernel_del_stream(const struct re_address *);
+void kernel_batch_start(void);
+void kernel_batch_end(void);
 GList *kernel_list(void);
 int kernel_update_stats(const struct re_address *a, struct rtpengine_stats_info *out);
 
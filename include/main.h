@@ -34,6 +34,8 @@ struct rtpengine_config {
 	struct rtpengine_common_config common;
 
 	int			kernel_table;
+	char			**xdp_interfaces;
+	int			xdp_queues;
 	int			max_sessions;
 	int			timeout;
 	int			silent_timeout;
@@ -67,6 +69,7 @@ struct rtpengine_config {
 	int			save_interface_ports;
 	int			port_min;
 	int			port_max;
+	int			socket_pool;
 	int			redis_db;
 	int			redis_write_db;
 	int			no_redis_required;
@@ -81,12 +84,17 @@ struct rtpengine_config {
 	int			active_switchover;
 	int			num_threads;
 	int			media_num_threads;
+	int			transcode_threads;
 	char			*spooldir;
 	char			*rec_method;
 	char			*rec_format;
+	int			rec_pcap_rotate;
+	int			rec_pcap_buffer;
+	char			*rec_meta_socket;
 	char			*iptables_chain;
 	int			load_limit;
 	int			cpu_limit;
+	int			transcode_limit; // CPU cores times 100
 	uint64_t		bw_limit;
 	char			*scheduling;
 	int			priority;
@@ -133,6 +141,8 @@ struct rtpengine_config {
 	str			cn_payload;
 	char			*software_id;
 	int			poller_per_thread;
+	int			io_uring;
+	int			io_uring_buffers;
 	char			*mqtt_host;
 	int			mqtt_port;
 	char			*mqtt_id;
@@ -84,9 +84,12 @@ struct port_pool {
 
 	unsigned int			min, max;
 
-	mutex_t				free_list_lock;
-	GQueue				free_list;
-	BIT_ARRAY_DECLARE(free_list_used, 0x10000);
+	// pre-bound sockets (--socket-pool), filled by port_pool_loop(). pooled ports are also
+	// marked in ports_used. whoever clears a bit in `pooled` owns the matching fd slot
+	BIT_ARRAY_DECLARE(pooled, 0x10000);
+	int				*pooled_fds; // indexed by port - min, NULL if the pool is disabled
+	volatile unsigned int		num_pooled;
+	unsigned int			pool_next; // refill search position
 };
 struct intf_address {
 	socktype_t			*type;
@@ -180,6 +183,7 @@ struct stream_fd *stream_fd_new(socket_t *fd, struct call *call, const struct lo
 struct stream_fd *stream_fd_lookup(const endpoint_t *);
 void stream_fd_release(struct stream_fd *);
 void release_closed_sockets(void);
+void port_pool_loop(void *);
 
 void free_intf_list(struct intf_list *il);
 void free_release_intf_list(struct intf_list *il);
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <time.h>
 #include <glib.h>
+#include "socket.h"
 
 
 
@@ -15,6 +16,7 @@ struct obj;
 
 
 typedef void (*poller_func_t)(int, void *, uintptr_t);
+typedef void (*poller_recv_func_t)(int, void *, char *, size_t, const void *, const struct timeval *);
 
 struct poller_item {
 	int				fd;
@@ -25,6 +27,14 @@ struct poller_item {
 	poller_func_t			writeable;
 	poller_func_t			closed;
 	poller_func_t			timer;
+
+	// Optional. Pollers running on io_uring receive the packets themselves
+	// and pass them here, instead of calling `readable`. Arguments are the
+	// payload, the source sockaddr and the receive timestamp. The payload is
+	// located in a buffer with RTP_BUFFER_HEAD_ROOM in front of it and
+	// RTP_BUFFER_TAIL_ROOM after MAX_RTP_PACKET_SIZE, and may be modified in
+	// place. The sockaddr lives in the head room.
+	poller_recv_func_t		recv;
 };
 
 struct poller;
@@ -51,5 +61,13 @@ void poller_loop2(void *);
 int poller_add_timer(struct poller *, void (*)(void *), struct obj *);
 int poller_del_timer(struct poller *, void (*)(void *), struct obj *);
 
+ssize_t poller_sendto(socket_t *, const void *, size_t, const endpoint_t *, void (*)(void *), void *);
+ssize_t poller_sendiov(socket_t *, const struct iovec *, unsigned int, const endpoint_t *);
+
+INLINE ssize_t poller_sendto_copy(socket_t *s, const void *buf, size_t len, const endpoint_t *ep) {
+	struct iovec iov = { .iov_base = (void *) buf, .iov_len = len };
+	return poller_sendiov(s, &iov, 1, ep);
+}
+
 
 #endif
@@ -24,20 +24,24 @@ enum call_opmode;
 struct rtpengine_target_info;
 struct call_monologue;
 struct call_media;
+struct rec_pcap_file;
 
 
 struct recording_pcap {
 	FILE          *meta_fp;
-	pcap_t        *recording_pd;
-	pcap_dumper_t *recording_pdumper;
+	struct rec_pcap_file *file; // own pcap file, unless recording into capture files
 	uint64_t      packet_num;
 	char          *recording_path;
+	GQueue        capture_files; // paths of the capture files the call went into
+	unsigned int  capture_gen; // capture file last written into
 
 	mutex_t       recording_lock;
 };
 
 struct recording_proc {
 	unsigned int call_idx;
+	bool meta_sent; // metadata went through the recording daemon's socket
+	bool meta_file; // ... until that failed, now it goes to the spool file
 };
 struct recording_stream_proc {
 	unsigned int stream_idx;
@@ -83,6 +87,8 @@ struct recording_method {
 	void (*setup_media)(struct call_media *);
 	void (*setup_monologue)(struct call_monologue *);
 	void (*stream_kernel_info)(struct packet_stream *, struct rtpengine_target_info *);
+
+	void (*writer_loop)(void *);
 };
 
 extern const struct recording_method *selected_recording_method;
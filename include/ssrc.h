@@ -120,6 +120,7 @@ struct ssrc_entry_call {
 	// input only
 	GHashTable *sequencers;
 	uint32_t jitter, transit;
+	int audio_level; // RFC 6464 level (-dBov) of the last decoded frame if silence detection is active, else -1
 	// output only
 	uint16_t seq_diff;
 };
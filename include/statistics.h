@@ -4,6 +4,7 @@
 #include "aux.h"
 #include "bencode.h"
 #include "rtpengine_config.h"
+#include "xt_RTPENGINE.h"
 
 struct call;
 struct packet_stream;
@@ -75,6 +76,8 @@ struct rtp_stats {
 	atomic64		kernel_bytes;
 };
 
+#define CODEC_LATENCY_BUCKETS 24
+
 struct codec_stats {
 	char			*chain;
 	char			*chain_brief;
@@ -85,6 +88,10 @@ struct codec_stats {
 	atomic64		packets_input[3];
 	atomic64		bytes_input[3];
 	atomic64		pcm_samples[3];
+	// offloaded transcoding only: CPU time spent and log2-scaled latency histogram,
+	// bucket N counts packets with a queue+processing time of [2^N, 2^(N+1)) us
+	atomic64		cpu_time_us;
+	atomic64		latency_hist[CODEC_LATENCY_BUCKETS];
 };
 
 struct stats_metric {
@@ -100,6 +107,7 @@ struct stats_metric {
 	int is_int;
 	const char *prom_name;
 	const char *prom_type;
+	const char *prom_suffix; // for the _bucket/_count/_sum series of histograms
 	char *prom_label;
 };
 
@@ -209,6 +217,39 @@ INLINE void stats_gauge_calc_avg_reset(struct global_stats_gauge_min_max *out,
 }
 
 
+INLINE void codec_stats_add_latency(struct codec_stats *stats_entry, long long us) {
+	unsigned int bucket = 0;
+	if (us > 1)
+		bucket = 63 - __builtin_clzll(us);
+	if (bucket >= CODEC_LATENCY_BUCKETS)
+		bucket = CODEC_LATENCY_BUCKETS - 1;
+	atomic64_inc(&stats_entry->latency_hist[bucket]);
+}
+
+// returns the upper bound (in us) of the log2-scaled latency bucket containing the given
+// percentile, or 0 if no samples were recorded
+INLINE uint64_t stats_hist_pct(atomic64 *hist, unsigned int num_buckets, unsigned int pct) {
+	uint64_t counts[num_buckets];
+	uint64_t total = 0;
+	for (unsigned int i = 0; i < num_buckets; i++) {
+		counts[i] = atomic64_get(&hist[i]);
+		total += counts[i];
+	}
+	if (!total)
+		return 0;
+	uint64_t thres = (total * pct + 99) / 100;
+	uint64_t sum = 0;
+	for (unsigned int i = 0; i < num_buckets; i++) {
+		sum += counts[i];
+		if (sum >= thres)
+			return 2ULL << i;
+	}
+	return 2ULL << (num_buckets - 1);
+}
+INLINE uint64_t codec_stats_latency_pct(struct codec_stats *stats_entry, unsigned int pct) {
+	return stats_hist_pct(stats_entry->latency_hist, CODEC_LATENCY_BUCKETS, pct);
+}
+
 void statistics_init(void);
 void statistics_free(void);
 
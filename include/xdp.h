@@ -0,0 +1,44 @@
+#ifndef _XDP_H_
+#define _XDP_H_
+
+#include <glib.h>
+#include "xt_RTPENGINE.h"
+
+
+// XDP data plane, used in place of the kernel module when the latter isn't
+// available. It takes the same target and destination descriptions that are
+// otherwise pushed into the kernel, and forwards either from within the XDP
+// program or from userspace through AF_XDP sockets.
+
+
+#ifdef HAVE_XDP
+
+
+int xdp_init(char **interfaces, int queues);
+void xdp_launch(void);
+void xdp_free(void);
+
+int xdp_add_target(const struct rtpengine_target_info *);
+int xdp_add_destination(const struct rtpengine_destination_info *);
+int xdp_del_target(const struct re_address *);
+GList *xdp_list(void);
+int xdp_update_stats(const struct re_address *, struct rtpengine_stats_info *);
+
+
+#else
+
+#include <errno.h>
+#include "compat.h"
+
+INLINE int xdp_init(char **interfaces, int queues) { errno = ENOTSUP; return -1; }
+INLINE void xdp_launch(void) { }
+INLINE void xdp_free(void) { }
+
+INLINE int xdp_add_target(const struct rtpengine_target_info *i) { return -1; }
+INLINE int xdp_add_destination(const struct rtpengine_destination_info *i) { return -1; }
+INLINE int xdp_del_target(const struct re_address *a) { return -1; }
+INLINE GList *xdp_list(void) { return NULL; }
+INLINE int xdp_update_stats(const struct re_address *a, struct rtpengine_stats_info *s) { return -1; }
+
+#endif
+#endif
@@ -0,0 +1,64 @@
+#ifndef _XDP_FILTER_H_
+#define _XDP_FILTER_H_
+
+// Map layout shared between the XDP program (xdp_filter.bpf.c) and the
+// daemon. Packets matching an entry are either forwarded directly by the
+// program, or redirected to the AF_XDP socket bound to the receiving queue.
+// Everything else passes on to the regular network stack.
+
+#include <linux/types.h>
+
+#define XDP_FILTER_MAX_TARGETS	65536
+#define XDP_FILTER_MAX_QUEUES	64
+#define XDP_FILTER_NUM_SSRC	4
+#define XDP_FILTER_NUM_PT	32
+#define XDP_FILTER_PT_NONE	0xff
+
+#define XDP_FILTER_F_RTP	0x01	// only take RTP with a listed payload type
+#define XDP_FILTER_F_RTCP_MUX	0x02	// pass muxed RTCP
+#define XDP_FILTER_F_SRC	0x04	// only take packets from `src`
+#define XDP_FILTER_F_FORWARD	0x08	// forward to `out` directly
+#define XDP_FILTER_F_DROP	0x10	// count, then drop
+
+struct xdp_filter_key {
+	__u32		family;		// AF_INET or AF_INET6
+	__u8		addr[16];	// IPv4 in the first four bytes, network byte order
+	__u16		port;		// host byte order
+	__u16		pad;
+};
+
+struct xdp_filter_output {
+	__u8		src_addr[16];
+	__u8		dst_addr[16];
+	__u16		src_port;			// network byte order
+	__u16		dst_port;			// network byte order
+	__u32		ssrc_out[XDP_FILTER_NUM_SSRC];	// network byte order, 0 = unchanged
+	__u8		tos;
+	__u8		pad[3];
+};
+
+struct xdp_filter_value {
+	__u32		flags;
+	__u32		ssrc[XDP_FILTER_NUM_SSRC];	// network byte order, unused if [0] is 0
+	__u8		pt_idx[128];			// index into the payload type stats
+	__u8		src_addr[16];
+	__u16		src_port;
+	__u16		pad;
+	struct xdp_filter_output out;
+};
+
+// per-CPU, keyed like the targets
+struct xdp_filter_counters {
+	__u64		packets;
+	__u64		bytes;
+	__u64		pt_packets[XDP_FILTER_NUM_PT];
+	__u64		pt_bytes[XDP_FILTER_NUM_PT];
+	__u64		ssrc_packets[XDP_FILTER_NUM_SSRC];
+	__u64		ssrc_bytes[XDP_FILTER_NUM_SSRC];
+	__u32		ssrc_seq[XDP_FILTER_NUM_SSRC];		// last seen, host byte order
+	__u32		ssrc_ts[XDP_FILTER_NUM_SSRC];		// last seen, host byte order
+	__u8		in_tos;
+	__u8		pad[7];
+};
+
+#endif
@@ -16,6 +16,22 @@
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,25)
 #include <crypto/aead.h>
 #endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,3,0)
+#include <crypto/skcipher.h>
+#define RE_HAS_SKCIPHER 1
+#else
+#define RE_HAS_SKCIPHER 0
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0)
+#define RE_HAS_SYNC_SKCIPHER 1
+#else
+#define RE_HAS_SYNC_SKCIPHER 0
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,18,0)
+#define RE_HAS_SHASH_ON_STACK 1
+#else
+#define RE_HAS_SHASH_ON_STACK 0
+#endif
 #include <net/icmp.h>
 #include <net/ip.h>
 #include <net/ipv6.h>
@@ -24,6 +40,10 @@
 #include <net/dst.h>
 #include <linux/proc_fs.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,0,0)
 #include <linux/bsearch.h>
 #endif
@@ -200,6 +220,14 @@ static uint stream_packets_list_limit = 10;
 module_param(stream_packets_list_limit, uint, 0);
 MODULE_PARM_DESC(stream_packets_list_limit, "maximum number of packets to retain for intercept streams");
 
+static uint ring_size = 4096;
+module_param(ring_size, uint, 0);
+MODULE_PARM_DESC(ring_size, "size in kB of the per-table intercept ring, rounded up to a power of two");
+
+static bool delay_stats = 1;
+module_param(delay_stats, bool, 0644);
+MODULE_PARM_DESC(delay_stats, "keep histograms of the receive to transmit delay of forwarded packets");
+
 static bool log_errors = 0;
 module_param(log_errors, bool, 0);
 MODULE_PARM_DESC(log_errors, "generate kernel log lines from forwarding errors");
@@ -249,6 +277,11 @@ static int proc_stream_close(struct inode *i, struct file *f);
 static ssize_t proc_stream_read(struct file *f, char __user *b, size_t l, loff_t *o);
 static unsigned int proc_stream_poll(struct file *f, struct poll_table_struct *p);
 
+static int proc_ring_open(struct inode *i, struct file *f);
+static int proc_ring_close(struct inode *i, struct file *f);
+static int proc_ring_mmap(struct file *f, struct vm_area_struct *vma);
+static unsigned int proc_ring_poll(struct file *f, struct poll_table_struct *p);
+
 static void table_put(struct rtpengine_table *);
 static struct rtpengine_target *get_target(struct rtpengine_table *, const struct re_address *);
 static int is_valid_address(const struct re_address *rea);
@@ -282,25 +315,40 @@ struct re_crypto_context {
 	unsigned char			session_auth_key[20];
 	uint32_t			roc[RTPE_NUM_SSRC_TRACKING];
 	struct crypto_cipher		*tfm[2];
+#if RE_HAS_SYNC_SKCIPHER
+	struct crypto_sync_skcipher	*skcipher;
+#else
+	struct crypto_skcipher		*skcipher;
+#endif
 	struct crypto_shash		*shash;
+	void				*shash_state; // exported keyed HMAC state, ready for use
 	struct crypto_aead		*aead;
 	const struct re_cipher		*cipher;
 	const struct re_hmac		*hmac;
 };
 
-struct rtpengine_stats_a {
-	atomic64_t			packets;
-	atomic64_t			bytes;
-	atomic64_t			errors;
-	uint64_t			delay_min;
-	uint64_t			delay_avg;
-	uint64_t			delay_max;
-	atomic_t          in_tos;
-};
-struct rtpengine_rtp_stats_a {
-	atomic64_t			packets;
-	atomic64_t			bytes;
+// Packet counters are kept per CPU so that forwarding never writes to a
+// cache line shared with other CPUs. Readers add them up.
+struct rtpengine_target_pcpu {
+	u64				packets;
+	u64				bytes;
+	u64				errors;
+	u64				delay_min;
+	u64				delay_max;
+	u64				delay_total;
+	u64				delay_count;
+	u64				delay_hist[RTPE_NUM_DELAY_BUCKETS];
+	u64				delay_hist_sum;
+	struct rtpengine_rtp_stats	ssrc_stats[RTPE_NUM_SSRC_TRACKING];
+	struct rtpengine_rtp_stats	rtp_stats[]; // target.num_payload_types
 };
+#define target_pcpu_sum(g, field) ({						\
+		u64 __sum = 0;							\
+		int __cpu;							\
+		for_each_possible_cpu(__cpu)					\
+			__sum += per_cpu_ptr((g)->pcpu, __cpu)->field;		\
+		__sum;								\
+	})
 struct rtpengine_output {
 	struct rtpengine_output_info	output;
 	struct re_crypto_context	encrypt;
@@ -311,16 +359,20 @@ struct rtpengine_target {
 	struct rtpengine_target_info	target;
 	unsigned int			last_pt; // index into payload_types[]
 
-	struct rtpengine_stats_a	stats;
-	struct rtpengine_rtp_stats_a	rtp_stats[RTPE_NUM_PAYLOAD_TYPES];
+	struct rtpengine_target_pcpu __percpu *pcpu;
+	atomic_t			in_tos;
+	int				in_tos_set;
 	spinlock_t			ssrc_stats_lock;
-	struct rtpengine_ssrc_stats	ssrc_stats[RTPE_NUM_SSRC_TRACKING];
+	struct rtpengine_ssrc_stats	ssrc_stats[RTPE_NUM_SSRC_TRACKING]; // sequence and jitter tracking
+	struct rtpengine_rtp_stats	ssrc_stats_reset[RTPE_NUM_SSRC_TRACKING]; // counter values at last reset
 
 	struct re_crypto_context	decrypt;
 
 	rwlock_t			outputs_lock;
 	struct rtpengine_output		*outputs;
 	unsigned int			outputs_unfilled; // only ever decreases
+
+	struct rcu_head			rcu;
 };
 
 struct re_bitfield {
@@ -331,6 +383,7 @@ struct re_bitfield {
 struct re_bucket {
 	struct re_bitfield		ports_lo_bf;
 	struct rtpengine_target		*ports_lo[256];
+	struct rcu_head			rcu;
 };
 
 struct re_dest_addr {
@@ -396,12 +449,13 @@ struct re_stream {
 	wait_queue_head_t		read_wq;
 	wait_queue_head_t		close_wq;
 	int				eof; /* protected by packet_list_lock */
+	unsigned int			readers; /* protected by packet_list_lock */
 };
 
 #define RE_HASH_BITS 8 /* make configurable? */
 struct rtpengine_table {
 	atomic_t			refcnt;
-	rwlock_t			target_lock;
+	rwlock_t			target_lock; // writers only, lookups use RCU
 	pid_t				pid;
 
 	unsigned int			id;
@@ -411,6 +465,7 @@ struct rtpengine_table {
 	struct proc_dir_entry		*proc_list;
 	struct proc_dir_entry		*proc_blist;
 	struct proc_dir_entry		*proc_calls;
+	struct proc_dir_entry		*proc_ring;
 
 	struct re_dest_addr_hash	dest_addr_hash;
 
@@ -422,12 +477,21 @@ struct rtpengine_table {
 	struct hlist_head		calls_hash[1 << RE_HASH_BITS];
 	spinlock_t			streams_hash_lock[1 << RE_HASH_BITS];
 	struct hlist_head		streams_hash[1 << RE_HASH_BITS];
+
+	// intercepted packets go here instead of the stream queues while mapped
+	spinlock_t			ring_lock;
+	struct rtpengine_ring_header	*ring; /* NULL without consumer */
+	unsigned char			*ring_data;
+	u32				ring_size;
+	u64				ring_head; /* our copy, the shared one is only written */
+	wait_queue_head_t		ring_wq;
 };
 
 struct re_cipher {
 	enum rtpengine_cipher		id;
 	const char			*name;
 	const char			*tfm_name;
+	const char			*skcipher_name;
 	const char			*aead_name;
 	int				(*decrypt)(struct re_crypto_context *, struct rtpengine_srtp *,
 			struct rtp_parsed *, uint64_t *);
@@ -496,6 +560,7 @@ static struct re_auto_array streams;
 #  define PROC_RELEASE release
 #  define PROC_LSEEK llseek
 #  define PROC_POLL poll
+#  define PROC_MMAP mmap
 #else
 #  define PROC_OP_STRUCT proc_ops
 #  define PROC_OWNER
@@ -505,6 +570,7 @@ static struct re_auto_array streams;
 #  define PROC_RELEASE proc_release
 #  define PROC_LSEEK proc_lseek
 #  define PROC_POLL proc_poll
+#  define PROC_MMAP proc_mmap
 #endif
 
 static const struct PROC_OP_STRUCT proc_control_ops = {
@@ -574,6 +640,14 @@ static const struct PROC_OP_STRUCT proc_stream_ops = {
 	.PROC_RELEASE		= proc_stream_close,
 };
 
+static const struct PROC_OP_STRUCT proc_ring_ops = {
+	PROC_OWNER
+	.PROC_OPEN		= proc_ring_open,
+	.PROC_RELEASE		= proc_ring_close,
+	.PROC_MMAP		= proc_ring_mmap,
+	.PROC_POLL		= proc_ring_poll,
+};
+
 static const struct re_cipher re_ciphers[] = {
 	[REC_INVALID] = {
 		.id		= REC_INVALID,
@@ -587,6 +661,7 @@ static const struct re_cipher re_ciphers[] = {
 		.id		= REC_AES_CM_128,
 		.name		= "AES-CM-128",
 		.tfm_name	= "aes",
+		.skcipher_name	= "ctr(aes)",
 		.decrypt	= srtp_encrypt_aes_cm,
 		.encrypt	= srtp_encrypt_aes_cm,
 	},
@@ -602,6 +677,7 @@ static const struct re_cipher re_ciphers[] = {
 		.id		= REC_AES_CM_192,
 		.name		= "AES-CM-192",
 		.tfm_name	= "aes",
+		.skcipher_name	= "ctr(aes)",
 		.decrypt	= srtp_encrypt_aes_cm,
 		.encrypt	= srtp_encrypt_aes_cm,
 	},
@@ -609,6 +685,7 @@ static const struct re_cipher re_ciphers[] = {
 		.id		= REC_AES_CM_256,
 		.name		= "AES-CM-256",
 		.tfm_name	= "aes",
+		.skcipher_name	= "ctr(aes)",
 		.decrypt	= srtp_encrypt_aes_cm,
 		.encrypt	= srtp_encrypt_aes_cm,
 	},
@@ -731,6 +808,8 @@ static struct rtpengine_table *new_table(void) {
 		INIT_HLIST_HEAD(&t->streams_hash[i]);
 		spin_lock_init(&t->streams_hash_lock[i]);
 	}
+	spin_lock_init(&t->ring_lock);
+	init_waitqueue_head(&t->ring_wq);
 
 	return t;
 }
@@ -818,6 +897,11 @@ static int table_create_proc(struct rtpengine_table *t, uint32_t id) {
 	if (!t->proc_calls)
 		return -1;
 
+	t->proc_ring = proc_create_user("ring", S_IFREG | S_IWUSR | S_IWGRP | S_IRUSR | S_IRGRP,
+			t->proc_root, &proc_ring_ops, (void *) (unsigned long) id);
+	if (!t->proc_ring)
+		return -1;
+
 	return 0;
 }
 
@@ -867,12 +951,27 @@ static void free_crypto_context(struct re_crypto_context *c) {
 	for (i = 0; i < ARRAY_SIZE(c->tfm); i++) {
 		if (c->tfm[i])
 			crypto_free_cipher(c->tfm[i]);
+		c->tfm[i] = NULL;
 	}
+#if RE_HAS_SKCIPHER
+	if (c->skcipher)
+#if RE_HAS_SYNC_SKCIPHER
+		crypto_free_sync_skcipher(c->skcipher);
+#else
+		crypto_free_skcipher(c->skcipher);
+#endif
+	c->skcipher = NULL;
+#endif
 	if (c->shash)
 		crypto_free_shash(c->shash);
+	c->shash = NULL;
+	if (c->shash_state)
+		kfree(c->shash_state);
+	c->shash_state = NULL;
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,25)
 	if (c->aead)
 		crypto_free_aead(c->aead);
+	c->aead = NULL;
 #endif
 }
 
@@ -894,6 +993,7 @@ static void target_put(struct rtpengine_target *t) {
 			free_crypto_context(&t->outputs[i].encrypt);
 		kfree(t->outputs);
 	}
+	free_percpu(t->pcpu);
 	kfree(t);
 }
 
@@ -906,6 +1006,54 @@ static void target_get(struct rtpengine_target *t) {
 	atomic_inc(&t->refcnt);
 }
 
+static void target_stats_sum(struct rtpengine_target *g, struct rtpengine_stats *st) {
+	u64 delay_count = 0, delay_total = 0;
+	int cpu;
+	unsigned int i;
+
+	memset(st, 0, sizeof(*st));
+
+	for_each_possible_cpu(cpu) {
+		const struct rtpengine_target_pcpu *pc = per_cpu_ptr(g->pcpu, cpu);
+
+		st->packets += pc->packets;
+		st->bytes += pc->bytes;
+		st->errors += pc->errors;
+		for (i = 0; i < RTPE_NUM_DELAY_BUCKETS; i++)
+			st->delay_hist[i] += pc->delay_hist[i];
+		st->delay_hist_sum += pc->delay_hist_sum;
+
+		if (!pc->delay_count)
+			continue;
+		if (!delay_count || pc->delay_min < st->delay_min)
+			st->delay_min = pc->delay_min;
+		if (pc->delay_max > st->delay_max)
+			st->delay_max = pc->delay_max;
+		delay_total += pc->delay_total;
+		delay_count += pc->delay_count;
+	}
+
+	if (delay_count)
+		st->delay_avg = div64_u64(delay_total, delay_count);
+	st->in_tos = atomic_read(&g->in_tos);
+}
+
+// The table's reference to a target and the memory of emptied buckets are
+// released only after a grace period, as lookups in the packet path can
+// still be using them.
+static void target_put_rcu(struct rcu_head *head) {
+	target_put(container_of(head, struct rtpengine_target, rcu));
+}
+static void target_release(struct rtpengine_target *t) {
+	call_rcu(&t->rcu, target_put_rcu);
+}
+static void bucket_free_rcu(struct rcu_head *head) {
+	kfree(container_of(head, struct re_bucket, rcu));
+}
+static void bucket_release(struct re_bucket *b) {
+	call_rcu(&b->rcu, bucket_free_rcu);
+}
+
 
 
 
@@ -935,6 +1083,7 @@ static void clear_table_proc_files(struct rtpengine_table *t) {
 	clear_proc(&t->proc_list);
 	clear_proc(&t->proc_blist);
 	clear_proc(&t->proc_calls);
+	clear_proc(&t->proc_ring);
 	clear_proc(&t->proc_root);
 }
 
@@ -1151,6 +1300,12 @@ static ssize_t proc_status(struct file *f, char __user *b, size_t l, loff_t *o)
 	len += sprintf(buf + len, "Targets:     %u\n", t->num_targets);
 	read_unlock_irqrestore(&t->target_lock, flags);
 
+	spin_lock_irqsave(&t->ring_lock, flags);
+	if (t->ring)
+		len += sprintf(buf + len, "Ring:        %u kB, %llu dropped\n", t->ring_size / 1024,
+				(unsigned long long) t->ring->dropped);
+	spin_unlock_irqrestore(&t->ring_lock, flags);
+
 	table_put(t);
 
 	if (copy_to_user(b, buf, len))
@@ -1423,17 +1578,11 @@ static ssize_t proc_blist_read(struct file *f, char __user *b, size_t l, loff_t
 
 	memcpy(&opp->target, &g->target, sizeof(opp->target));
 
-	opp->stats.packets = atomic64_read(&g->stats.packets);
-	opp->stats.bytes = atomic64_read(&g->stats.bytes);
-	opp->stats.errors = atomic64_read(&g->stats.errors);
-	opp->stats.delay_min = g->stats.delay_min;
-	opp->stats.delay_max = g->stats.delay_max;
-	opp->stats.delay_avg = g->stats.delay_avg;
-	opp->stats.in_tos = atomic_read(&g->stats.in_tos);
+	target_stats_sum(g, &opp->stats);
 
 	for (i = 0; i < g->target.num_payload_types; i++) {
-		opp->rtp_stats[i].packets = atomic64_read(&g->rtp_stats[i].packets);
-		opp->rtp_stats[i].bytes = atomic64_read(&g->rtp_stats[i].bytes);
+		opp->rtp_stats[i].packets = target_pcpu_sum(g, rtp_stats[i].packets);
+		opp->rtp_stats[i].bytes = target_pcpu_sum(g, rtp_stats[i].bytes);
 	}
 
 	spin_lock_irqsave(&g->decrypt.lock, flags);
@@ -1645,14 +1794,25 @@ static int proc_list_show(struct seq_file *f, void *v) {
 	if (g->target.src_mismatch > 0 && g->target.src_mismatch <= ARRAY_SIZE(re_msm_strings))
 		seq_printf(f, "    src mismatch action: %s\n", re_msm_strings[g->target.src_mismatch]);
 	seq_printf(f, "    stats: %20llu bytes, %20llu packets, %20llu errors\n",
-		(unsigned long long) atomic64_read(&g->stats.bytes),
-		(unsigned long long) atomic64_read(&g->stats.packets),
-		(unsigned long long) atomic64_read(&g->stats.errors));
+		(unsigned long long) target_pcpu_sum(g, bytes),
+		(unsigned long long) target_pcpu_sum(g, packets),
+		(unsigned long long) target_pcpu_sum(g, errors));
+	seq_printf(f, "    delay:");
+	for (i = 0; i < RTPE_NUM_DELAY_BUCKETS; i++) {
+		u64 n = target_pcpu_sum(g, delay_hist[i]);
+		if (!n)
+			continue;
+		if (i == RTPE_NUM_DELAY_BUCKETS - 1)
+			seq_printf(f, " >=%lluus %llu", 1ULL << i, (unsigned long long) n);
+		else
+			seq_printf(f, " <%lluus %llu", 2ULL << i, (unsigned long long) n);
+	}
+	seq_printf(f, "\n");
 	for (i = 0; i < g->target.num_payload_types; i++) {
 		seq_printf(f, "        RTP payload type %3u: %20llu bytes, %20llu packets\n",
 			g->target.payload_types[i].pt_num,
-			(unsigned long long) atomic64_read(&g->rtp_stats[i].bytes),
-			(unsigned long long) atomic64_read(&g->rtp_stats[i].packets));
+			(unsigned long long) target_pcpu_sum(g, rtp_stats[i].bytes),
+			(unsigned long long) target_pcpu_sum(g, rtp_stats[i].packets));
 		if (g->target.payload_types[i].replace_pattern_len)
 			seq_printf(f, "            %u bytes replacement payload\n",
 					g->target.payload_types[i].replace_pattern_len);
@@ -1764,6 +1924,7 @@ static int re_address_match(const struct re_address *a, const struct re_address
 	return 0;
 }
 
+// must be called with either target_lock or rcu_read_lock held
 static struct re_dest_addr *find_dest_addr(const struct re_dest_addr_hash *h, const struct re_address *local) {
 	unsigned int rda_hash, i;
 	struct re_dest_addr *rda;
@@ -1771,7 +1932,7 @@ static struct re_dest_addr *find_dest_addr(const struct re_dest_addr_hash *h, co
 	i = rda_hash = re_address_hash(local);
 
 	while (1) {
-		rda = h->addrs[i];
+		rda = rcu_dereference_raw(h->addrs[i]);
 		if (!rda)
 			return NULL;
 		if (re_address_match(local, &rda->destination))
@@ -1801,12 +1962,19 @@ static int table_get_target_stats(struct rtpengine_table *t, struct rtpengine_st
 	spin_lock_irqsave(&g->ssrc_stats_lock, flags);
 
 	for (u = 0; u < RTPE_NUM_SSRC_TRACKING; u++) {
+		u64 packets = target_pcpu_sum(g, ssrc_stats[u].packets);
+		u64 bytes = target_pcpu_sum(g, ssrc_stats[u].bytes);
+
 		i->ssrc[u] = g->target.ssrc[u];
 		i->ssrc_stats[u] = g->ssrc_stats[u];
+		i->ssrc_stats[u].basic_stats.packets = packets - g->ssrc_stats_reset[u].packets;
+		i->ssrc_stats[u].basic_stats.bytes = bytes - g->ssrc_stats_reset[u].bytes;
 
 		if (reset) {
-			g->ssrc_stats[u].basic_stats.packets = 0;
-			g->ssrc_stats[u].basic_stats.bytes = 0;
+			// per-CPU counters can't be cleared safely, so remember the
+			// current totals instead
+			g->ssrc_stats_reset[u].packets = packets;
+			g->ssrc_stats_reset[u].bytes = bytes;
 			g->ssrc_stats[u].total_lost = 0;
 		}
 	}
@@ -1820,52 +1988,59 @@ static int table_get_target_stats(struct rtpengine_table *t, struct rtpengine_st
 
 
 
-static int table_del_target(struct rtpengine_table *t, const struct re_address *local) {
+static struct rtpengine_target *target_remove_locked(struct rtpengine_table *t, const struct re_address *local,
+		struct re_bucket **bp)
+{
 	unsigned char hi, lo;
 	struct re_dest_addr *rda;
 	struct re_bucket *b;
-	struct rtpengine_target *g = NULL;
-	unsigned long flags;
-
-	if (!local || !is_valid_address(local))
-		return -EINVAL;
+	struct rtpengine_target *g;
 
 	hi = (local->port & 0xff00) >> 8;
 	lo = local->port & 0xff;
 
-	write_lock_irqsave(&t->target_lock, flags);
-
 	rda = find_dest_addr(&t->dest_addr_hash, local);
 	if (!rda)
-		goto out;
+		return NULL;
 	b = rda->ports_hi[hi];
 	if (!b)
-		goto out;
+		return NULL;
 	g = b->ports_lo[lo];
 	if (!g)
-		goto out;
+		return NULL;
 
-	b->ports_lo[lo] = NULL;
+	RCU_INIT_POINTER(b->ports_lo[lo], NULL);
 	re_bitfield_clear(&b->ports_lo_bf, lo);
 	t->num_targets--;
 	if (!b->ports_lo_bf.used) {
-		rda->ports_hi[hi] = NULL;
+		RCU_INIT_POINTER(rda->ports_hi[hi], NULL);
 		re_bitfield_clear(&rda->ports_hi_bf, hi);
+		*bp = b;
 	}
-	else
-		b = NULL;
 
 	/* not freeing or NULLing the re_dest_addr due to hash collision logic */
 
-out:
+	return g;
+}
+
+static int table_del_target(struct rtpengine_table *t, const struct re_address *local) {
+	struct re_bucket *b = NULL;
+	struct rtpengine_target *g;
+	unsigned long flags;
+
+	if (!local || !is_valid_address(local))
+		return -EINVAL;
+
+	write_lock_irqsave(&t->target_lock, flags);
+	g = target_remove_locked(t, local, &b);
 	write_unlock_irqrestore(&t->target_lock, flags);
 
 	if (!g)
 		return -ENOENT;
 	if (b)
-		kfree(b);
+		bucket_release(b);
 
-	target_put(g);
+	target_release(g);
 
 	return 0;
 }
@@ -2088,6 +2263,69 @@ static int gen_session_key(unsigned char *out, int len, struct rtpengine_srtp *s
 
 
 
+// Runs the HMAC initialisation once and keeps the resulting keyed state, so
+// that each packet only needs to import it instead of starting from scratch.
+static int shash_state_init(struct re_crypto_context *c) {
+	struct shash_desc *dsc;
+	size_t alloc_size;
+	int ret;
+
+	alloc_size = sizeof(*dsc) + crypto_shash_descsize(c->shash);
+	dsc = kzalloc(alloc_size, GFP_KERNEL);
+	if (!dsc)
+		return -ENOMEM;
+	dsc->tfm = c->shash;
+
+	ret = -ENOMEM;
+	c->shash_state = kzalloc(crypto_shash_statesize(c->shash), GFP_KERNEL);
+	if (!c->shash_state)
+		goto out;
+
+	ret = crypto_shash_init(dsc);
+	if (ret)
+		goto out;
+	ret = crypto_shash_export(dsc, c->shash_state);
+
+out:
+	kfree(dsc);
+	return ret;
+}
+
+#if RE_HAS_SKCIPHER
+// the transform is synchronous, so the request can live on the stack
+#if RE_HAS_SYNC_SKCIPHER
+static int aes_ctr_skcipher(unsigned char *in_out, unsigned int in_len,
+		struct crypto_sync_skcipher *tfm, unsigned char *iv)
+{
+	SYNC_SKCIPHER_REQUEST_ON_STACK(req, tfm);
+#else
+static int aes_ctr_skcipher(unsigned char *in_out, unsigned int in_len,
+		struct crypto_skcipher *tfm, unsigned char *iv)
+{
+	SKCIPHER_REQUEST_ON_STACK(req, tfm);
+#endif
+	struct scatterlist sg;
+	int ret;
+
+	if (!in_len)
+		return 0;
+
+	sg_init_one(&sg, in_out, in_len);
+#if RE_HAS_SYNC_SKCIPHER
+	skcipher_request_set_sync_tfm(req, tfm);
+#else
+	skcipher_request_set_tfm(req, tfm);
+#endif
+	skcipher_request_set_callback(req, 0, NULL, NULL);
+	skcipher_request_set_crypt(req, &sg, &sg, in_len, iv);
+
+	ret = crypto_skcipher_encrypt(req);
+	skcipher_request_zero(req);
+
+	return ret;
+}
+#endif
+
 static int aes_f8_session_key_init(struct re_crypto_context *c, struct rtpengine_srtp *s) {
 	unsigned char m[16];
 	int i, ret;
@@ -2130,7 +2368,31 @@ static int gen_session_keys(struct re_crypto_context *c, struct rtpengine_srtp *
 	if (ret)
 		goto error;
 
-	if (c->cipher->tfm_name) {
+#if RE_HAS_SKCIPHER
+	if (c->cipher->skcipher_name) {
+		// synchronous only, as we run in softirq context. falls back to
+		// doing the block chaining ourselves if unavailable
+#if RE_HAS_SYNC_SKCIPHER
+		c->skcipher = crypto_alloc_sync_skcipher(c->cipher->skcipher_name, 0, CRYPTO_ALG_ASYNC);
+#else
+		c->skcipher = crypto_alloc_skcipher(c->cipher->skcipher_name, 0, CRYPTO_ALG_ASYNC);
+#endif
+		if (IS_ERR(c->skcipher))
+			c->skcipher = NULL;
+		else {
+			err = "failed to set skcipher key";
+#if RE_HAS_SYNC_SKCIPHER
+			ret = crypto_sync_skcipher_setkey(c->skcipher, c->session_key, s->session_key_len);
+#else
+			ret = crypto_skcipher_setkey(c->skcipher, c->session_key, s->session_key_len);
+#endif
+			if (ret)
+				goto error;
+		}
+	}
+#endif
+
+	if (c->cipher->tfm_name && !c->skcipher) {
 		err = "failed to load cipher";
 		c->tfm[0] = crypto_alloc_cipher(c->cipher->tfm_name, 0, CRYPTO_ALG_ASYNC);
 		if (IS_ERR(c->tfm[0])) {
@@ -2185,6 +2447,10 @@ static int gen_session_keys(struct re_crypto_context *c, struct rtpengine_srtp *
 		ret = crypto_shash_setkey(c->shash, c->session_auth_key, 20);
 		if (ret)
 			goto error;
+		err = "failed to prepare HMAC state";
+		ret = shash_state_init(c);
+		if (ret)
+			goto error;
 	}
 
 	switch(s->master_key_len) {
@@ -2277,33 +2543,28 @@ static void crypto_context_init(struct re_crypto_context *c, struct rtpengine_sr
 	c->hmac = &re_hmacs[s->hmac];
 }
 
-static int table_new_target(struct rtpengine_table *t, struct rtpengine_target_info *i) {
-	unsigned char hi, lo;
-	unsigned int rda_hash, rh_it;
+static struct rtpengine_target *target_new(struct rtpengine_table *t, struct rtpengine_target_info *i, int *errp) {
 	struct rtpengine_target *g;
-	struct re_dest_addr *rda;
-	struct re_bucket *b, *ba = NULL;
-	struct rtpengine_target *og = NULL;
-	int err;
-	unsigned long flags;
 	unsigned int u;
+	int err;
 
 	/* validation */
 
+	err = -EINVAL;
 	if (!is_valid_address(&i->local))
-		return -EINVAL;
+		goto fail;
 	if (i->num_destinations > RTPE_MAX_FORWARD_DESTINATIONS)
-		return -EINVAL;
+		goto fail;
 	if (!i->non_forwarding) {
 		if (!i->num_destinations)
-			return -EINVAL;
+			goto fail;
 	}
 	else {
 		if (i->num_destinations)
-			return -EINVAL;
+			goto fail;
 	}
 	if (validate_srtp(&i->decrypt))
-		return -EINVAL;
+		goto fail;
 
 	DBG("Creating new target\n");
 
@@ -2312,7 +2573,7 @@ static int table_new_target(struct rtpengine_table *t, struct rtpengine_target_i
 	err = -ENOMEM;
 	g = kzalloc(sizeof(*g), GFP_KERNEL);
 	if (!g)
-		goto fail1;
+		goto fail;
 
 	g->table = t->id;
 	atomic_set(&g->refcnt, 1);
@@ -2324,6 +2585,12 @@ static int table_new_target(struct rtpengine_table *t, struct rtpengine_target_i
 		g->ssrc_stats[u].lost_bits = -1;
 	rwlock_init(&g->outputs_lock);
 
+	err = -ENOMEM;
+	g->pcpu = __alloc_percpu(sizeof(*g->pcpu) + sizeof(*g->pcpu->rtp_stats) * i->num_payload_types,
+			__alignof__(*g->pcpu));
+	if (!g->pcpu)
+		goto fail2;
+
 	if (i->num_destinations) {
 		err = -ENOMEM;
 		g->outputs = kzalloc(sizeof(*g->outputs) * i->num_destinations, GFP_KERNEL);
@@ -2336,47 +2603,54 @@ static int table_new_target(struct rtpengine_table *t, struct rtpengine_target_i
 	if (err)
 		goto fail2;
 
-	/* find or allocate re_dest_addr */
+	return g;
 
-	rda_hash = re_address_hash(&i->local);
-	hi = (i->local.port & 0xff00) >> 8;
-	lo = i->local.port & 0xff;
+fail2:
+	target_put(g);
+fail:
+	*errp = err;
+	return NULL;
+}
 
-retry:
-	rh_it = rda_hash;
-	write_lock_irqsave(&t->target_lock, flags);
+// Must be called with target_lock held for writing. Links the target into the
+// table, consuming the spare re_dest_addr and re_bucket if new ones are needed.
+// The target must be fully set up as it becomes visible to lookups immediately.
+// Returns -EAGAIN if a spare is needed but not provided.
+static int target_insert_locked(struct rtpengine_table *t, struct rtpengine_target *g,
+		struct re_dest_addr **rda_spare, struct re_bucket **b_spare)
+{
+	const struct re_address *local = &g->target.local;
+	unsigned char hi, lo;
+	unsigned int rda_hash, rh_it;
+	struct re_dest_addr *rda;
+	struct re_bucket *b;
 
+	rda_hash = re_address_hash(local);
+	hi = (local->port & 0xff00) >> 8;
+	lo = local->port & 0xff;
+
+	/* find or allocate re_dest_addr */
+
+	rh_it = rda_hash;
 	rda = t->dest_addr_hash.addrs[rh_it];
 	while (rda) {
-		if (re_address_match(&rda->destination, &i->local))
+		if (re_address_match(&rda->destination, local))
 			goto got_rda;
 		rh_it++;
 		if (rh_it >= 256)
 			rh_it = 0;
-		err = -ENXIO;
 		if (rh_it == rda_hash)
-			goto fail4;
+			return -ENXIO;
 		rda = t->dest_addr_hash.addrs[rh_it];
 	}
 
-	write_unlock_irqrestore(&t->target_lock, flags);
+	if (!*rda_spare)
+		return -EAGAIN;
+	rda = *rda_spare;
+	*rda_spare = NULL;
 
-	rda = kzalloc(sizeof(*rda), GFP_KERNEL);
-	err = -ENOMEM;
-	if (!rda)
-		goto fail2;
-
-	memcpy(&rda->destination, &i->local, sizeof(rda->destination));
-
-	write_lock_irqsave(&t->target_lock, flags);
-
-	if (t->dest_addr_hash.addrs[rh_it]) {
-		write_unlock_irqrestore(&t->target_lock, flags);
-		kfree(rda);
-		goto retry;
-	}
-
-	t->dest_addr_hash.addrs[rh_it] = rda;
+	memcpy(&rda->destination, local, sizeof(rda->destination));
+	rcu_assign_pointer(t->dest_addr_hash.addrs[rh_it], rda);
 	re_bitfield_set(&t->dest_addr_hash.addrs_bf, rh_it);
 
 got_rda:
@@ -2385,61 +2659,69 @@ got_rda:
 	if ((b = rda->ports_hi[hi]))
 		goto got_bucket;
 
-	write_unlock_irqrestore(&t->target_lock, flags);
-
-	b = kzalloc(sizeof(*b), GFP_KERNEL);
-	err = -ENOMEM;
-	if (!b)
-		goto fail2;
+	if (!*b_spare)
+		return -EAGAIN;
+	b = *b_spare;
+	*b_spare = NULL;
 
-	write_lock_irqsave(&t->target_lock, flags);
-
-	if (!rda->ports_hi[hi]) {
-		rda->ports_hi[hi] = b;
-		re_bitfield_set(&rda->ports_hi_bf, hi);
-	}
-	else {
-		ba = b;
-		b = rda->ports_hi[hi];
-	}
+	rcu_assign_pointer(rda->ports_hi[hi], b);
+	re_bitfield_set(&rda->ports_hi_bf, hi);
 
 got_bucket:
-	err = -EEXIST;
 	if (b->ports_lo[lo])
-		goto fail4;
+		return -EEXIST;
 	re_bitfield_set(&b->ports_lo_bf, lo);
 	t->num_targets++;
 
-	b->ports_lo[lo] = g;
-	g = NULL;
-	write_unlock_irqrestore(&t->target_lock, flags);
-
-	if (ba)
-		kfree(ba);
-	if (og)
-		target_put(og);
+	rcu_assign_pointer(b->ports_lo[lo], g);
 
 	return 0;
+}
 
-fail4:
-	write_unlock_irqrestore(&t->target_lock, flags);
-	if (ba)
-		kfree(ba);
-fail2:
-	if (g->outputs)
-		kfree(g->outputs);
-	kfree(g);
-fail1:
-	return err;
+static int target_alloc_spares(struct re_dest_addr **rda_spare, struct re_bucket **b_spare) {
+	if (!*rda_spare)
+		*rda_spare = kzalloc(sizeof(**rda_spare), GFP_KERNEL);
+	if (!*b_spare)
+		*b_spare = kzalloc(sizeof(**b_spare), GFP_KERNEL);
+	if (!*rda_spare || !*b_spare)
+		return -ENOMEM;
+	return 0;
 }
 
-static int table_add_destination(struct rtpengine_table *t, struct rtpengine_destination_info *i) {
-	unsigned long flags;
-	int err;
+static int table_new_target(struct rtpengine_table *t, struct rtpengine_target_info *i) {
 	struct rtpengine_target *g;
+	struct re_dest_addr *rda = NULL;
+	struct re_bucket *b = NULL;
+	int err;
+	unsigned long flags;
 
-	// validate input
+	g = target_new(t, i, &err);
+	if (!g)
+		return err;
 
+	for (;;) {
+		write_lock_irqsave(&t->target_lock, flags);
+		err = target_insert_locked(t, g, &rda, &b);
+		write_unlock_irqrestore(&t->target_lock, flags);
+
+		if (err != -EAGAIN)
+			break;
+		err = target_alloc_spares(&rda, &b);
+		if (err)
+			break;
+	}
+
+	if (rda)
+		kfree(rda);
+	if (b)
+		kfree(b);
+	if (err)
+		target_put(g);
+
+	return err;
+}
+
+static int validate_destination(struct rtpengine_destination_info *i) {
 	if (!is_valid_address(&i->output.src_addr))
 		return -EINVAL;
 	if (!is_valid_address(&i->output.dst_addr))
@@ -2448,10 +2730,12 @@ static int table_add_destination(struct rtpengine_table *t, struct rtpengine_des
 		return -EINVAL;
 	if (validate_srtp(&i->output.encrypt))
 		return -EINVAL;
+	return 0;
+}
 
-	g = get_target(t, &i->local);
-	if (!g)
-		return -ENOENT;
+static int target_add_output(struct rtpengine_target *g, struct rtpengine_destination_info *i) {
+	unsigned long flags;
+	int err;
 
 	// ready to fill in
 
@@ -2492,41 +2776,209 @@ static int table_add_destination(struct rtpengine_table *t, struct rtpengine_des
 	if (err)
 		goto out;
 
+	// packet path checks this without the lock
+	smp_wmb();
 	g->outputs_unfilled--;
 
 	err = 0;
 
 out:
 	_w_unlock(&g->outputs_lock, flags);
+	return err;
+}
+
+static int table_add_destination(struct rtpengine_table *t, struct rtpengine_destination_info *i) {
+	int err;
+	struct rtpengine_target *g;
+
+	// validate input
+
+	err = validate_destination(i);
+	if (err)
+		return err;
+
+	g = get_target(t, &i->local);
+	if (!g)
+		return -ENOENT;
+
+	err = target_add_output(g, i);
+
 	target_put(g);
 	return err;
 }
 
+struct batch_op_state {
+	struct rtpengine_target		*g;		// new target, owned until linked
+	struct re_dest_addr		*rda;		// spare
+	struct re_bucket		*b;		// spare
+	struct rtpengine_target		*old_g;		// removed target
+	struct re_bucket		*old_b;		// emptied bucket
+	struct rtpengine_batch_op	*target_op;	// earlier op whose target this destination was added to
+};
 
+// Applies a list of target/destination operations with the same outcome as
+// applying them one by one in order. All targets are allocated and keyed up
+// front, and destinations are filled in right away: either into a target
+// created earlier in the same batch, before it becomes visible, or into the
+// one already in the table if no earlier op in the batch touches the same
+// address. Additions and deletions are then applied in order under a single
+// acquisition of the target lock. A destination added to a target that then
+// fails to be linked inherits the target's error. Per-operation results are
+// returned in the message itself.
+static int table_batch(struct rtpengine_table *t, struct rtpengine_message *msg, size_t buflen) {
+	struct rtpengine_batch_op *ops = (void *) msg->data;
+	unsigned int num = msg->u.batch.num_ops;
+	struct batch_op_state *st;
+	struct rtpengine_batch_op *op;
+	unsigned int n, k;
+	unsigned long flags;
 
+	if (!num || num > RTPE_MAX_BATCH_OPS)
+		return -EINVAL;
+	if (buflen != sizeof(*msg) + num * sizeof(*ops))
+		return -EMSGSIZE;
 
+	st = kcalloc(num, sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
 
-static struct rtpengine_target *get_target(struct rtpengine_table *t, const struct re_address *local) {
+	// phase one: allocate and prepare, no table locks held
+
+	for (n = 0; n < num; n++) {
+		op = &ops[n];
+		op->result = 0;
+
+		switch (op->cmd) {
+			case REMG_ADD_TARGET:
+				st[n].g = target_new(t, &op->u.target, &op->result);
+				if (!st[n].g)
+					break;
+				op->result = target_alloc_spares(&st[n].rda, &st[n].b);
+				break;
+
+			case REMG_DEL_TARGET:
+				if (!is_valid_address(&op->u.target.local))
+					op->result = -EINVAL;
+				break;
+
+			case REMG_ADD_DESTINATION:
+				op->result = validate_destination(&op->u.destination);
+				if (op->result)
+					break;
+				// look for the most recent matching target op in this batch
+				for (k = n; k-- > 0; ) {
+					if (ops[k].cmd != REMG_ADD_TARGET && ops[k].cmd != REMG_DEL_TARGET)
+						continue;
+					if (!re_address_match(&ops[k].u.target.local, &op->u.destination.local))
+						continue;
+					if (ops[k].cmd == REMG_DEL_TARGET || !st[k].g)
+						op->result = -ENOENT;
+					else if (ops[k].result)
+						op->result = ops[k].result;
+					else {
+						op->result = target_add_output(st[k].g, &op->u.destination);
+						st[n].target_op = &ops[k];
+					}
+					break;
+				}
+				// no earlier op for this address: the table entry is
+				// already in the state this op expects
+				if (k == (unsigned int) -1)
+					op->result = table_add_destination(t, &op->u.destination);
+				break;
+
+			default:
+				op->result = -EINVAL;
+				break;
+		}
+	}
+
+	// phase two: link and unlink under a single write lock
+
+	write_lock_irqsave(&t->target_lock, flags);
+
+	for (n = 0; n < num; n++) {
+		op = &ops[n];
+		if (op->result)
+			continue;
+
+		switch (op->cmd) {
+			case REMG_ADD_TARGET:
+				op->result = target_insert_locked(t, st[n].g, &st[n].rda, &st[n].b);
+				if (!op->result)
+					st[n].g = NULL;
+				break;
+
+			case REMG_DEL_TARGET:
+				st[n].old_g = target_remove_locked(t, &op->u.target.local, &st[n].old_b);
+				if (!st[n].old_g)
+					op->result = -ENOENT;
+				break;
+		}
+	}
+
+	write_unlock_irqrestore(&t->target_lock, flags);
+
+	// phase three: propagate link failures and clean up
+
+	for (n = 0; n < num; n++) {
+		op = &ops[n];
+
+		if (st[n].target_op && st[n].target_op->result && !op->result)
+			op->result = st[n].target_op->result;
+
+		if (st[n].g)
+			target_put(st[n].g);
+		if (st[n].old_g)
+			target_release(st[n].old_g);
+		if (st[n].rda)
+			kfree(st[n].rda);
+		if (st[n].b)
+			kfree(st[n].b);
+		if (st[n].old_b)
+			bucket_release(st[n].old_b);
+	}
+
+	kfree(st);
+
+	return 0;
+}
+
+
+
+
+
+// must be called with rcu_read_lock held; no reference is taken
+static struct rtpengine_target *get_target_rcu(struct rtpengine_table *t, const struct re_address *local) {
 	unsigned char hi, lo;
 	struct re_dest_addr *rda;
+	struct re_bucket *b;
+
+	hi = (local->port & 0xff00) >> 8;
+	lo = local->port & 0xff;
+
+	rda = find_dest_addr(&t->dest_addr_hash, local);
+	if (!rda)
+		return NULL;
+	b = rcu_dereference(rda->ports_hi[hi]);
+	if (!b)
+		return NULL;
+	return rcu_dereference(b->ports_lo[lo]);
+}
+
+static struct rtpengine_target *get_target(struct rtpengine_table *t, const struct re_address *local) {
 	struct rtpengine_target *r;
-	unsigned long flags;
 
 	if (!t)
 		return NULL;
 	if (!local)
 		return NULL;
 
-	hi = (local->port & 0xff00) >> 8;
-	lo = local->port & 0xff;
-
-	read_lock_irqsave(&t->target_lock, flags);
-
-	rda = find_dest_addr(&t->dest_addr_hash, local);
-	r = rda ? (rda->ports_hi[hi] ? rda->ports_hi[hi]->ports_lo[lo] : NULL) : NULL;
+	rcu_read_lock();
+	r = get_target_rcu(t, local);
 	if (r)
 		target_get(r);
-	read_unlock_irqrestore(&t->target_lock, flags);
+	rcu_read_unlock();
 
 	return r;
 }
@@ -3323,6 +3775,7 @@ static int proc_stream_open(struct inode *i, struct file *f) {
 		stream_put(stream);
 		return -ETXTBSY;
 	}
+	stream->readers++;
 	spin_unlock_irqrestore(&stream->packet_list_lock, flags);
 
 	return 0;
@@ -3331,12 +3784,16 @@ static int proc_stream_open(struct inode *i, struct file *f) {
 static int proc_stream_close(struct inode *i, struct file *f) {
 	unsigned int stream_idx = (unsigned int) (unsigned long) PDE_DATA(f->f_path.dentry->d_inode);
 	struct re_stream *stream;
+	unsigned long flags;
 
 	DBG("entering proc_stream_close()\n");
 
 	stream = get_stream_lock(NULL, stream_idx);
 	if (!stream)
 		return -EIO;
+	spin_lock_irqsave(&stream->packet_list_lock, flags);
+	stream->readers--;
+	spin_unlock_irqrestore(&stream->packet_list_lock, flags);
 	/* release our own ref and the ref from _open */
 	stream_put(stream);
 	stream_put(stream);
@@ -3349,7 +3806,176 @@ static int proc_stream_close(struct inode *i, struct file *f) {
 
 
 
-static void add_stream_packet(struct re_stream *stream, struct re_stream_packet *packet) {
+static int proc_ring_open(struct inode *i, struct file *f) {
+	uint32_t id = (uint32_t) (unsigned long) PDE_DATA(i);
+	struct rtpengine_table *t;
+	struct rtpengine_ring_header *ring;
+	unsigned long flags;
+	u32 size;
+	int err;
+
+	DBG("entering proc_ring_open()\n");
+
+	if ((err = proc_generic_open_modref(i, f)))
+		return err;
+
+	err = -ENOENT;
+	t = get_table(id);
+	if (!t)
+		goto fail;
+
+	size = roundup_pow_of_two(clamp_t(uint, ring_size, 64, 1 << 20) * 1024);
+	err = -ENOMEM;
+	ring = vmalloc_user(PAGE_SIZE + size);
+	if (!ring)
+		goto fail2;
+	ring->size = size;
+
+	/* only one consumer at a time */
+	spin_lock_irqsave(&t->ring_lock, flags);
+	if (t->ring) {
+		spin_unlock_irqrestore(&t->ring_lock, flags);
+		vfree(ring);
+		err = -EBUSY;
+		goto fail2;
+	}
+	t->ring = ring;
+	t->ring_data = (unsigned char *) ring + PAGE_SIZE;
+	t->ring_size = size;
+	t->ring_head = 0;
+	spin_unlock_irqrestore(&t->ring_lock, flags);
+
+	f->private_data = t; /* holds the reference */
+
+	return 0;
+
+fail2:
+	table_put(t);
+fail:
+	proc_generic_close_modref(i, f);
+	return err;
+}
+
+static int proc_ring_close(struct inode *i, struct file *f) {
+	struct rtpengine_table *t = f->private_data;
+	struct rtpengine_ring_header *ring;
+	unsigned long flags;
+
+	DBG("entering proc_ring_close()\n");
+
+	spin_lock_irqsave(&t->ring_lock, flags);
+	ring = t->ring;
+	t->ring = NULL;
+	t->ring_data = NULL;
+	spin_unlock_irqrestore(&t->ring_lock, flags);
+
+	/* pages still mapped somewhere are kept alive by their mappings */
+	vfree(ring);
+	table_put(t);
+
+	proc_generic_close_modref(i, f);
+
+	return 0;
+}
+
+static int proc_ring_mmap(struct file *f, struct vm_area_struct *vma) {
+	struct rtpengine_table *t = f->private_data;
+
+	return remap_vmalloc_range(vma, t->ring, vma->vm_pgoff);
+}
+
+static unsigned int proc_ring_poll(struct file *f, struct poll_table_struct *p) {
+	struct rtpengine_table *t = f->private_data;
+	unsigned long flags;
+	unsigned int ret = 0;
+
+	poll_wait(f, &t->ring_wq, p);
+
+	spin_lock_irqsave(&t->ring_lock, flags);
+	if (t->ring && READ_ONCE(t->ring->tail) != t->ring_head)
+		ret |= POLLIN | POLLRDNORM;
+	spin_unlock_irqrestore(&t->ring_lock, flags);
+
+	return ret;
+}
+
+/* returns -ENODEV if the table has no ring consumer, otherwise the packet has been
+ * consumed: copied into the ring or counted as dropped */
+static int ring_add_packet(struct rtpengine_table *t, struct re_stream *stream,
+		const struct re_stream_packet *packet)
+{
+	struct rtpengine_ring_record *rec;
+	const unsigned char *data;
+	unsigned int len;
+	unsigned long flags;
+	u32 off, reclen, pad;
+	u64 used;
+
+	if (packet->buflen) {
+		data = packet->buf;
+		len = packet->buflen;
+	}
+	else if (packet->skbuf) {
+		data = packet->skbuf->data;
+		len = packet->skbuf->len;
+	}
+	else
+		return -EINVAL;
+
+	reclen = ALIGN(sizeof(*rec) + len, RTPE_RING_ALIGN);
+
+	spin_lock_irqsave(&t->ring_lock, flags);
+
+	if (!t->ring) {
+		spin_unlock_irqrestore(&t->ring_lock, flags);
+		return -ENODEV;
+	}
+
+	off = t->ring_head & (t->ring_size - 1);
+	pad = 0;
+	if (off + reclen > t->ring_size)
+		pad = t->ring_size - off;
+
+	/* the tail is written by userspace and can't be trusted to be sane */
+	used = t->ring_head - READ_ONCE(t->ring->tail);
+	if (used > t->ring_size || reclen + pad > t->ring_size - used) {
+		t->ring->dropped++;
+		spin_unlock_irqrestore(&t->ring_lock, flags);
+		return 0;
+	}
+
+	if (pad) {
+		rec = (void *) (t->ring_data + off);
+		rec->len = pad;
+		rec->stream_idx = 0;
+		rec->data_len = 0;
+		rec->flags = RTPE_RING_F_PAD;
+		t->ring_head += pad;
+		off = 0;
+	}
+
+	rec = (void *) (t->ring_data + off);
+	rec->len = reclen;
+	rec->stream_idx = stream->info.stream_idx;
+	rec->data_len = len;
+	rec->flags = 0;
+	memcpy(rec->data, data, len);
+	t->ring_head += reclen;
+
+	/* record contents must be visible before the new head */
+	smp_wmb();
+	WRITE_ONCE(t->ring->head, t->ring_head);
+
+	spin_unlock_irqrestore(&t->ring_lock, flags);
+
+	wake_up_interruptible(&t->ring_wq);
+
+	return 0;
+}
+
+static void add_stream_packet(struct rtpengine_table *t, struct re_stream *stream,
+		struct re_stream_packet *packet)
+{
 	int err;
 	unsigned long flags;
 	LIST_HEAD(delete_list);
@@ -3364,6 +3990,13 @@ static void add_stream_packet(struct re_stream *stream, struct re_stream_packet
 	if (stream->eof)
 		goto err; /* we accept, but ignore/discard */
 
+	/* nobody has the stream's own file open: hand the packet to the ring if mapped */
+	if (!stream->readers && !ring_add_packet(t, stream, packet)) {
+		spin_unlock_irqrestore(&stream->packet_list_lock, flags);
+		free_packet(packet);
+		return;
+	}
+
 	DBG("adding packet to queue\n");
 	list_add_tail(&packet->list_entry, &stream->packet_list);
 	stream->list_count++;
@@ -3431,7 +4064,7 @@ static int stream_packet(struct rtpengine_table *t, const struct rtpengine_packe
 	packet->buflen = len;
 
 	/* append */
-	add_stream_packet(stream, packet);
+	add_stream_packet(t, stream, packet);
 
 	err = 0;
 	goto out2;
@@ -3539,6 +4172,10 @@ static inline ssize_t proc_control_read_write(struct file *file, char __user *ub
 			err = stream_packet(t, &msg->u.packet, msg->data, buflen - sizeof(*msg));
 			break;
 
+		case REMG_BATCH:
+			err = table_batch(t, msg, buflen);
+			break;
+
 		default:
 			printk(KERN_WARNING "xt_RTPENGINE unimplemented op %u\n", msg->cmd);
 			err = -EINVAL;
@@ -3552,7 +4189,7 @@ static inline ssize_t proc_control_read_write(struct file *file, char __user *ub
 
 	if (writeable) {
 		err = -EFAULT;
-		if (copy_to_user(ubuf, msg, sizeof(*msg)))
+		if (copy_to_user(ubuf, msg, (msg->cmd == REMG_BATCH) ? buflen : sizeof(*msg)))
 			goto out;
 	}
 
@@ -3901,32 +4538,42 @@ static int srtp_hash(unsigned char *hmac,
 		uint64_t pkt_idx)
 {
 	uint32_t roc;
+#if RE_HAS_SHASH_ON_STACK
+	SHASH_DESC_ON_STACK(dsc, c->shash);
+#else
 	struct shash_desc *dsc;
 	size_t alloc_size;
+#endif
+	int ret;
 
 	if (!s->auth_tag_len)
 		return 0;
 
 	roc = htonl((pkt_idx & 0xffffffff0000ULL) >> 16);
 
+#if !RE_HAS_SHASH_ON_STACK
 	alloc_size = sizeof(*dsc) + crypto_shash_descsize(c->shash);
 	dsc = kmalloc(alloc_size, GFP_ATOMIC);
 	if (!dsc)
 		return -1;
 	memset(dsc, 0, alloc_size);
+#endif
 
 	dsc->tfm = c->shash;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,1,0)
+	dsc->flags = 0;
+#endif
 
-	if (crypto_shash_init(dsc))
-		goto error;
+	// start out from the pre-keyed state
+	ret = -1;
+	if (crypto_shash_import(dsc, c->shash_state))
+		goto out;
 
 	crypto_shash_update(dsc, (void *) r->header, r->header_len + r->payload_len);
 	crypto_shash_update(dsc, (void *) &roc, sizeof(roc));
 
 	crypto_shash_final(dsc, hmac);
 
-	kfree(dsc);
-
 	DBG("calculated HMAC %02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x\n",
 			hmac[0], hmac[1], hmac[2], hmac[3],
 			hmac[4], hmac[5], hmac[6], hmac[7],
@@ -3934,11 +4581,15 @@ static int srtp_hash(unsigned char *hmac,
 			hmac[12], hmac[13], hmac[14], hmac[15],
 			hmac[16], hmac[17], hmac[18], hmac[19]);
 
-	return 0;
+	ret = 0;
 
-error:
+out:
+#if RE_HAS_SHASH_ON_STACK
+	memzero_explicit(dsc, sizeof(*dsc) + crypto_shash_descsize(c->shash));
+#else
 	kfree(dsc);
-	return -1;
+#endif
+	return ret;
 }
 
 /* XXX shared code */
@@ -4072,6 +4723,10 @@ static int srtp_encrypt_aes_cm(struct re_crypto_context *c,
 	ivi[2] ^= idxh;
 	ivi[3] ^= idxl;
 
+#if RE_HAS_SKCIPHER
+	if (c->skcipher)
+		return aes_ctr_skcipher(r->payload, r->payload_len, c->skcipher, iv);
+#endif
 	aes_ctr(r->payload, r->payload, r->payload_len, c->tfm[0], iv);
 
 	return 0;
@@ -4378,10 +5033,12 @@ static void rtp_stats(struct rtpengine_target *g, struct rtp_parsed *rtp, s64 ar
 	uint16_t seq = ntohs(rtp->header->seq_num);
 	uint32_t ts = ntohl(rtp->header->timestamp);
 
+	this_cpu_inc(g->pcpu->ssrc_stats[ssrc_idx].packets);
+	this_cpu_add(g->pcpu->ssrc_stats[ssrc_idx].bytes, rtp->payload_len);
+
+	// sequence and jitter tracking depend on packet order and stay serialised
 	spin_lock_irqsave(&g->ssrc_stats_lock, flags);
 
-	s->basic_stats.packets++;
-	s->basic_stats.bytes += rtp->payload_len;
 	s->timestamp = ts;
 
 	// track sequence numbers and lost frames
@@ -4451,6 +5108,19 @@ static void rtp_stats(struct rtpengine_target *g, struct rtp_parsed *rtp, s64 ar
 }
 
 
+static inline unsigned int delay_bucket(s64 ns) {
+	u64 us;
+	unsigned int bucket;
+
+	if (ns < 2000)
+		return 0;
+	us = div_u64(ns, 1000);
+	bucket = fls64(us) - 1;
+	if (bucket >= RTPE_NUM_DELAY_BUCKETS)
+		bucket = RTPE_NUM_DELAY_BUCKETS - 1;
+	return bucket;
+}
+
 static unsigned int rtpengine46(struct sk_buff *skb, struct rtpengine_table *t, struct re_address *src,
 		struct re_address *dst, uint8_t in_tos, const struct xt_action_param *par)
 {
@@ -4469,13 +5139,17 @@ static unsigned int rtpengine46(struct sk_buff *skb, struct rtpengine_table *t,
 	struct re_stream *stream;
 	struct re_stream_packet *packet;
 	const char *errstr = NULL;
-	unsigned long flags;
 	unsigned int i;
+	s64 rx_time = 0;
 
 #if (RE_HAS_MEASUREDELAY)
 	uint64_t starttime, endtime, delay;
 #endif
 
+	// software receive timestamp if the stack took one, otherwise ours
+	if (delay_stats)
+		rx_time = skb->tstamp ? ktime_to_ns(skb->tstamp) : ktime_to_ns(ktime_get_real());
+
 	skb_reset_transport_header(skb);
 	uh = udp_hdr(skb);
 	skb_pull(skb, sizeof(*uh));
@@ -4490,18 +5164,17 @@ static unsigned int rtpengine46(struct sk_buff *skb, struct rtpengine_table *t,
 	src->port = ntohs(uh->source);
 	dst->port = ntohs(uh->dest);
 
-	g = get_target(t, dst);
+	// the target remains valid until rcu_read_unlock() even if it gets
+	// removed from the table in the meantime
+	rcu_read_lock();
+	g = get_target_rcu(t, dst);
 	if (!g)
-		goto skip2;
+		goto skip1;
 
-	// all our outputs filled?
-	_r_lock(&g->outputs_lock, flags);
-	if (g->outputs_unfilled) {
-		// pass to application
-		_r_unlock(&g->outputs_lock, flags);
+	// all our outputs filled? pass to application if not
+	if (g->outputs_unfilled)
 		goto skip1;
-	}
-	_r_unlock(&g->outputs_lock, flags);
+	smp_rmb();
 
 	DBG("target found, src "MIPF" -> dst "MIPF"\n", MIPP(g->target.src_addr), MIPP(g->target.dst_addr));
 	DBG("target decrypt hmac and cipher are %s and %s", g->decrypt.hmac->name,
@@ -4615,7 +5288,7 @@ not_rtp:
 		packet->skbuf = intercept_skb_copy(skb, src);
 		if (!packet->skbuf)
 			goto no_intercept_free;
-		add_stream_packet(stream, packet);
+		add_stream_packet(t, stream, packet);
 		goto intercept_done;
 
 no_intercept_free:
@@ -4649,7 +5322,7 @@ no_intercept:
 			skb2 = skb_copy_expand(skb, MAX_HEADER, MAX_SKB_TAIL_ROOM, GFP_ATOMIC);
 			if (!skb2) {
 				log_err("out of memory while creating skb copy");
-				atomic64_inc(&g->stats.errors);
+				this_cpu_inc(g->pcpu->errors);
 				continue;
 			}
 		}
@@ -4673,18 +5346,27 @@ no_intercept:
 
 		err = send_proxy_packet(skb2, &o->output.src_addr, &o->output.dst_addr, o->output.tos, par);
 		if (err)
-			atomic64_inc(&g->stats.errors);
+			this_cpu_inc(g->pcpu->errors);
 	}
 
-	if (atomic64_read(&g->stats.packets)==0)
-		atomic_set(&g->stats.in_tos,in_tos);
+	if (rx_time) {
+		s64 fwd_delay = ktime_to_ns(ktime_get_real()) - rx_time;
+		this_cpu_inc(g->pcpu->delay_hist[delay_bucket(fwd_delay)]);
+		if (fwd_delay > 0)
+			this_cpu_add(g->pcpu->delay_hist_sum, div_u64(fwd_delay, 1000));
+	}
+
+	if (unlikely(!g->in_tos_set)) {
+		atomic_set(&g->in_tos, in_tos);
+		g->in_tos_set = 1;
+	}
 
-	atomic64_inc(&g->stats.packets);
-	atomic64_add(datalen, &g->stats.bytes);
+	this_cpu_inc(g->pcpu->packets);
+	this_cpu_add(g->pcpu->bytes, datalen);
 
 	if (rtp_pt_idx >= 0) {
-		atomic64_inc(&g->rtp_stats[rtp_pt_idx].packets);
-		atomic64_add(datalen, &g->rtp_stats[rtp_pt_idx].bytes);
+		this_cpu_inc(g->pcpu->rtp_stats[rtp_pt_idx].packets);
+		this_cpu_add(g->pcpu->rtp_stats[rtp_pt_idx].bytes, datalen);
 
 #if (RE_HAS_MEASUREDELAY)
 		starttime = ktime_to_ns(skb->tstamp);
@@ -4692,40 +5374,33 @@ no_intercept:
 
 		delay = endtime - starttime;
 
-		/* XXX needs locking - not atomic */
-		if (atomic64_read(&g->stats.packets)==1) {
-			g->stats.delay_min=delay;
-			g->stats.delay_avg=delay;
-			g->stats.delay_max=delay;
-		} else {
-			if (g->stats.delay_min > delay) {
-				g->stats.delay_min = delay;
-			}
-			if (g->stats.delay_max < delay) {
-				g->stats.delay_max = delay;
-			}
-
-			g->stats.delay_avg = g->stats.delay_avg * (atomic64_read(&g->stats.packets)-1);
-			g->stats.delay_avg = g->stats.delay_avg + delay;
-			g->stats.delay_avg = div64_u64(g->stats.delay_avg, atomic64_read(&g->stats.packets));
+		{
+			struct rtpengine_target_pcpu *pc = get_cpu_ptr(g->pcpu);
+			if (!pc->delay_count || pc->delay_min > delay)
+				pc->delay_min = delay;
+			if (pc->delay_max < delay)
+				pc->delay_max = delay;
+			pc->delay_total += delay;
+			pc->delay_count++;
+			put_cpu_ptr(g->pcpu);
 		}
 #endif
 	}
 	else if (rtp_pt_idx == -2)
 		/* not RTP */ ;
 	else if (rtp_pt_idx == -1)
-		atomic64_inc(&g->stats.errors);
+		this_cpu_inc(g->pcpu->errors);
 
-	target_put(g);
+	rcu_read_unlock();
 	table_put(t);
 
 	return NF_DROP;
 
 skip_error:
 	log_err("x_tables action failed: %s", errstr);
-	atomic64_inc(&g->stats.errors);
+	this_cpu_inc(g->pcpu->errors);
 skip1:
-	target_put(g);
+	rcu_read_unlock();
 skip2:
 	kfree_skb(skb);
 	table_put(t);
@@ -4932,6 +5607,9 @@ static void __exit fini(void) {
 
 	auto_array_free(&streams);
 	auto_array_free(&calls);
+
+	// wait for deferred target and bucket releases
+	rcu_barrier();
 }
 
 module_init(init);
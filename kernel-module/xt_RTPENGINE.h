@@ -6,6 +6,8 @@
 #define RTPE_NUM_PAYLOAD_TYPES 32
 #define RTPE_MAX_FORWARD_DESTINATIONS 32
 #define RTPE_NUM_SSRC_TRACKING 4
+#define RTPE_MAX_BATCH_OPS 16
+#define RTPE_NUM_DELAY_BUCKETS 24
 
 
 
@@ -20,6 +22,11 @@ struct rtpengine_stats {
 	uint64_t			delay_min;
 	uint64_t			delay_avg;
 	uint64_t			delay_max;
+	// receive to transmit delay, bucket N counts packets forwarded within
+	// [2^N, 2^(N+1)) us, except [0] includes anything faster and the last
+	// anything slower
+	uint64_t			delay_hist[RTPE_NUM_DELAY_BUCKETS];
+	uint64_t			delay_hist_sum; // us, of all packets in delay_hist
 	uint8_t            in_tos;
 };
 struct rtpengine_rtp_stats {
@@ -171,6 +178,10 @@ struct rtpengine_noop_info {
 	int				last_cmd;
 };
 
+struct rtpengine_batch_info {
+	unsigned int			num_ops;	// number of rtpengine_batch_op following the message
+};
+
 struct rtpengine_message {
 	enum {
 		/* noop_info: */
@@ -198,6 +209,9 @@ struct rtpengine_message {
 		REMG_GET_STATS,
 		REMG_GET_RESET_STATS,
 
+		/* batch_info, followed by rtpengine_batch_op[]: */
+		REMG_BATCH,
+
 		__REMG_LAST
 	}				cmd;
 
@@ -209,8 +223,44 @@ struct rtpengine_message {
 		struct rtpengine_stream_info	stream;
 		struct rtpengine_packet_info	packet;
 		struct rtpengine_stats_info	stats;
+		struct rtpengine_batch_info	batch;
+	} u;
+
+	unsigned char			data[];
+};
+
+struct rtpengine_batch_op {
+	unsigned int			cmd;		// REMG_ADD_TARGET, REMG_DEL_TARGET or REMG_ADD_DESTINATION
+	int				result;		// output: 0 or negative errno
+	union {
+		struct rtpengine_target_info	target;
+		struct rtpengine_destination_info destination;
 	} u;
+};
+
+// Layout of /proc/rtpengine/$ID/ring once mmap'd: the header occupies the first
+// page and the record area of `size` bytes follows. `head` and `tail` are
+// running byte counts, the offset into the record area being the count modulo
+// `size`. Records are aligned to RTPE_RING_ALIGN and never wrap; if one doesn't
+// fit before the end of the area, a pad record fills the remainder.
+#define RTPE_RING_ALIGN 16
+#define RTPE_RING_F_PAD 0x1
+
+struct rtpengine_ring_header {
+	uint32_t			size;
+	uint32_t			__pad0;
+	uint64_t			head;		// advanced by the module
+	uint64_t			__pad1[6];
+	uint64_t			tail;		// advanced by the consumer
+	uint64_t			__pad2[7];
+	uint64_t			dropped;	// records discarded while the ring was full
+};
 
+struct rtpengine_ring_record {
+	uint32_t			len;		// total, including this header and alignment
+	uint32_t			stream_idx;
+	uint32_t			data_len;
+	uint32_t			flags;
 	unsigned char			data[];
 };
 
@@ -565,6 +565,9 @@ static codec_def_t __codec_defs[] = {
 
 static GQueue __supplemental_codecs = G_QUEUE_INIT;
 const GQueue * const codec_supplemental_codecs = &__supplemental_codecs;
+struct codeclib_frame_stats codeclib_frame_stats;
+// estimated CPU time spent in decode/encode calls by the current thread
+__thread uint64_t codec_cost_thread_ns;
 static codec_def_t *codec_def_cn;
 
 
@@ -587,6 +590,64 @@ const codec_def_t *codec_find_by_av(enum AVCodecID id) {
 	return g_hash_table_lookup(codecs_ht_by_av, GINT_TO_POINTER(id));
 }
 
+const codec_def_t *codec_def_get(unsigned int idx) {
+	if (idx >= G_N_ELEMENTS(__codec_defs))
+		return NULL;
+	return &__codec_defs[idx];
+}
+
+static struct codec_cost *codec_def_cost(const codec_def_t *def) {
+	return (struct codec_cost *) &def->cost;
+}
+
+static void codec_cost_decay(struct codec_cost *cost) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	int64_t last = __atomic_load_n(&cost->decay_time, __ATOMIC_RELAXED);
+	if (ts.tv_sec - last < CODEC_COST_DECAY_SECS)
+		return;
+	if (!__atomic_compare_exchange_n(&cost->decay_time, &last, (int64_t) ts.tv_sec, false,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return; // another thread got there first
+
+	uint64_t *counters[] = { &cost->decode_ns, &cost->decode_media_us,
+		&cost->encode_ns, &cost->encode_media_us };
+	for (unsigned int i = 0; i < G_N_ELEMENTS(counters); i++) {
+		uint64_t val = __atomic_load_n(counters[i], __ATOMIC_RELAXED);
+		__atomic_sub_fetch(counters[i], val / 8, __ATOMIC_RELAXED);
+	}
+}
+
+// `start_ns` from codec_cost_start()
+void codec_cost_add(struct codec_cost *cost, uint64_t *ns_counter, uint64_t *media_counter,
+		uint64_t start_ns, unsigned long samples, int clockrate)
+{
+	if (!start_ns || clockrate <= 0)
+		return;
+	uint64_t ns = codec_cost_now() - start_ns;
+	codec_cost_thread_ns += ns * CODEC_COST_SAMPLE;
+	codec_cost_decay(cost);
+	__atomic_add_fetch(ns_counter, ns, __ATOMIC_RELAXED);
+	if (samples)
+		__atomic_add_fetch(media_counter, (uint64_t) samples * 1000000ULL / clockrate,
+				__ATOMIC_RELAXED);
+}
+
+// sum of average CPU loads of all active decoders and encoders, in millionths of a CPU core
+uint64_t codeclib_transcoding_load(void) {
+	uint64_t ret = 0;
+	for (int i = 0; i < G_N_ELEMENTS(__codec_defs); i++) {
+		codec_def_t *def = &__codec_defs[i];
+		int decs = g_atomic_int_get(&def->cost.active_decoders);
+		int encs = g_atomic_int_get(&def->cost.active_encoders);
+		if (decs > 0)
+			ret += decs * codec_decode_cost_ppm(def);
+		if (encs > 0)
+			ret += encs * codec_encode_cost_ppm(def);
+	}
+	return ret;
+}
+
 
 
 
@@ -676,6 +737,9 @@ decoder_t *decoder_new_fmtp(const codec_def_t *def, int clockrate, int channels,
 
 	decoder_switch_dtx(ret, dm);
 
+	ret->cost_active = true;
+	g_atomic_int_inc(&codec_def_cost(def)->active_decoders);
+
 	return ret;
 
 err:
@@ -742,11 +806,37 @@ void decoder_close(decoder_t *dec) {
 
 	decoder_switch_dtx(dec, -1);
 
+	if (dec->cost_active)
+		g_atomic_int_add(&codec_def_cost(dec->def)->active_decoders, -1);
+
 	resample_shutdown(&dec->resampler);
+	for (unsigned int i = 0; i < dec->num_spare_frames; i++)
+		av_frame_free(&dec->spare_frames[i]);
 	g_slice_free1(sizeof(*dec), dec);
 }
 
 
+static AVFrame *decoder_frame_get(decoder_t *dec) {
+	if (dec->num_spare_frames) {
+		codeclib_frame_stats_inc(&codeclib_frame_stats.frame_reuses);
+		return dec->spare_frames[--dec->num_spare_frames];
+	}
+	codeclib_frame_stats_inc(&codeclib_frame_stats.frame_allocs);
+	return av_frame_alloc();
+}
+// takes ownership of the frame and keeps it around for the next decoder_frame_get()
+static void decoder_frame_put(decoder_t *dec, AVFrame **frame) {
+	if (!*frame)
+		return;
+	if (dec->num_spare_frames >= G_N_ELEMENTS(dec->spare_frames)) {
+		av_frame_free(frame);
+		return;
+	}
+	av_frame_unref(*frame);
+	dec->spare_frames[dec->num_spare_frames++] = *frame;
+	*frame = NULL;
+}
+
 static int avc_decoder_input(decoder_t *dec, const str *data, GQueue *out) {
 	if (!dec->u.avc.avpkt)
 		return -1; // decoder shut down
@@ -766,7 +856,8 @@ static int avc_decoder_input(decoder_t *dec, const str *data, GQueue *out) {
 		keep_going = 0;
 		int got_frame = 0;
 		err = "failed to alloc av frame";
-		frame = av_frame_alloc();
+		if (!frame)
+			frame = decoder_frame_get(dec);
 		if (!frame)
 			goto err;
 
@@ -841,7 +932,7 @@ static int avc_decoder_input(decoder_t *dec, const str *data, GQueue *out) {
 		}
 	} while (keep_going);
 
-	av_frame_free(&frame);
+	decoder_frame_put(dec, &frame);
 	return 0;
 
 err:
@@ -886,6 +977,8 @@ static int __decoder_input_data(decoder_t *dec, const str *data, unsigned long t
 	}
 	dec->rtp_ts = ts;
 
+	uint64_t cpu_start = codec_cost_start(&dec->cost_countdown);
+
 	if (data)
 		dec->def->codec_type->decoder_input(dec, data, &frames);
 	else
@@ -894,8 +987,19 @@ static int __decoder_input_data(decoder_t *dec, const str *data, unsigned long t
 	AVFrame *frame;
 	int ret = 0;
 	unsigned long samples = 0;
-	while ((frame = g_queue_pop_head(&frames))) {
+
+	for (GList *l = frames.head; l; l = l->next) {
+		frame = l->data;
 		samples += frame->nb_samples;
+	}
+
+	if (cpu_start) {
+		struct codec_cost *cost = codec_def_cost(dec->def);
+		codec_cost_add(cost, &cost->decode_ns, &cost->decode_media_us, cpu_start, samples,
+				dec->in_format.clockrate);
+	}
+
+	while ((frame = g_queue_pop_head(&frames))) {
 		dec->dec_out_format.format = frame->format;
 		AVFrame *rsmp_frame = resample_frame(&dec->resampler, frame, &dec->dest_format);
 		if (!rsmp_frame) {
@@ -906,7 +1010,7 @@ static int __decoder_input_data(decoder_t *dec, const str *data, unsigned long t
 			if (callback(dec, rsmp_frame, u1, u2))
 				ret = -1;
 		}
-		av_frame_free(&frame);
+		decoder_frame_put(dec, &frame);
 	}
 
 	if (ptime)
@@ -1326,6 +1430,9 @@ int encoder_config_fmtp(encoder_t *enc, const codec_def_t *def, int bitrate, int
 	if (err)
 		goto err;
 
+	enc->cost_def = def;
+	g_atomic_int_inc(&codec_def_cost(def)->active_encoders);
+
 // output frame and fifo
 	enc->frame = av_frame_alloc();
 
@@ -1371,6 +1478,10 @@ void encoder_close(encoder_t *enc) {
 		return;
 	if (enc->def && enc->def->codec_type && enc->def->codec_type->encoder_close)
 		enc->def->codec_type->encoder_close(enc);
+	if (enc->cost_def) {
+		g_atomic_int_add(&codec_def_cost(enc->cost_def)->active_encoders, -1);
+		enc->cost_def = NULL;
+	}
 	format_init(&enc->requested_format);
 	format_init(&enc->actual_format);
 	av_audio_fifo_free(enc->fifo);
@@ -1470,10 +1581,19 @@ int encoder_input_data(encoder_t *enc, AVFrame *frame,
 		if (!enc->def->codec_type->encoder_input)
 			break;
 
+		unsigned long samples = frame ? frame->nb_samples : 0;
+		uint64_t cpu_start = codec_cost_start(&enc->cost_countdown);
+
 		int ret = enc->def->codec_type->encoder_input(enc, &frame);
 		if (ret < 0)
 			return -1;
 
+		if (cpu_start) {
+			struct codec_cost *cost = codec_def_cost(enc->def);
+			codec_cost_add(cost, &cost->encode_ns, &cost->encode_media_us, cpu_start, samples,
+					enc->actual_format.clockrate);
+		}
+
 		if (enc->avpkt->size) {
 			// don't rely on the encoder producing steady timestamps,
 			// instead keep track of them ourselves based on the returned
@@ -4,6 +4,7 @@
 
 struct codec_def_s;
 struct packet_sequencer_s;
+struct resample_fast;
 typedef struct codec_def_s codec_def_t;
 typedef struct packet_sequencer_s packet_sequencer_t;
 
@@ -39,9 +40,11 @@ INLINE enum media_type codec_get_type(const str *type) {
 
 
 #include <stdbool.h>
+#include <time.h>
 #include <libswresample/swresample.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/audio_fifo.h>
+#include <libavutil/buffer.h>
 #ifdef HAVE_BCG729
 #include <bcg729/encoder.h>
 #include <bcg729/decoder.h>
@@ -127,6 +130,22 @@ enum dtx_method {
 	NUM_DTX_METHODS
 };
 
+#define CODEC_COST_SAMPLE 16 // CPU time is measured for one in this many decode/encode calls
+#define CODEC_COST_DECAY_SECS 2 // older measurements lose 1/8 of their weight this often
+
+// CPU time spent in sampled decode/encode calls for one codec, shared by all threads.
+// Media time is kept in microseconds so that instances with different clock rates
+// can be aggregated. Both sums decay over time, so their ratio follows the recent cost.
+struct codec_cost {
+	uint64_t decode_ns;
+	uint64_t decode_media_us;
+	uint64_t encode_ns;
+	uint64_t encode_media_us;
+	int64_t decay_time; // seconds
+	int active_decoders;
+	int active_encoders;
+};
+
 struct codec_def_s {
 	const char * const rtpname;
 	int clockrate_mult;
@@ -166,6 +185,9 @@ struct codec_def_s {
 	// libavcodec
 	const AVCodec *encoder;
 	const AVCodec *decoder;
+
+	// runtime CPU cost accounting, see codec_cost_add()
+	struct codec_cost cost;
 };
 
 struct format_s {
@@ -176,7 +198,18 @@ struct format_s {
 
 struct resample_s {
 	SwrContext *swresample;
+	struct resample_fast *fast; // built-in resampler, used instead of swresample if set
 	bool no_filter;
+	AVBufferPool *buffer_pool; // output frame buffers, sized for the first resampled frame
+	int buffer_pool_size;
+};
+
+// counters for the decode/resample frame pipeline, shared by all threads
+struct codeclib_frame_stats {
+	uint64_t frame_allocs; // AVFrame structs allocated from the heap
+	uint64_t frame_reuses; // AVFrame structs recycled from a decoder
+	uint64_t buffer_allocs; // sample buffers allocated from the heap
+	uint64_t buffer_gets; // sample buffers handed out by a pool, including newly allocated ones
 };
 
 enum codec_event {
@@ -237,6 +270,13 @@ struct decoder_s {
 	uint64_t pts;
 	int ptime;
 
+	// recycled for the next decoder outputs: one for the frame handed out, one for the
+	// receive attempt that comes back empty
+	AVFrame *spare_frames[2];
+	unsigned int num_spare_frames;
+	bool cost_active; // counted in def->cost.active_decoders
+	unsigned int cost_countdown; // calls until the next CPU time sample
+
 	int (*event_func)(enum codec_event event, void *ptr, void *event_data);
 	void *event_data;
 };
@@ -277,6 +317,8 @@ struct encoder_s {
 	int samples_per_packet; // for frame packetizer
 	AVFrame *frame; // to pull samples from the fifo
 	int64_t mux_dts; // last dts passed to muxer
+	const codec_def_t *cost_def; // counted in cost_def->cost.active_encoders
+	unsigned int cost_countdown; // calls until the next CPU time sample
 };
 
 struct seq_packet_s {
@@ -292,9 +334,15 @@ struct packet_sequencer_s {
 
 
 extern const GQueue * const codec_supplemental_codecs;
+extern struct codeclib_frame_stats codeclib_frame_stats;
+extern __thread uint64_t codec_cost_thread_ns;
 
 
 void codeclib_init(int);
+const codec_def_t *codec_def_get(unsigned int idx);
+uint64_t codeclib_transcoding_load(void);
+void codec_cost_add(struct codec_cost *cost, uint64_t *ns_counter, uint64_t *media_counter,
+		uint64_t start_ns, unsigned long samples, int clockrate);
 void codeclib_free(void);
 
 
@@ -375,6 +423,39 @@ INLINE char *av_error(int no) {
 	av_strerror(no, buf, THREAD_BUF_SIZE);
 	return buf;
 }
+INLINE void codeclib_frame_stats_inc(uint64_t *counter) {
+	__atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+INLINE uint64_t codeclib_frame_stats_get(const uint64_t *counter) {
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+INLINE uint64_t codec_cost_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+// returns the start time if this call is to be measured, 0 otherwise
+INLINE uint64_t codec_cost_start(unsigned int *countdown) {
+	if (G_LIKELY(*countdown)) {
+		(*countdown)--;
+		return 0;
+	}
+	*countdown = CODEC_COST_SAMPLE - 1;
+	return codec_cost_now();
+}
+// average CPU load of one instance, in millionths of a CPU core
+INLINE uint64_t codec_cost_ppm(const uint64_t *ns_counter, const uint64_t *media_counter) {
+	uint64_t media_us = __atomic_load_n(media_counter, __ATOMIC_RELAXED);
+	if (!media_us)
+		return 0;
+	return __atomic_load_n(ns_counter, __ATOMIC_RELAXED) * 1000 / media_us;
+}
+INLINE uint64_t codec_decode_cost_ppm(const codec_def_t *def) {
+	return codec_cost_ppm(&def->cost.decode_ns, &def->cost.decode_media_us);
+}
+INLINE uint64_t codec_encode_cost_ppm(const codec_def_t *def) {
+	return codec_cost_ppm(&def->cost.encode_ns, &def->cost.encode_media_us);
+}
 INLINE int decoder_event(decoder_t *dec, enum codec_event event, void *ptr) {
 	if (!dec)
 		return 0;
@@ -409,6 +490,12 @@ INLINE void codeclib_free(void) {
 INLINE const codec_def_t *codec_find(const str *name, enum media_type type) {
 	return NULL;
 }
+INLINE const codec_def_t *codec_def_get(unsigned int idx) {
+	return NULL;
+}
+INLINE uint64_t codeclib_transcoding_load(void) {
+	return 0;
+}
 INLINE void packet_sequencer_destroy(packet_sequencer_t *p) {
 	return;
 }
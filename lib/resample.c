@@ -9,11 +9,328 @@
 #include <libswresample/swresample.h>
 #include <libavutil/opt.h>
 #include <libavutil/frame.h>
+#include <math.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "log.h"
 #include "codeclib.h"
 #include "fix_frame_channel_layout.h"
 
 
+#if LIBAVUTIL_VERSION_MAJOR >= 57
+typedef size_t buffer_pool_size_t;
+#else
+typedef int buffer_pool_size_t;
+#endif
+
+
+// Built-in polyphase resampler for mono S16 audio and integer ratios between the common
+// telephony sample rates (8, 16, 48 kHz). The filter is centred on the output sample in the
+// same way as swresample's default filter, so that the number of output samples and their
+// timing are the same as when going through swresample.
+
+#define RSF_HALF_WIDTH		16 // filter half width in samples at the lower rate
+#define RSF_COEFF_SHIFT		14 // Q14 coefficients, unity gain must be representable
+
+struct resample_fast_filter {
+	unsigned int ratio;
+	unsigned int taps; // per output sample, multiple of 16
+	int16_t *down; // [taps]
+	int16_t *up; // [ratio][taps]
+};
+
+struct resample_fast {
+	const struct resample_fast_filter *filter;
+	bool up;
+	int16_t *buf; // input history plus new samples
+	unsigned int buf_len;
+	unsigned int buf_size;
+	unsigned int pos; // index into buf of the input sample aligned with the next output
+	unsigned int phase; // upsampling: sub-sample position of the next output
+};
+
+static const unsigned int rsf_ratios[] = { 2, 3, 6 };
+static struct resample_fast_filter rsf_filters[G_N_ELEMENTS(rsf_ratios)];
+static pthread_once_t rsf_filters_once = PTHREAD_ONCE_INIT;
+
+int resample_fast_path;
+
+
+// Blackman-windowed sinc low-pass at the higher rate, `d` in samples at the higher rate
+static double rsf_prototype(unsigned int ratio, int d) {
+	double width = RSF_HALF_WIDTH * ratio;
+	if (d <= -width || d >= width)
+		return 0;
+	double fc = 0.9 / ratio; // cutoff relative to the higher rate's Nyquist frequency
+	double x = M_PI * fc * d;
+	double sinc = d ? sin(x) / x : 1.0;
+	double w = 0.42 + 0.5 * cos(M_PI * d / width) + 0.08 * cos(2.0 * M_PI * d / width);
+	return fc * sinc * w;
+}
+
+static void rsf_quantise(int16_t *out, const double *in, unsigned int num) {
+	double sum = 0;
+	for (unsigned int i = 0; i < num; i++)
+		sum += in[i];
+	// normalise to unity DC gain
+	for (unsigned int i = 0; i < num; i++)
+		out[i] = lrint(in[i] / sum * (1 << RSF_COEFF_SHIFT));
+}
+
+static void rsf_filters_init(void) {
+	for (unsigned int i = 0; i < G_N_ELEMENTS(rsf_ratios); i++) {
+		struct resample_fast_filter *f = &rsf_filters[i];
+		unsigned int ratio = rsf_ratios[i];
+		f->ratio = ratio;
+		f->taps = RSF_HALF_WIDTH * ratio * 2;
+
+		// downsampling: taps cover input samples [pos - width + 1, pos + width]
+		double tmp[f->taps];
+		f->down = g_new(int16_t, f->taps);
+		for (unsigned int t = 0; t < f->taps; t++)
+			tmp[t] = rsf_prototype(ratio, (int) t - RSF_HALF_WIDTH * ratio + 1);
+		rsf_quantise(f->down, tmp, f->taps);
+
+		// upsampling: one set of taps per phase, covering input samples
+		// [pos - half width + 1, pos + half width]. The taps are padded to the same
+		// length as the downsampling filter to keep the vector kernels simple.
+		f->up = g_new0(int16_t, ratio * f->taps);
+		for (unsigned int r = 0; r < ratio; r++) {
+			memset(tmp, 0, sizeof(tmp));
+			for (unsigned int t = 0; t < RSF_HALF_WIDTH * 2; t++)
+				tmp[t] = rsf_prototype(ratio, (int) r - ((int) t - RSF_HALF_WIDTH + 1) * (int) ratio);
+			rsf_quantise(&f->up[r * f->taps], tmp, RSF_HALF_WIDTH * 2);
+		}
+	}
+}
+
+static const struct resample_fast_filter *rsf_filter(int from_rate, int to_rate, bool *up) {
+	if (from_rate <= 0 || to_rate <= 0)
+		return NULL;
+	int lo = MIN(from_rate, to_rate);
+	int hi = MAX(from_rate, to_rate);
+	if (hi % lo)
+		return NULL;
+	if (lo % 8000)
+		return NULL;
+	unsigned int ratio = hi / lo;
+	for (unsigned int i = 0; i < G_N_ELEMENTS(rsf_ratios); i++) {
+		if (rsf_ratios[i] != ratio)
+			continue;
+		pthread_once(&rsf_filters_once, rsf_filters_init);
+		*up = to_rate > from_rate;
+		return &rsf_filters[i];
+	}
+	return NULL;
+}
+
+
+// dot product of `num` samples and coefficients, `num` must be a multiple of 16
+#if defined(__AVX2__)
+static int32_t rsf_dot(const int16_t *x, const int16_t *c, unsigned int num) {
+	__m256i acc = _mm256_setzero_si256();
+	for (unsigned int i = 0; i < num; i += 16) {
+		__m256i xv = _mm256_loadu_si256((const __m256i *) (x + i));
+		__m256i cv = _mm256_loadu_si256((const __m256i *) (c + i));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(xv, cv));
+	}
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(s);
+}
+#elif defined(__SSE2__)
+static int32_t rsf_dot(const int16_t *x, const int16_t *c, unsigned int num) {
+	__m128i acc0 = _mm_setzero_si128();
+	__m128i acc1 = _mm_setzero_si128();
+	for (unsigned int i = 0; i < num; i += 16) {
+		acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) (x + i)),
+					_mm_loadu_si128((const __m128i *) (c + i))));
+		acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) (x + i + 8)),
+					_mm_loadu_si128((const __m128i *) (c + i + 8))));
+	}
+	__m128i s = _mm_add_epi32(acc0, acc1);
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(s);
+}
+#else
+static int32_t rsf_dot(const int16_t *x, const int16_t *c, unsigned int num) {
+	int32_t acc = 0;
+	for (unsigned int i = 0; i < num; i++)
+		acc += (int32_t) x[i] * c[i];
+	return acc;
+}
+#endif
+
+static inline int16_t rsf_sample(int32_t acc) {
+	acc = (acc + (1 << (RSF_COEFF_SHIFT - 1))) >> RSF_COEFF_SHIFT;
+	if (acc > INT16_MAX)
+		return INT16_MAX;
+	if (acc < INT16_MIN)
+		return INT16_MIN;
+	return acc;
+}
+
+static struct resample_fast *resample_fast_new(const struct resample_fast_filter *filter, bool up) {
+	struct resample_fast *rf = g_slice_alloc0(sizeof(*rf));
+	rf->filter = filter;
+	rf->up = up;
+	// zero history so that the first output is aligned with the first input sample
+	rf->pos = up ? RSF_HALF_WIDTH - 1 : RSF_HALF_WIDTH * filter->ratio - 1;
+	rf->buf_len = rf->pos;
+	rf->buf_size = filter->taps * 4;
+	rf->buf = g_malloc0(rf->buf_size * sizeof(*rf->buf));
+	return rf;
+}
+
+static void resample_fast_free(struct resample_fast **rfp) {
+	struct resample_fast *rf = *rfp;
+	if (!rf)
+		return;
+	g_free(rf->buf);
+	g_slice_free1(sizeof(*rf), rf);
+	*rfp = NULL;
+}
+
+static unsigned int resample_fast_avail(struct resample_fast *rf) {
+	unsigned int ratio = rf->filter->ratio;
+	if (rf->up) {
+		// needs input samples up to pos + half width
+		if (rf->pos + RSF_HALF_WIDTH >= rf->buf_len)
+			return 0;
+		return (rf->buf_len - RSF_HALF_WIDTH - rf->pos) * ratio - rf->phase;
+	}
+	if (rf->pos + RSF_HALF_WIDTH * ratio >= rf->buf_len)
+		return 0;
+	return (rf->buf_len - 1 - RSF_HALF_WIDTH * ratio - rf->pos) / ratio + 1;
+}
+
+static void resample_fast_run(struct resample_fast *rf, int16_t *out, unsigned int num) {
+	const struct resample_fast_filter *f = rf->filter;
+
+	if (rf->up) {
+		for (unsigned int i = 0; i < num; i++) {
+			const int16_t *x = &rf->buf[rf->pos - RSF_HALF_WIDTH + 1];
+			// only the first 2 * half width taps of each phase are used
+			out[i] = rsf_sample(rsf_dot(x, &f->up[rf->phase * f->taps], RSF_HALF_WIDTH * 2));
+			if (++rf->phase == f->ratio) {
+				rf->phase = 0;
+				rf->pos++;
+			}
+		}
+	}
+	else {
+		unsigned int width = RSF_HALF_WIDTH * f->ratio;
+		for (unsigned int i = 0; i < num; i++) {
+			out[i] = rsf_sample(rsf_dot(&rf->buf[rf->pos - width + 1], f->down, f->taps));
+			rf->pos += f->ratio;
+		}
+	}
+
+	// drop input samples that are no longer needed
+	unsigned int keep_from = rf->pos - (rf->up ? RSF_HALF_WIDTH - 1 : RSF_HALF_WIDTH * f->ratio - 1);
+	if (keep_from > rf->buf_len)
+		keep_from = rf->buf_len;
+	memmove(rf->buf, &rf->buf[keep_from], (rf->buf_len - keep_from) * sizeof(*rf->buf));
+	rf->buf_len -= keep_from;
+	rf->pos -= keep_from;
+}
+
+static AVFrame *resample_fast_frame(resample_t *resample, AVFrame *frame, const format_t *to_format,
+		const CH_LAYOUT_T *to_channel_layout)
+{
+	struct resample_fast *rf = resample->fast;
+
+	if (rf->buf_len + frame->nb_samples > rf->buf_size) {
+		rf->buf_size = rf->buf_len + frame->nb_samples + rf->filter->taps;
+		rf->buf = g_realloc(rf->buf, rf->buf_size * sizeof(*rf->buf));
+	}
+	memcpy(&rf->buf[rf->buf_len], frame->extended_data[0], frame->nb_samples * sizeof(*rf->buf));
+	rf->buf_len += frame->nb_samples;
+
+	AVFrame *out = av_frame_alloc();
+	codeclib_frame_stats_inc(&codeclib_frame_stats.frame_allocs);
+	if (!out)
+		return NULL;
+	av_frame_copy_props(out, frame);
+	out->format = to_format->format;
+	out->CH_LAYOUT = *to_channel_layout;
+	unsigned int num = resample_fast_avail(rf);
+	out->nb_samples = num ? : 1; // buffer can't be empty
+	out->sample_rate = to_format->clockrate;
+	if (resample_frame_get_buffer(resample, out, 1) < 0) {
+		av_frame_free(&out);
+		return NULL;
+	}
+
+	resample_fast_run(rf, (int16_t *) out->extended_data[0], num);
+	out->nb_samples = num;
+
+	out->pts = av_rescale(frame->pts, to_format->clockrate, frame->sample_rate);
+	return out;
+}
+
+static bool resample_fast_setup(resample_t *resample, AVFrame *frame, const format_t *to_format,
+		const CH_LAYOUT_T *to_channel_layout)
+{
+	if (!resample_fast_path || resample->no_filter)
+		return false;
+	if (frame->format != AV_SAMPLE_FMT_S16 || to_format->format != AV_SAMPLE_FMT_S16)
+		return false;
+	if (to_format->channels != 1 || !CH_LAYOUT_EQ(frame->CH_LAYOUT, *to_channel_layout))
+		return false;
+
+	bool up;
+	const struct resample_fast_filter *filter = rsf_filter(frame->sample_rate, to_format->clockrate, &up);
+	if (!filter)
+		return false;
+
+	resample->fast = resample_fast_new(filter, up);
+	return true;
+}
+
+
+
+static AVBufferRef *resample_buffer_alloc(buffer_pool_size_t size) {
+	codeclib_frame_stats_inc(&codeclib_frame_stats.buffer_allocs);
+	return av_buffer_alloc(size);
+}
+
+// like av_frame_get_buffer() but recycles buffers through a pool owned by the resampler, so that
+// the steady state doesn't touch the heap. Buffers outlive the pool if needed.
+static int resample_frame_get_buffer(resample_t *resample, AVFrame *frame, int channels) {
+	if (channels > AV_NUM_DATA_POINTERS)
+		return av_frame_get_buffer(frame, 0);
+
+	int linesize;
+	int size = av_samples_get_buffer_size(&linesize, channels, frame->nb_samples, frame->format, 0);
+	if (size < 0)
+		return size;
+
+	if (!resample->buffer_pool || size > resample->buffer_pool_size) {
+		av_buffer_pool_uninit(&resample->buffer_pool);
+		// leave some headroom as the number of output samples varies slightly
+		resample->buffer_pool_size = size + size / 8;
+		resample->buffer_pool = av_buffer_pool_init(resample->buffer_pool_size, resample_buffer_alloc);
+		if (!resample->buffer_pool)
+			return AVERROR(ENOMEM);
+	}
+
+	frame->buf[0] = av_buffer_pool_get(resample->buffer_pool);
+	if (!frame->buf[0])
+		return AVERROR(ENOMEM);
+	codeclib_frame_stats_inc(&codeclib_frame_stats.buffer_gets);
+
+	int ret = av_samples_fill_arrays(frame->data, &frame->linesize[0], frame->buf[0]->data,
+			channels, frame->nb_samples, frame->format, 0);
+	if (ret < 0)
+		return ret;
+	frame->extended_data = frame->data;
+	return 0;
+}
 
 
 AVFrame *resample_frame(resample_t *resample, AVFrame *frame, const format_t *to_format) {
@@ -35,7 +352,13 @@ AVFrame *resample_frame(resample_t *resample, AVFrame *frame, const format_t *to
 
 resample:
 
+	if (resample->fast)
+		return resample_fast_frame(resample, frame, to_format, &to_channel_layout);
+
 	if (G_UNLIKELY(!resample->swresample)) {
+		if (resample_fast_setup(resample, frame, to_format, &to_channel_layout))
+			return resample_fast_frame(resample, frame, to_format, &to_channel_layout);
+
 		SWR_ALLOC_SET_OPTS(&resample->swresample,
 				to_channel_layout,
 				to_format->format,
@@ -64,6 +387,7 @@ resample:
 				to_format->clockrate, frame->sample_rate, AV_ROUND_UP);
 
 	AVFrame *swr_frame = av_frame_alloc();
+	codeclib_frame_stats_inc(&codeclib_frame_stats.frame_allocs);
 
 	err = "failed to alloc resampling frame";
 	if (!swr_frame)
@@ -74,7 +398,7 @@ resample:
 	swr_frame->nb_samples = dst_samples;
 	swr_frame->sample_rate = to_format->clockrate;
 	err = "failed to get resample buffers";
-	if ((errcode = av_frame_get_buffer(swr_frame, 0)) < 0)
+	if ((errcode = resample_frame_get_buffer(resample, swr_frame, to_format->channels)) < 0)
 		goto err;
 
 	int ret_samples = swr_convert(resample->swresample, swr_frame->extended_data,
@@ -101,4 +425,7 @@ err:
 
 void resample_shutdown(resample_t *resample) {
 	swr_free(&resample->swresample);
+	resample_fast_free(&resample->fast);
+	av_buffer_pool_uninit(&resample->buffer_pool);
+	resample->buffer_pool_size = 0;
 }
@@ -6,6 +6,8 @@
 #include <libavutil/frame.h>
 
 
+extern int resample_fast_path;
+
 AVFrame *resample_frame(resample_t *resample, AVFrame *frame, const format_t *to_format);
 void resample_shutdown(resample_t *resample);
 
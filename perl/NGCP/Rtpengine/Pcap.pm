@@ -0,0 +1,50 @@
+package NGCP::Rtpengine::Pcap;
+
+use strict;
+use warnings;
+use Net::Pcap;
+
+# Reads all IPv4 UDP packets from a pcap file, in capture order. Each one is
+# returned as a hash with the raw IP packet (`ip`), the IP source address as
+# a number (`src`) and the UDP header fields along with the UDP payload
+# (`udp`). Anything else found in the capture is skipped.
+sub read_udp {
+	my ($file) = @_;
+
+	my $err;
+	my $p = pcap_open_offline($file, \$err) or die $err;
+	my $linktype = pcap_datalink($p);
+
+	my @ret;
+	my $cb = sub {
+		my ($user_data, $header, $packet) = @_;
+		my %eth;
+		if ($linktype == DLT_EN10MB) {
+			@eth{qw(src dst type rest)} = unpack('a6 a6 n a*', $packet);
+		}
+		elsif ($linktype == DLT_LINUX_SLL) {
+			@eth{qw(direction arphdr addrlen addr type rest)} = unpack('nnn a8 n a*', $packet);
+		}
+		else {
+			die("unsupported link type $linktype");
+		}
+		return if $eth{type} != 0x0800;
+
+		my ($hv, $proto, $src, $rest) = unpack('C x8 C x2 N x4 a*', $eth{rest});
+		return if $proto != 17;
+		$rest = substr($rest, (($hv & 0x0f) - 5) * 4);		# IP options
+
+		my %udp;
+		@udp{qw(src dst len csum payload)} = unpack('nnnn a*', $rest);
+
+		push(@ret, { ip => $eth{rest}, src => $src, udp => \%udp });
+	};
+
+	my $r = pcap_loop($p, -1, $cb, '');
+	$r == 0 or die $r;
+	pcap_close($p);
+
+	return @ret;
+}
+
+1;
@@ -0,0 +1,622 @@
+// Load test and throughput benchmark for the recording daemon. The daemon's own
+// metadata handling, decoding, mixing and output code run in one process
+// without rtpengine or the kernel module: calls are created from synthesized
+// metadata, and feeder threads take the place of the poller threads and hand
+// one RTP packet per stream to packet_process() every 20 ms, in real time.
+//
+// Calls can be added in steps until the feeders can't keep up any more, which
+// gives the number of calls that can be sustained. For each step the CPU time
+// used per stream, the time spent in packet_process() and how late packets were
+// handed over are reported. At the end, the time it takes for all recordings to
+// be completely written out after the last packet is reported.
+//
+// Ex: make bench
+//     ./rtpengine-recording-bench --calls=2000 --step=250 --seconds=20 \
+//             --codec=opus --output-mixed --output-format=mp3
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <glib.h>
+#include "main.h"
+#include "log.h"
+#include "codeclib.h"
+#include "resample.h"
+#include "rtplib.h"
+#include "str.h"
+#include "fix_frame_channel_layout.h"
+#include "types.h"
+#include "metafile.h"
+#include "stream.h"
+#include "packet.h"
+#include "decoder.h"
+#include "output.h"
+#include "mix.h"
+#include "epoll.h"
+#include "garbage.h"
+
+
+#define BENCH_PTIME_US 20000
+#define BENCH_PAYLOADS 100 // 2 seconds of encoded audio, sent in a loop
+#define BENCH_PT 96
+#define BENCH_LATE_US BENCH_PTIME_US // packets handed over later than this count as late
+#define BENCH_LATE_MAX 0.01 // fraction of late packets for a step to fail
+
+
+// settings of the daemon, see main.c
+int ktable = 0;
+int num_threads;
+enum output_storage_enum output_storage = OUTPUT_STORAGE_FILE;
+char *spool_dir = NULL;
+char *metadata_socket = NULL;
+char *output_dir = NULL;
+static char *output_format = NULL;
+int output_mixed;
+enum mix_method mix_method;
+int mix_filter;
+int mix_threads;
+int output_single;
+int output_passthrough;
+int output_enabled = 1;
+int output_threads;
+int output_io_threads;
+int output_queue_len = 1500;
+mode_t output_chmod;
+mode_t output_chmod_dir;
+uid_t output_chown = -1;
+gid_t output_chgrp = -1;
+char *output_pattern = NULL;
+int decoding_enabled = 1;
+char *c_mysql_host,
+      *c_mysql_user,
+      *c_mysql_pass,
+      *c_mysql_db;
+int c_mysql_port;
+int c_mysql_batch = 100;
+int c_mysql_queue = 10000;
+char *forward_to = NULL;
+endpoint_t tls_send_to_ep;
+int tls_resample = 8000;
+
+volatile int shutdown_flag;
+
+struct rtpengine_common_config rtpe_common_config;
+
+
+struct bench_stream {
+	stream_t *stream;
+	uint32_t ssrc, ts;
+	uint16_t seq;
+	unsigned int pos; // in the payload loop
+};
+
+struct bench_call {
+	char name[64];
+	struct bench_stream streams[2];
+	long long next; // us, next packet due
+};
+
+struct bench_stats {
+	unsigned long long packets, late;
+	long long late_max_us;
+	long long proc_ns, proc_max_ns;
+};
+
+struct bench_feeder {
+	pthread_t thread;
+	struct bench_call **calls;
+	unsigned int active; // calls[] up to this are being fed
+	pthread_mutex_t lock;
+	struct bench_stats stats; // since the last step, protected by lock
+};
+
+
+static int num_calls = 100;
+static int step_calls;
+static int step_seconds = 30;
+static char *codec_name;
+static int log_level = LOG_WARN;
+
+static const codec_def_t *codec_def;
+static char *codec_encoding;
+static unsigned int codec_ts_step; // RTP timestamp increment per packet
+static GPtrArray *payloads; // GString
+
+static struct bench_call *calls;
+static struct bench_feeder *feeders;
+static struct bench_call *call_opening; // from the main thread only
+static volatile int bench_stop;
+
+
+
+static long long now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double cpu_seconds(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+		+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+
+static void options(int *argc, char ***argv) {
+	AUTO_CLEANUP_GBUF(mix_method_str);
+
+	GOptionEntry e[] = {
+		{ "calls",		0,   0, G_OPTION_ARG_INT,	&num_calls,	"Number of calls, with two streams each","INT"		},
+		{ "step",		0,   0, G_OPTION_ARG_INT,	&step_calls,	"Start this many calls at a time",	"INT"		},
+		{ "seconds",		0,   0, G_OPTION_ARG_INT,	&step_seconds,	"Duration of each step",		"INT"		},
+		{ "codec",		0,   0, G_OPTION_ARG_STRING,	&codec_name,	"Codec of the streams",			"PCMU|G722|opus|AMR|..."},
+		{ "log-level",		'L', 0, G_OPTION_ARG_INT,	&log_level,	"Log level",				"INT"		},
+		{ "num-threads",	0,   0, G_OPTION_ARG_INT,	&num_threads,	"Number of feeder threads",		"INT"		},
+		{ "output-dir",		0,   0, G_OPTION_ARG_STRING,	&output_dir,	"Where to write media files to",	"PATH"		},
+		{ "output-format",	0,   0, G_OPTION_ARG_STRING,	&output_format,	"Write audio files of this type",	"wav|mp3"	},
+		{ "resample-to",	0,   0, G_OPTION_ARG_INT,	&resample_audio,"Resample all output audio",		"INT"		},
+		{ "fast-resampler",	0,   0, G_OPTION_ARG_NONE,	&resample_fast_path,"Use built-in resampler for integer sample rate ratios",NULL	},
+		{ "mp3-bitrate",	0,   0, G_OPTION_ARG_INT,	&mp3_bitrate,	"Bits per second for MP3 encoding",	"INT"		},
+		{ "output-mixed",	0,   0, G_OPTION_ARG_NONE,	&output_mixed,	"Mix participating sources into a single output",NULL	},
+		{ "mix-method",		0,   0, G_OPTION_ARG_STRING,	&mix_method_str,"How to mix multiple sources",		"direct|channels"},
+		{ "mix-filter",		0,   0, G_OPTION_ARG_NONE,	&mix_filter,	"Mix through libavfilter instead of the built-in mixer",NULL	},
+		{ "mix-threads",	0,   0, G_OPTION_ARG_INT,	&mix_threads,	"Number of threads mixing audio",	"INT"		},
+		{ "output-single",	0,   0, G_OPTION_ARG_NONE,	&output_single,	"Create one output file for each source",NULL		},
+		{ "output-passthrough",	0,   0, G_OPTION_ARG_NONE,	&output_passthrough,"Store G.711 and Opus in single outputs without transcoding",NULL	},
+		{ "output-threads",	0,   0, G_OPTION_ARG_INT,	&output_threads,"Number of threads encoding output files","INT"		},
+		{ "output-io-threads",	0,   0, G_OPTION_ARG_INT,	&output_io_threads,"Number of threads writing output files","INT"	},
+		{ "output-queue",	0,   0, G_OPTION_ARG_INT,	&output_queue_len,"Max frames queued per output file",	"INT"		},
+		{ NULL, }
+	};
+
+	GOptionContext *c = g_option_context_new(" - rtpengine recording daemon benchmark");
+	g_option_context_add_main_entries(c, e, NULL);
+	GError *er = NULL;
+	if (!g_option_context_parse(c, argc, argv, &er)) {
+		fprintf(stderr, "Bad command line: %s\n", er->message);
+		exit(1);
+	}
+	g_option_context_free(c);
+
+	rtpe_common_config_ptr = &rtpe_common_config;
+	rtpe_common_config.log_stderr = 1;
+	write_log = log_to_stderr;
+	for (unsigned int i = 0; i < num_log_levels; i++)
+		rtpe_common_config.log_levels[i] = log_level;
+	rtpe_common_config.log_levels[log_level_index_internals] = -1;
+
+	if (num_calls <= 0)
+		die("Invalid 'calls' option");
+	if (step_calls <= 0 || step_calls > num_calls)
+		step_calls = num_calls;
+	if (step_seconds <= 0)
+		die("Invalid 'seconds' option");
+	if (!codec_name)
+		codec_name = g_strdup("PCMU");
+	if (!output_format)
+		output_format = g_strdup("wav");
+	if (!output_mixed && !output_single)
+		output_mixed = output_single = 1;
+	if (!mix_method_str || !mix_method_str[0] || !strcmp(mix_method_str, "direct"))
+		mix_method = MM_DIRECT;
+	else if (!strcmp(mix_method_str, "channels"))
+		mix_method = MM_CHANNELS;
+	else
+		die("Invalid 'mix-method' option");
+
+	if (num_threads <= 0)
+		num_threads = num_cpu_cores(8);
+	if (mix_threads <= 0)
+		mix_threads = num_threads;
+	if (output_threads <= 0)
+		output_threads = num_threads;
+	if (output_io_threads <= 0)
+		output_io_threads = 2;
+	if (output_queue_len <= 0)
+		die("Invalid 'output-queue' option");
+
+	if (!output_dir) {
+		GError *err = NULL;
+		output_dir = g_dir_make_tmp("rtpengine-recording-bench-XXXXXX", &err);
+		if (!output_dir)
+			die("Failed to create output directory: %s", err->message);
+	}
+	output_pattern = g_strdup("%c-%t");
+	spool_dir = g_strdup("/nonexistent");
+}
+
+
+static void bench_payload_free(void *p) {
+	g_string_free(p, TRUE);
+}
+
+
+static int bench_got_packet(encoder_t *enc, void *u1, void *u2) {
+	GString *buf = u1;
+	AVPacket *in_pkt = enc->avpkt;
+	unsigned int bytes_per_packet = (enc->samples_per_packet ? : enc->samples_per_frame)
+		* enc->def->bits_per_sample / 8;
+
+	while (1) {
+		unsigned int len = MAX(enc->avpkt->size, bytes_per_packet);
+		char *out = g_malloc(len);
+		str inout;
+		str_init_len(&inout, out, len);
+		int ret = enc->def->packetizer(in_pkt, buf, &inout, enc);
+		if (ret == -1 || enc->avpkt->pts == AV_NOPTS_VALUE) {
+			g_free(out);
+			break;
+		}
+		if (payloads->len < BENCH_PAYLOADS)
+			g_ptr_array_add(payloads, g_string_new_len(inout.s, inout.len));
+		g_free(out);
+		if (ret == 0)
+			break;
+		in_pkt = NULL;
+	}
+
+	return 0;
+}
+
+
+// encodes a tone to get payloads in the selected codec
+static void bench_payloads(void) {
+	str name;
+	str_init(&name, codec_name);
+	codec_def = codec_find(&name, MT_AUDIO);
+	if (!codec_def || !codec_def->support_encoding || !codec_def->support_decoding
+			|| codec_def->media_type != MT_AUDIO)
+		die("Codec '%s' not supported", codec_name);
+
+	int clockrate = codec_def->default_clockrate;
+	int channels = codec_def->default_channels ? : 1;
+	if (channels > 1)
+		codec_encoding = g_strdup_printf("%s/%i/%i", codec_def->rtpname, clockrate, channels);
+	else
+		codec_encoding = g_strdup_printf("%s/%i", codec_def->rtpname, clockrate);
+	codec_ts_step = clockrate * (BENCH_PTIME_US / 1000) / 1000;
+
+	format_t req_format = {
+		.clockrate = clockrate * codec_def->clockrate_mult,
+		.channels = channels,
+		.format = -1,
+	};
+	format_t enc_format;
+	str fmtp;
+	str_init(&fmtp, (char *) (codec_def->default_fmtp ? : ""));
+	encoder_t *enc = encoder_new();
+	if (encoder_config_fmtp(enc, codec_def, codec_def->default_bitrate, BENCH_PTIME_US / 1000,
+				&req_format, &enc_format, &fmtp, NULL))
+		die("Failed to configure encoder for '%s'", codec_name);
+
+	format_t tone_format = {
+		.clockrate = req_format.clockrate,
+		.channels = 1,
+		.format = AV_SAMPLE_FMT_S16,
+	};
+	unsigned int samples = tone_format.clockrate * (BENCH_PTIME_US / 1000) / 1000;
+	resample_t resample = {0};
+	GString *buf = g_string_new("");
+	payloads = g_ptr_array_new_with_free_func(bench_payload_free);
+
+	for (unsigned int i = 0; payloads->len < BENCH_PAYLOADS; i++) {
+		if (i > BENCH_PAYLOADS * 4)
+			die("Encoder for '%s' produced no output", codec_name);
+
+		AVFrame *frame = av_frame_alloc();
+		frame->nb_samples = samples;
+		frame->format = AV_SAMPLE_FMT_S16;
+		frame->sample_rate = tone_format.clockrate;
+		DEF_CH_LAYOUT(&frame->CH_LAYOUT, 1);
+		frame->pts = (int64_t) i * samples;
+		if (av_frame_get_buffer(frame, 0) < 0)
+			die("Failed to allocate audio frame");
+		int16_t *s = (int16_t *) frame->extended_data[0];
+		for (unsigned int j = 0; j < samples; j++)
+			s[j] = lrint(8000.0 * sin(2.0 * M_PI * 400.0 * (i * samples + j)
+						/ tone_format.clockrate));
+
+		AVFrame *conv = resample_frame(&resample, frame, &enc_format);
+		if (!conv)
+			die("Failed to convert audio frame for encoder");
+		if (encoder_input_fifo(enc, conv, bench_got_packet, buf, NULL))
+			die("Failed to encode audio frame");
+		av_frame_free(&conv);
+		av_frame_free(&frame);
+	}
+
+	g_string_free(buf, TRUE);
+	resample_shutdown(&resample);
+	encoder_free(enc);
+}
+
+
+static void chunk(GString *s, const char *section, const char *content) {
+	g_string_append_printf(s, "%s\n%zu:\n%s\n\n", section, strlen(content), content);
+}
+
+
+// streams of the call being created, see stream_source
+static void bench_stream_open(stream_t *stream) {
+	if (!call_opening || stream->id >= G_N_ELEMENTS(call_opening->streams))
+		return;
+	call_opening->streams[stream->id].stream = stream;
+}
+
+
+static void bench_call_start(struct bench_call *c, unsigned int idx) {
+	char section[64], content[128];
+
+	snprintf(c->name, sizeof(c->name), "bench-%i-%u", getpid(), idx);
+
+	GString *s = g_string_new("");
+	chunk(s, "CALL-ID", c->name);
+	chunk(s, "PARENT", c->name);
+	chunk(s, "RECORDING 1", "");
+	chunk(s, "TAG 0", "caller");
+	chunk(s, "TAG 1", "callee");
+	for (unsigned int i = 0; i < 2; i++) {
+		snprintf(section, sizeof(section), "MEDIA %u PAYLOAD TYPE %u", i + 1, BENCH_PT);
+		chunk(s, section, codec_encoding);
+		if (codec_def->default_fmtp) {
+			snprintf(section, sizeof(section), "MEDIA %u FMTP %u", i + 1, BENCH_PT);
+			chunk(s, section, codec_def->default_fmtp);
+		}
+		snprintf(section, sizeof(section), "STREAM %u details", i);
+		snprintf(content, sizeof(content), "TAG %u MEDIA %u TAG-MEDIA 1 COMPONENT 1 FLAGS 0", i, i + 1);
+		chunk(s, section, content);
+		snprintf(section, sizeof(section), "STREAM %u interface", i);
+		snprintf(content, sizeof(content), "%s-%u", c->name, i);
+		chunk(s, section, content);
+
+		struct bench_stream *bs = &c->streams[i];
+		bs->ssrc = g_random_int();
+		bs->seq = g_random_int();
+		bs->ts = g_random_int();
+		bs->pos = g_random_int_range(0, BENCH_PAYLOADS);
+	}
+
+	call_opening = c;
+	metafile_chunks(c->name, s->str, s->len);
+	call_opening = NULL;
+	g_string_free(s, TRUE);
+
+	if (!c->streams[0].stream || !c->streams[1].stream)
+		die("Streams of call '%s' weren't opened", c->name);
+
+	// spread the calls out across the packet interval
+	c->next = now_us() + g_random_int_range(0, BENCH_PTIME_US);
+
+	struct bench_feeder *f = &feeders[idx % num_threads];
+	f->calls[f->active] = c;
+	g_atomic_int_inc(&f->active);
+}
+
+
+// returns the time spent in packet_process()
+static long long bench_send(struct bench_stream *bs) {
+	GString *pl = g_ptr_array_index(payloads, bs->pos++ % payloads->len);
+	unsigned int len = sizeof(struct iphdr) + sizeof(struct udphdr) + sizeof(struct rtp_header) + pl->len;
+
+	packet_t *packet = packet_new(len);
+	struct iphdr *ip = (void *) packet->buffer;
+	struct udphdr *udp = (void *) (ip + 1);
+	struct rtp_header *rtp = (void *) (udp + 1);
+
+	*ip = (struct iphdr) {
+		.version = 4,
+		.ihl = 5,
+		.ttl = 64,
+		.protocol = IPPROTO_UDP,
+		.tot_len = htons(len),
+		.saddr = htonl(0x7f000001),
+		.daddr = htonl(0x7f000001),
+	};
+	*udp = (struct udphdr) {
+		.source = htons(40000),
+		.dest = htons(30000),
+		.len = htons(len - sizeof(*ip)),
+	};
+	*rtp = (struct rtp_header) {
+		.v_p_x_cc = 0x80,
+		.m_pt = BENCH_PT,
+		.seq_num = htons(bs->seq++),
+		.timestamp = htonl(bs->ts),
+		.ssrc = htonl(bs->ssrc),
+	};
+	memcpy(rtp + 1, pl->str, pl->len);
+	bs->ts += codec_ts_step;
+
+	log_info_call = bs->stream->metafile->name;
+	log_info_stream = bs->stream->name;
+
+	long long start = now_ns();
+	packet_process(bs->stream, &packet, 1); // consumes the packet
+	long long ret = now_ns() - start;
+
+	log_info_call = NULL;
+	log_info_stream = NULL;
+
+	return ret;
+}
+
+
+static void *bench_feeder_thread(void *p) {
+	struct bench_feeder *f = p;
+
+	while (!g_atomic_int_get(&bench_stop)) {
+		struct bench_stats st = {0,};
+		long long now = now_us();
+		long long next = now + BENCH_PTIME_US;
+		unsigned int active = g_atomic_int_get(&f->active);
+
+		for (unsigned int i = 0; i < active; i++) {
+			struct bench_call *c = f->calls[i];
+			while (c->next <= now) {
+				long long late = now - c->next;
+				if (late > BENCH_LATE_US)
+					st.late += 2;
+				st.late_max_us = MAX(st.late_max_us, late);
+				for (unsigned int j = 0; j < 2; j++) {
+					long long ns = bench_send(&c->streams[j]);
+					st.proc_ns += ns;
+					st.proc_max_ns = MAX(st.proc_max_ns, ns);
+				}
+				st.packets += 2;
+				c->next += BENCH_PTIME_US;
+			}
+			next = MIN(next, c->next);
+		}
+
+		pthread_mutex_lock(&f->lock);
+		f->stats.packets += st.packets;
+		f->stats.late += st.late;
+		f->stats.late_max_us = MAX(f->stats.late_max_us, st.late_max_us);
+		f->stats.proc_ns += st.proc_ns;
+		f->stats.proc_max_ns = MAX(f->stats.proc_max_ns, st.proc_max_ns);
+		pthread_mutex_unlock(&f->lock);
+
+		now = now_us();
+		if (next > now)
+			usleep(next - now);
+	}
+
+	packet_thread_end();
+	return NULL;
+}
+
+
+// totals of all feeders since the last call
+static struct bench_stats bench_stats_take(void) {
+	struct bench_stats ret = {0,};
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		struct bench_feeder *f = &feeders[i];
+		pthread_mutex_lock(&f->lock);
+		ret.packets += f->stats.packets;
+		ret.late += f->stats.late;
+		ret.late_max_us = MAX(ret.late_max_us, f->stats.late_max_us);
+		ret.proc_ns += f->stats.proc_ns;
+		ret.proc_max_ns = MAX(ret.proc_max_ns, f->stats.proc_max_ns);
+		ZERO(f->stats);
+		pthread_mutex_unlock(&f->lock);
+	}
+
+	return ret;
+}
+
+
+int main(int argc, char **argv) {
+	options(&argc, &argv);
+
+	log_init("rtpengine-recording-bench");
+	codeclib_init(0);
+	output_init(output_format);
+	metafile_setup();
+	epoll_setup();
+	stream_source = bench_stream_open;
+
+	bench_payloads();
+
+	output_threads_start();
+	if (output_mixed)
+		mix_threads_start();
+
+	printf("%i calls with 2 streams each, %s, %s%s%s output as %s%s, %i feeder threads, "
+			"recordings in %s\n",
+			num_calls, codec_encoding,
+			output_mixed ? "mixed" : "", output_mixed && output_single ? " and " : "",
+			output_single ? "single" : "", output_format,
+			output_passthrough ? " (passthrough)" : "", num_threads, output_dir);
+
+	calls = g_new0(struct bench_call, num_calls);
+	feeders = g_new0(struct bench_feeder, num_threads);
+	for (unsigned int i = 0; i < num_threads; i++) {
+		struct bench_feeder *f = &feeders[i];
+		f->calls = g_new0(struct bench_call *, num_calls / num_threads + 1);
+		pthread_mutex_init(&f->lock, NULL);
+		if (pthread_create(&f->thread, NULL, bench_feeder_thread, f))
+			die_errno("pthread_create failed");
+	}
+
+	unsigned int started = 0, sustained = 0;
+	while (started < num_calls) {
+		unsigned int num = MIN(step_calls, num_calls - started);
+		for (unsigned int i = 0; i < num; i++)
+			bench_call_start(&calls[started + i], started + i);
+		started += num;
+
+		bench_stats_take();
+		double cpu = cpu_seconds();
+		long long start = now_us();
+
+		sleep(step_seconds);
+
+		struct bench_stats st = bench_stats_take();
+		cpu = cpu_seconds() - cpu;
+		double secs = (now_us() - start) / 1000000.0;
+		unsigned int streams = started * 2;
+		double late = st.packets ? (double) st.late / st.packets : 1.0;
+		int ok = late <= BENCH_LATE_MAX;
+
+		printf("%u calls: CPU %.1f%% (%.3f ms per stream per second), packet_process() "
+				"avg %lld us max %lld us, %.2f%% of packets late (max %lld ms): %s\n",
+				started, cpu * 100.0 / secs, cpu * 1000.0 / secs / streams,
+				st.packets ? st.proc_ns / (long long) st.packets / 1000 : 0,
+				st.proc_max_ns / 1000, late * 100.0, st.late_max_us / 1000,
+				ok ? "sustained" : "FAILED");
+
+		if (!ok)
+			break;
+		sustained = started;
+	}
+
+	g_atomic_int_set(&bench_stop, 1);
+	for (unsigned int i = 0; i < num_threads; i++)
+		pthread_join(feeders[i].thread, NULL);
+
+	// everything still queued is written out before the outputs are done
+	long long start = now_us();
+	for (unsigned int i = 0; i < started; i++)
+		metafile_delete(calls[i].name);
+	garbage_collect_all();
+	metafile_cleanup();
+	mix_cleanup();
+	output_cleanup();
+	long long drain = now_us() - start;
+
+	printf("%u calls sustained, recordings complete %lld ms after the last packet\n",
+			sustained, drain / 1000);
+
+	packet_thread_end();
+	epoll_cleanup();
+	codeclib_free();
+
+	for (unsigned int i = 0; i < num_threads; i++) {
+		g_free(feeders[i].calls);
+		pthread_mutex_destroy(&feeders[i].lock);
+	}
+	g_free(feeders);
+	g_free(calls);
+	g_ptr_array_free(payloads, TRUE);
+	g_free(codec_encoding);
+
+	return sustained == num_calls ? 0 : 1;
+}
@@ -4,6 +4,8 @@
 #include <glib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 #include "types.h"
 #include "main.h"
 #include "log.h"
@@ -53,8 +55,91 @@ CREATE TABLE `recording_metakeys` (
 
 
 
-static __thread MYSQL *mysql_conn;
-static __thread MYSQL_STMT
+#define DB_METADATA_ROWS 16 // largest multi-row insert into recording_metakeys
+#define DB_RETRIES 3
+#define DB_STATS_INTERVAL 60
+
+
+// All writes are made by a single writer thread, which owns the connection. The
+// db_* functions only queue a job and return. The writer takes whatever has queued
+// up since its last round (up to --mysql-batch jobs) and runs it as one
+// transaction, so a burst of calls ending costs one commit instead of one per
+// statement. Row IDs are only known to the writer: metafiles and outputs hold a
+// reference to a db_ref_t which the writer fills in. Jobs run in the order they
+// were queued, so each job sees the IDs set by the ones queued before it.
+
+enum db_job_type {
+	DB_INSERT_CALL,
+	DB_INSERT_METADATA,
+	DB_CLOSE_CALL,
+	DB_INSERT_STREAM,
+	DB_CONFIG_STREAM,
+	DB_CLOSE_STREAM,
+	DB_DELETE_STREAM,
+};
+
+struct db_ref_s {
+	volatile gint refs;
+	// writer thread only
+	unsigned long long id;
+	unsigned int streams; // of a call
+};
+
+struct db_job {
+	enum db_job_type type;
+	db_ref_t *call,
+		 *stream;
+	double now;
+	long long queued;
+	char *text; // call ID, metadata, or file name
+	char *file_format,
+	     *full_filename,
+	     *label;
+	const char *output_type;
+	unsigned long stream_id,
+		      ssrc;
+	int channels,
+	    clockrate;
+	str blob;
+
+	// state of the references before the job ran, to undo a rolled back transaction
+	unsigned long long call_id,
+			   stream_db_id;
+	unsigned int call_streams;
+
+	unsigned int ran:1,
+		     blob_read:1,
+		     unlink:1;
+};
+
+struct db_meta_row {
+	unsigned long long call;
+	str key,
+	    value;
+};
+
+
+static pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t db_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t db_space = PTHREAD_COND_INITIALIZER;
+static GQueue db_jobs = G_QUEUE_INIT;
+static int db_shutdown;
+static int db_running;
+static pthread_t db_thread;
+
+static struct {
+	// db_lock
+	unsigned int queued_max;
+	unsigned long long stalls, stall_us;
+	int stalling;
+	// writer thread
+	unsigned long long jobs, batches, statements, retries, failed, latency_us, latency_max_us;
+} db_stats;
+
+
+// writer thread only
+static MYSQL *mysql_conn;
+static MYSQL_STMT
 	*stm_insert_call,
 	*stm_close_call,
 	*stm_delete_call,
@@ -62,7 +147,10 @@ static __thread MYSQL_STMT
 	*stm_close_stream,
 	*stm_delete_stream,
 	*stm_config_stream,
-	*stm_insert_metadata;
+	*stm_insert_metadata[DB_METADATA_ROWS]; // by number of rows - 1, prepared on demand
+static struct db_meta_row meta_rows[DB_METADATA_ROWS];
+static unsigned int meta_num;
+static char db_error[256];
 
 
 static void my_stmt_close(MYSQL_STMT **st) {
@@ -81,7 +169,8 @@ static void reset_conn(void) {
 	my_stmt_close(&stm_close_stream);
 	my_stmt_close(&stm_delete_stream);
 	my_stmt_close(&stm_config_stream);
-	my_stmt_close(&stm_insert_metadata);
+	for (unsigned int i = 0; i < DB_METADATA_ROWS; i++)
+		my_stmt_close(&stm_insert_metadata[i]);
 	mysql_close(mysql_conn);
 	mysql_conn = NULL;
 }
@@ -102,8 +191,6 @@ INLINE int prep(MYSQL_STMT **st, const char *str) {
 static int check_conn(void) {
 	if (mysql_conn)
 		return 0;
-	if (!c_mysql_host || !c_mysql_db)
-		return -1;
 
 	dbg("connecting to MySQL");
 
@@ -149,10 +236,9 @@ static int check_conn(void) {
 	}
 	if (prep(&stm_delete_stream, "delete from recording_streams where id = ?"))
 		goto err;
-	if (prep(&stm_config_stream, "update recording_streams set channels = ?, sample_rate = ? where id = ?"))
-		goto err;
-	if (prep(&stm_insert_metadata, "insert into recording_metakeys (`call`, `key`, `value`) values " \
-				"(?,?,?)"))
+	if (prep(&stm_config_stream, "update recording_streams set channels = ?, sample_rate = ?, " \
+				"local_filename = concat(?,'.',?), full_filename = concat(?,'.',?), " \
+				"file_format = ? where id = ?"))
 		goto err;
 
 	dbg("Connection to MySQL established");
@@ -162,10 +248,13 @@ static int check_conn(void) {
 err:
 	if (mysql_conn) {
 		ilog(LOG_ERR, "Failed to connect to MySQL: %s", mysql_error(mysql_conn));
+		snprintf(db_error, sizeof(db_error), "%s", mysql_error(mysql_conn));
 		reset_conn();
 	}
-	else
+	else {
 		ilog(LOG_ERR, "Failed to connect to MySQL: out of memory");
+		snprintf(db_error, sizeof(db_error), "out of memory");
+	}
 
 	return -1;
 }
@@ -211,41 +300,24 @@ INLINE void my_d(MYSQL_BIND *b, const double *d) {
 }
 
 
-static void execute_wrap(MYSQL_STMT **stmt, MYSQL_BIND *binds, unsigned long long *auto_id) {
-	int retr = 0;
-	while (1) {
-		if (check_conn())
-			goto err;
-		if (mysql_stmt_bind_param(*stmt, binds))
-			goto err;
-		if (mysql_stmt_execute(*stmt))
-			goto err;
-		if (auto_id) {
-			*auto_id = mysql_insert_id(mysql_conn);
-			if (*auto_id == 0)
-				goto err;
-		}
-		if (mysql_commit(mysql_conn))
+// doesn't commit, that's left to the end of the batch
+static int execute(MYSQL_STMT *stmt, MYSQL_BIND *binds, unsigned long long *auto_id) {
+	if (mysql_stmt_bind_param(stmt, binds))
+		goto err;
+	if (mysql_stmt_execute(stmt))
+		goto err;
+	db_stats.statements++;
+	if (auto_id) {
+		*auto_id = mysql_insert_id(mysql_conn);
+		if (*auto_id == 0)
 			goto err;
+	}
 
-		return;
+	return 0;
 
 err:
-		if (retr > 5) {
-			// fatal
-			ilog(LOG_ERR, "Failed to bind or execute prepared statement: %s",
-					mysql_stmt_error(*stmt));
-			reset_conn();
-			return;
-		}
-		if (retr > 2) {
-			reset_conn();
-			if (check_conn())
-				return;
-		}
-
-		retr++;
-	}
+	snprintf(db_error, sizeof(db_error), "%s", mysql_stmt_error(stmt));
+	return -1;
 }
 
 
@@ -255,32 +327,63 @@ static double now_double(void) {
 	return tv.tv_sec + tv.tv_usec / 1000000.0;
 }
 
-static void db_do_call_id(metafile_t *mf) {
-	if (mf->db_id > 0)
-		return;
-	if (!mf->call_id)
-		return;
+static long long now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
 
-	double now = now_double();
+
+// metadata rows are collected and inserted together
+static int db_meta_flush(void) {
+	if (!meta_num)
+		return 0;
+
+	unsigned int num = meta_num;
+	meta_num = 0;
+
+	MYSQL_STMT **st = &stm_insert_metadata[num - 1];
+	if (!*st) {
+		GString *q = g_string_new("insert into recording_metakeys (`call`, `key`, `value`) values ");
+		for (unsigned int i = 0; i < num; i++)
+			g_string_append(q, i ? ",(?,?,?)" : "(?,?,?)");
+		int ret = prep(st, q->str);
+		g_string_free(q, TRUE);
+		if (ret) {
+			snprintf(db_error, sizeof(db_error), "failed to prepare statement");
+			return -1;
+		}
+	}
+
+	MYSQL_BIND b[DB_METADATA_ROWS * 3];
+	for (unsigned int i = 0; i < num; i++) {
+		my_ull(&b[i * 3], &meta_rows[i].call);
+		my_str(&b[i * 3 + 1], &meta_rows[i].key);
+		my_str(&b[i * 3 + 2], &meta_rows[i].value);
+	}
+
+	return execute(*st, b, NULL);
+}
+
+
+static int db_run_insert_call(struct db_job *j) {
+	if (j->call->id > 0)
+		return 0;
 
 	MYSQL_BIND b[2];
-	my_cstr(&b[0], mf->call_id);
-	my_d(&b[1], &now);
+	my_cstr(&b[0], j->text);
+	my_d(&b[1], &j->now);
 
-	execute_wrap(&stm_insert_call, b, &mf->db_id);
+	return execute(stm_insert_call, b, &j->call->id);
 }
-static void db_do_call_metadata(metafile_t *mf) {
-	if (!mf->metadata_db)
-		return;
-	if (mf->db_id == 0)
-		return;
 
-	MYSQL_BIND b[3];
-	my_ull(&b[0], &mf->db_id); // stays persistent
+static int db_run_insert_metadata(struct db_job *j) {
+	if (j->call->id == 0)
+		return 0;
 
 	// XXX offload this parsing to proxy module -> bencode list/dictionary
 	str all_meta;
-	str_init(&all_meta, mf->metadata_db);
+	str_init(&all_meta, j->text);
 	while (all_meta.len > 1) {
 		str token;
 		if (str_token_sep(&token, &all_meta, '|'))
@@ -292,184 +395,546 @@ static void db_do_call_metadata(metafile_t *mf) {
 			continue;
 		}
 
-		my_str(&b[1], &key);
-		my_str(&b[2], &token);
-
-		execute_wrap(&stm_insert_metadata, b, NULL);
+		if (meta_num == DB_METADATA_ROWS && db_meta_flush())
+			return -1;
+		meta_rows[meta_num++] = (struct db_meta_row) {
+			.call = j->call->id,
+			.key = key,
+			.value = token,
+		};
 	}
 
-	mf->metadata_db = NULL;
+	return 0;
 }
 
-void db_do_call(metafile_t *mf) {
-	if (check_conn())
-		return;
+static int db_run_close_call(struct db_job *j) {
+	if (j->call->id == 0)
+		return 0;
 
-	db_do_call_id(mf);
-	db_do_call_metadata(mf);
-}
+	MYSQL_BIND b[2];
 
+	if (j->call->streams > 0) {
+		my_d(&b[0], &j->now);
+		my_ull(&b[1], &j->call->id);
+		return execute(stm_close_call, b, NULL);
+	}
 
-// mf is locked
-void db_do_stream(metafile_t *mf, output_t *op, const char *type, stream_t *stream, unsigned long ssrc) {
-	if (check_conn())
-		return;
-	if (mf->db_id == 0)
-		return;
-	if (op->db_id > 0)
-		return;
+	// pending metadata rows may refer to this call
+	if (db_meta_flush())
+		return -1;
+
+	my_ull(&b[0], &j->call->id);
+	if (execute(stm_delete_call, b, NULL))
+		return -1;
+	j->call->id = 0;
 
-	unsigned long id = stream ? stream->id : 0;
-	double now = now_double();
+	return 0;
+}
+
+static int db_run_insert_stream(struct db_job *j) {
+	if (j->call->id == 0)
+		return 0;
+	if (j->stream->id > 0)
+		return 0;
 
 	MYSQL_BIND b[11];
-	my_ull(&b[0], &mf->db_id);
-	my_cstr(&b[1], op->file_name);
-	my_cstr(&b[2], op->file_format);
-	my_cstr(&b[3], op->full_filename);
-	my_cstr(&b[4], op->file_format);
-	my_cstr(&b[5], op->file_format);
-	my_cstr(&b[6], type);
+	my_ull(&b[0], &j->call->id);
+	my_cstr(&b[1], j->text);
+	my_cstr(&b[2], j->file_format);
+	my_cstr(&b[3], j->full_filename);
+	my_cstr(&b[4], j->file_format);
+	my_cstr(&b[5], j->file_format);
+	my_cstr(&b[6], j->output_type);
 	b[7] = (MYSQL_BIND) {
 		.buffer_type = MYSQL_TYPE_LONG,
-		.buffer = &id,
-		.buffer_length = sizeof(id),
+		.buffer = &j->stream_id,
+		.buffer_length = sizeof(j->stream_id),
 		.is_unsigned = 1,
 	};
 	b[8] = (MYSQL_BIND) {
 		.buffer_type = MYSQL_TYPE_LONG,
-		.buffer = &ssrc,
-		.buffer_length = sizeof(ssrc),
+		.buffer = &j->ssrc,
+		.buffer_length = sizeof(j->ssrc),
 		.is_unsigned = 1,
 	};
-	if (stream && stream->tag != (unsigned long) -1) {
-		tag_t *tag = tag_get(mf, stream->tag);
-		my_cstr(&b[9], tag->label ? : "");
+	my_cstr(&b[9], j->label);
+	my_d(&b[10], &j->now);
+
+	if (execute(stm_insert_stream, b, &j->stream->id))
+		return -1;
+
+	j->call->streams++;
+
+	return 0;
+}
+
+static int db_run_config_stream(struct db_job *j) {
+	if (j->stream->id == 0)
+		return 0;
+
+	// the file format may have changed for passthrough outputs
+	MYSQL_BIND b[8];
+	my_i(&b[0], &j->channels);
+	my_i(&b[1], &j->clockrate);
+	my_cstr(&b[2], j->text);
+	my_cstr(&b[3], j->file_format);
+	my_cstr(&b[4], j->full_filename);
+	my_cstr(&b[5], j->file_format);
+	my_cstr(&b[6], j->file_format);
+	my_ull(&b[7], &j->stream->id);
+
+	return execute(stm_config_stream, b, NULL);
+}
+
+// reads the finished file for storage in the database. returns -1 if the stream
+// shouldn't be closed at all
+static int db_read_blob(struct db_job *j) {
+	if (!(output_storage & OUTPUT_STORAGE_DB))
+		return 0;
+	if (j->blob_read)
+		return 0;
+
+	FILE *f = fopen(j->text, "rb");
+	if (!f) {
+		ilog(LOG_ERR, "Failed to open file: %s%s%s", FMT_M(j->text));
+		goto err;
 	}
-	else
-		my_cstr(&b[9], "");
-	my_d(&b[10], &now);
+	fseek(f, 0, SEEK_END);
+	long pos = ftell(f);
+	if (pos < 0) {
+		ilog(LOG_ERR, "Failed to get file position: %s", strerror(errno));
+		fclose(f);
+		goto err;
+	}
+	fseek(f, 0, SEEK_SET);
+	j->blob.s = malloc(pos);
+	if (j->blob.s) {
+		size_t count = fread(j->blob.s, 1, pos, f);
+		if (count != pos) {
+			ilog(LOG_ERR, "Failed to read from stream");
+			fclose(f);
+			g_clear_pointer(&j->blob.s, free);
+			goto err;
+		}
+		j->blob.len = pos;
+	}
+	fclose(f);
+	j->blob_read = 1;
 
-	execute_wrap(&stm_insert_stream, b, &op->db_id);
+	return 0;
 
-	if (op->db_id > 0)
-		mf->db_streams++;
+err:
+	if ((output_storage & OUTPUT_STORAGE_FILE)) {
+		j->blob_read = 1;
+		return 0;
+	}
+	return -1;
 }
 
-void db_close_call(metafile_t *mf) {
-	if (check_conn())
-		return;
-	if (mf->db_id == 0)
-		return;
+static int db_run_close_stream(struct db_job *j) {
+	if (j->stream->id == 0)
+		return 0;
+	if (db_read_blob(j))
+		return 0;
 
-	double now = now_double();
+	MYSQL_BIND b[3];
+	int par_idx = 0;
+	my_d(&b[par_idx++], &j->now);
+	if ((output_storage & OUTPUT_STORAGE_DB))
+		my_str(&b[par_idx++], &j->blob);
+	my_ull(&b[par_idx++], &j->stream->id);
 
-	MYSQL_BIND b[2];
+	if (execute(stm_close_stream, b, NULL))
+		return -1;
+
+	// only once the transaction has been committed
+	if (!(output_storage & OUTPUT_STORAGE_FILE))
+		j->unlink = 1;
+
+	return 0;
+}
+
+static int db_run_delete_stream(struct db_job *j) {
+	if (j->stream->id == 0)
+		return 0;
+
+	MYSQL_BIND b[1];
+	my_ull(&b[0], &j->stream->id);
+
+	if (execute(stm_delete_stream, b, NULL))
+		return -1;
 
-	if (mf->db_streams > 0) {
-		my_d(&b[0], &now);
-		my_ull(&b[1], &mf->db_id);
-		execute_wrap(&stm_close_call, b, NULL);
+	if (j->call && j->call->streams > 0)
+		j->call->streams--;
+
+	return 0;
+}
+
+
+static int db_job_run(struct db_job *j) {
+	j->ran = 1;
+	if (j->call) {
+		j->call_id = j->call->id;
+		j->call_streams = j->call->streams;
 	}
-	else {
-		my_ull(&b[0], &mf->db_id);
-		execute_wrap(&stm_delete_call, b, NULL);
-		mf->db_id = 0;
+	if (j->stream)
+		j->stream_db_id = j->stream->id;
+
+	switch (j->type) {
+		case DB_INSERT_CALL:
+			return db_run_insert_call(j);
+		case DB_INSERT_METADATA:
+			return db_run_insert_metadata(j);
+		case DB_CLOSE_CALL:
+			return db_run_close_call(j);
+		case DB_INSERT_STREAM:
+			return db_run_insert_stream(j);
+		case DB_CONFIG_STREAM:
+			return db_run_config_stream(j);
+		case DB_CLOSE_STREAM:
+			return db_run_close_stream(j);
+		case DB_DELETE_STREAM:
+			return db_run_delete_stream(j);
 	}
+
+	return 0;
 }
 
-void db_close_stream(output_t *op) {
+static void db_job_undo(struct db_job *j) {
+	if (!j->ran)
+		return;
+	j->ran = 0;
+	j->unlink = 0;
+	if (j->call) {
+		j->call->id = j->call_id;
+		j->call->streams = j->call_streams;
+	}
+	if (j->stream)
+		j->stream->id = j->stream_db_id;
+}
+
+
+// runs the jobs as one transaction
+static int db_batch_run(GQueue *batch) {
 	if (check_conn())
+		return -1;
+
+	for (GList *l = batch->head; l; l = l->next) {
+		if (db_job_run(l->data))
+			goto err;
+	}
+	if (db_meta_flush())
+		goto err;
+	if (mysql_commit(mysql_conn)) {
+		snprintf(db_error, sizeof(db_error), "%s", mysql_error(mysql_conn));
+		goto err;
+	}
+
+	return 0;
+
+err:
+	// closing the connection rolls back whatever the transaction had done.
+	// undo in reverse order to get back to the state before the batch
+	meta_num = 0;
+	for (GList *l = batch->tail; l; l = l->prev)
+		db_job_undo(l->data);
+	reset_conn();
+	return -1;
+}
+
+static int db_batch_retry(GQueue *batch) {
+	for (unsigned int i = 0; i < DB_RETRIES; i++) {
+		if (i)
+			db_stats.retries++;
+		if (!db_batch_run(batch))
+			return 0;
+	}
+	return -1;
+}
+
+
+void db_release(db_ref_t **rp) {
+	db_ref_t *r = *rp;
+	*rp = NULL;
+	if (!r)
 		return;
-	if (op->db_id == 0)
+	if (!g_atomic_int_dec_and_test(&r->refs))
 		return;
+	g_slice_free1(sizeof(*r), r);
+}
 
-	double now = now_double();
+static db_ref_t *db_ref_new(void) {
+	db_ref_t *r = g_slice_alloc0(sizeof(*r));
+	r->refs = 1;
+	return r;
+}
 
-	str stream;
-        MYSQL_BIND b[3];
-        stream.s = 0;
-        stream.len = 0;
+static db_ref_t *db_ref_get(db_ref_t *r) {
+	if (r)
+		g_atomic_int_inc(&r->refs);
+	return r;
+}
 
-	if ((output_storage & OUTPUT_STORAGE_DB)) {
-		FILE *f = fopen(op->filename, "rb");
-		if (!f) {
-			ilog(LOG_ERR, "Failed to open file: %s%s%s", FMT_M(op->filename));
-			if ((output_storage & OUTPUT_STORAGE_FILE))
-				goto file;
-			return;
-		}
-		fseek(f, 0, SEEK_END);
-		long pos = ftell(f);
-		if (pos < 0) {
-			ilog(LOG_ERR, "Failed to get file position: %s", strerror(errno));
-			fclose(f);
-			if ((output_storage & OUTPUT_STORAGE_FILE))
-				goto file;
-			return;
-		}
-		stream.len = pos;
-		fseek(f, 0, SEEK_SET);
-		stream.s = malloc(stream.len);
-		if (stream.s) {
-			size_t count = fread(stream.s, 1, stream.len, f);
-			if (count != stream.len) {
-				stream.len = 0;
-				ilog(LOG_ERR, "Failed to read from stream");
-				fclose(f);
-				if ((output_storage & OUTPUT_STORAGE_FILE))
-					goto file;
-				free(stream.s);
-				return;
+
+static void db_job_free(struct db_job *j) {
+	if (j->unlink && unlink(j->text))
+		ilog(LOG_ERR, "Failed to delete file '%s': %s", j->text, strerror(errno));
+	db_release(&j->call);
+	db_release(&j->stream);
+	g_free(j->text);
+	g_free(j->file_format);
+	g_free(j->full_filename);
+	g_free(j->label);
+	free(j->blob.s);
+	g_slice_free1(sizeof(*j), j);
+}
+
+
+static void db_batch(GQueue *batch) {
+	unsigned int failed = 0;
+
+	db_stats.batches++;
+
+	if (db_batch_retry(batch)) {
+		// try each job on its own so that one bad job doesn't take the others
+		// down with it. no point if we can't even connect
+		int down = batch->length == 1;
+		for (GList *l = batch->head; l; l = l->next) {
+			if (!down && check_conn())
+				down = 1;
+			if (!down) {
+				GQueue single = G_QUEUE_INIT;
+				g_queue_push_tail(&single, l->data);
+				int ret = db_batch_retry(&single);
+				g_queue_clear(&single);
+				if (!ret)
+					continue;
 			}
+			failed++;
 		}
-		fclose(f);
-        }
+		ilog(LOG_ERR, "Failed to write %u of %u queued database updates: %s",
+				failed, batch->length, db_error);
+		db_stats.failed += failed;
+	}
 
-file:;
-	int par_idx = 0;
-	my_d(&b[par_idx++], &now);
-	if ((output_storage & OUTPUT_STORAGE_DB))
-		my_str(&b[par_idx++], &stream);
-	my_ull(&b[par_idx++], &op->db_id);
+	long long now = now_us();
+	struct db_job *j;
+	while ((j = g_queue_pop_head(batch))) {
+		long long lat = now - j->queued;
+		db_stats.jobs++;
+		db_stats.latency_us += lat;
+		if (lat > db_stats.latency_max_us)
+			db_stats.latency_max_us = lat;
+		db_job_free(j);
+	}
+}
 
-	execute_wrap(&stm_close_stream, b, NULL);
 
-        if (stream.s)
-		free(stream.s);
-	if (!(output_storage & OUTPUT_STORAGE_FILE))
-		if (unlink(op->filename))
-			ilog(LOG_ERR, "Failed to delete file '%s': %s", op->filename, strerror(errno));
+static void db_stats_log(void) {
+	pthread_mutex_lock(&db_lock);
+	unsigned int queued = db_jobs.length;
+	unsigned int queued_max = db_stats.queued_max;
+	unsigned long long stalls = db_stats.stalls;
+	unsigned long long stall_us = db_stats.stall_us;
+	db_stats.queued_max = queued;
+	db_stats.stalling = 0;
+	pthread_mutex_unlock(&db_lock);
+
+	ilog(LOG_INFO, "Database writer: %llu updates in %llu transactions (%llu statements, %llu retries, "
+			"%llu failed), latency avg %llu us, max %llu us; %u queued (max %u), "
+			"callers held back %llu times for %llu us",
+			db_stats.jobs, db_stats.batches, db_stats.statements, db_stats.retries,
+			db_stats.failed,
+			db_stats.jobs ? db_stats.latency_us / db_stats.jobs : 0,
+			db_stats.latency_max_us, queued, queued_max, stalls, stall_us);
+	db_stats.latency_max_us = 0;
 }
 
-void db_delete_stream(metafile_t *mf, output_t *op) {
-	if (check_conn())
+
+static void *db_writer_thread(void *p) {
+	GQueue batch = G_QUEUE_INIT;
+	time_t next_stats = time(NULL) + DB_STATS_INTERVAL;
+
+	mysql_thread_init();
+
+	while (1) {
+		pthread_mutex_lock(&db_lock);
+		while (!db_jobs.length && !db_shutdown)
+			pthread_cond_wait(&db_cond, &db_lock);
+		while (batch.length < c_mysql_batch && db_jobs.length)
+			g_queue_push_tail(&batch, g_queue_pop_head(&db_jobs));
+		pthread_cond_broadcast(&db_space);
+		pthread_mutex_unlock(&db_lock);
+
+		if (!batch.length)
+			break; // shutting down and nothing left to do
+
+		db_batch(&batch);
+
+		time_t now = time(NULL);
+		if (now >= next_stats) {
+			db_stats_log();
+			next_stats = now + DB_STATS_INTERVAL;
+		}
+	}
+
+	db_stats_log();
+
+	reset_conn();
+	mysql_thread_end();
+
+	return NULL;
+}
+
+
+static struct db_job *db_job_new(enum db_job_type type, db_ref_t *call, db_ref_t *stream) {
+	struct db_job *j = g_slice_alloc0(sizeof(*j));
+	j->type = type;
+	j->call = db_ref_get(call);
+	j->stream = db_ref_get(stream);
+	j->now = now_double();
+	return j;
+}
+
+static void db_queue(struct db_job *j) {
+	j->queued = now_us();
+
+	pthread_mutex_lock(&db_lock);
+	if (db_jobs.length >= c_mysql_queue && !db_shutdown) {
+		// the writer can't keep up: hold the caller back instead of letting the
+		// queue grow without bounds
+		if (!db_stats.stalling)
+			ilog(LOG_WARN, "Database writer is falling behind, %u updates queued",
+					db_jobs.length);
+		db_stats.stalling = 1;
+		db_stats.stalls++;
+		long long start = now_us();
+		while (db_jobs.length >= c_mysql_queue && !db_shutdown)
+			pthread_cond_wait(&db_space, &db_lock);
+		db_stats.stall_us += now_us() - start;
+	}
+	g_queue_push_tail(&db_jobs, j);
+	if (db_jobs.length > db_stats.queued_max)
+		db_stats.queued_max = db_jobs.length;
+	pthread_cond_signal(&db_cond);
+	pthread_mutex_unlock(&db_lock);
+}
+
+
+// mf is locked
+void db_do_call(metafile_t *mf) {
+	if (!db_running)
+		return;
+
+	if (!mf->db) {
+		if (!mf->call_id)
+			return;
+		mf->db = db_ref_new();
+		struct db_job *j = db_job_new(DB_INSERT_CALL, mf->db, NULL);
+		j->text = g_strdup(mf->call_id);
+		db_queue(j);
+	}
+
+	if (mf->metadata_db) {
+		struct db_job *j = db_job_new(DB_INSERT_METADATA, mf->db, NULL);
+		j->text = g_strdup(mf->metadata_db);
+		db_queue(j);
+		mf->metadata_db = NULL;
+	}
+}
+
+
+// mf is locked
+void db_do_stream(metafile_t *mf, output_t *op, const char *type, stream_t *stream, unsigned long ssrc) {
+	if (!db_running)
+		return;
+	if (!mf->db)
+		return;
+	if (op->db)
+		return;
+
+	op->db = db_ref_new();
+	struct db_job *j = db_job_new(DB_INSERT_STREAM, mf->db, op->db);
+	j->text = g_strdup(op->file_name);
+	j->file_format = g_strdup(op->file_format);
+	j->full_filename = g_strdup(op->full_filename);
+	j->output_type = type;
+	j->stream_id = stream ? stream->id : 0;
+	j->ssrc = ssrc;
+	if (stream && stream->tag != (unsigned long) -1) {
+		tag_t *tag = tag_get(mf, stream->tag);
+		j->label = g_strdup(tag->label ? : "");
+	}
+	else
+		j->label = g_strdup("");
+	db_queue(j);
+}
+
+void db_close_call(metafile_t *mf) {
+	if (!db_running)
 		return;
-	if (op->db_id == 0)
+	if (!mf->db)
 		return;
 
-        MYSQL_BIND b[1];
-	my_ull(&b[0], &op->db_id);
+	db_queue(db_job_new(DB_CLOSE_CALL, mf->db, NULL));
+}
 
-	execute_wrap(&stm_delete_stream, b, NULL);
+void db_close_stream(output_t *op) {
+	if (!db_running)
+		return;
+	if (!op->db)
+		return;
 
-	mf->db_streams--;
+	struct db_job *j = db_job_new(DB_CLOSE_STREAM, NULL, op->db);
+	j->text = g_strdup(op->filename);
+	db_queue(j);
 }
 
-void db_config_stream(output_t *op) {
-	if (check_conn())
+void db_delete_stream(metafile_t *mf, output_t *op) {
+	if (!db_running)
 		return;
-	if (op->db_id == 0)
+	if (!op->db)
 		return;
 
-	MYSQL_BIND b[3];
-	my_i(&b[0], &op->encoder->actual_format.channels);
-	my_i(&b[1], &op->encoder->actual_format.clockrate);
-	my_ull(&b[2], &op->db_id);
+	db_queue(db_job_new(DB_DELETE_STREAM, mf->db, op->db));
+}
+
+void db_config_stream(output_t *op, const format_t *format) {
+	if (!db_running)
+		return;
+	if (!op->db)
+		return;
 
-	execute_wrap(&stm_config_stream, b, NULL);
+	struct db_job *j = db_job_new(DB_CONFIG_STREAM, NULL, op->db);
+	j->channels = format->channels;
+	j->clockrate = format->clockrate;
+	j->text = g_strdup(op->file_name);
+	j->file_format = g_strdup(op->file_format);
+	j->full_filename = g_strdup(op->full_filename);
+	db_queue(j);
 }
 
-void db_thread_end(void) {
-	reset_conn();
+
+void db_thread_start(void) {
+	if (!c_mysql_host || !c_mysql_db)
+		return;
+
+	db_running = 1;
+	if (pthread_create(&db_thread, NULL, db_writer_thread, NULL))
+		die_errno("pthread_create failed");
+}
+
+// waits for everything queued so far to be written
+void db_cleanup(void) {
+	if (!db_running)
+		return;
+
+	pthread_mutex_lock(&db_lock);
+	db_shutdown = 1;
+	pthread_cond_broadcast(&db_cond);
+	pthread_cond_broadcast(&db_space);
+	pthread_mutex_unlock(&db_lock);
+
+	pthread_join(db_thread, NULL);
+	db_running = 0;
 }
@@ -9,8 +9,10 @@ void db_close_call(metafile_t *);
 void db_do_stream(metafile_t *mf, output_t *op, const char *type, stream_t *, unsigned long ssrc);
 void db_close_stream(output_t *op);
 void db_delete_stream(metafile_t *, output_t *op);
-void db_config_stream(output_t *op);
-void db_thread_end(void);
+void db_config_stream(output_t *op, const format_t *);
+void db_release(db_ref_t **);
+void db_thread_start(void);
+void db_cleanup(void);
 
 
 #endif
@@ -19,13 +19,15 @@
 #include "main.h"
 #include "packet.h"
 #include "tag.h"
+#include "recaux.h"
 
 
 int resample_audio;
 
 
 
-decode_t *decoder_new(const char *payload_str, const char *format, int ptime, output_t *outp) {
+// parses an encoding string such as "opus/48000/2"
+const codec_def_t *decoder_codec(const char *payload_str, int *clockrate_p, int *channels_p) {
 	str name;
 	char *slash = strchr(payload_str, '/');
 	if (!slash) {
@@ -54,6 +56,18 @@ decode_t *decoder_new(const char *payload_str, const char *format, int ptime, ou
 		ilog(LOG_WARN, "No decoder for payload %s", payload_str);
 		return NULL;
 	}
+
+	*clockrate_p = clockrate;
+	*channels_p = channels;
+	return def;
+}
+
+
+decode_t *decoder_new(const char *payload_str, const char *format, int ptime, output_t *outp) {
+	int clockrate, channels;
+	const codec_def_t *def = decoder_codec(payload_str, &clockrate, &channels);
+	if (!def)
+		return NULL;
 	if (def->supplemental || !def->support_decoding || def->media_type != MT_AUDIO) {
 		// not a real audio codec
 		ilog(LOG_DEBUG, "Not decoding codec %s", payload_str);
@@ -91,7 +105,6 @@ decode_t *decoder_new(const char *payload_str, const char *format, int ptime, ou
 		return NULL;
 	decode_t *deco = g_slice_alloc0(sizeof(decode_t));
 	deco->dec = dec;
-	deco->mixer_idx = (unsigned int) -1;
 	return deco;
 }
 
@@ -112,29 +125,23 @@ static int decoder_got_frame(decoder_t *dec, AVFrame *frame, void *sp, void *dp)
 	if (!metafile->recording_on)
 		goto no_recording;
 
-	// handle mix output
-	pthread_mutex_lock(&metafile->mix_lock);
-	if (metafile->mix_out) {
-		dbg("adding packet from stream #%lu to mix output", stream->id);
-		if (G_UNLIKELY(deco->mixer_idx == (unsigned int) -1))
-			deco->mixer_idx = mix_get_index(metafile->mix, ssrc);
-		format_t actual_format;
-		if (output_config(metafile->mix_out, &dec->dest_format, &actual_format))
-			goto no_mix_out;
-		mix_config(metafile->mix, &actual_format);
-		// XXX might be a second resampling to same format
-		AVFrame *dec_frame = resample_frame(&deco->mix_resampler, frame, &actual_format);
-		if (!dec_frame) {
+	// handle mix output. the mixer is created before any of the call's streams
+	// are opened
+	if (metafile->mix) {
+		if (G_UNLIKELY(!deco->mix_input)) {
+			format_t actual_format;
+			mutex_lock_timed(&metafile->mix_lock);
+			if (!output_config(metafile->mix_out, &dec->dest_format, &actual_format))
+				deco->mix_input = mix_input_new(metafile->mix, ssrc, &actual_format);
 			pthread_mutex_unlock(&metafile->mix_lock);
-			goto err;
 		}
-		if (mix_add(metafile->mix, dec_frame, deco->mixer_idx, ssrc, metafile->mix_out))
-			ilog(LOG_ERR, "Failed to add decoded packet to mixed output");
+		if (deco->mix_input) {
+			dbg("adding packet from stream #%lu to mix output", stream->id);
+			mix_input_push(deco->mix_input, frame);
+		}
 	}
-no_mix_out:
-	pthread_mutex_unlock(&metafile->mix_lock);
 
-	if (output) {
+	if (output && !output->passthrough) {
 		dbg("SSRC %lx of stream #%lu has single output", ssrc->ssrc, stream->id);
 		if (output_config(output, &dec->dest_format, NULL))
 			goto err;
@@ -195,6 +202,5 @@ void decoder_free(decode_t *deco) {
 	if (!deco)
 		return;
 	decoder_close(deco->dec);
-	resample_shutdown(&deco->mix_resampler);
 	g_slice_free1(sizeof(*deco), deco);
 }
@@ -8,6 +8,7 @@
 extern int resample_audio;
 
 
+const codec_def_t *decoder_codec(const char *payload_str, int *clockrate, int *channels);
 decode_t *decoder_new(const char *payload_str, const char *format, int ptime, output_t *);
 int decoder_input(decode_t *, const str *, unsigned long ts, ssrc_t *);
 void decoder_free(decode_t *);
@@ -3,55 +3,100 @@
 #include <glib.h>
 #include <pthread.h>
 #include <unistd.h>
-#include <mysql.h>
+#include <time.h>
 #include "log.h"
 #include "main.h"
 #include "garbage.h"
-#include "db.h"
+#include "stream.h"
+#include "packet.h"
+#include "recaux.h"
 
 
-static int epoll_fd = -1;
+#define EPOLL_MAX_EVENTS 64
+#define EPOLL_STATS_INTERVAL 60
+
+
+// Each poller thread has its own epoll instance. All fds of one call are added
+// to the same one (see metafile_t.shard), so a call is only ever handled by one
+// thread and its locks aren't contended between threads.
+static int *epoll_fds;
+static unsigned int num_epoll_fds;
+static volatile unsigned int epoll_next_shard;
+
+// totals of all threads that have finished
+static volatile unsigned long long total_wakeups, total_events, total_lock_waits, total_lock_wait_us;
+
+static __thread unsigned long long thread_wakeups, thread_events;
 
 
 void epoll_setup(void) {
-	epoll_fd = epoll_create1(0);
-	if (epoll_fd == -1)
-		die_errno("epoll_create1 failed");
+	num_epoll_fds = num_threads;
+	epoll_fds = malloc(sizeof(*epoll_fds) * num_epoll_fds);
+	for (unsigned int i = 0; i < num_epoll_fds; i++) {
+		epoll_fds[i] = epoll_create1(0);
+		if (epoll_fds[i] == -1)
+			die_errno("epoll_create1 failed");
+	}
+}
+
 
+unsigned int epoll_new_shard(void) {
+	return g_atomic_int_add(&epoll_next_shard, 1) % num_epoll_fds;
 }
 
 
-int epoll_add(int fd, uint32_t events, handler_t *handler) {
+int epoll_add(int fd, uint32_t events, handler_t *handler, unsigned int shard) {
 	struct epoll_event epev = { .events = events | EPOLLET, .data = { .ptr = handler } };
-	int ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &epev);
+	int ret = epoll_ctl(epoll_fds[shard % num_epoll_fds], EPOLL_CTL_ADD, fd, &epev);
 	return ret;
 }
 
 
-void epoll_del(int fd) {
-	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+void epoll_del(int fd, unsigned int shard) {
+	epoll_ctl(epoll_fds[shard % num_epoll_fds], EPOLL_CTL_DEL, fd, NULL);
+}
+
+
+static void epoll_stats_log(int prio, const char *what, unsigned long long wakeups, unsigned long long events,
+		unsigned long long lock_waits, unsigned long long lock_wait_us)
+{
+	ilog(prio, "%s: %llu events in %llu wakeups (%.1f per wakeup), "
+			"%llu contended locks, %llu us waited",
+			what, events, wakeups, wakeups ? (double) events / wakeups : 0.0,
+			lock_waits, lock_wait_us);
 }
 
 
 static void poller_thread_end(void *ptr) {
-	mysql_thread_end();
-	db_thread_end();
+	unsigned int me_num = GPOINTER_TO_UINT(ptr);
+	char what[32];
+
+	snprintf(what, sizeof(what), "Poller thread %u", me_num);
+	epoll_stats_log(LOG_DEBUG, what, thread_wakeups, thread_events, lock_waits, lock_wait_us);
+
+	__atomic_add_fetch(&total_wakeups, thread_wakeups, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&total_events, thread_events, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&total_lock_waits, lock_waits, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&total_lock_wait_us, lock_wait_us, __ATOMIC_RELAXED);
+
+	stream_thread_end();
+	packet_thread_end();
 }
 
 
 void *poller_thread(void *ptr) {
-	struct epoll_event epev;
+	struct epoll_event epev[EPOLL_MAX_EVENTS];
 	unsigned int me_num = GPOINTER_TO_UINT(ptr);
+	int epoll_fd = epoll_fds[me_num % num_epoll_fds];
+	time_t next_stats = time(NULL) + EPOLL_STATS_INTERVAL;
 
 	dbg("poller thread %u running", me_num);
 
-	mysql_thread_init();
-
-	pthread_cleanup_push(poller_thread_end, NULL);
+	pthread_cleanup_push(poller_thread_end, ptr);
 
 	while (!shutdown_flag) {
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-		int ret = epoll_wait(epoll_fd, &epev, 1, 10000);
+		int ret = epoll_wait(epoll_fd, epev, G_N_ELEMENTS(epev), 10000);
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
 		if (ret == -1) {
@@ -61,13 +106,29 @@ void *poller_thread(void *ptr) {
 		}
 
 		if (ret > 0) {
-			dbg("thread %u handling event", me_num);
+			dbg("thread %u handling %i events", me_num, ret);
 
-			handler_t *handler = epev.data.ptr;
-			handler->func(handler);
+			thread_wakeups++;
+			thread_events += ret;
+
+			// anything removed by one of these handlers is only freed
+			// through the garbage collector, so later events stay valid
+			for (int i = 0; i < ret; i++) {
+				handler_t *handler = epev[i].data.ptr;
+				handler->func(handler);
+			}
 		}
 
 		garbage_collect(me_num);
+
+		time_t now = time(NULL);
+		if (now >= next_stats) {
+			char what[32];
+			snprintf(what, sizeof(what), "Poller thread %u", me_num);
+			epoll_stats_log(LOG_DEBUG, what, thread_wakeups, thread_events,
+					lock_waits, lock_wait_us);
+			next_stats = now + EPOLL_STATS_INTERVAL;
+		}
 	}
 
 	pthread_cleanup_pop(1);
@@ -77,5 +138,11 @@ void *poller_thread(void *ptr) {
 
 
 void epoll_cleanup(void) {
-	close(epoll_fd);
+	epoll_stats_log(LOG_INFO, "Poller threads", total_wakeups, total_events,
+			total_lock_waits, total_lock_wait_us);
+
+	for (unsigned int i = 0; i < num_epoll_fds; i++)
+		close(epoll_fds[i]);
+	free(epoll_fds);
+	epoll_fds = NULL;
 }
@@ -10,8 +10,9 @@
 void epoll_setup(void);
 void epoll_cleanup(void);
 
-int epoll_add(int fd, uint32_t events, handler_t *handler);
-void epoll_del(int fd);
+unsigned int epoll_new_shard(void);
+int epoll_add(int fd, uint32_t events, handler_t *handler, unsigned int shard);
+void epoll_del(int fd, unsigned int shard);
 
 
 void *poller_thread(void *ptr);
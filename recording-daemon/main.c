@@ -18,6 +18,9 @@
 #include "log.h"
 #include "epoll.h"
 #include "inotify.h"
+#include "metasocket.h"
+#include "ring.h"
+#include "packet.h"
 #include "metafile.h"
 #include "garbage.h"
 #include "auxlib.h"
@@ -25,8 +28,11 @@
 #include "output.h"
 #include "forward.h"
 #include "codeclib.h"
+#include "resample.h"
 #include "socket.h"
 #include "ssllib.h"
+#include "db.h"
+#include "mix.h"
 
 
 
@@ -34,12 +40,19 @@ int ktable = 0;
 int num_threads;
 enum output_storage_enum output_storage = OUTPUT_STORAGE_FILE;
 char *spool_dir = NULL;
+char *metadata_socket = NULL;
 char *output_dir = NULL;
 static char *output_format = NULL;
 int output_mixed;
 enum mix_method mix_method;
+int mix_filter;
+int mix_threads;
 int output_single;
+int output_passthrough;
 int output_enabled = 1;
+int output_threads;
+int output_io_threads;
+int output_queue_len = 1500;
 mode_t output_chmod;
 mode_t output_chmod_dir;
 uid_t output_chown = -1;
@@ -51,6 +64,8 @@ char *c_mysql_host,
       *c_mysql_pass,
       *c_mysql_db;
 int c_mysql_port;
+int c_mysql_batch = 100;
+int c_mysql_queue = 10000;
 char *forward_to = NULL;
 static char *tls_send_to = NULL;
 endpoint_t tls_send_to_ep;
@@ -92,7 +107,9 @@ static void setup(void) {
 	signals();
 	metafile_setup();
 	epoll_setup();
+	ring_setup();
 	inotify_setup();
+	metasocket_setup();
 
 }
 
@@ -153,7 +170,13 @@ static void wait_for_signal(void) {
 static void cleanup(void) {
 	garbage_collect_all();
 	metafile_cleanup();
+	mix_cleanup();
+	output_cleanup();
+	db_cleanup();
+	packet_thread_end();
+	metasocket_cleanup();
 	inotify_cleanup();
+	ring_cleanup();
 	epoll_cleanup();
 	mysql_library_end();
 }
@@ -181,16 +204,24 @@ static void options(int *argc, char ***argv) {
 	GOptionEntry e[] = {
 		{ "table",		't', 0, G_OPTION_ARG_INT,	&ktable,	"Kernel table rtpengine uses",		"INT"		},
 		{ "spool-dir",		0,   0, G_OPTION_ARG_STRING,	&spool_dir,	"Directory containing rtpengine metadata files", "PATH" },
+		{ "metadata-socket",	0,   0, G_OPTION_ARG_STRING,	&metadata_socket,"Receive metadata from rtpengine through this socket", "PATH" },
 		{ "num-threads",	0,   0, G_OPTION_ARG_INT,	&num_threads,	"Number of worker threads",		"INT"		},
 		{ "output-storage",	0,   0, G_OPTION_ARG_STRING,	&os_str,	"Where to store audio streams",	        "file|db|both"	},
 		{ "output-dir",		0,   0, G_OPTION_ARG_STRING,	&output_dir,	"Where to write media files to",	"PATH"		},
 		{ "output-pattern",	0,   0, G_OPTION_ARG_STRING,	&output_pattern,"File name pattern for recordings",	"STRING"	},
 		{ "output-format",	0,   0, G_OPTION_ARG_STRING,	&output_format,	"Write audio files of this type",	"wav|mp3|none"	},
 		{ "resample-to",	0,   0, G_OPTION_ARG_INT,	&resample_audio,"Resample all output audio",		"INT"		},
+		{ "fast-resampler",	0,   0, G_OPTION_ARG_NONE,	&resample_fast_path,"Use built-in resampler for integer sample rate ratios",NULL	},
 		{ "mp3-bitrate",	0,   0, G_OPTION_ARG_INT,	&mp3_bitrate,	"Bits per second for MP3 encoding",	"INT"		},
 		{ "output-mixed",	0,   0, G_OPTION_ARG_NONE,	&output_mixed,	"Mix participating sources into a single output",NULL	},
 		{ "mix-method",		0,   0, G_OPTION_ARG_STRING,	&mix_method_str,"How to mix multiple sources",		"direct|channels"},
+		{ "mix-filter",		0,   0, G_OPTION_ARG_NONE,	&mix_filter,	"Mix through libavfilter instead of the built-in mixer",NULL	},
+		{ "mix-threads",	0,   0, G_OPTION_ARG_INT,	&mix_threads,	"Number of threads mixing audio",	"INT"		},
 		{ "output-single",	0,   0, G_OPTION_ARG_NONE,	&output_single,	"Create one output file for each source",NULL		},
+		{ "output-passthrough",	0,   0, G_OPTION_ARG_NONE,	&output_passthrough,"Store G.711 and Opus in single outputs without transcoding",NULL	},
+		{ "output-threads",	0,   0, G_OPTION_ARG_INT,	&output_threads,"Number of threads encoding output files","INT"		},
+		{ "output-io-threads",	0,   0, G_OPTION_ARG_INT,	&output_io_threads,"Number of threads writing output files","INT"	},
+		{ "output-queue",	0,   0, G_OPTION_ARG_INT,	&output_queue_len,"Max frames queued per output file",	"INT"		},
 		{ "output-chmod",	0,   0, G_OPTION_ARG_STRING,	&chmod_mode,	"File mode for recordings",		"OCTAL"		},
 		{ "output-chmod-dir",	0,   0, G_OPTION_ARG_STRING,	&chmod_dir_mode,"Directory mode for recordings",	"OCTAL"		},
 		{ "output-chown",	0,   0, G_OPTION_ARG_STRING,	&user_uid,	"File owner for recordings",		"USER|UID"	},
@@ -200,6 +231,8 @@ static void options(int *argc, char ***argv) {
 		{ "mysql-user",		0,   0,	G_OPTION_ARG_STRING,	&c_mysql_user,	"MySQL connection credentials",		"USERNAME"	},
 		{ "mysql-pass",		0,   0,	G_OPTION_ARG_STRING,	&c_mysql_pass,	"MySQL connection credentials",		"PASSWORD"	},
 		{ "mysql-db",		0,   0,	G_OPTION_ARG_STRING,	&c_mysql_db,	"MySQL database name",			"STRING"	},
+		{ "mysql-batch",	0,   0,	G_OPTION_ARG_INT,	&c_mysql_batch,	"Max database updates per transaction",	"INT"		},
+		{ "mysql-queue",	0,   0,	G_OPTION_ARG_INT,	&c_mysql_queue,	"Max database updates waiting to be written","INT"	},
 		{ "forward-to", 	0,   0, G_OPTION_ARG_STRING,	&forward_to,	"Where to forward to (unix socket)",	"PATH"		},
 		{ "tls-send-to", 	0,   0, G_OPTION_ARG_STRING,	&tls_send_to,	"Where to send to (TLS destination)",	"IP:PORT"	},
 		{ "tls-resample", 	0,   0, G_OPTION_ARG_INT,	&tls_resample,	"Sampling rate for TLS PCM output",	"INT"		},
@@ -290,6 +323,18 @@ static void options(int *argc, char ***argv) {
 
 	if (num_threads <= 0)
 		num_threads = num_cpu_cores(8);
+	if (output_threads <= 0)
+		output_threads = num_threads;
+	if (output_io_threads <= 0)
+		output_io_threads = 2;
+	if (mix_threads <= 0)
+		mix_threads = num_threads;
+	if (output_queue_len <= 0)
+		die("Invalid 'output-queue' option");
+	if (c_mysql_batch <= 0)
+		die("Invalid 'mysql-batch' option");
+	if (c_mysql_queue <= 0)
+		die("Invalid 'mysql-queue' option");
 
 	if (!output_pattern)
 		output_pattern = g_strdup("%c-%t");
@@ -302,6 +347,7 @@ static void options(int *argc, char ***argv) {
 static void options_free(void) {
 	// free config options	
 	g_free(spool_dir);
+	g_free(metadata_socket);
 	g_free(output_dir);
 	g_free(output_format);
 	g_free(c_mysql_host);
@@ -324,6 +370,13 @@ int main(int argc, char **argv) {
 
 	service_notify("READY=1\n");
 
+	db_thread_start();
+	if (output_enabled) {
+		output_threads_start();
+		if (output_mixed)
+			mix_threads_start();
+	}
+
 	for (int i = 0; i < num_threads; i++)
 		start_poller_thread();
 
@@ -21,11 +21,18 @@ extern int ktable;
 extern int num_threads;
 extern enum output_storage_enum output_storage;
 extern char *spool_dir;
+extern char *metadata_socket;
 extern char *output_dir;
 extern int output_mixed;
 extern enum mix_method mix_method;
+extern int mix_filter;
+extern int mix_threads;
 extern int output_single;
+extern int output_passthrough;
 extern int output_enabled;
+extern int output_threads;
+extern int output_io_threads;
+extern int output_queue_len;
 extern mode_t output_chmod;
 extern mode_t output_chmod_dir;
 extern uid_t output_chown;
@@ -37,6 +44,8 @@ extern char *c_mysql_host,
       *c_mysql_pass,
       *c_mysql_db;
 extern int c_mysql_port;
+extern int c_mysql_batch;
+extern int c_mysql_queue;
 extern char *forward_to;
 extern endpoint_t tls_send_to_ep;
 extern int tls_resample;
@@ -11,6 +11,7 @@
 #include "garbage.h"
 #include "main.h"
 #include "recaux.h"
+#include "epoll.h"
 #include "packet.h"
 #include "output.h"
 #include "mix.h"
@@ -26,9 +27,11 @@ static void meta_free(void *ptr) {
 	metafile_t *mf = ptr;
 
 	dbg("freeing metafile info for %s%s%s", FMT_M(mf->name));
+	mix_sync(mf->mix);
 	output_close(mf, mf->mix_out);
 	mix_destroy(mf->mix);
 	db_close_call(mf);
+	db_release(&mf->db);
 	g_string_chunk_free(mf->gsc);
 	for (int i = 0; i < mf->streams->len; i++) {
 		stream_t *stream = g_ptr_array_index(mf->streams, i);
@@ -72,12 +75,12 @@ static void meta_destroy(metafile_t *mf) {
 static void meta_stream_interface(metafile_t *mf, unsigned long snum, char *content) {
 	db_do_call(mf);
 	if (output_enabled && output_mixed && mf->recording_on) {
-		pthread_mutex_lock(&mf->mix_lock);
+		mutex_lock_timed(&mf->mix_lock);
 		if (!mf->mix) {
 			mf->mix_out = output_new(output_dir, mf->parent, "mix", "mix");
 			if (mix_method == MM_CHANNELS)
 				mf->mix_out->channel_mult = MIX_NUM_INPUTS;
-			mf->mix = mix_new();
+			mf->mix = mix_new(mf->mix_out);
 			db_do_stream(mf, mf->mix_out, "mixed", NULL, 0);
 		}
 		pthread_mutex_unlock(&mf->mix_lock);
@@ -192,6 +195,8 @@ static void meta_section(metafile_t *mf, char *section, char *content, unsigned
 		mf->recording_on = u ? 1 : 0;
 	else if (sscanf_match(section, "FORWARDING %u", &u) == 1)
 		mf->forwarding_on = u ? 1 : 0;
+	else if (sscanf_match(section, "STREAM %lu KERNEL-INDEX %u", &lu, &u) == 2)
+		stream_kernel_idx(mf, lu, u);
 	else if (sscanf_match(section, "STREAM %lu FORWARDING %u", &lu, &u) == 2)
 		stream_forwarding_on(mf, lu, u);
 	else if (!strcmp(section, "OUTPUT_DESTINATION"))
@@ -218,6 +223,7 @@ static metafile_t *metafile_get(char *name) {
 	mf->forward_count = 0;
 	mf->forward_failed = 0;
 	mf->recording_on = 1;
+	mf->shard = epoll_new_shard();
 
 	if (decoding_enabled) {
 		pthread_mutex_init(&mf->payloads_lock, NULL);
@@ -229,51 +235,18 @@ static metafile_t *metafile_get(char *name) {
 
 out:
 	// switch locks
-	pthread_mutex_lock(&mf->lock);
+	mutex_lock_timed(&mf->lock);
 	pthread_mutex_unlock(&metafiles_lock);
 
 	return mf;
 }
 
 
-void metafile_change(char *name) {
-	metafile_t *mf = metafile_get(name);
-
-	char fnbuf[PATH_MAX];
-	snprintf(fnbuf, sizeof(fnbuf), "%s/%s", spool_dir, name);
-
-	// open file and seek to last known position
-	int fd = open(fnbuf, O_RDONLY);
-	if (fd == -1) {
-		ilog(LOG_ERR, "Failed to open %s%s%s: %s", FMT_M(fnbuf), strerror(errno));
-		goto out;
-	}
-	if (lseek(fd, mf->pos, SEEK_SET) == (off_t) -1) {
-		ilog(LOG_ERR, "Failed to seek to end of file %s%s%s: %s", FMT_M(fnbuf), strerror(errno));
-		close(fd);
-		goto out;
-	}
-
-	// read the entire file
-	GString *s = g_string_new(NULL);
-	char buf[1024];
-	while (1) {
-		int ret = read(fd, buf, sizeof(buf));
-		if (ret == 0)
-			break;
-		if (ret == -1)
-			die_errno("read on metadata file failed");
-		g_string_append_len(s, buf, ret);
-	}
-
-	// save read position and close file
-	mf->pos = lseek(fd, 0, SEEK_CUR);
-	close(fd);
-
-	// process contents of metadata file
+// mf is locked. buf must be writable and NUL terminated
+static void metafile_parse(metafile_t *mf, const char *name, char *buf, size_t len) {
 	// XXX use "str" type?
-	char *head = s->str;
-	char *endp = s->str + s->len;
+	char *head = buf;
+	char *endp = buf + len;
 	while (head < endp) {
 		// section header
 		char *nl = memchr(head, '\n', endp - head);
@@ -332,6 +305,45 @@ void metafile_change(char *name) {
 
 		meta_section(mf, section, content, slen);
 	}
+}
+
+
+void metafile_change(char *name) {
+	metafile_t *mf = metafile_get(name);
+
+	char fnbuf[PATH_MAX];
+	snprintf(fnbuf, sizeof(fnbuf), "%s/%s", spool_dir, name);
+
+	// open file and seek to last known position
+	int fd = open(fnbuf, O_RDONLY);
+	if (fd == -1) {
+		ilog(LOG_ERR, "Failed to open %s%s%s: %s", FMT_M(fnbuf), strerror(errno));
+		goto out;
+	}
+	if (lseek(fd, mf->pos, SEEK_SET) == (off_t) -1) {
+		ilog(LOG_ERR, "Failed to seek to end of file %s%s%s: %s", FMT_M(fnbuf), strerror(errno));
+		close(fd);
+		goto out;
+	}
+
+	// read the entire file
+	GString *s = g_string_new(NULL);
+	char buf[1024];
+	while (1) {
+		int ret = read(fd, buf, sizeof(buf));
+		if (ret == 0)
+			break;
+		if (ret == -1)
+			die_errno("read on metadata file failed");
+		g_string_append_len(s, buf, ret);
+	}
+
+	// save read position and close file
+	mf->pos = lseek(fd, 0, SEEK_CUR);
+	close(fd);
+
+	// process contents of metadata file
+	metafile_parse(mf, name, s->str, s->len);
 
 	g_string_free(s, TRUE);
 
@@ -340,6 +352,14 @@ out:
 }
 
 
+// sections received through the metadata socket
+void metafile_chunks(char *name, char *buf, size_t len) {
+	metafile_t *mf = metafile_get(name);
+	metafile_parse(mf, name, buf, len);
+	pthread_mutex_unlock(&mf->lock);
+}
+
+
 void metafile_delete(char *name) {
 	// get metafile metadata
 	pthread_mutex_lock(&metafiles_lock);
@@ -350,7 +370,7 @@ void metafile_delete(char *name) {
 		return;
 	}
 	// switch locks and remove entry
-	pthread_mutex_lock(&mf->lock);
+	mutex_lock_timed(&mf->lock);
 	g_hash_table_remove(metafiles, name);
 	pthread_mutex_unlock(&metafiles_lock);
 
@@ -7,6 +7,7 @@ void metafile_setup(void);
 void metafile_cleanup(void);
 
 void metafile_change(char *name);
+void metafile_chunks(char *name, char *buf, size_t len);
 void metafile_delete(char *name);
 
 #endif
@@ -0,0 +1,158 @@
+#include "metasocket.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "log.h"
+#include "main.h"
+#include "epoll.h"
+#include "metafile.h"
+
+
+// Instead of appending to metadata files in the spool directory, rtpengine can
+// send the same sections over a SOCK_SEQPACKET connection. Each message starts
+// with the name of the metadata file and a newline, followed by the new
+// sections only. A message with only the name marks the end of the call, the
+// same as the file being deleted.
+
+struct metasocket_conn {
+	handler_t handler;
+	int fd;
+};
+
+
+static int listen_fd = -1;
+
+
+static handler_func metasocket_accept;
+static handler_t listen_handler = {
+	.func = metasocket_accept,
+};
+
+
+static void metasocket_message(char *buf, size_t len) {
+	char *nl = memchr(buf, '\n', len);
+	if (!nl || nl == buf || memchr(buf, '\0', nl - buf) || memchr(buf, '/', nl - buf)) {
+		ilog(LOG_WARN, "Invalid message received on metadata socket");
+		return;
+	}
+	*nl = '\0';
+	char *name = buf;
+	nl++;
+	size_t rest = len - (nl - buf);
+
+	if (!rest) {
+		dbg("metadata socket: delete(%s%s%s)", FMT_M(name));
+		metafile_delete(name);
+		return;
+	}
+
+	dbg("metadata socket: %zu bytes for %s%s%s", rest, FMT_M(name));
+	metafile_chunks(name, nl, rest);
+}
+
+
+static void metasocket_close(struct metasocket_conn *conn) {
+	epoll_del(conn->fd, 0);
+	close(conn->fd);
+	g_slice_free1(sizeof(*conn), conn);
+}
+
+
+static void metasocket_read(handler_t *handler) {
+	struct metasocket_conn *conn = handler->ptr;
+	char stackbuf[8192];
+
+	while (1) {
+		// get the size of the next message first
+		ssize_t ret = recv(conn->fd, stackbuf, sizeof(stackbuf) - 1, MSG_PEEK | MSG_TRUNC);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				return;
+			ilog(LOG_ERR, "Failed to read from metadata socket: %s", strerror(errno));
+			metasocket_close(conn);
+			return;
+		}
+		if (ret == 0) {
+			ilog(LOG_INFO, "Metadata connection closed");
+			metasocket_close(conn);
+			return;
+		}
+
+		// one extra byte, so that the last section can be terminated
+		char *buf = ret < sizeof(stackbuf) ? stackbuf : g_malloc(ret + 1);
+		ssize_t len = recv(conn->fd, buf, ret, 0);
+		if (len == ret) {
+			buf[len] = '\0';
+			metasocket_message(buf, len);
+		}
+		if (buf != stackbuf)
+			g_free(buf);
+	}
+}
+
+
+static void metasocket_accept(handler_t *handler) {
+	while (1) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EWOULDBLOCK && errno != EAGAIN)
+				ilog(LOG_ERR, "Failed to accept connection on metadata socket: %s",
+						strerror(errno));
+			return;
+		}
+
+		ilog(LOG_INFO, "New metadata connection");
+
+		struct metasocket_conn *conn = g_slice_alloc0(sizeof(*conn));
+		conn->fd = fd;
+		conn->handler.func = metasocket_read;
+		conn->handler.ptr = conn;
+		// same thread as the listening socket and inotify
+		if (epoll_add(fd, EPOLLIN, &conn->handler, 0)) {
+			ilog(LOG_ERR, "Failed to add metadata connection to epoll: %s", strerror(errno));
+			close(fd);
+			g_slice_free1(sizeof(*conn), conn);
+			continue;
+		}
+		// anything received before it was added
+		metasocket_read(&conn->handler);
+	}
+}
+
+
+void metasocket_setup(void) {
+	if (!metadata_socket)
+		return;
+
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	if (strlen(metadata_socket) >= sizeof(sun.sun_path))
+		die("Metadata socket path too long");
+	strcpy(sun.sun_path, metadata_socket);
+
+	listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1)
+		die_errno("Failed to create metadata socket");
+	unlink(metadata_socket);
+	if (bind(listen_fd, (struct sockaddr *) &sun, sizeof(sun)))
+		die_errno("Failed to bind metadata socket");
+	if (listen(listen_fd, 16))
+		die_errno("Failed to listen on metadata socket");
+
+	if (epoll_add(listen_fd, EPOLLIN, &listen_handler, 0))
+		die_errno("failed to add metadata socket to epoll");
+}
+
+
+void metasocket_cleanup(void) {
+	if (listen_fd == -1)
+		return;
+	close(listen_fd);
+	unlink(metadata_socket);
+}
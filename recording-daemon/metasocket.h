@@ -0,0 +1,7 @@
+#ifndef _METASOCKET_H_
+#define _METASOCKET_H_
+
+void metasocket_setup(void);
+void metasocket_cleanup(void);
+
+#endif
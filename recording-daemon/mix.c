@@ -7,7 +7,11 @@
 #include <libavutil/mathematics.h>
 #include <inttypes.h>
 #include <libavutil/opt.h>
+#include <pthread.h>
 #include <sys/time.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "types.h"
 #include "log.h"
 #include "output.h"
@@ -16,6 +20,28 @@
 #include "fix_frame_channel_layout.h"
 
 
+// Decoders don't mix themselves. Each one pushes its frames into its own queue
+// (mix_input_t) and each call's mixer is run as a task by a pool of mixing
+// threads, which takes the frames from all queues of the mixer in turn. Only
+// one decoder pushes into a queue and only the mixing task takes frames out of
+// it, so no locks are needed for the handoff, and a decoder never waits for the
+// mixer. A mixer is run by at most one mixing thread at a time.
+
+#define MIX_QUEUE_LEN 64 // frames waiting per input, power of two
+#define MIX_RUN_BATCH 32 // frames per turn of a mixer
+
+
+struct mix_input_s {
+	mix_t *mix;
+	void *ref;
+	unsigned int idx;
+	format_t format; // of the mixer input
+	resample_t resample;
+	unsigned long long dropped; // decoder only
+	unsigned int head; // written by the decoder only
+	unsigned int tail; // written by the mixing task only
+	AVFrame *frames[MIX_QUEUE_LEN];
+};
 
 struct mix_s {
 	format_t in_format,
@@ -38,9 +64,34 @@ struct mix_s {
 	uint64_t out_pts; // starting at zero
 
 	AVFrame *silence_frame;
+
+	// built-in mixer, used instead of the filter graph unless --mix-filter is set
+	int native;
+	int native_in, native_out; // no sample format conversion needed
+	format_t mix_in_format, // S16 versions of in_format/out_format
+		 mix_format;
+	resample_t in_resample[MIX_NUM_INPUTS];
+	int32_t *acc; // ring of acc_len samples with mix_format.channels each
+	unsigned int acc_len; // power of two
+	uint64_t mix_pts; // adjusted pts of the first sample not yet output
+
+	// mixing task, see mix_input_push()
+	output_t *output;
+	pthread_mutex_t lock; // held while mixing
+	pthread_cond_t idle;
+	GQueue inputs; // mix_input_t, protected by lock
+	int scheduled; // queued for or being run by a mixing thread
 };
 
 
+static pthread_mutex_t mix_sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mix_sched_cond = PTHREAD_COND_INITIALIZER;
+static GQueue mix_sched_queue = G_QUEUE_INIT; // mix_t, protected by mix_sched_lock
+static int mix_sched_shutdown;
+static pthread_t *mix_thread_ids;
+static unsigned int num_mix_threads;
+
+
 static void mix_shutdown(mix_t *mix) {
 	if (mix->amix_ctx)
 		avfilter_free(mix->amix_ctx);
@@ -59,17 +110,39 @@ static void mix_shutdown(mix_t *mix) {
 	resample_shutdown(&mix->resample);
 	avfilter_graph_free(&mix->graph);
 
+	for (unsigned int i = 0; i < MIX_NUM_INPUTS; i++)
+		resample_shutdown(&mix->in_resample[i]);
+	g_free(mix->acc);
+	mix->acc = NULL;
+	mix->native = 0;
+
 	format_init(&mix->in_format);
 	format_init(&mix->out_format);
 }
 
 
+static void mix_input_free(mix_input_t *in) {
+	while (in->tail != in->head)
+		av_frame_free(&in->frames[in->tail++ & (MIX_QUEUE_LEN - 1)]);
+	if (in->dropped)
+		ilog(LOG_WARN, "%llu frames of mixer input %u were dropped", in->dropped, in->idx);
+	resample_shutdown(&in->resample);
+	g_slice_free1(sizeof(*in), in);
+}
+
+
+// the mixer must be idle, see mix_sync()
 void mix_destroy(mix_t *mix) {
 	if (!mix)
 		return;
 	mix_shutdown(mix);
 	av_frame_free(&mix->sink_frame);
 	av_frame_free(&mix->silence_frame);
+	mix_input_t *in;
+	while ((in = g_queue_pop_head(&mix->inputs)))
+		mix_input_free(in);
+	pthread_mutex_destroy(&mix->lock);
+	pthread_cond_destroy(&mix->idle);
 	g_slice_free1(sizeof(*mix), mix);
 }
 
@@ -106,6 +179,142 @@ unsigned int mix_get_index(mix_t *mix, void *ptr) {
 }
 
 
+// Accumulate and saturate kernels of the built-in mixer. Inputs are added up as
+// 32-bit sums, which can't overflow for MIX_NUM_INPUTS inputs, and are saturated
+// to 16 bits when the mixed samples are taken out.
+
+// acc[i] += in[i]
+#if defined(__AVX2__)
+static void mix_acc_add(int32_t *acc, const int16_t *in, unsigned int num) {
+	unsigned int i = 0;
+	for (; i + 8 <= num; i += 8) {
+		__m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (in + i)));
+		__m256i a = _mm256_loadu_si256((const __m256i *) (acc + i));
+		_mm256_storeu_si256((__m256i *) (acc + i), _mm256_add_epi32(a, x));
+	}
+	for (; i < num; i++)
+		acc[i] += in[i];
+}
+#elif defined(__SSE2__)
+static void mix_acc_add(int32_t *acc, const int16_t *in, unsigned int num) {
+	unsigned int i = 0;
+	for (; i + 8 <= num; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+		// sign extend by moving each sample into the upper half first
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		__m128i *a = (__m128i *) (acc + i);
+		_mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), lo));
+		_mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), hi));
+	}
+	for (; i < num; i++)
+		acc[i] += in[i];
+}
+#else
+static void mix_acc_add(int32_t *acc, const int16_t *in, unsigned int num) {
+	for (unsigned int i = 0; i < num; i++)
+		acc[i] += in[i];
+}
+#endif
+
+// out[i] = saturated acc[i], and acc[i] = 0 to make the slot available again
+#if defined(__AVX2__)
+static void mix_acc_out(int16_t *out, int32_t *acc, unsigned int num) {
+	unsigned int i = 0;
+	__m256i zero = _mm256_setzero_si256();
+	for (; i + 16 <= num; i += 16) {
+		__m256i a0 = _mm256_loadu_si256((const __m256i *) (acc + i));
+		__m256i a1 = _mm256_loadu_si256((const __m256i *) (acc + i + 8));
+		// packs works per 128-bit lane: restore sample order afterwards
+		__m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(a0, a1), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *) (out + i), p);
+		_mm256_storeu_si256((__m256i *) (acc + i), zero);
+		_mm256_storeu_si256((__m256i *) (acc + i + 8), zero);
+	}
+	for (; i < num; i++) {
+		out[i] = acc[i] > INT16_MAX ? INT16_MAX : acc[i] < INT16_MIN ? INT16_MIN : acc[i];
+		acc[i] = 0;
+	}
+}
+#elif defined(__SSE2__)
+static void mix_acc_out(int16_t *out, int32_t *acc, unsigned int num) {
+	unsigned int i = 0;
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 8 <= num; i += 8) {
+		__m128i a0 = _mm_loadu_si128((const __m128i *) (acc + i));
+		__m128i a1 = _mm_loadu_si128((const __m128i *) (acc + i + 4));
+		_mm_storeu_si128((__m128i *) (out + i), _mm_packs_epi32(a0, a1));
+		_mm_storeu_si128((__m128i *) (acc + i), zero);
+		_mm_storeu_si128((__m128i *) (acc + i + 4), zero);
+	}
+	for (; i < num; i++) {
+		out[i] = acc[i] > INT16_MAX ? INT16_MAX : acc[i] < INT16_MIN ? INT16_MIN : acc[i];
+		acc[i] = 0;
+	}
+}
+#else
+static void mix_acc_out(int16_t *out, int32_t *acc, unsigned int num) {
+	for (unsigned int i = 0; i < num; i++) {
+		out[i] = acc[i] > INT16_MAX ? INT16_MAX : acc[i] < INT16_MIN ? INT16_MIN : acc[i];
+		acc[i] = 0;
+	}
+}
+#endif
+
+// channels mode: each input sample goes into its own slot of a wider output sample
+static void mix_acc_add_strided(int32_t *acc, unsigned int stride, const int16_t *in, unsigned int channels,
+		unsigned int num)
+{
+	for (unsigned int i = 0; i < num; i++) {
+		for (unsigned int ch = 0; ch < channels; ch++)
+			acc[ch] += in[ch];
+		acc += stride;
+		in += channels;
+	}
+}
+
+
+// interleaved S16, or planar with just one plane
+static int mix_format_s16(const format_t *format) {
+	if (format->format == AV_SAMPLE_FMT_S16)
+		return 1;
+	if (format->format == AV_SAMPLE_FMT_S16P && format->channels == 1)
+		return 1;
+	return 0;
+}
+
+
+static int mix_config_native(mix_t *mix) {
+	mix->out_format = mix->in_format;
+	if (mix_method == MM_CHANNELS)
+		mix->out_format.channels *= MIX_NUM_INPUTS;
+
+	mix->native_in = mix_format_s16(&mix->in_format);
+	mix->native_out = mix_format_s16(&mix->out_format);
+	mix->mix_in_format = mix->in_format;
+	mix->mix_format = mix->out_format;
+	if (!mix->native_in)
+		mix->mix_in_format.format = AV_SAMPLE_FMT_S16;
+	if (!mix->native_out)
+		mix->mix_format.format = AV_SAMPLE_FMT_S16;
+
+	// one second is enough to cover the 0.5 seconds that inputs may lag behind
+	mix->acc_len = 1;
+	while (mix->acc_len < mix->in_format.clockrate)
+		mix->acc_len <<= 1;
+	mix->acc = g_malloc0(sizeof(*mix->acc) * mix->acc_len * mix->mix_format.channels);
+
+	// like with the filter graph, samples buffered in the old format are lost
+	mix->mix_pts = (uint64_t) -1LL;
+	for (unsigned int i = 0; i < MIX_NUM_INPUTS; i++)
+		mix->mix_pts = MIN(mix->mix_pts, mix->in_pts[i]);
+
+	mix->native = 1;
+
+	return 0;
+}
+
+
 int mix_config(mix_t *mix, const format_t *format) {
 	const char *err;
 	char args[512];
@@ -117,6 +326,9 @@ int mix_config(mix_t *mix, const format_t *format) {
 
 	mix->in_format = *format;
 
+	if (!mix_filter)
+		return mix_config_native(mix);
+
 	// filter graph
 	err = "failed to alloc filter graph";
 	mix->graph = avfilter_graph_alloc();
@@ -214,11 +426,16 @@ err:
 }
 
 
-mix_t *mix_new() {
+// `output` receives the frames mixed from the inputs of mix_input_new()
+mix_t *mix_new(output_t *output) {
 	mix_t *mix = g_slice_alloc0(sizeof(*mix));
 	format_init(&mix->in_format);
 	format_init(&mix->out_format);
 	mix->sink_frame = av_frame_alloc();
+	mix->output = output;
+	pthread_mutex_init(&mix->lock, NULL);
+	pthread_cond_init(&mix->idle, NULL);
+	g_queue_init(&mix->inputs);
 
 	for (unsigned int i = 0; i < MIX_NUM_INPUTS; i++)
 		mix->pts_offs[i] = (uint64_t) -1LL;
@@ -230,6 +447,13 @@ mix_t *mix_new() {
 static void mix_silence_fill_idx_upto(mix_t *mix, unsigned int idx, uint64_t upto) {
 	unsigned int silence_samples = mix->in_format.clockrate / 100;
 
+	if (mix->native) {
+		// nothing to push: the unused parts of the mix buffer are silence
+		if (mix->in_pts[idx] < upto)
+			mix->in_pts[idx] = upto;
+		return;
+	}
+
 	while (mix->in_pts[idx] < upto) {
 		if (G_UNLIKELY(upto - mix->in_pts[idx] > mix->in_format.clockrate * 30)) {
 			ilog(LOG_WARN, "More than 30 seconds of silence needed to fill mix buffer, resetting");
@@ -281,6 +505,151 @@ static void mix_silence_fill(mix_t *mix) {
 }
 
 
+// output holds on to the frames, so each gets its own buffer
+static AVFrame *mix_native_frame(mix_t *mix, unsigned int num) {
+	AVFrame *frame = av_frame_alloc();
+	if (!frame)
+		return NULL;
+	frame->format = mix->mix_format.format;
+	DEF_CH_LAYOUT(&frame->CH_LAYOUT, mix->mix_format.channels);
+	frame->nb_samples = num;
+	frame->sample_rate = mix->mix_format.clockrate;
+	if (av_frame_get_buffer(frame, 0) < 0) {
+		av_frame_free(&frame);
+		return NULL;
+	}
+	return frame;
+}
+
+
+static int mix_native_output(mix_t *mix, AVFrame *frame, output_t *output) {
+	if (!mix->native_out) {
+		AVFrame *conv = resample_frame(&mix->resample, frame, &mix->out_format);
+		av_frame_free(&frame);
+		if (!conv)
+			return -1;
+		frame = conv;
+	}
+
+	int ret = output_add(output, frame);
+	av_frame_free(&frame);
+	return ret;
+}
+
+
+// outputs everything up to `upto`, filling in silence for inputs that haven't
+// reached it yet
+static int mix_native_flush(mix_t *mix, uint64_t upto, output_t *output) {
+	unsigned int channels = mix->mix_format.channels;
+	uint64_t skip_to = 0;
+
+	for (unsigned int i = 0; i < MIX_NUM_INPUTS; i++) {
+		if (mix->in_pts[i] < upto)
+			mix->in_pts[i] = upto;
+	}
+
+	if (G_UNLIKELY(upto - mix->mix_pts > mix->acc_len + mix->in_format.clockrate * 30)) {
+		// nothing but silence after the buffered samples
+		ilog(LOG_WARN, "More than 30 seconds of silence needed to fill mix buffer, resetting");
+		skip_to = upto;
+		upto = mix->mix_pts + mix->acc_len;
+	}
+
+	while (mix->mix_pts < upto) {
+		unsigned int pos = mix->mix_pts & (mix->acc_len - 1);
+		unsigned int num = MIN(upto - mix->mix_pts, mix->acc_len - pos);
+
+		AVFrame *frame = mix_native_frame(mix, num);
+		if (!frame)
+			return -1;
+		mix_acc_out((int16_t *) frame->extended_data[0], mix->acc + pos * channels, num * channels);
+		frame->pts = mix->mix_pts;
+		mix->mix_pts += num;
+
+		if (mix_native_output(mix, frame, output))
+			return -1;
+	}
+
+	if (skip_to)
+		mix->mix_pts = skip_to;
+
+	return 0;
+}
+
+
+// adds samples at the current position of the input. this is the timeline of
+// the input and only ever moves forward: frames overlapping what was already
+// received are appended, as amix does with its input queues
+static void mix_native_put(mix_t *mix, unsigned int idx, const int16_t *in, unsigned int num) {
+	unsigned int channels = mix->in_format.channels;
+	unsigned int stride = mix->mix_format.channels;
+
+	while (num) {
+		unsigned int pos = mix->in_pts[idx] & (mix->acc_len - 1);
+		unsigned int len = MIN(num, mix->acc_len - pos);
+		int32_t *acc = mix->acc + pos * stride;
+
+		if (mix_method == MM_CHANNELS)
+			mix_acc_add_strided(acc + idx * channels, stride, in, channels, len);
+		else
+			mix_acc_add(acc, in, len * channels);
+
+		in += len * channels;
+		num -= len;
+		mix->in_pts[idx] += len;
+	}
+}
+
+
+static int mix_add_native(mix_t *mix, AVFrame *frame, unsigned int idx, output_t *output) {
+	if (!mix->native_in) {
+		AVFrame *conv = resample_frame(&mix->in_resample[idx], frame, &mix->mix_in_format);
+		av_frame_free(&frame);
+		if (!conv) {
+			ilog(LOG_ERR, "Failed to add frame to mixer: %s", "failed to convert samples");
+			return -1;
+		}
+		frame = conv;
+	}
+
+	const int16_t *in = (const int16_t *) frame->extended_data[0];
+	unsigned int num = frame->nb_samples;
+	int ret = 0;
+
+	while (num) {
+		unsigned int len = MIN(num, mix->acc_len / 2);
+
+		// make room if this input is too far ahead of the others
+		uint64_t end = mix->in_pts[idx] + len;
+		if (end - mix->mix_pts > mix->acc_len) {
+			ret = mix_native_flush(mix, end - mix->acc_len, output);
+			if (ret)
+				break;
+		}
+
+		mix_native_put(mix, idx, in, len);
+		in += len * mix->in_format.channels;
+		num -= len;
+	}
+
+	av_frame_free(&frame);
+	if (ret)
+		return -1;
+
+	if (mix->in_pts[idx] > mix->out_pts)
+		mix->out_pts = mix->in_pts[idx];
+
+	mix_silence_fill(mix);
+
+	// everything that all inputs have reached is complete
+	uint64_t upto = mix->in_pts[0];
+	for (unsigned int i = 1; i < MIX_NUM_INPUTS; i++)
+		upto = MIN(upto, mix->in_pts[i]);
+
+	return mix_native_flush(mix, upto, output);
+}
+
+
 int mix_add(mix_t *mix, AVFrame *frame, unsigned int idx, void *ptr, output_t *output) {
 	const char *err;
 
@@ -289,7 +658,7 @@ int mix_add(mix_t *mix, AVFrame *frame, unsigned int idx, void *ptr, output_t *o
 		goto err;
 
 	err = "mixer not initialized";
-	if (!mix->src_ctxs[idx])
+	if (!mix->native && !mix->src_ctxs[idx])
 		goto err;
 
 	err = "received samples for old re-used input channel";
@@ -320,6 +689,9 @@ int mix_add(mix_t *mix, AVFrame *frame, unsigned int idx, void *ptr, output_t *o
 	if (G_UNLIKELY(frame->pts < mix->in_pts[idx]))
 		mix->pts_offs[idx] += mix->in_pts[idx] - frame->pts;
 
+	if (mix->native)
+		return mix_add_native(mix, frame, idx, output);
+
 	uint64_t next_pts = frame->pts + frame->nb_samples;
 
 	frame->CH_LAYOUT = mix->channel_layout[idx];
@@ -364,3 +736,195 @@ err:
 	av_frame_free(&frame);
 	return -1;
 }
+
+
+
+// frames of a decoder producing `format`, which are mixed as `ref`
+mix_input_t *mix_input_new(mix_t *mix, void *ref, const format_t *format) {
+	mix_input_t *in = g_slice_alloc0(sizeof(*in));
+	in->mix = mix;
+	in->ref = ref;
+	in->format = *format;
+
+	pthread_mutex_lock(&mix->lock);
+	in->idx = mix_get_index(mix, ref);
+	g_queue_push_tail(&mix->inputs, in);
+	pthread_mutex_unlock(&mix->lock);
+
+	return in;
+}
+
+
+// mixing task only
+static AVFrame *mix_input_pop(mix_input_t *in) {
+	unsigned int tail = in->tail;
+	if (tail == __atomic_load_n(&in->head, __ATOMIC_SEQ_CST))
+		return NULL;
+	AVFrame *frame = in->frames[tail & (MIX_QUEUE_LEN - 1)];
+	__atomic_store_n(&in->tail, tail + 1, __ATOMIC_RELEASE);
+	return frame;
+}
+
+
+// mixing task only
+static void mix_input_frame(mix_t *mix, mix_input_t *in, AVFrame *frame) {
+	mix_config(mix, &in->format);
+	// XXX might be a second resampling to same format
+	AVFrame *dec_frame = resample_frame(&in->resample, frame, &in->format);
+	av_frame_free(&frame);
+	if (!dec_frame || mix_add(mix, dec_frame, in->idx, in->ref, mix->output))
+		ilog(LOG_ERR, "Failed to add decoded packet to mixed output");
+}
+
+
+// takes one frame from each input in turn, so that the inputs stay close to
+// each other. returns the number of frames mixed
+static unsigned int mix_run_inputs(mix_t *mix) {
+	unsigned int num = 0;
+	for (GList *l = mix->inputs.head; l; l = l->next) {
+		mix_input_t *in = l->data;
+		AVFrame *frame = mix_input_pop(in);
+		if (!frame)
+			continue;
+		mix_input_frame(mix, in, frame);
+		num++;
+	}
+	return num;
+}
+
+
+// mix->lock is held
+static int mix_pending(mix_t *mix) {
+	for (GList *l = mix->inputs.head; l; l = l->next) {
+		mix_input_t *in = l->data;
+		if (in->tail != __atomic_load_n(&in->head, __ATOMIC_SEQ_CST))
+			return 1;
+	}
+	return 0;
+}
+
+
+static void mix_schedule(mix_t *mix);
+
+static void mix_run(mix_t *mix) {
+	pthread_mutex_lock(&mix->lock);
+
+	unsigned int num = 0;
+	while (1) {
+		unsigned int ret = mix_run_inputs(mix);
+		num += ret;
+		if (ret) {
+			if (num < MIX_RUN_BATCH || !num_mix_threads)
+				continue;
+			// more to do, give the others a turn first
+			pthread_mutex_unlock(&mix->lock);
+			mix_schedule(mix);
+			return;
+		}
+
+		// a decoder pushing a frame after this schedules the mixer again,
+		// so check once more for frames pushed before
+		__atomic_store_n(&mix->scheduled, 0, __ATOMIC_SEQ_CST);
+		if (!mix_pending(mix))
+			break;
+		if (__atomic_exchange_n(&mix->scheduled, 1, __ATOMIC_SEQ_CST))
+			break; // scheduled again already
+	}
+
+	pthread_cond_broadcast(&mix->idle);
+	pthread_mutex_unlock(&mix->lock);
+}
+
+
+static void mix_schedule(mix_t *mix) {
+	if (!num_mix_threads) {
+		// no mixing threads running: mix right away
+		mix_run(mix);
+		return;
+	}
+
+	pthread_mutex_lock(&mix_sched_lock);
+	g_queue_push_tail(&mix_sched_queue, mix);
+	pthread_cond_signal(&mix_sched_cond);
+	pthread_mutex_unlock(&mix_sched_lock);
+}
+
+
+// called by the decoder of the input only. the frame isn't consumed: a
+// reference to it is queued
+void mix_input_push(mix_input_t *in, AVFrame *frame) {
+	unsigned int head = in->head;
+
+	if (G_UNLIKELY(head - __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE) >= MIX_QUEUE_LEN)) {
+		// mixing threads can't keep up
+		if (!in->dropped)
+			ilog(LOG_WARN, "Queue of mixer input %u is full, dropping frames", in->idx);
+		in->dropped++;
+		return;
+	}
+
+	AVFrame *ref = av_frame_clone(frame);
+	if (!ref)
+		return;
+	in->frames[head & (MIX_QUEUE_LEN - 1)] = ref;
+	__atomic_store_n(&in->head, head + 1, __ATOMIC_SEQ_CST);
+
+	if (!__atomic_exchange_n(&in->mix->scheduled, 1, __ATOMIC_SEQ_CST))
+		mix_schedule(in->mix);
+}
+
+
+// waits until the mixing threads are done with all frames pushed so far
+void mix_sync(mix_t *mix) {
+	if (!mix)
+		return;
+	pthread_mutex_lock(&mix->lock);
+	while (__atomic_load_n(&mix->scheduled, __ATOMIC_SEQ_CST))
+		pthread_cond_wait(&mix->idle, &mix->lock);
+	pthread_mutex_unlock(&mix->lock);
+}
+
+
+static void *mix_thread(void *p) {
+	while (1) {
+		pthread_mutex_lock(&mix_sched_lock);
+		while (!mix_sched_queue.length && !mix_sched_shutdown)
+			pthread_cond_wait(&mix_sched_cond, &mix_sched_lock);
+		mix_t *mix = g_queue_pop_head(&mix_sched_queue);
+		pthread_mutex_unlock(&mix_sched_lock);
+
+		if (!mix)
+			break; // shutting down and nothing left to do
+
+		mix_run(mix);
+	}
+
+	return NULL;
+}
+
+
+void mix_threads_start(void) {
+	num_mix_threads = mix_threads;
+	mix_thread_ids = g_malloc0(sizeof(*mix_thread_ids) * num_mix_threads);
+	for (unsigned int i = 0; i < num_mix_threads; i++) {
+		if (pthread_create(&mix_thread_ids[i], NULL, mix_thread, NULL))
+			die_errno("pthread_create failed");
+	}
+}
+
+
+// all mixers must be destroyed
+void mix_cleanup(void) {
+	if (!mix_thread_ids)
+		return;
+
+	pthread_mutex_lock(&mix_sched_lock);
+	mix_sched_shutdown = 1;
+	pthread_cond_broadcast(&mix_sched_cond);
+	pthread_mutex_unlock(&mix_sched_lock);
+	for (unsigned int i = 0; i < num_mix_threads; i++)
+		pthread_join(mix_thread_ids[i], NULL);
+	g_free(mix_thread_ids);
+	mix_thread_ids = NULL;
+	num_mix_threads = 0;
+}
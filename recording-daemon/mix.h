@@ -8,13 +8,20 @@
 #define MIX_NUM_INPUTS 4
 
 
-mix_t *mix_new(void);
+mix_t *mix_new(output_t *output);
 void mix_destroy(mix_t *mix);
 
 int mix_config(mix_t *, const format_t *format);
 int mix_add(mix_t *mix, AVFrame *frame, unsigned int idx, void *, output_t *output);
 unsigned int mix_get_index(mix_t *, void *);
 
+mix_input_t *mix_input_new(mix_t *, void *, const format_t *format);
+void mix_input_push(mix_input_t *, AVFrame *frame);
+void mix_sync(mix_t *);
+
+void mix_threads_start(void);
+void mix_cleanup(void);
+
 
 #endif
 
@@ -5,11 +5,59 @@
 #include <stdint.h>
 #include <glib.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include "log.h"
 #include "db.h"
 #include "main.h"
+#include "fix_frame_channel_layout.h"
+
+
+// Frames given to output_add() are only queued. A pool of encoder threads
+// encodes and muxes them, and the muxed data goes to I/O threads which write
+// it out, so that neither encoding nor slow storage holds up packet
+// processing. An output is handled by at most one encoder thread at a time and
+// always by the same I/O thread, which keeps its frames and writes in order.
+
+#define OUTPUT_AVIO_BUFSIZE 32768
+#define OUTPUT_ENCODE_BATCH 32 // frames per turn of an output
+#define OUTPUT_IO_LIMIT (32 << 20) // bytes pending per I/O thread before encoders wait
+#define OUTPUT_IOV_MAX 64
+#define OUTPUT_STATS_INTERVAL 60
+#define OUTPUT_PT_MAX_GAP 30 // seconds of silence inserted into passthrough outputs at most
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+#define AVIO_WRITE_CONST const
+#else
+#define AVIO_WRITE_CONST
+#endif
+
+
+struct output_write {
+	output_t *output;
+	int fd;
+	int64_t offset;
+	unsigned int len;
+	int close; // 1: close fd, 2: also done with the output
+	char *filename; // close only
+	long long queued; // us
+	unsigned char data[];
+};
+
+struct output_io {
+	unsigned int num;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond, space;
+	GQueue writes;
+	unsigned int bytes;
+	int shutdown;
+	// statistics, I/O thread only
+	unsigned long long writes_done, bytes_done, write_us, write_max_us;
+};
 
 
 //static int output_codec_id;
@@ -18,10 +66,126 @@ static const char *output_file_format;
 
 int mp3_bitrate;
 
+static pthread_mutex_t encode_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t encode_cond = PTHREAD_COND_INITIALIZER;
+static GQueue encode_queue = G_QUEUE_INIT; // output_t, protected by encode_lock
+static int encode_shutdown;
+static pthread_t *encode_threads;
+static unsigned int num_encode_threads;
+
+static struct output_io *output_ios;
+static unsigned int num_output_ios;
+static volatile unsigned int output_next_io;
+
+static volatile unsigned int frames_queued;
+static volatile unsigned long long frames_dropped;
+
+static __thread int io_may_wait; // only encoder threads wait for the I/O threads
+
+
+
+static int output_shutdown(output_t *output, int last);
+static void output_free(output_t *output);
+
+
+
+static long long now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 
+static void output_io_queue(output_t *output, struct output_write *w) {
+	struct output_io *io = &output_ios[output->io_shard % num_output_ios];
 
-static int output_shutdown(output_t *output);
+	w->output = output;
+	w->queued = now_us();
 
+	pthread_mutex_lock(&io->lock);
+	while (io_may_wait && io->bytes && io->bytes + w->len > OUTPUT_IO_LIMIT && !io->shutdown)
+		pthread_cond_wait(&io->space, &io->lock);
+	io->bytes += w->len;
+	g_queue_push_tail(&io->writes, w);
+	pthread_cond_signal(&io->cond);
+	pthread_mutex_unlock(&io->lock);
+}
+
+
+static int output_avio_write(void *opaque, AVIO_WRITE_CONST uint8_t *buf, int size) {
+	output_t *output = opaque;
+
+	struct output_write *w = g_malloc(sizeof(*w) + size);
+	w->fd = output->fd;
+	w->offset = output->io_pos;
+	w->len = size;
+	w->close = 0;
+	w->filename = NULL;
+	memcpy(w->data, buf, size);
+	output_io_queue(output, w);
+
+	output->io_pos += size;
+	if (output->io_pos > output->io_size)
+		output->io_size = output->io_pos;
+
+	return size;
+}
+
+
+static int64_t output_avio_seek(void *opaque, int64_t offset, int whence) {
+	output_t *output = opaque;
+
+	switch (whence & ~AVSEEK_FORCE) {
+		case AVSEEK_SIZE:
+			return output->io_size;
+		case SEEK_SET:
+			break;
+		case SEEK_CUR:
+			offset += output->io_pos;
+			break;
+		case SEEK_END:
+			offset += output->io_size;
+			break;
+		default:
+			return AVERROR(EINVAL);
+	}
+	if (offset < 0)
+		return AVERROR(EINVAL);
+
+	output->io_pos = offset;
+	return offset;
+}
+
+
+// queued after the last write to the file
+static void output_io_close(output_t *output, int last) {
+	struct output_write *w = g_malloc(sizeof(*w));
+	w->fd = output->fd;
+	w->offset = 0;
+	w->len = 0;
+	w->close = last ? 2 : 1;
+	w->filename = g_strdup(output->filename);
+	output->fd = -1;
+	// with `last` set, the I/O thread frees the output
+	output_io_queue(output, w);
+}
+
+
+static void output_schedule(output_t *output) {
+	pthread_mutex_lock(&encode_lock);
+	g_queue_push_tail(&encode_queue, output);
+	pthread_cond_signal(&encode_cond);
+	pthread_mutex_unlock(&encode_lock);
+}
+
+
+// waits until the encoder threads are done with all frames queued so far
+static void output_sync(output_t *output) {
+	pthread_mutex_lock(&output->lock);
+	while (output->scheduled)
+		pthread_cond_wait(&output->idle, &output->lock);
+	pthread_mutex_unlock(&output->lock);
+}
 
 
 static int output_got_packet(encoder_t *enc, void *u1, void *u2) {
@@ -38,12 +202,370 @@ static int output_got_packet(encoder_t *enc, void *u1, void *u2) {
 }
 
 
+// queues a frame, or a packet for passthrough outputs. returns 1 if the queue is
+// full and the caller should drop it
+static int output_queue(output_t *output, void *item) {
+	pthread_mutex_lock(&output->lock);
+
+	if (G_UNLIKELY(output->frames.length >= output_queue_len)) {
+		// encoder threads or storage can't keep up
+		if (!output->frames_dropped)
+			ilog(LOG_WARN, "Output queue for '%s%s%s' is full, dropping frames",
+					FMT_M(output->file_name));
+		output->frames_dropped++;
+		pthread_mutex_unlock(&output->lock);
+		__atomic_add_fetch(&frames_dropped, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	g_queue_push_tail(&output->frames, item);
+	if (output->frames.length > output->frames_max)
+		output->frames_max = output->frames.length;
+	int schedule = !output->scheduled;
+	output->scheduled = 1;
+
+	pthread_mutex_unlock(&output->lock);
+
+	g_atomic_int_inc(&frames_queued);
+	if (schedule)
+		output_schedule(output);
+
+	return 0;
+}
+
+
+// the frame isn't consumed: a reference to it is queued
 int output_add(output_t *output, AVFrame *frame) {
 	if (!output)
 		return -1;
-	if (!output->encoder) // not ready - not configured
+	if (!output->encoder || !output->fmtctx) // not ready - not configured
+		return -1;
+	if (output->passthrough)
+		return -1;
+
+	AVFrame *ref = av_frame_clone(frame);
+	if (!ref)
+		return -1;
+
+	if (output_queue(output, ref))
+		av_frame_free(&ref);
+
+	return 0;
+}
+
+
+// encoder threads only
+static void output_write_packet(output_t *output, AVPacket *pkt) {
+	av_packet_rescale_ts(pkt, (AVRational) {1, output->pt_clockrate}, output->avst->time_base);
+	pkt->stream_index = output->avst->index;
+	if (av_write_frame(output->fmtctx, pkt))
+		ilog(LOG_ERR, "Failed to write packet to '%s%s%s'", FMT_M(output->file_name));
+}
+
+
+// called by encoder threads only
+static void output_encode(output_t *output) {
+	for (unsigned int i = 0; i < OUTPUT_ENCODE_BATCH; i++) {
+		pthread_mutex_lock(&output->lock);
+		void *item = g_queue_pop_head(&output->frames);
+		if (!item) {
+			int closing = output->closing;
+			output->scheduled = 0;
+			pthread_cond_broadcast(&output->idle);
+			pthread_mutex_unlock(&output->lock);
+			// the output is gone after this
+			if (closing && !output_shutdown(output, 1))
+				output_free(output);
+			return;
+		}
+		pthread_mutex_unlock(&output->lock);
+
+		g_atomic_int_add(&frames_queued, -1);
+		if (output->passthrough) {
+			AVPacket *pkt = item;
+			output_write_packet(output, pkt);
+			av_packet_free(&pkt);
+			continue;
+		}
+		AVFrame *frame = item;
+		if (encoder_input_fifo(output->encoder, frame, output_got_packet, output, NULL))
+			ilog(LOG_ERR, "Failed to encode frame for '%s%s%s'", FMT_M(output->file_name));
+		av_frame_free(&frame);
+	}
+
+	// more to do, give the others a turn first
+	output_schedule(output);
+}
+
+
+static void *output_encode_thread(void *p) {
+	io_may_wait = 1;
+
+	while (1) {
+		pthread_mutex_lock(&encode_lock);
+		while (!encode_queue.length && !encode_shutdown)
+			pthread_cond_wait(&encode_cond, &encode_lock);
+		output_t *output = g_queue_pop_head(&encode_queue);
+		pthread_mutex_unlock(&encode_lock);
+
+		if (!output)
+			break; // shutting down and nothing left to do
+
+		output_encode(output);
+	}
+
+	return NULL;
+}
+
+
+static int output_pwritev(int fd, struct iovec *iov, unsigned int num, off_t offset) {
+	while (num) {
+		ssize_t ret = pwritev(fd, iov, num, offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0) {
+			errno = ENOSPC;
+			return -1;
+		}
+		offset += ret;
+		while (num && ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			num--;
+		}
+		if (num) {
+			iov->iov_base = (char *) iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return 0;
+}
+
+
+static void output_free(output_t *output) {
+	encoder_free(output->encoder);
+	db_release(&output->db);
+	g_clear_pointer(&output->full_filename, g_free);
+	g_clear_pointer(&output->file_path, g_free);
+	g_clear_pointer(&output->file_name, g_free);
+	g_clear_pointer(&output->filename, g_free);
+	pthread_mutex_destroy(&output->lock);
+	pthread_cond_destroy(&output->idle);
+	g_slice_free1(sizeof(*output), output);
+}
+
+
+static void output_io_finish(struct output_write *w) {
+	output_t *output = w->output;
+
+	if (w->fd != -1)
+		close(w->fd);
+
+	if (output_chmod)
+		if (chmod(w->filename, output_chmod))
+			ilog(LOG_WARN, "Failed to change file mode of '%s%s%s': %s",
+					FMT_M(w->filename), strerror(errno));
+	if (output_chown != -1 || output_chgrp != -1)
+		if (chown(w->filename, output_chown, output_chgrp))
+			ilog(LOG_WARN, "Failed to change file owner/group of '%s%s%s': %s",
+					FMT_M(w->filename), strerror(errno));
+
+	if (w->close == 2) {
+		ilog(output->frames_dropped || output->write_errors ? LOG_WARN : LOG_INFO,
+				"Closed '%s%s%s': max %u frames queued, %llu frames dropped, "
+				"%llu bytes in %llu writes (%llu failed), write latency avg %llu us, max %llu us",
+				FMT_M(w->filename), output->frames_max, output->frames_dropped,
+				output->write_bytes, output->writes, output->write_errors,
+				output->writes ? output->write_us / output->writes : 0,
+				output->write_max_us);
+		db_close_stream(output);
+		output_free(output);
+	}
+
+	g_free(w->filename);
+	g_free(w);
+}
+
+
+// writes out a run of contiguous requests for the same file in one go
+static void output_io_flush(struct output_io *io, struct output_write **run, unsigned int num) {
+	if (!num)
+		return;
+
+	struct iovec iov[OUTPUT_IOV_MAX];
+	unsigned int bytes = 0;
+	for (unsigned int i = 0; i < num; i++) {
+		iov[i].iov_base = run[i]->data;
+		iov[i].iov_len = run[i]->len;
+		bytes += run[i]->len;
+	}
+
+	output_t *output = run[0]->output;
+	int ret = output_pwritev(run[0]->fd, iov, num, run[0]->offset);
+	long long lat = now_us() - run[0]->queued;
+
+	if (ret) {
+		if (!output->write_errors)
+			ilog(LOG_ERR, "Failed to write to '%s%s%s': %s", FMT_M(output->filename),
+					strerror(errno));
+		output->write_errors++;
+	}
+	output->writes++;
+	output->write_bytes += bytes;
+	output->write_us += lat;
+	if (lat > output->write_max_us)
+		output->write_max_us = lat;
+
+	io->writes_done++;
+	io->bytes_done += bytes;
+	io->write_us += lat;
+	if (lat > io->write_max_us)
+		io->write_max_us = lat;
+
+	for (unsigned int i = 0; i < num; i++)
+		g_free(run[i]);
+
+	pthread_mutex_lock(&io->lock);
+	io->bytes -= bytes;
+	pthread_cond_broadcast(&io->space);
+	pthread_mutex_unlock(&io->lock);
+}
+
+
+static int output_write_cmp(const void *A, const void *B, void *dummy) {
+	const struct output_write *a = A, *b = B;
+	if (a->output < b->output)
 		return -1;
-	return encoder_input_fifo(output->encoder, frame, output_got_packet, output, NULL);
+	if (a->output > b->output)
+		return 1;
+	return 0;
+}
+
+
+static void output_io_run(struct output_io *io, GQueue *batch) {
+	struct output_write *run[OUTPUT_IOV_MAX];
+	unsigned int num = 0;
+
+	// group by output so that consecutive writes to one file can be combined. the
+	// sort is stable, so the order of each output's requests stays the same
+	g_queue_sort(batch, output_write_cmp, NULL);
+
+	struct output_write *w;
+	while ((w = g_queue_pop_head(batch))) {
+		if (num && (num == OUTPUT_IOV_MAX || w->close || run[0]->fd != w->fd
+					|| run[num - 1]->offset + run[num - 1]->len != w->offset))
+		{
+			output_io_flush(io, run, num);
+			num = 0;
+		}
+		if (w->close) {
+			output_io_finish(w);
+			continue;
+		}
+		run[num++] = w;
+	}
+
+	output_io_flush(io, run, num);
+}
+
+
+static void output_io_stats(struct output_io *io) {
+	ilog(LOG_INFO, "Output I/O thread %u: %llu bytes in %llu writes, write latency avg %llu us, "
+			"max %llu us, %u bytes pending; %u frames waiting for encoders, %llu dropped",
+			io->num, io->bytes_done, io->writes_done,
+			io->writes_done ? io->write_us / io->writes_done : 0,
+			io->write_max_us, g_atomic_int_get(&io->bytes),
+			g_atomic_int_get(&frames_queued),
+			__atomic_load_n(&frames_dropped, __ATOMIC_RELAXED));
+	io->write_max_us = 0;
+}
+
+
+static void *output_io_thread(void *p) {
+	struct output_io *io = p;
+	GQueue batch = G_QUEUE_INIT;
+	time_t next_stats = time(NULL) + OUTPUT_STATS_INTERVAL;
+
+	while (1) {
+		pthread_mutex_lock(&io->lock);
+		while (!io->writes.length && !io->shutdown)
+			pthread_cond_wait(&io->cond, &io->lock);
+		batch = io->writes;
+		g_queue_init(&io->writes);
+		pthread_mutex_unlock(&io->lock);
+
+		if (!batch.length)
+			break; // shutting down and nothing left to do
+
+		output_io_run(io, &batch);
+
+		time_t now = time(NULL);
+		if (now >= next_stats) {
+			output_io_stats(io);
+			next_stats = now + OUTPUT_STATS_INTERVAL;
+		}
+	}
+
+	output_io_stats(io);
+
+	return NULL;
+}
+
+
+void output_threads_start(void) {
+	num_output_ios = output_io_threads;
+	output_ios = g_malloc0(sizeof(*output_ios) * num_output_ios);
+	for (unsigned int i = 0; i < num_output_ios; i++) {
+		struct output_io *io = &output_ios[i];
+		io->num = i;
+		pthread_mutex_init(&io->lock, NULL);
+		pthread_cond_init(&io->cond, NULL);
+		pthread_cond_init(&io->space, NULL);
+		g_queue_init(&io->writes);
+		if (pthread_create(&io->thread, NULL, output_io_thread, io))
+			die_errno("pthread_create failed");
+	}
+
+	num_encode_threads = output_threads;
+	encode_threads = g_malloc0(sizeof(*encode_threads) * num_encode_threads);
+	for (unsigned int i = 0; i < num_encode_threads; i++) {
+		if (pthread_create(&encode_threads[i], NULL, output_encode_thread, NULL))
+			die_errno("pthread_create failed");
+	}
+}
+
+
+// all outputs must be closed: waits for everything to be written out
+void output_cleanup(void) {
+	if (!output_ios)
+		return;
+
+	pthread_mutex_lock(&encode_lock);
+	encode_shutdown = 1;
+	pthread_cond_broadcast(&encode_cond);
+	pthread_mutex_unlock(&encode_lock);
+	for (unsigned int i = 0; i < num_encode_threads; i++)
+		pthread_join(encode_threads[i], NULL);
+	g_free(encode_threads);
+	encode_threads = NULL;
+
+	for (unsigned int i = 0; i < num_output_ios; i++) {
+		struct output_io *io = &output_ios[i];
+		pthread_mutex_lock(&io->lock);
+		io->shutdown = 1;
+		pthread_cond_broadcast(&io->cond);
+		pthread_cond_broadcast(&io->space);
+		pthread_mutex_unlock(&io->lock);
+		pthread_join(io->thread, NULL);
+		pthread_mutex_destroy(&io->lock);
+		pthread_cond_destroy(&io->cond);
+		pthread_cond_destroy(&io->space);
+	}
+	g_free(output_ios);
+	output_ios = NULL;
 }
 
 
@@ -91,6 +613,11 @@ static output_t *output_alloc(const char *path, const char *name) {
 	ret->channel_mult = 1;
 	ret->requested_format.format = -1;
 	ret->actual_format.format = -1;
+	pthread_mutex_init(&ret->lock, NULL);
+	pthread_cond_init(&ret->idle, NULL);
+	g_queue_init(&ret->frames);
+	ret->fd = -1;
+	ret->io_shard = g_atomic_int_add(&output_next_io, 1);
 
 	return ret;
 }
@@ -190,6 +717,53 @@ output_t *output_new_from_full_path(const char *path, char *name) {
 	return ret;
 }
 
+// picks an unused file name, opens the file and writes the header. returns a
+// description of what went wrong, or NULL
+static const char *output_open(output_t *output, int *av_ret) {
+	char *full_fn = NULL;
+	char suff[16] = "";
+	for (int i = 1; i < 20; i++) {
+		if (!output->skip_filename_extension) {
+			full_fn = g_strdup_printf("%s%s.%s", output->full_filename, suff, output->file_format);
+		}
+		else {
+			full_fn = g_strdup_printf("%s%s", output->full_filename, suff);
+		}
+		if (!g_file_test(full_fn, G_FILE_TEST_EXISTS))
+			goto got_fn;
+		ilog(LOG_INFO, "Storing record in %s", full_fn);
+		snprintf(suff, sizeof(suff), "-%i", i);
+		g_free(full_fn);
+	}
+
+	return "failed to find unused output file number";
+
+got_fn:
+	g_free(output->filename);
+	output->filename = full_fn;
+	output->fd = open(full_fn, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (output->fd == -1) {
+		ilog(LOG_ERR, "Failed to open '%s%s%s': %s", FMT_M(full_fn), strerror(errno));
+		return "failed to open output file";
+	}
+	output->io_pos = output->io_size = 0;
+	unsigned char *avio_buf = av_malloc(OUTPUT_AVIO_BUFSIZE);
+	if (avio_buf)
+		output->fmtctx->pb = avio_alloc_context(avio_buf, OUTPUT_AVIO_BUFSIZE, 1, output, NULL,
+				output_avio_write, output_avio_seek);
+	if (!output->fmtctx->pb) {
+		av_free(avio_buf);
+		close(output->fd);
+		output->fd = -1;
+		return "failed to alloc avio context";
+	}
+	*av_ret = avformat_write_header(output->fmtctx, NULL);
+	if (*av_ret)
+		return "failed to write header";
+
+	return NULL;
+}
+
 int output_config(output_t *output, const format_t *requested_format, format_t *actual_format) {
 	const char *err;
 	int av_ret = 0;
@@ -205,7 +779,9 @@ int output_config(output_t *output, const format_t *requested_format, format_t *
 	if (G_LIKELY(format_eq(&req_fmt, &output->requested_format)))
 		goto done;
 
-	output_shutdown(output);
+	// frames still queued are in the old format
+	output_sync(output);
+	output_shutdown(output, 0);
 
 	err = "failed to alloc format context";
 	output->fmtctx = avformat_alloc_context();
@@ -248,44 +824,18 @@ int output_config(output_t *output, const format_t *requested_format, format_t *
 	avcodec_parameters_from_context(output->avst->codecpar, output->encoder->u.avc.avcctx);
 #endif
 
-	char *full_fn = NULL;
-	char suff[16] = "";
-	for (int i = 1; i < 20; i++) {
-		if (!output->skip_filename_extension) {
-			full_fn = g_strdup_printf("%s%s.%s", output->full_filename, suff, output->file_format);
-		}
-		else {
-			full_fn = g_strdup_printf("%s%s", output->full_filename, suff);
-		}
-		if (!g_file_test(full_fn, G_FILE_TEST_EXISTS))
-			goto got_fn;
-		ilog(LOG_INFO, "Storing record in %s", full_fn);
-		snprintf(suff, sizeof(suff), "-%i", i);
-		g_free(full_fn);
-	}
-
-	err = "failed to find unused output file number";
-	goto err;
-
-got_fn:
-	output->filename = full_fn;
-	err = "failed to open avio";
-	av_ret = avio_open(&output->fmtctx->pb, full_fn, AVIO_FLAG_WRITE);
-	if (av_ret < 0)
-		goto err;
-	err = "failed to write header";
-	av_ret = avformat_write_header(output->fmtctx, NULL);
-	if (av_ret)
+	err = output_open(output, &av_ret);
+	if (err)
 		goto err;
 
-	db_config_stream(output);
+	db_config_stream(output, &output->encoder->actual_format);
 done:
 	if (actual_format)
 		*actual_format = output->actual_format;
 	return 0;
 
 err:
-	output_shutdown(output);
+	output_shutdown(output, 0);
 	ilog(LOG_ERR, "Error configuring media output: %s", err);
 	if (av_ret)
 		ilog(LOG_ERR, "Error returned from libav: %s", av_error(av_ret));
@@ -293,7 +843,231 @@ err:
 }
 
 
-static int output_shutdown(output_t *output) {
+static const char *output_passthrough_format(const codec_def_t *def) {
+	switch (def->avcodec_id) {
+		case AV_CODEC_ID_PCM_ALAW:
+		case AV_CODEC_ID_PCM_MULAW:
+			return "wav";
+		case AV_CODEC_ID_OPUS:
+			return "ogg";
+	}
+	return NULL;
+}
+
+// the ID header of RFC 7845, which the Ogg muxer expects as extradata. RTP
+// doesn't tell us about pre-skip or the original sample rate
+static int output_opus_head(AVCodecParameters *par, int channels) {
+	par->extradata = av_mallocz(19 + AV_INPUT_BUFFER_PADDING_SIZE);
+	if (!par->extradata)
+		return -1;
+	par->extradata_size = 19;
+	unsigned char *p = par->extradata;
+	memcpy(p, "OpusHead", 8);
+	p[8] = 1; // version
+	p[9] = channels;
+	// pre-skip, input sample rate and output gain are left at 0
+	p[18] = 0; // mapping family: mono or stereo
+	return 0;
+}
+
+// Sets up an output to take RTP payloads in the given codec as they are,
+// without decoding and encoding. Only possible while the output hasn't been
+// set up for anything else. Returns 0 if the output can take the codec.
+int output_config_passthrough(output_t *output, const codec_def_t *def, int clockrate, int channels) {
+	if (output->passthrough) {
+		if (output->passthrough == def && output->pt_clockrate == clockrate
+				&& output->pt_channels == channels)
+			return 0;
+		return -1;
+	}
+	if (output->fmtctx || output->requested_format.format != -1)
+		return -1; // already encoding
+
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(57, 26, 0)
+	return -1;
+#else
+	const char *format = output_passthrough_format(def);
+	if (!format)
+		return -1;
+	if (def->avcodec_id == AV_CODEC_ID_OPUS && clockrate != 48000)
+		return -1;
+
+	const char *err;
+	int av_ret = 0;
+
+	err = "failed to alloc format context";
+	output->fmtctx = avformat_alloc_context();
+	if (!output->fmtctx)
+		goto err;
+	output->fmtctx->oformat = av_guess_format(format, NULL, NULL);
+	err = "failed to determine output format";
+	if (!output->fmtctx->oformat)
+		goto err;
+
+	err = "failed to alloc output stream";
+	output->avst = avformat_new_stream(output->fmtctx, NULL);
+	if (!output->avst)
+		goto err;
+	AVCodecParameters *par = output->avst->codecpar;
+	par->codec_type = AVMEDIA_TYPE_AUDIO;
+	par->codec_id = def->avcodec_id;
+	par->sample_rate = clockrate;
+	DEF_CH_LAYOUT(&par->CH_LAYOUT, channels);
+	SET_CHANNELS(par, channels);
+	if (def->avcodec_id == AV_CODEC_ID_OPUS) {
+		err = "failed to alloc extradata";
+		if (output_opus_head(par, channels))
+			goto err;
+	}
+	else {
+		par->bits_per_coded_sample = 8;
+		par->block_align = channels;
+	}
+	output->avst->time_base = (AVRational) {1, clockrate};
+
+	output->file_format = format;
+	output->passthrough = def;
+	output->pt_clockrate = clockrate;
+	output->pt_channels = channels;
+	output->pt_started = 0;
+	output->actual_format = (format_t) {
+		.clockrate = clockrate,
+		.channels = channels,
+		.format = -1,
+	};
+
+	err = output_open(output, &av_ret);
+	if (err)
+		goto err;
+
+	db_config_stream(output, &output->actual_format);
+
+	ilog(LOG_DEBUG, "Storing %s in '%s%s%s' without transcoding", def->rtpname,
+			FMT_M(output->filename));
+
+	return 0;
+
+err:
+	output_shutdown(output, 0);
+	output->passthrough = NULL;
+	output->file_format = output_file_format;
+	ilog(LOG_ERR, "Error configuring passthrough output: %s", err);
+	if (av_ret)
+		ilog(LOG_ERR, "Error returned from libav: %s", av_error(av_ret));
+	return -1;
+#endif
+}
+
+
+// RFC 6716 3.1: samples at 48 kHz
+static unsigned int output_opus_samples(const str *payload) {
+	static const unsigned int frame_sizes[32] = {
+		480, 960, 1920, 2880, 480, 960, 1920, 2880, 480, 960, 1920, 2880, // SILK
+		480, 960, 480, 960, // hybrid
+		120, 240, 480, 960, 120, 240, 480, 960, 120, 240, 480, 960, 120, 240, 480, 960, // CELT
+	};
+	if (payload->len < 1)
+		return 0;
+	unsigned char toc = payload->s[0];
+	unsigned int frames;
+	switch (toc & 3) {
+		case 0:
+			frames = 1;
+			break;
+		case 1:
+		case 2:
+			frames = 2;
+			break;
+		default:
+			if (payload->len < 2)
+				return 0;
+			frames = payload->s[1] & 0x3f;
+			break;
+	}
+	return frame_sizes[toc >> 3] * frames;
+}
+
+static AVPacket *output_pt_packet(output_t *output, unsigned int len, unsigned int samples) {
+	AVPacket *pkt = av_packet_alloc();
+	if (!pkt)
+		return NULL;
+	if (av_new_packet(pkt, len)) {
+		av_packet_free(&pkt);
+		return NULL;
+	}
+	pkt->pts = pkt->dts = output->pt_next;
+	pkt->duration = samples;
+	output->pt_next += samples;
+	return pkt;
+}
+
+static void output_pt_queue(output_t *output, AVPacket *pkt) {
+	if (output_queue(output, pkt))
+		av_packet_free(&pkt);
+}
+
+// fills a gap in the RTP timestamps, so that the recording keeps its timing
+static void output_pt_fill(output_t *output, unsigned int samples) {
+	if (output->passthrough->avcodec_id == AV_CODEC_ID_OPUS) {
+		// a TOC byte without frames (20 ms CELT) is taken as a lost frame by the decoder
+		while (samples >= 960) {
+			AVPacket *pkt = output_pt_packet(output, 1, 960);
+			if (!pkt)
+				return;
+			pkt->data[0] = 0xf8;
+			output_pt_queue(output, pkt);
+			samples -= 960;
+		}
+		return;
+	}
+
+	unsigned char silence = output->passthrough->avcodec_id == AV_CODEC_ID_PCM_ALAW ? 0xd5 : 0xff;
+	while (samples) {
+		unsigned int num = MIN(samples, output->pt_clockrate);
+		AVPacket *pkt = output_pt_packet(output, num * output->pt_channels, num);
+		if (!pkt)
+			return;
+		memset(pkt->data, silence, num * output->pt_channels);
+		output_pt_queue(output, pkt);
+		samples -= num;
+	}
+}
+
+// takes an RTP payload for an output set up with output_config_passthrough()
+int output_add_payload(output_t *output, const str *payload, uint32_t ts) {
+	unsigned int samples;
+	if (output->passthrough->avcodec_id == AV_CODEC_ID_OPUS)
+		samples = output_opus_samples(payload);
+	else
+		samples = payload->len / output->pt_channels;
+	if (!samples)
+		return -1;
+
+	if (output->pt_started) {
+		// pt_ts is where the next packet was expected
+		int32_t gap = ts - output->pt_ts;
+		if (gap > 0 && gap <= OUTPUT_PT_MAX_GAP * output->pt_clockrate)
+			output_pt_fill(output, gap);
+		else if (gap)
+			ilog(LOG_DEBUG, "RTP timestamp jump of %i in '%s%s%s'", (int) gap,
+					FMT_M(output->file_name));
+	}
+	output->pt_started = 1;
+	output->pt_ts = ts + samples;
+
+	AVPacket *pkt = output_pt_packet(output, payload->len, samples);
+	if (!pkt)
+		return -1;
+	memcpy(pkt->data, payload->s, payload->len);
+	output_pt_queue(output, pkt);
+
+	return 0;
+}
+
+
+// with `last` set, this hands the output over to the I/O thread, which frees it
+// once the file is complete
+static int output_shutdown(output_t *output, int last) {
 	if (!output)
 		return 0;
 	if (!output->fmtctx)
@@ -302,16 +1076,14 @@ static int output_shutdown(output_t *output) {
 	int ret = 0;
 	if (output->fmtctx->pb) {
 		av_write_trailer(output->fmtctx);
-		avio_closep(&output->fmtctx->pb);
+		avio_flush(output->fmtctx->pb);
+		av_freep(&output->fmtctx->pb->buffer);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 81, 100)
+		avio_context_free(&output->fmtctx->pb);
+#else
+		av_freep(&output->fmtctx->pb);
+#endif
 		ret = 1;
-		if (output_chmod)
-			if (chmod(output->filename, output_chmod))
-				ilog(LOG_WARN, "Failed to change file mode of '%s%s%s': %s",
-						FMT_M(output->filename), strerror(errno));
-		if (output_chown != -1 || output_chgrp != -1)
-			if (chown(output->filename, output_chown, output_chgrp))
-				ilog(LOG_WARN, "Failed to change file owner/group of '%s%s%s': %s",
-						FMT_M(output->filename), strerror(errno));
 	}
 	avformat_free_context(output->fmtctx);
 
@@ -325,6 +1097,9 @@ static int output_shutdown(output_t *output) {
 	output->fmtctx = NULL;
 	output->avst = NULL;
 
+	if (ret)
+		output_io_close(output, last);
+
 	return ret;
 }
 
@@ -332,16 +1107,23 @@ static int output_shutdown(output_t *output) {
 void output_close(metafile_t *mf, output_t *output) {
 	if (!output)
 		return;
-	if (output_shutdown(output))
-		db_close_stream(output);
-	else
+
+	if (!output->fmtctx) {
+		// nothing was written
 		db_delete_stream(mf, output);
-	encoder_free(output->encoder);
-	g_clear_pointer(&output->full_filename, g_free);
-	g_clear_pointer(&output->file_path, g_free);
-	g_clear_pointer(&output->file_name, g_free);
-	g_clear_pointer(&output->filename, g_free);
-	g_slice_free1(sizeof(*output), output);
+		output_free(output);
+		return;
+	}
+
+	// the last encoder thread to handle the output finishes it up
+	pthread_mutex_lock(&output->lock);
+	output->closing = 1;
+	int schedule = !output->scheduled;
+	output->scheduled = 1;
+	pthread_mutex_unlock(&output->lock);
+
+	if (schedule)
+		output_schedule(output);
 }
 
 
@@ -16,6 +16,11 @@ void output_close(metafile_t *, output_t *);
 
 int output_config(output_t *output, const format_t *requested_format, format_t *actual_format);
 int output_add(output_t *output, AVFrame *frame);
+int output_config_passthrough(output_t *output, const codec_def_t *def, int clockrate, int channels);
+int output_add_payload(output_t *output, const str *payload, uint32_t ts);
+
+void output_threads_start(void);
+void output_cleanup(void);
 
 
 #endif
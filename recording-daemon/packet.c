@@ -17,6 +17,11 @@
 #include "streambuf.h"
 #include "resample.h"
 #include "tag.h"
+#include "stream.h"
+#include "recaux.h"
+
+
+#define PACKET_CACHE 256
 
 
 static ssize_t ssrc_tls_write(void *, const void *, size_t);
@@ -74,12 +79,54 @@ static ssize_t ssrc_tls_read(void *fd, void *b, size_t s) {
 	return ssrc_tls_check_blocked(ssl, ret);
 }
 
-static void packet_free(void *p) {
+// Freed packets of the standard size are kept for reuse by the same thread,
+// linked through their buffers. Packets are usually freed by the thread that
+// read them, but the cache is bounded in case they aren't.
+static __thread packet_t *packet_cache;
+static __thread unsigned int packet_cache_len;
+
+
+packet_t *packet_new(unsigned int len) {
+	packet_t *packet = packet_cache;
+	unsigned int bufsize = PACKET_BUFLEN;
+
+	if (len <= PACKET_BUFLEN && packet) {
+		packet_cache = *(packet_t **) packet->buffer;
+		packet_cache_len--;
+	}
+	else {
+		if (len > PACKET_BUFLEN)
+			bufsize = len;
+		packet = malloc(sizeof(*packet) + bufsize + BUFPADDING);
+	}
+
+	ZERO(*packet);
+	packet->buffer = (unsigned char *) (packet + 1);
+	packet->len = len;
+	packet->bufsize = bufsize;
+	return packet;
+}
+
+void packet_free(void *p) {
 	packet_t *packet = p;
 	if (!packet)
 		return;
-	free(packet->buffer);
-	g_slice_free1(sizeof(*packet), packet);
+	if (packet->bufsize != PACKET_BUFLEN || packet_cache_len >= PACKET_CACHE) {
+		free(packet);
+		return;
+	}
+	*(packet_t **) packet->buffer = packet_cache;
+	packet_cache = packet;
+	packet_cache_len++;
+}
+
+void packet_thread_end(void) {
+	packet_t *packet;
+	while ((packet = packet_cache)) {
+		packet_cache = *(packet_t **) packet->buffer;
+		free(packet);
+	}
+	packet_cache_len = 0;
 }
 
 
@@ -156,7 +203,7 @@ void ssrc_free(void *p) {
 // mf must be unlocked; returns ssrc locked
 static ssrc_t *ssrc_get(stream_t *stream, unsigned long ssrc) {
 	metafile_t *mf = stream->metafile;
-	pthread_mutex_lock(&mf->lock);
+	mutex_lock_timed(&mf->lock);
 	ssrc_t *ret = g_hash_table_lookup(mf->ssrc_hash, GUINT_TO_POINTER(ssrc));
 	if (ret)
 		goto out;
@@ -256,35 +303,85 @@ tls_out:
 }
 
 
+// returns the encoding of a payload type, e.g. "PCMA/8000"
+static char *payload_type_encoding(metafile_t *mf, unsigned int payload_type, char **format, int *ptime) {
+	pthread_mutex_lock(&mf->payloads_lock);
+	char *payload_str = mf->payload_types[payload_type];
+	*format = mf->payload_formats[payload_type];
+	*ptime = mf->payload_ptimes[payload_type];
+	pthread_mutex_unlock(&mf->payloads_lock);
+
+	if (!payload_str) {
+		const struct rtp_payload_type *rpt = rtp_get_rfc_payload_type(payload_type);
+		if (!rpt) {
+			ilog(LOG_WARN, "Unknown RTP payload type %u", payload_type);
+			return NULL;
+		}
+		payload_str = rpt->encoding_with_params.s;
+	}
+
+	dbg("payload type for %u is %s", payload_type, payload_str);
+
+	return payload_str;
+}
+
+
+// ssrc is locked. Puts the payload straight into the single output if the
+// output can store the codec as it is. Returns 1 if nothing else needs the
+// decoded audio.
+static int packet_passthrough(ssrc_t *ssrc, packet_t *packet, unsigned int payload_type) {
+	metafile_t *mf = ssrc->metafile;
+	output_t *output = ssrc->output;
+
+	if (G_UNLIKELY(!ssrc->passthrough[payload_type])) {
+		ssrc->passthrough[payload_type] = -1;
+		char *format;
+		int ptime, clockrate, channels;
+		char *payload_str = payload_type_encoding(mf, payload_type, &format, &ptime);
+		const codec_def_t *def = payload_str ? decoder_codec(payload_str, &clockrate, &channels) : NULL;
+		if (def && !def->supplemental) {
+			if (!output_config_passthrough(output, def, clockrate, channels))
+				ssrc->passthrough[payload_type] = 1;
+			else if (output->passthrough)
+				ilog(LOG_WARN, "Not recording RTP payload type %u (%s) into '%s%s%s', "
+						"which already stores %s", payload_type, payload_str,
+						FMT_M(output->file_name), output->passthrough->rtpname);
+		}
+	}
+
+	if (ssrc->passthrough[payload_type] < 0)
+		return 0;
+
+	if (mf->recording_on) {
+		if (output_add_payload(output, &packet->payload, ntohl(packet->rtp->timestamp)))
+			ilog(LOG_ERR, "Failed to add media packet to output");
+	}
+
+	// mix_out is set before any of the call's streams are opened
+	return !mf->mix_out && !ssrc->tls_fwd_stream;
+}
+
+
 // ssrc is locked
 static void packet_decode(ssrc_t *ssrc, packet_t *packet) {
 	// determine payload type and run decoder
 	unsigned int payload_type = packet->rtp->m_pt & 0x7f;
+	if (output_passthrough && ssrc->output && packet_passthrough(ssrc, packet, payload_type))
+		return;
 	// check if we have a decoder for this payload type yet
 	if (G_UNLIKELY(!ssrc->decoders[payload_type])) {
 		metafile_t *mf = ssrc->metafile;
-		pthread_mutex_lock(&mf->payloads_lock);
-		char *payload_str = mf->payload_types[payload_type];
-		char *format = mf->payload_formats[payload_type];
-		int ptime = mf->payload_ptimes[payload_type];
-		pthread_mutex_unlock(&mf->payloads_lock);
-
-		if (!payload_str) {
-			const struct rtp_payload_type *rpt = rtp_get_rfc_payload_type(payload_type);
-			if (!rpt) {
-				ilog(LOG_WARN, "Unknown RTP payload type %u", payload_type);
-				return;
-			}
-			payload_str = rpt->encoding_with_params.s;
-		}
-
-		dbg("payload type for %u is %s", payload_type, payload_str);
+		char *format;
+		int ptime;
+		char *payload_str = payload_type_encoding(mf, payload_type, &format, &ptime);
+		if (!payload_str)
+			return;
 
-		pthread_mutex_lock(&mf->mix_lock);
+		mutex_lock_timed(&mf->mix_lock);
 		output_t *outp = NULL;
 		if (mf->mix_out)
 			outp = mf->mix_out;
-		else if (ssrc->output)
+		else if (ssrc->output && !ssrc->output->passthrough)
 			outp = ssrc->output;
 		ssrc->decoders[payload_type] = decoder_new(payload_str, format, ptime, outp);
 		pthread_mutex_unlock(&mf->mix_lock);
@@ -321,63 +418,81 @@ static void ssrc_run(ssrc_t *ssrc) {
 }
 
 
-// stream is unlocked, buf is malloc'd
-void packet_process(stream_t *stream, unsigned char *buf, unsigned len) {
-	packet_t *packet = g_slice_alloc0(sizeof(*packet));
-	packet->buffer = buf; // handing it over
-
+// fills in the header pointers; returns 1 for packets to be skipped silently
+static int packet_parse(packet_t *packet) {
 	// XXX more checking here
 	str bufstr;
-	str_init_len(&bufstr, packet->buffer, len);
+	str_init_len(&bufstr, (char *) packet->buffer, packet->len);
 	packet->ip = (void *) bufstr.s;
 	// XXX kernel already does this - add metadata?
 	if (packet->ip->version == 4) {
 		if (str_shift(&bufstr, packet->ip->ihl << 2))
-			goto err;
+			return -1;
 	}
 	else {
 		packet->ip = NULL;
 		packet->ip6 = (void *) bufstr.s;
 		if (str_shift(&bufstr, sizeof(*packet->ip6)))
-			goto err;
+			return -1;
 	}
 
 	packet->udp = (void *) bufstr.s;
 	str_shift(&bufstr, sizeof(*packet->udp));
 
 	if (rtcp_demux_is_rtcp(&bufstr))
-		goto ignore; // for now
+		return 1; // for now
 
 	if (rtp_payload(&packet->rtp, &packet->payload, &bufstr))
-		goto err;
+		return -1;
 	if (rtp_padding(packet->rtp, &packet->payload))
-		goto err;
+		return -1;
 
 	packet->p.seq = ntohs(packet->rtp->seq_num);
-	unsigned long ssrc_num = ntohl(packet->rtp->ssrc);
-	log_info_ssrc = ssrc_num;
 	dbg("packet parsed successfully, seq %u", packet->p.seq);
+	return 0;
+}
 
-	// insert into ssrc queue
-	ssrc_t *ssrc = ssrc_get(stream, ssrc_num);
-	if (packet_sequencer_insert(&ssrc->sequencer, &packet->p) < 0)
-		goto dupe;
 
-	// got a new packet, run the decoder
-	ssrc_run(ssrc);
-	log_info_ssrc = 0;
-	return;
+// stream is unlocked, consumes the packets. All headers are parsed first, then
+// the packets are handed to their SSRCs, taking each SSRC's lock once.
+void packet_process(stream_t *stream, packet_t **packets, unsigned int num) {
+	unsigned int n = 0;
 
-dupe:
-	dbg("skipping dupe packet (new seq %i prev seq %i)", packet->p.seq, ssrc->sequencer.seq);
-	pthread_mutex_unlock(&ssrc->lock);
-	packet_free(packet);
-	log_info_ssrc = 0;
-	return;
+	for (unsigned int i = 0; i < num; i++) {
+		int ret = packet_parse(packets[i]);
+		if (ret) {
+			if (ret < 0)
+				ilog(LOG_WARN, "Failed to parse packet headers");
+			packet_free(packets[i]);
+			continue;
+		}
+		packets[n++] = packets[i];
+	}
+
+	for (unsigned int i = 0; i < n; i++) {
+		if (!packets[i])
+			continue;
+
+		uint32_t ssrc_num = packets[i]->rtp->ssrc;
+		log_info_ssrc = ntohl(ssrc_num);
+
+		// insert into ssrc queue
+		ssrc_t *ssrc = ssrc_get(stream, ntohl(ssrc_num));
+		for (unsigned int j = i; j < n; j++) {
+			packet_t *packet = packets[j];
+			if (!packet || packet->rtp->ssrc != ssrc_num)
+				continue;
+			packets[j] = NULL;
+			if (packet_sequencer_insert(&ssrc->sequencer, &packet->p) < 0) {
+				dbg("skipping dupe packet (new seq %i prev seq %i)", packet->p.seq,
+						ssrc->sequencer.seq);
+				packet_free(packet);
+			}
+		}
+
+		// got new packets, run the decoder
+		ssrc_run(ssrc);
+	}
 
-err:
-	ilog(LOG_WARN, "Failed to parse packet headers");
-ignore:
-	packet_free(packet);
 	log_info_ssrc = 0;
 }
@@ -3,9 +3,16 @@
 
 #include "types.h"
 
+// packets up to this size are kept in a per-thread cache when freed
+#define PACKET_BUFLEN 2048
+
 void ssrc_free(void *p);
 
-void packet_process(stream_t *, unsigned char *, unsigned len);
+packet_t *packet_new(unsigned int len);
+void packet_free(void *p);
+void packet_thread_end(void);
+
+void packet_process(stream_t *, packet_t **, unsigned int num);
 
 void ssrc_tls_state(ssrc_t *ssrc);
 
@@ -1,9 +1,11 @@
 #include "recaux.h"
 #include <stdio.h>
 #include <stdarg.h>
+#include <time.h>
 
 
 __thread int __sscanf_hack_var;
+__thread unsigned long long lock_waits, lock_wait_us;
 
 
 int __sscanf_match(const char *str, const char *fmt, ...) { 
@@ -19,3 +21,18 @@ int __sscanf_match(const char *str, const char *fmt, ...) {
 		return 0;
 	return ret;
 }
+
+
+// only measures the time spent waiting if the lock is actually taken by someone else
+void mutex_lock_timed(pthread_mutex_t *m) {
+	if (!pthread_mutex_trylock(m))
+		return;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(m);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	lock_waits++;
+	lock_wait_us += (end.tv_sec - start.tv_sec) * 1000000LL + (end.tv_nsec - start.tv_nsec) / 1000;
+}
@@ -1,9 +1,16 @@
 #ifndef _RECAUX_H_
 #define _RECAUX_H_
 
+#include <pthread.h>
+
 extern __thread int __sscanf_hack_var;
 
 #define sscanf_match(str, format, ...) __sscanf_match(str, format "%n", ##__VA_ARGS__, &__sscanf_hack_var)
 int __sscanf_match(const char *str, const char *fmt, ...) __attribute__ ((__format__ (__scanf__, 2, 3)));
 
+// contention counters of the calling thread, updated by mutex_lock_timed()
+extern __thread unsigned long long lock_waits, lock_wait_us;
+
+void mutex_lock_timed(pthread_mutex_t *m);
+
 #endif
@@ -0,0 +1,298 @@
+#include "ring.h"
+#include <sys/mman.h>
+#include <glib.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include "xt_RTPENGINE.h"
+#include "log.h"
+#include "main.h"
+#include "epoll.h"
+#include "stream.h"
+#include "packet.h"
+
+
+#define RING_BATCH 64
+
+
+// Packets of all streams not opened individually arrive through the one shared
+// ring of the kernel table. It's drained in batches: records are copied out
+// under the consumer lock, then the packets of each stream are handed to the
+// poller thread owning the stream's call (see metafile_t.shard), which
+// processes them. The ring handler itself never processes packets.
+
+struct ring_packet {
+	stream_t *stream;
+	unsigned int idx;
+	unsigned int shard;
+	packet_t *packet;
+};
+
+// packets of one stream, in ring order
+struct ring_batch {
+	stream_t *stream; // only compared against, see ring_shard_handler_func()
+	unsigned int idx;
+	unsigned int num;
+	packet_t *packets[RING_BATCH];
+};
+
+struct ring_shard {
+	pthread_mutex_t lock;
+	GQueue batches;
+	int efd;
+	handler_t handler;
+};
+
+
+static int ring_fd = -1;
+static struct rtpengine_ring_header *ring;
+static unsigned char *ring_data;
+static size_t ring_map_len;
+static uint64_t ring_dropped;
+
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER; // consumer side of the ring
+static pthread_mutex_t ring_streams_lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable *ring_streams; // kernel stream idx -> stream_t
+static struct ring_shard *ring_shards;
+static unsigned int num_ring_shards;
+
+
+static handler_func ring_handler_func;
+static handler_t ring_handler = {
+	.func = ring_handler_func,
+};
+
+
+// ring_lock is held
+static unsigned int ring_fetch(struct ring_packet *batch, int *empty) {
+	uint64_t tail = ring->tail;
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	unsigned int n = 0;
+
+	pthread_mutex_lock(&ring_streams_lock);
+
+	while (tail != head && n < RING_BATCH) {
+		struct rtpengine_ring_record *rec = (void *) (ring_data + (tail & (ring->size - 1)));
+		tail += rec->len;
+		if ((rec->flags & RTPE_RING_F_PAD))
+			continue;
+		if (rec->data_len > MAXBUFLEN)
+			continue;
+
+		stream_t *stream = g_hash_table_lookup(ring_streams, GUINT_TO_POINTER(rec->stream_idx));
+		if (!stream)
+			continue;
+
+		packet_t *packet = packet_new(rec->data_len);
+		memcpy(packet->buffer, rec->data, rec->data_len);
+		batch[n++] = (struct ring_packet) { .stream = stream, .idx = rec->stream_idx,
+			.shard = stream->metafile->shard % num_ring_shards, .packet = packet };
+	}
+
+	pthread_mutex_unlock(&ring_streams_lock);
+
+	*empty = (tail == head);
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	uint64_t dropped = ring->dropped;
+	if (dropped != ring_dropped) {
+		ilog(LOG_WARN, "Kernel ring overflow, %llu packets dropped",
+				(unsigned long long) (dropped - ring_dropped));
+		ring_dropped = dropped;
+	}
+
+	return n;
+}
+
+
+static void ring_handler_func(handler_t *handler) {
+	struct ring_packet batch[RING_BATCH];
+	int empty = 0;
+
+	while (!empty) {
+		pthread_mutex_lock(&ring_lock);
+		unsigned int n = ring_fetch(batch, &empty);
+		pthread_mutex_unlock(&ring_lock);
+
+		// hand over all packets of one stream together, in ring order
+		for (unsigned int i = 0; i < n; i++) {
+			stream_t *stream = batch[i].stream;
+			if (!stream)
+				continue;
+			struct ring_batch *rb = g_slice_alloc(sizeof(*rb));
+			rb->stream = stream;
+			rb->idx = batch[i].idx;
+			rb->num = 0;
+			for (unsigned int j = i; j < n; j++) {
+				if (batch[j].stream != stream)
+					continue;
+				rb->packets[rb->num++] = batch[j].packet;
+				batch[j].stream = NULL;
+			}
+
+			struct ring_shard *rs = &ring_shards[batch[i].shard];
+			pthread_mutex_lock(&rs->lock);
+			int wake = !rs->batches.length;
+			g_queue_push_tail(&rs->batches, rb);
+			pthread_mutex_unlock(&rs->lock);
+
+			if (wake) {
+				uint64_t one = 1;
+				if (write(rs->efd, &one, sizeof(one)) != sizeof(one))
+					ilog(LOG_ERR, "Failed to wake up poller thread: %s", strerror(errno));
+			}
+		}
+	}
+}
+
+
+static void ring_batch_free(struct ring_batch *rb) {
+	for (unsigned int i = 0; i < rb->num; i++)
+		packet_free(rb->packets[i]);
+	g_slice_free1(sizeof(*rb), rb);
+}
+
+
+// runs in the poller thread owning the streams
+static void ring_shard_handler_func(handler_t *handler) {
+	struct ring_shard *rs = handler->ptr;
+	uint64_t val;
+	GQueue batches;
+
+	if (read(rs->efd, &val, sizeof(val)) == -1 && errno != EAGAIN)
+		ilog(LOG_ERR, "Failed to read from eventfd: %s", strerror(errno));
+
+	pthread_mutex_lock(&rs->lock);
+	batches = rs->batches;
+	g_queue_init(&rs->batches);
+	pthread_mutex_unlock(&rs->lock);
+
+	struct ring_batch *rb;
+	while ((rb = g_queue_pop_head(&batches))) {
+		// The stream may have been closed since the batch was queued. Once it's
+		// no longer listed, it's only freed after this thread has gone through
+		// garbage_collect(), so it's safe to use if it still is.
+		pthread_mutex_lock(&ring_streams_lock);
+		stream_t *stream = g_hash_table_lookup(ring_streams, GUINT_TO_POINTER(rb->idx));
+		pthread_mutex_unlock(&ring_streams_lock);
+
+		if (stream != rb->stream) {
+			ring_batch_free(rb);
+			continue;
+		}
+
+		stream_ring_packets(stream, rb->packets, rb->num); // consumes packets
+		g_slice_free1(sizeof(*rb), rb);
+	}
+}
+
+
+// stream is locked
+int ring_add_stream(stream_t *stream) {
+	if (ring_fd == -1)
+		return -1;
+
+	stream->ring_attached = 1;
+	pthread_mutex_lock(&ring_streams_lock);
+	g_hash_table_insert(ring_streams, GUINT_TO_POINTER(stream->kernel_idx), stream);
+	pthread_mutex_unlock(&ring_streams_lock);
+
+	return 0;
+}
+
+
+// stream is locked
+void ring_del_stream(stream_t *stream) {
+	if (!stream->ring_attached)
+		return;
+
+	stream->ring_attached = 0;
+	pthread_mutex_lock(&ring_streams_lock);
+	// the kernel may have handed the index to a new stream already
+	if (g_hash_table_lookup(ring_streams, GUINT_TO_POINTER(stream->kernel_idx)) == stream)
+		g_hash_table_remove(ring_streams, GUINT_TO_POINTER(stream->kernel_idx));
+	pthread_mutex_unlock(&ring_streams_lock);
+}
+
+
+void ring_setup(void) {
+	char fnbuf[PATH_MAX];
+	snprintf(fnbuf, sizeof(fnbuf), "/proc/rtpengine/%u/ring", ktable);
+
+	ring_fd = open(fnbuf, O_RDWR | O_NONBLOCK);
+	if (ring_fd == -1) {
+		ilog(LOG_INFO, "Kernel ring %s not available (%s), reading streams individually",
+				fnbuf, strerror(errno));
+		return;
+	}
+
+	// map the header on its own first to learn the size
+	long page = sysconf(_SC_PAGESIZE);
+	struct rtpengine_ring_header *hdr = mmap(NULL, page, PROT_READ, MAP_SHARED, ring_fd, 0);
+	if (hdr == MAP_FAILED)
+		goto err;
+	ring_map_len = page + hdr->size;
+	munmap(hdr, page);
+
+	ring = mmap(NULL, ring_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+	if (ring == MAP_FAILED) {
+		ring = NULL;
+		goto err;
+	}
+	ring_data = (unsigned char *) ring + page;
+
+	num_ring_shards = num_threads;
+	ring_shards = g_new0(struct ring_shard, num_ring_shards);
+	for (unsigned int i = 0; i < num_ring_shards; i++) {
+		struct ring_shard *rs = &ring_shards[i];
+		pthread_mutex_init(&rs->lock, NULL);
+		g_queue_init(&rs->batches);
+		rs->efd = eventfd(0, EFD_NONBLOCK);
+		if (rs->efd == -1)
+			die_errno("eventfd failed");
+		rs->handler.ptr = rs;
+		rs->handler.func = ring_shard_handler_func;
+		epoll_add(rs->efd, EPOLLIN, &rs->handler, i);
+	}
+
+	ring_streams = g_hash_table_new(g_direct_hash, g_direct_equal);
+	// only moves packets to the owning threads, so it doesn't matter which one runs it
+	epoll_add(ring_fd, EPOLLIN, &ring_handler, 0);
+
+	ilog(LOG_INFO, "Receiving kernel packets through %s (%u kB)", fnbuf, ring->size / 1024);
+	return;
+
+err:
+	ilog(LOG_ERR, "Failed to map kernel ring %s: %s", fnbuf, strerror(errno));
+	close(ring_fd);
+	ring_fd = -1;
+}
+
+
+void ring_cleanup(void) {
+	if (ring_fd == -1)
+		return;
+	epoll_del(ring_fd, 0);
+	for (unsigned int i = 0; i < num_ring_shards; i++) {
+		struct ring_shard *rs = &ring_shards[i];
+		epoll_del(rs->efd, i);
+		close(rs->efd);
+		struct ring_batch *rb;
+		while ((rb = g_queue_pop_head(&rs->batches)))
+			ring_batch_free(rb);
+		pthread_mutex_destroy(&rs->lock);
+	}
+	g_free(ring_shards);
+	ring_shards = NULL;
+	num_ring_shards = 0;
+	munmap(ring, ring_map_len);
+	ring = NULL;
+	close(ring_fd);
+	ring_fd = -1;
+	g_hash_table_destroy(ring_streams);
+	ring_streams = NULL;
+}
@@ -0,0 +1,12 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include "types.h"
+
+void ring_setup(void);
+void ring_cleanup(void);
+
+int ring_add_stream(stream_t *stream);
+void ring_del_stream(stream_t *stream);
+
+#endif
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <string.h>
 #include <libavcodec/avcodec.h>
 #include "metafile.h"
 #include "epoll.h"
@@ -11,23 +12,15 @@
 #include "main.h"
 #include "packet.h"
 #include "forward.h"
-
-
-#define MAXBUFLEN 65535
-#ifndef AV_INPUT_BUFFER_PADDING_SIZE
-#define AV_INPUT_BUFFER_PADDING_SIZE 0
-#endif
-#ifndef FF_INPUT_BUFFER_PADDING_SIZE
-#define FF_INPUT_BUFFER_PADDING_SIZE 0
-#endif
-#define ALLOCLEN (MAXBUFLEN + AV_INPUT_BUFFER_PADDING_SIZE + FF_INPUT_BUFFER_PADDING_SIZE)
+#include "ring.h"
 
 
 // stream is locked
 void stream_close(stream_t *stream) {
+	ring_del_stream(stream);
 	if (stream->fd == -1)
 		return;
-	epoll_del(stream->fd);
+	epoll_del(stream->fd, stream->metafile->shard);
 	close(stream->fd);
 	stream->fd = -1;
 }
@@ -37,61 +30,125 @@ void stream_free(stream_t *stream) {
 }
 
 
-static void stream_handler(handler_t *handler) {
-	stream_t *stream = handler->ptr;
-	unsigned char *buf = NULL;
+#define STREAM_BATCH 32
 
-	log_info_call = stream->metafile->name;
-	log_info_stream = stream->name;
 
-	//dbg("poll event for %s", stream->name);
+// if set, streams are handed to this instead of being read from the kernel, and
+// their packets are passed to packet_process() by whoever set it (see bench.c)
+void (*stream_source)(stream_t *);
 
-	pthread_mutex_lock(&stream->lock);
 
-	if (stream->fd == -1)
-		goto out;
+// scratch space to read packets of unknown size into
+static __thread unsigned char *stream_read_buf;
 
-	buf = malloc(ALLOCLEN);
-	int ret = read(stream->fd, buf, MAXBUFLEN);
-	if (ret == 0) {
-		ilog(LOG_INFO, "EOF on stream %s", stream->name);
-		stream_close(stream);
-		goto out;
+
+// consumes the packets
+static void stream_packets(stream_t *stream, packet_t **packets, unsigned int num) {
+	if (forward_to) {
+		for (unsigned int i = 0; i < num; i++) {
+			if (forward_packet(stream->metafile, packets[i]->buffer, packets[i]->len))
+				g_atomic_int_inc(&stream->metafile->forward_failed);
+			else
+				g_atomic_int_inc(&stream->metafile->forward_count);
+		}
 	}
-	else if (ret < 0) {
-		if (errno == EAGAIN || errno == EINTR || errno == EWOULDBLOCK)
-			goto out;
-		ilog(LOG_INFO, "Read error on stream %s: %s", stream->name, strerror(errno));
-		stream_close(stream);
-		goto out;
+	if (decoding_enabled)
+		packet_process(stream, packets, num); // consumes packets
+	else {
+		for (unsigned int i = 0; i < num; i++)
+			packet_free(packets[i]);
 	}
+}
 
-	// got a packet
-	pthread_mutex_unlock(&stream->lock);
 
-	if (forward_to){
-		if (forward_packet(stream->metafile,buf,ret)) // leaves buf intact
-			g_atomic_int_inc(&stream->metafile->forward_failed);
+// stream is locked; returns the number of packets read. Closes the stream on EOF or error.
+static unsigned int stream_read_batch(stream_t *stream, packet_t **packets, int *drained) {
+	unsigned int num = 0;
+
+	if (!stream_read_buf)
+		stream_read_buf = malloc(MAXBUFLEN);
+
+	while (num < STREAM_BATCH) {
+		int ret = read(stream->fd, stream_read_buf, MAXBUFLEN);
+		if (ret == 0) {
+			ilog(LOG_INFO, "EOF on stream %s", stream->name);
+			stream_close(stream);
+			break;
+		}
+		else if (ret < 0) {
+			if (errno == EAGAIN || errno == EINTR || errno == EWOULDBLOCK)
+				break;
+			ilog(LOG_INFO, "Read error on stream %s: %s", stream->name, strerror(errno));
+			stream_close(stream);
+			break;
+		}
+
+		packets[num] = packet_new(ret);
+		memcpy(packets[num]->buffer, stream_read_buf, ret);
+		num++;
+	}
+
+	*drained = (num < STREAM_BATCH);
+	return num;
+}
+
+
+static void stream_handler(handler_t *handler) {
+	stream_t *stream = handler->ptr;
+	packet_t *packets[STREAM_BATCH];
+	int drained = 0;
+
+	log_info_call = stream->metafile->name;
+	log_info_stream = stream->name;
+
+	//dbg("poll event for %s", stream->name);
+
+	// edge triggered, so keep going until the stream is empty
+	while (!drained) {
+		pthread_mutex_lock(&stream->lock);
+		unsigned int num = 0;
+		if (stream->fd != -1)
+			num = stream_read_batch(stream, packets, &drained);
 		else
-			g_atomic_int_inc(&stream->metafile->forward_count);
+			drained = 1;
+		pthread_mutex_unlock(&stream->lock);
+
+		if (num)
+			stream_packets(stream, packets, num);
 	}
-	if (decoding_enabled)
-		packet_process(stream, buf, ret); // consumes buf
-	else
-		free(buf);
 
 	log_info_call = NULL;
 	log_info_stream = NULL;
-	return;
+}
 
-out:
+
+// packets taken from the kernel ring, consumes the packets
+void stream_ring_packets(stream_t *stream, packet_t **packets, unsigned int num) {
+	log_info_call = stream->metafile->name;
+	log_info_stream = stream->name;
+
+	pthread_mutex_lock(&stream->lock);
+	int attached = stream->ring_attached;
 	pthread_mutex_unlock(&stream->lock);
-	free(buf);
+
+	if (attached)
+		stream_packets(stream, packets, num);
+	else {
+		for (unsigned int i = 0; i < num; i++)
+			packet_free(packets[i]);
+	}
+
 	log_info_call = NULL;
 	log_info_stream = NULL;
 }
 
 
+void stream_thread_end(void) {
+	free(stream_read_buf);
+	stream_read_buf = NULL;
+}
+
+
 // mf is locked
 static stream_t *stream_get(metafile_t *mf, unsigned long id) {
 	if (mf->streams->len <= id)
@@ -107,6 +164,7 @@ static stream_t *stream_get(metafile_t *mf, unsigned long id) {
 	ret->id = id;
 	ret->metafile = mf;
 	ret->tag = (unsigned long) -1;
+	ret->kernel_idx = -1;
 
 out:
 	return ret;
@@ -121,6 +179,21 @@ void stream_open(metafile_t *mf, unsigned long id, char *name) {
 
 	stream->name = g_string_chunk_insert(mf->gsc, name);
 
+	if (stream_source) {
+		stream_source(stream);
+		return;
+	}
+
+	if (stream->kernel_idx != -1) {
+		pthread_mutex_lock(&stream->lock);
+		int ret = ring_add_stream(stream);
+		pthread_mutex_unlock(&stream->lock);
+		if (!ret) {
+			dbg("receiving stream %s through the kernel ring", name);
+			return;
+		}
+	}
+
 	char fnbuf[PATH_MAX];
 	snprintf(fnbuf, sizeof(fnbuf), "/proc/rtpengine/%u/calls/%s/%s", ktable, mf->parent, name);
 
@@ -133,7 +206,7 @@ void stream_open(metafile_t *mf, unsigned long id, char *name) {
 	// add to epoll
 	stream->handler.ptr = stream;
 	stream->handler.func = stream_handler;
-	epoll_add(stream->fd, EPOLLIN, &stream->handler);
+	epoll_add(stream->fd, EPOLLIN, &stream->handler, mf->shard);
 }
 
 void stream_details(metafile_t *mf, unsigned long id, unsigned int tag) {
@@ -141,6 +214,11 @@ void stream_details(metafile_t *mf, unsigned long id, unsigned int tag) {
 	stream->tag = tag;
 }
 
+void stream_kernel_idx(metafile_t *mf, unsigned long id, unsigned int idx) {
+	stream_t *stream = stream_get(mf, id);
+	stream->kernel_idx = idx;
+}
+
 void stream_forwarding_on(metafile_t *mf, unsigned long id, unsigned int on) {
 	stream_t *stream = stream_get(mf, id);
 	dbg("Setting forwarding flag to %u for stream #%lu", on, stream->id);
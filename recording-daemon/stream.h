@@ -1,12 +1,29 @@
 #ifndef _STREAM_H_
 #define _STREAM_H_
 
+#include <libavcodec/avcodec.h>
 #include "types.h"
 
+
+#define MAXBUFLEN 65535
+#ifndef AV_INPUT_BUFFER_PADDING_SIZE
+#define AV_INPUT_BUFFER_PADDING_SIZE 0
+#endif
+#ifndef FF_INPUT_BUFFER_PADDING_SIZE
+#define FF_INPUT_BUFFER_PADDING_SIZE 0
+#endif
+#define BUFPADDING (AV_INPUT_BUFFER_PADDING_SIZE + FF_INPUT_BUFFER_PADDING_SIZE)
+
+
 void stream_open(metafile_t *mf, unsigned long id, char *name);
 void stream_details(metafile_t *mf, unsigned long id, unsigned int tag);
+void stream_kernel_idx(metafile_t *mf, unsigned long id, unsigned int idx);
 void stream_forwarding_on(metafile_t *mf, unsigned long id, unsigned int on);
 void stream_close(stream_t *stream);
 void stream_free(stream_t *stream);
+void stream_ring_packets(stream_t *stream, packet_t **packets, unsigned int num);
+void stream_thread_end(void);
+
+extern void (*stream_source)(stream_t *);
 
 #endif
@@ -33,8 +33,12 @@ struct output_s;
 typedef struct output_s output_t;
 struct mix_s;
 typedef struct mix_s mix_t;
+struct mix_input_s;
+typedef struct mix_input_s mix_input_t;
 struct decode_s;
 typedef struct decode_s decode_t;
+struct db_ref_s;
+typedef struct db_ref_s db_ref_t;
 
 
 typedef void handler_func(handler_t *);
@@ -54,6 +58,8 @@ struct stream_s {
 	unsigned long tag;
 	int fd;
 	handler_t handler;
+	unsigned int kernel_idx; // -1 if unknown
+	int ring_attached; // packets arrive through the kernel ring
 	unsigned int forwarding_on:1;
 };
 typedef struct stream_s stream_t;
@@ -61,7 +67,9 @@ typedef struct stream_s stream_t;
 
 struct packet_s {
 	seq_packet_t p; // must be first
-	void *buffer;
+	unsigned char *buffer; // follows the struct, see packet_new()
+	unsigned int len;
+	unsigned int bufsize;
 	// pointers into buffer
 	struct iphdr *ip;
 	struct ip6_hdr *ip6;
@@ -80,6 +88,7 @@ struct ssrc_s {
 	unsigned long ssrc;
 	packet_sequencer_t sequencer;
 	decode_t *decoders[128];
+	signed char passthrough[128]; // 1: written to the output as it is, -1: decoded
 	output_t *output;
 
 	// TLS output
@@ -108,14 +117,14 @@ typedef struct tag_s tag_t;
 struct metafile_s {
 	pthread_mutex_t lock;
 	char *name;
+	unsigned int shard; // poller thread handling this call's fds
 	char *parent;
 	char *call_id;
 	char *metadata;
 	char *metadata_db;
 	char *output_dest;
 	off_t pos;
-	unsigned long long db_id;
-	unsigned int db_streams;
+	db_ref_t *db;
 
 	GStringChunk *gsc; // XXX limit max size
 
@@ -148,7 +157,7 @@ struct output_s {
 		*file_name,
 		*filename; // path + filename + suffix
 	const char *file_format;
-	unsigned long long db_id;
+	db_ref_t *db;
 	gboolean skip_filename_extension;
 	unsigned int channel_mult;
 
@@ -157,13 +166,33 @@ struct output_s {
 	encoder_t *encoder;
 	format_t requested_format,
 		 actual_format;
+
+	// RTP payloads muxed as they are, without an encoder, see output_passthrough()
+	const codec_def_t *passthrough;
+	int pt_clockrate, pt_channels;
+	uint32_t pt_ts; // RTP timestamp of the last packet
+	int64_t pt_next; // expected pts of the next packet
+	unsigned int pt_started:1;
+
+	// encoder and I/O thread handoff, see output.c
+	pthread_mutex_t lock;
+	pthread_cond_t idle;
+	GQueue frames; // AVFrame from output_add(), or AVPacket for passthrough outputs
+	unsigned int scheduled:1, // queued for or being handled by an encoder thread
+		     closing:1;
+	unsigned int io_shard;
+	int fd;
+	int64_t io_pos, io_size; // of the AVIOContext
+	// statistics
+	unsigned int frames_max;
+	unsigned long long frames_dropped;
+	unsigned long long writes, write_bytes, write_us, write_max_us, write_errors; // I/O thread only
 };
 
 
 struct decode_s {
 	decoder_t *dec;
-	resample_t mix_resampler;
-	unsigned int mixer_idx;
+	mix_input_t *mix_input; // owned by the mixer
 };
 
 
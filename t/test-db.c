@@ -0,0 +1,227 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <mysql.h>
+#include "../recording-daemon/db.h"
+#include "../recording-daemon/main.h"
+#include "../recording-daemon/tag.h"
+
+// Feeds the database writer of the recording daemon a burst of calls and checks
+// the rows it produced. Needs a MySQL or MariaDB server and is skipped unless
+// RTPE_TEST_MYSQL_HOST is set. RTPE_TEST_MYSQL_PORT, RTPE_TEST_MYSQL_USER,
+// RTPE_TEST_MYSQL_PASS and RTPE_TEST_MYSQL_DB (default "rtpengine_test") are used
+// as well. The tables are created if they don't exist. Ex:
+//   RTPE_TEST_MYSQL_HOST=localhost RTPE_TEST_MYSQL_USER=root ./test-db
+
+#define NUM_CALLS 2000
+#define EMPTY_EVERY 10 // every 10th call has no streams left and gets deleted
+
+enum output_storage_enum output_storage = OUTPUT_STORAGE_FILE;
+char *c_mysql_host,
+      *c_mysql_user,
+      *c_mysql_pass,
+      *c_mysql_db;
+int c_mysql_port;
+int c_mysql_batch = 100;
+int c_mysql_queue = 10000;
+
+static tag_t caller = { .label = "caller" };
+
+static const char *schema[] = {
+	"create table if not exists `recording_calls` ("
+		"`id` int(10) unsigned NOT NULL AUTO_INCREMENT,"
+		"`call_id` varchar(250) NOT NULL,"
+		"`start_timestamp` decimal(13,3) DEFAULT NULL,"
+		"`end_timestamp` decimal(13,3) DEFAULT NULL,"
+		"`status` enum('recording','completed','confirmed') DEFAULT 'recording',"
+		"PRIMARY KEY (`id`),"
+		"KEY `call_id` (`call_id`)"
+	") ENGINE=InnoDB",
+	"create table if not exists `recording_streams` ("
+		"`id` int(10) unsigned NOT NULL AUTO_INCREMENT,"
+		"`call` int(10) unsigned NOT NULL,"
+		"`local_filename` varchar(250) NOT NULL,"
+		"`full_filename` varchar(250) NOT NULL,"
+		"`file_format` varchar(10) NOT NULL,"
+		"`stream` mediumblob,"
+		"`output_type` enum('mixed','single') NOT NULL,"
+		"`stream_id` int(10) unsigned NOT NULL,"
+		"`sample_rate` int(10) unsigned NOT NULL DEFAULT '0',"
+		"`channels` int(10) unsigned NOT NULL DEFAULT '0',"
+		"`ssrc` int(10) unsigned NOT NULL,"
+		"`start_timestamp` decimal(13,3) DEFAULT NULL,"
+		"`end_timestamp` decimal(13,3) DEFAULT NULL,"
+		"`tag_label` varchar(255) NOT NULL DEFAULT '',"
+		"PRIMARY KEY (`id`),"
+		"KEY `call` (`call`),"
+		"CONSTRAINT `fk_call_id` FOREIGN KEY (`call`) REFERENCES `recording_calls` (`id`) "
+			"ON DELETE CASCADE ON UPDATE CASCADE"
+	") ENGINE=InnoDB",
+	"create table if not exists `recording_metakeys` ("
+		"`id` int(10) unsigned NOT NULL AUTO_INCREMENT,"
+		"`call` int(10) unsigned NOT NULL,"
+		"`key` char(255) NOT NULL,"
+		"`value` char(255) NOT NULL,"
+		"PRIMARY KEY (`id`),"
+		"KEY `prim_lookup` (`value`,`key`),"
+		"KEY `fk_call_idx` (`call`),"
+		"CONSTRAINT `fk_call_idx` FOREIGN KEY (`call`) REFERENCES `recording_calls` (`id`) "
+			"ON DELETE CASCADE ON UPDATE CASCADE"
+	") ENGINE=InnoDB",
+};
+
+void (__ilog)(int prio, const char *fmt, ...) {
+	if (prio > LOG_INFO)
+		return;
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+}
+
+tag_t *tag_get(metafile_t *mf, unsigned long id) {
+	return &caller;
+}
+
+static void query(MYSQL *m, const char *q) {
+	if (mysql_query(m, q)) {
+		fprintf(stderr, "query '%s' failed: %s\n", q, mysql_error(m));
+		abort();
+	}
+}
+
+static unsigned long long count(MYSQL *m, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	char *q = g_strdup_vprintf(fmt, ap);
+	va_end(ap);
+
+	query(m, q);
+	MYSQL_RES *res = mysql_store_result(m);
+	assert(res != NULL);
+	MYSQL_ROW row = mysql_fetch_row(res);
+	assert(row != NULL && row[0] != NULL);
+	unsigned long long ret = strtoull(row[0], NULL, 10);
+	mysql_free_result(res);
+	g_free(q);
+
+	return ret;
+}
+
+static long long now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int main(void) {
+	c_mysql_host = getenv("RTPE_TEST_MYSQL_HOST");
+	if (!c_mysql_host) {
+		printf("RTPE_TEST_MYSQL_HOST not set, skipping\n");
+		return 0;
+	}
+	c_mysql_user = getenv("RTPE_TEST_MYSQL_USER");
+	c_mysql_pass = getenv("RTPE_TEST_MYSQL_PASS");
+	c_mysql_db = getenv("RTPE_TEST_MYSQL_DB") ? : "rtpengine_test";
+	c_mysql_port = getenv("RTPE_TEST_MYSQL_PORT") ? atoi(getenv("RTPE_TEST_MYSQL_PORT")) : 0;
+
+	mysql_library_init(0, NULL, NULL);
+
+	MYSQL *m = mysql_init(NULL);
+	if (!mysql_real_connect(m, c_mysql_host, c_mysql_user, c_mysql_pass, NULL, c_mysql_port,
+				NULL, 0))
+	{
+		fprintf(stderr, "failed to connect: %s\n", mysql_error(m));
+		return 1;
+	}
+	char *q = g_strdup_printf("create database if not exists `%s`", c_mysql_db);
+	query(m, q);
+	g_free(q);
+	if (mysql_select_db(m, c_mysql_db)) {
+		fprintf(stderr, "failed to select database: %s\n", mysql_error(m));
+		return 1;
+	}
+	for (unsigned int i = 0; i < G_N_ELEMENTS(schema); i++)
+		query(m, schema[i]);
+
+	char *prefix = g_strdup_printf("test-db-%i-", getpid());
+
+	metafile_t *mfs = g_new0(metafile_t, NUM_CALLS);
+	output_t *ops = g_new0(output_t, NUM_CALLS);
+	stream_t stream = { .id = 1, .tag = 0 };
+	format_t fmt = { .clockrate = 8000, .channels = 1 };
+
+	db_thread_start();
+
+	// what the poller threads would do during a burst of calls
+	long long start = now_us();
+	for (unsigned int i = 0; i < NUM_CALLS; i++) {
+		metafile_t *mf = &mfs[i];
+		output_t *op = &ops[i];
+
+		mf->call_id = g_strdup_printf("%s%u", prefix, i);
+		mf->metadata_db = "foo:bar|num:1234|broken|";
+		db_do_call(mf);
+
+		op->file_name = g_strdup_printf("%s-caller", mf->call_id);
+		op->full_filename = g_strdup_printf("/tmp/%s", op->file_name);
+		op->filename = g_strdup_printf("%s.wav", op->full_filename);
+		op->file_format = "wav";
+		db_do_stream(mf, op, "single", &stream, 0x1234 + i);
+
+		if (i % EMPTY_EVERY == 0)
+			db_delete_stream(mf, op);
+		else {
+			db_config_stream(op, &fmt);
+			db_close_stream(op);
+		}
+		db_close_call(mf);
+	}
+	long long queued = now_us() - start;
+
+	db_cleanup();
+	long long done = now_us() - start;
+
+	printf("%u calls: %lld us to queue, %lld us until written\n", NUM_CALLS, queued, done);
+
+	unsigned int exp = NUM_CALLS - (NUM_CALLS + EMPTY_EVERY - 1) / EMPTY_EVERY;
+
+	assert(count(m, "select count(*) from recording_calls where call_id like '%s%%'", prefix) == exp);
+	assert(count(m, "select count(*) from recording_calls where call_id like '%s%%' "
+				"and status = 'completed' and end_timestamp is not null", prefix) == exp);
+	assert(count(m, "select count(*) from recording_streams s join recording_calls c on s.call = c.id "
+				"where c.call_id like '%s%%' and s.end_timestamp is not null "
+				"and s.channels = 1 and s.sample_rate = 8000 and s.tag_label = 'caller' "
+				"and s.output_type = 'single' and s.file_format = 'wav' "
+				"and s.local_filename = concat(c.call_id, '-caller.wav')", prefix) == exp);
+	assert(count(m, "select count(*) from recording_metakeys k join recording_calls c on k.call = c.id "
+				"where c.call_id like '%s%%'", prefix) == exp * 2);
+	assert(count(m, "select count(*) from recording_metakeys k join recording_calls c on k.call = c.id "
+				"where c.call_id like '%s%%' and k.key = 'num' and k.value = '1234'", prefix) == exp);
+
+	q = g_strdup_printf("delete from recording_calls where call_id like '%s%%'", prefix);
+	query(m, q);
+	g_free(q);
+	mysql_close(m);
+
+	for (unsigned int i = 0; i < NUM_CALLS; i++) {
+		db_release(&mfs[i].db);
+		db_release(&ops[i].db);
+		g_free(mfs[i].call_id);
+		g_free(ops[i].file_name);
+		g_free(ops[i].full_filename);
+		g_free(ops[i].filename);
+	}
+	g_free(mfs);
+	g_free(ops);
+	g_free(prefix);
+
+	mysql_library_end();
+
+	printf("all done\n");
+
+	return 0;
+}
@@ -0,0 +1,300 @@
+#include <libavutil/frame.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <stdarg.h>
+#include "codeclib.h"
+#include "fix_frame_channel_layout.h"
+#include "../recording-daemon/mix.h"
+#include "../recording-daemon/main.h"
+
+// Checks the samples produced by the built-in mixer for both mixing methods,
+// directly and with the frames handed over to mixing threads, then mixes the
+// same calls through the built-in mixer, through the amix filter graph and
+// through the mixing threads and prints the time spent per input frame.
+
+#define CLOCKRATE 8000
+#define PTIME 160
+#define CHECK_FRAMES 500
+#define BENCH_MIXES 100
+#define BENCH_FRAMES 1500 // 30 seconds
+#define MIX_THREADS 4
+#define SYNC_FRAMES 32 // less than the queue of a mixer input holds
+
+enum mix_method mix_method;
+int mix_filter;
+int mix_threads = MIX_THREADS;
+
+static int out_channels;
+static int16_t out_buf[CHECK_FRAMES * PTIME * MIX_NUM_INPUTS];
+static unsigned int out_samples;
+
+void (__ilog)(int prio, const char *fmt, ...) {
+	if (prio > LOG_WARN)
+		return;
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+}
+
+int output_add(output_t *output, AVFrame *frame) {
+	assert(frame->format == AV_SAMPLE_FMT_S16);
+	if (!out_channels) {
+		// benchmark: just count, possibly from several mixing threads
+		__atomic_add_fetch(&out_samples, frame->nb_samples, __ATOMIC_RELAXED);
+		return 0;
+	}
+	assert(out_samples + frame->nb_samples <= CHECK_FRAMES * PTIME);
+	memcpy(out_buf + out_samples * out_channels, frame->extended_data[0],
+			frame->nb_samples * out_channels * sizeof(int16_t));
+	out_samples += frame->nb_samples;
+	return 0;
+}
+
+static AVFrame *const_frame(int16_t val, uint64_t pts) {
+	AVFrame *f = av_frame_alloc();
+	f->nb_samples = PTIME;
+	f->format = AV_SAMPLE_FMT_S16;
+	f->sample_rate = CLOCKRATE;
+	DEF_CH_LAYOUT(&f->CH_LAYOUT, 1);
+	f->pts = pts;
+	int ret = av_frame_get_buffer(f, 0);
+	assert(ret == 0);
+	int16_t *s = (int16_t *) f->extended_data[0];
+	for (int i = 0; i < PTIME; i++)
+		s[i] = val;
+	return f;
+}
+
+static int16_t input_val(unsigned int input, unsigned int frame) {
+	if (frame < CHECK_FRAMES / 2)
+		return input ? 2000 : 1000;
+	if (frame < CHECK_FRAMES * 4 / 5)
+		return 20000;
+	return -20000;
+}
+
+static void check(enum mix_method method, int queued) {
+	printf("checking built-in mixer, method %i%s\n", method, queued ? ", mixing threads" : "");
+
+	mix_method = method;
+	mix_filter = 0;
+	out_channels = method == MM_CHANNELS ? MIX_NUM_INPUTS : 1;
+	out_samples = 0;
+
+	format_t fmt = {
+		.clockrate = CLOCKRATE,
+		.channels = 1,
+		.format = AV_SAMPLE_FMT_S16,
+	};
+	mix_t *mix = mix_new(NULL);
+	int ret = mix_config(mix, &fmt);
+	assert(ret == 0);
+
+	int a, b;
+	if (queued) {
+		// the inputs get the first two indexes
+		mix_input_t *in_a = mix_input_new(mix, &a, &fmt);
+		mix_input_t *in_b = mix_input_new(mix, &b, &fmt);
+
+		for (unsigned int i = 0; i < CHECK_FRAMES; i++) {
+			AVFrame *f = const_frame(input_val(0, i), i * PTIME);
+			mix_input_push(in_a, f);
+			av_frame_free(&f);
+			f = const_frame(input_val(1, i), i * PTIME);
+			mix_input_push(in_b, f);
+			av_frame_free(&f);
+			// the mixer must see the second input start one frame late,
+			// and not later
+			if (i == 0 || i % SYNC_FRAMES == SYNC_FRAMES - 1)
+				mix_sync(mix);
+		}
+		mix_sync(mix);
+	}
+	else {
+		unsigned int idx_a = mix_get_index(mix, &a);
+		unsigned int idx_b = mix_get_index(mix, &b);
+		assert(idx_a == 0 && idx_b == 1);
+
+		for (unsigned int i = 0; i < CHECK_FRAMES; i++) {
+			ret = mix_add(mix, const_frame(input_val(0, i), i * PTIME), idx_a, &a, NULL);
+			assert(ret == 0);
+			ret = mix_add(mix, const_frame(input_val(1, i), i * PTIME), idx_b, &b, NULL);
+			assert(ret == 0);
+		}
+	}
+
+	// the second input starts one frame late, the unused inputs hold the output
+	// back by half a second
+	printf("received samples %u\n", out_samples);
+	assert(out_samples == CHECK_FRAMES * PTIME + PTIME - CLOCKRATE / 2);
+
+	for (unsigned int p = 0; p < out_samples; p++) {
+		int32_t va = input_val(0, p / PTIME);
+		int32_t vb = p >= PTIME ? input_val(1, (p - PTIME) / PTIME) : 0;
+		int16_t *s = out_buf + p * out_channels;
+		if (method == MM_CHANNELS) {
+			assert(s[0] == va);
+			assert(s[1] == vb);
+			assert(s[2] == 0);
+			assert(s[3] == 0);
+		}
+		else {
+			int32_t exp = va + vb;
+			if (exp > INT16_MAX)
+				exp = INT16_MAX;
+			if (exp < INT16_MIN)
+				exp = INT16_MIN;
+			assert(s[0] == exp);
+		}
+	}
+
+	mix_destroy(mix);
+	out_channels = 0;
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bench(int filter) {
+	mix_method = MM_DIRECT;
+	mix_filter = filter;
+	out_samples = 0;
+
+	format_t fmt = {
+		.clockrate = CLOCKRATE,
+		.channels = 1,
+		.format = AV_SAMPLE_FMT_S16,
+	};
+	mix_t *mixes[BENCH_MIXES];
+	for (unsigned int i = 0; i < BENCH_MIXES; i++) {
+		mixes[i] = mix_new(NULL);
+		int ret = mix_config(mixes[i], &fmt);
+		assert(ret == 0);
+		mix_get_index(mixes[i], &mixes[i]);
+		mix_get_index(mixes[i], mixes[i]);
+	}
+
+	AVFrame *tmpl[2];
+	for (unsigned int i = 0; i < 2; i++) {
+		tmpl[i] = const_frame(0, 0);
+		int16_t *s = (int16_t *) tmpl[i]->extended_data[0];
+		for (int j = 0; j < PTIME; j++)
+			s[j] = lrint(12000.0 * sin(2.0 * M_PI * (i + 1) * 400.0 * j / CLOCKRATE));
+	}
+
+	long long start = now_ns();
+	for (unsigned int f = 0; f < BENCH_FRAMES; f++) {
+		for (unsigned int i = 0; i < BENCH_MIXES; i++) {
+			AVFrame *fr = av_frame_clone(tmpl[0]);
+			fr->pts = f * PTIME;
+			mix_add(mixes[i], fr, 0, &mixes[i], NULL);
+			fr = av_frame_clone(tmpl[1]);
+			fr->pts = f * PTIME;
+			mix_add(mixes[i], fr, 1, mixes[i], NULL);
+		}
+	}
+	long long dur = now_ns() - start;
+
+	printf("%s: %u frames, %u samples out, %lld ns per frame\n",
+			filter ? "amix filter graph" : "built-in mixer",
+			BENCH_MIXES * BENCH_FRAMES * 2, out_samples,
+			dur / (BENCH_MIXES * BENCH_FRAMES * 2));
+
+	if (!filter)
+		assert(out_samples == BENCH_MIXES * (BENCH_FRAMES * PTIME + PTIME - CLOCKRATE / 2));
+	else
+		assert(out_samples > 0);
+
+	for (unsigned int i = 0; i < BENCH_MIXES; i++)
+		mix_destroy(mixes[i]);
+	av_frame_free(&tmpl[0]);
+	av_frame_free(&tmpl[1]);
+}
+
+// the decoders push their frames and the mixing threads mix them. reports the
+// time spent by the decoders and the total time until everything is mixed
+static void bench_threads(void) {
+	mix_method = MM_DIRECT;
+	mix_filter = 0;
+	out_samples = 0;
+
+	format_t fmt = {
+		.clockrate = CLOCKRATE,
+		.channels = 1,
+		.format = AV_SAMPLE_FMT_S16,
+	};
+	mix_t *mixes[BENCH_MIXES];
+	mix_input_t *ins[BENCH_MIXES][2];
+	for (unsigned int i = 0; i < BENCH_MIXES; i++) {
+		mixes[i] = mix_new(NULL);
+		ins[i][0] = mix_input_new(mixes[i], &ins[i][0], &fmt);
+		ins[i][1] = mix_input_new(mixes[i], &ins[i][1], &fmt);
+	}
+
+	AVFrame *tmpl[2];
+	for (unsigned int i = 0; i < 2; i++) {
+		tmpl[i] = const_frame(0, 0);
+		int16_t *s = (int16_t *) tmpl[i]->extended_data[0];
+		for (int j = 0; j < PTIME; j++)
+			s[j] = lrint(12000.0 * sin(2.0 * M_PI * (i + 1) * 400.0 * j / CLOCKRATE));
+	}
+
+	long long push = 0;
+	long long start = now_ns();
+	for (unsigned int f = 0; f < BENCH_FRAMES; f++) {
+		long long push_start = now_ns();
+		for (unsigned int i = 0; i < BENCH_MIXES; i++) {
+			for (unsigned int j = 0; j < 2; j++) {
+				tmpl[j]->pts = f * PTIME;
+				mix_input_push(ins[i][j], tmpl[j]);
+			}
+		}
+		push += now_ns() - push_start;
+		if (f == 0 || f % SYNC_FRAMES == SYNC_FRAMES - 1) {
+			for (unsigned int i = 0; i < BENCH_MIXES; i++)
+				mix_sync(mixes[i]);
+		}
+	}
+	for (unsigned int i = 0; i < BENCH_MIXES; i++)
+		mix_sync(mixes[i]);
+	long long dur = now_ns() - start;
+
+	printf("built-in mixer, %u mixing threads: %u frames, %u samples out, %lld ns per frame "
+			"in decoders, %lld ns per frame until mixed\n",
+			MIX_THREADS, BENCH_MIXES * BENCH_FRAMES * 2, out_samples,
+			push / (BENCH_MIXES * BENCH_FRAMES * 2),
+			dur / (BENCH_MIXES * BENCH_FRAMES * 2));
+
+	assert(out_samples == BENCH_MIXES * (BENCH_FRAMES * PTIME + PTIME - CLOCKRATE / 2));
+
+	for (unsigned int i = 0; i < BENCH_MIXES; i++)
+		mix_destroy(mixes[i]);
+	av_frame_free(&tmpl[0]);
+	av_frame_free(&tmpl[1]);
+}
+
+int main(void) {
+	codeclib_init(0);
+
+	check(MM_DIRECT, 0);
+	check(MM_CHANNELS, 0);
+
+	bench(1);
+	bench(0);
+
+	mix_threads_start();
+	check(MM_DIRECT, 1);
+	check(MM_CHANNELS, 1);
+	bench_threads();
+	mix_cleanup();
+
+	printf("all done\n");
+
+	return 0;
+}
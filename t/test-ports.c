@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "media_socket.h"
+#include "iptables.h"
+#include "poller.h"
+#include "control_ng.h"
+#include "main.h"
+
+// Without arguments, allocates RTP/RTCP port pairs on a small range with most
+// of it excluded and checks the results: even/odd pairing, search wraparound,
+// exhaustion of the range and refilling of the socket pool.
+//
+// With "bench" as argument (see `make bench-ports`), allocates and releases
+// 30000 pairs on an interface with 90% of its range in use, first by binding
+// on demand and then from the socket pool, and prints the average time per
+// allocation.
+
+#define TEST_PORT_MIN 30000
+#define TEST_PORT_MAX 30399
+#define TEST_FREE_EVERY 4 // one pair out of every four is left free
+#define TEST_POOL_PAIRS 16
+#define TEST_POOL_ROUNDS 5
+
+#define BENCH_PORT_MIN 20000
+#define BENCH_PORT_MAX 59999
+#define BENCH_FREE_EVERY 10
+#define BENCH_POOL_PAIRS 500
+#define BENCH_PAIRS 30000
+
+int _log_facility_rtcp;
+int _log_facility_cdr;
+int _log_facility_dtmf;
+struct rtpengine_config rtpe_config = {
+	.dtls_rsa_key_size = 2048,
+};
+struct rtpengine_config initial_rtpe_config;
+struct poller *rtpe_poller;
+struct poller_map *rtpe_poller_map;
+GString *dtmf_logs;
+struct control_ng *rtpe_control_ng[2];
+
+static unsigned int port_min, port_max, free_every;
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool excluded(unsigned int port) {
+	return (port / 2) % free_every != 0;
+}
+
+// returns NULL if no pair was available, adds the time spent in
+// __get_consecutive_ports() to *dur if given
+static struct intf_list *get_pair(const struct local_intf *loc, long long *dur) {
+	str label = STR_CONST_INIT("test-ports");
+	struct intf_list *il = g_slice_alloc0(sizeof(*il));
+	il->local_intf = loc;
+
+	long long start = now_ns();
+	int ret = __get_consecutive_ports(&il->list, 2, 0, loc->spec, &label);
+	if (dur)
+		*dur += now_ns() - start;
+
+	if (ret) {
+		if (il->list.length)
+			abort();
+		g_slice_free1(sizeof(*il), il);
+		return NULL;
+	}
+
+	if (il->list.length != 2)
+		abort();
+	socket_t *a = il->list.head->data;
+	socket_t *b = il->list.tail->data;
+	if ((a->local.port & 1) || b->local.port != a->local.port + 1)
+		abort();
+	if (a->local.port < port_min || b->local.port > port_max || excluded(a->local.port))
+		abort();
+
+	return il;
+}
+
+static unsigned int pair_port(struct intf_list *il) {
+	socket_t *a = il->list.head->data;
+	return a->local.port;
+}
+
+static void put_pair(struct intf_list *il) {
+	if (!il)
+		abort();
+	free_socket_intf_list(il);
+	release_closed_sockets();
+}
+
+static void *pool_thread(void *p) {
+	port_pool_loop(p);
+	return NULL;
+}
+
+static void wait_pool_full(struct port_pool *pp) {
+	for (unsigned int i = 0; i < 10000; i++) {
+		if (g_atomic_int_get(&pp->num_pooled) >= rtpe_config.socket_pool * 2)
+			return;
+		usleep(1000);
+	}
+	printf("socket pool wasn't refilled\n");
+	abort();
+}
+
+// takes all free pairs and checks that each one is handed out exactly once
+static void get_all_pairs(const struct local_intf *loc, struct intf_list **pairs, unsigned int num) {
+	bool seen[TEST_PORT_MAX - TEST_PORT_MIN + 1] = {0};
+
+	for (unsigned int i = 0; i < num; i++) {
+		pairs[i] = get_pair(loc, NULL);
+		if (!pairs[i]) {
+			printf("only got %u out of %u pairs\n", i, num);
+			abort();
+		}
+		unsigned int port = pair_port(pairs[i]);
+		if (seen[port - port_min])
+			abort();
+		seen[port - port_min] = true;
+	}
+
+	// range is exhausted
+	if (get_pair(loc, NULL))
+		abort();
+}
+
+static void test(const struct local_intf *loc) {
+	struct port_pool *pp = &loc->spec->port_pool;
+	const unsigned int num_pairs = (port_max - port_min + 1) / 2 / free_every;
+	struct intf_list *pairs[num_pairs];
+
+	// pool is empty while its thread isn't running: every pair is bound on demand
+	get_all_pairs(loc, pairs, num_pairs);
+	if (g_atomic_int_get(&pp->free_ports) != (port_max - port_min + 1) - num_pairs * 2)
+		abort();
+
+	// the only free pair is below the search position: the search must wrap around
+	unsigned int lowest = pair_port(pairs[0]);
+	for (unsigned int i = 1; i < num_pairs; i++) {
+		if (pair_port(pairs[i]) < lowest)
+			lowest = pair_port(pairs[i]);
+	}
+	for (unsigned int i = 0; i < num_pairs; i++) {
+		if (pair_port(pairs[i]) != lowest)
+			continue;
+		put_pair(pairs[i]);
+		// close enough to the end for the search to start past the pair even
+		// with the random offset added, but still inside the range
+		g_atomic_int_set(&pp->last_used, port_max - 32);
+		pairs[i] = get_pair(loc, NULL);
+		if (!pairs[i] || pair_port(pairs[i]) != lowest)
+			abort();
+		break;
+	}
+
+	for (unsigned int i = 0; i < num_pairs; i++)
+		put_pair(pairs[i]);
+	if (g_atomic_int_get(&pp->free_ports) != port_max - port_min + 1)
+		abort();
+
+	GThread *thr = g_thread_new("socket pool", pool_thread, NULL);
+
+	// drain the pool, wait for the refill, repeat
+	for (unsigned int round = 0; round < TEST_POOL_ROUNDS; round++) {
+		wait_pool_full(pp);
+
+		// pooled pairs are handed out before any others. the pool isn't refilled
+		// while it's full, so what's pooled now is what the next pair comes from
+		bool pooled[TEST_PORT_MAX - TEST_PORT_MIN + 1];
+		for (unsigned int port = port_min; port <= port_max; port++)
+			pooled[port - port_min] = bit_array_isset(pp->pooled, port);
+		struct intf_list *il = get_pair(loc, NULL);
+		if (!il || !pooled[pair_port(il) - port_min])
+			abort();
+		put_pair(il);
+
+		for (unsigned int i = 1; i < rtpe_config.socket_pool; i++)
+			put_pair(get_pair(loc, NULL));
+	}
+
+	wait_pool_full(pp);
+	rtpe_shutdown = 1;
+	g_thread_join(thr);
+
+	// pooled pairs count towards the range
+	get_all_pairs(loc, pairs, num_pairs);
+	if (g_atomic_int_get(&pp->num_pooled) != 0)
+		abort();
+	for (unsigned int i = 0; i < num_pairs; i++)
+		put_pair(pairs[i]);
+
+	// and the pool recovers once they're released
+	rtpe_shutdown = 0;
+	thr = g_thread_new("socket pool", pool_thread, NULL);
+	wait_pool_full(pp);
+	rtpe_shutdown = 1;
+	g_thread_join(thr);
+
+	printf("%u pairs on %u ports checked\n", num_pairs, port_max - port_min + 1);
+}
+
+static void bench(const struct local_intf *loc) {
+	struct port_pool *pp = &loc->spec->port_pool;
+
+	long long total = 0;
+	for (unsigned int i = 0; i < BENCH_PAIRS; i++)
+		put_pair(get_pair(loc, &total));
+	printf("bound on demand: %u pairs, %lld ns per pair\n", BENCH_PAIRS, total / BENCH_PAIRS);
+
+	GThread *thr = g_thread_new("socket pool", pool_thread, NULL);
+
+	// drain the pool, wait for the refill, repeat
+	total = 0;
+	for (unsigned int i = 0; i < BENCH_PAIRS; i++) {
+		if (i % BENCH_POOL_PAIRS == 0)
+			wait_pool_full(pp);
+		put_pair(get_pair(loc, &total));
+	}
+	printf("from socket pool: %u pairs, %lld ns per pair\n", BENCH_PAIRS, total / BENCH_PAIRS);
+
+	rtpe_shutdown = 1;
+	g_thread_join(thr);
+}
+
+int main(int argc, char **argv) {
+	rtpe_common_config_ptr = &rtpe_config.common;
+
+	bool do_bench = argc > 1 && !strcmp(argv[1], "bench");
+	if (do_bench) {
+		port_min = BENCH_PORT_MIN;
+		port_max = BENCH_PORT_MAX;
+		free_every = BENCH_FREE_EVERY;
+		rtpe_config.socket_pool = BENCH_POOL_PAIRS;
+	}
+	else {
+		port_min = TEST_PORT_MIN;
+		port_max = TEST_PORT_MAX;
+		free_every = TEST_FREE_EVERY;
+		rtpe_config.socket_pool = TEST_POOL_PAIRS;
+	}
+
+	// the pool and the pairs in use need about 1000 descriptors
+	struct rlimit rl;
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	socket_init();
+	iptables_init();
+
+	struct intf_config ifa = {
+		.name = STR_CONST_INIT("default"),
+		.name_base = STR_CONST_INIT("default"),
+		.port_min = port_min,
+		.port_max = port_max,
+	};
+	if (sockaddr_parse_any(&ifa.local_address.addr, "127.0.0.1"))
+		abort();
+	ifa.local_address.type = socktype_udp;
+	ifa.advertised_address = ifa.local_address;
+
+	GQueue intfs = G_QUEUE_INIT;
+	g_queue_push_tail(&intfs, &ifa);
+	interfaces_init(&intfs);
+
+	sockfamily_t *fam = get_socket_family_enum(SF_IP4);
+	struct logical_intf *lif = get_logical_interface(NULL, fam, 0);
+	const struct local_intf *loc = get_interface_address(lif, fam);
+	struct port_pool *pp = &loc->spec->port_pool;
+
+	for (unsigned int port = port_min; port <= port_max; port++) {
+		if (excluded(port))
+			interfaces_exclude_port(port);
+	}
+
+	if (do_bench)
+		bench(loc);
+	else
+		test(loc);
+
+	if (g_atomic_int_get(&pp->free_ports) != (port_max - port_min + 1))
+		abort();
+
+	interfaces_free();
+
+	printf("all done\n");
+
+	return 0;
+}
@@ -1,6 +1,8 @@
 #include <libavutil/frame.h>
 #include <libavutil/opt.h>
 #include <assert.h>
+#include <math.h>
+#include <time.h>
 #include "resample.h"
 #include "codeclib.h"
 
@@ -41,15 +43,206 @@ void test_1(int in_samples, int in_format, int in_rate, int in_channels, bool no
 	resample_shutdown(&resampler);
 }
 
+static AVFrame *sine_frame(int samples, int rate, int64_t pts) {
+	AVFrame *f = av_frame_alloc();
+	f->nb_samples = samples;
+	f->format = AV_SAMPLE_FMT_S16;
+	f->sample_rate = rate;
+	f->channel_layout = av_get_default_channel_layout(1);
+	f->pts = pts;
+	int ret = av_frame_get_buffer(f, 0);
+	assert(ret == 0);
+	int16_t *s = (int16_t *) f->extended_data[0];
+	for (int i = 0; i < samples; i++)
+		s[i] = lrint(16000.0 * sin(2.0 * M_PI * 1000.0 * (pts + i) / rate));
+	return f;
+}
+
+// resamples 1 second of a 1 kHz tone in 20 ms frames and compares the output against
+// an ideal tone at the output rate. Only the built-in resampler is held to a minimum.
+static void test_quality(int in_rate, int out_rate, bool fast) {
+	resample_fast_path = fast;
+
+	resample_t resampler;
+	ZERO(resampler);
+	format_t out_fmt = {
+		.channels = 1,
+		.clockrate = out_rate,
+		.format = AV_SAMPLE_FMT_S16,
+	};
+
+	int in_samples = in_rate / 50;
+	int16_t *out = malloc(out_rate * 2 * sizeof(*out));
+	int out_samples = 0;
+
+	for (int i = 0; i < 50; i++) {
+		AVFrame *in_f = sine_frame(in_samples, in_rate, i * in_samples);
+		AVFrame *out_f = resample_frame(&resampler, in_f, &out_fmt);
+		assert(out_f != NULL);
+		memcpy(out + out_samples, out_f->extended_data[0], out_f->nb_samples * sizeof(*out));
+		out_samples += out_f->nb_samples;
+		av_frame_free(&in_f);
+		av_frame_free(&out_f);
+	}
+
+	// skip the filter start-up and the end
+	double signal = 0, noise = 0;
+	for (int i = out_rate / 100; i < out_samples - out_rate / 100; i++) {
+		double ref = 16000.0 * sin(2.0 * M_PI * 1000.0 * i / out_rate);
+		signal += ref * ref;
+		noise += (out[i] - ref) * (out[i] - ref);
+	}
+	double snr = 10.0 * log10(signal / noise);
+
+	printf("quality %i -> %i (%s): %i samples, SNR %.1f dB\n", in_rate, out_rate,
+			fast ? "built-in" : "swresample", out_samples, snr);
+	if (fast)
+		assert(snr >= 60);
+
+	free(out);
+	resample_shutdown(&resampler);
+	resample_fast_path = 0;
+}
+
+static void test_throughput(int in_rate, int out_rate, bool fast) {
+	resample_fast_path = fast;
+
+	resample_t resampler;
+	ZERO(resampler);
+	format_t out_fmt = {
+		.channels = 1,
+		.clockrate = out_rate,
+		.format = AV_SAMPLE_FMT_S16,
+	};
+
+	int in_samples = in_rate / 50;
+	AVFrame *in_f = sine_frame(in_samples, in_rate, 0);
+	const int iterations = 20000;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < iterations; i++) {
+		in_f->pts = (int64_t) i * in_samples;
+		AVFrame *out_f = resample_frame(&resampler, in_f, &out_fmt);
+		assert(out_f != NULL);
+		av_frame_free(&out_f);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	long long ns = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+	printf("throughput %i -> %i (%s): %lli ns per 20 ms frame\n", in_rate, out_rate,
+			fast ? "built-in" : "swresample", ns / iterations);
+
+	av_frame_free(&in_f);
+	resample_shutdown(&resampler);
+	resample_fast_path = 0;
+}
+
+static int pool_decoded(decoder_t *dec, AVFrame *frame, void *u1, void *u2) {
+	int *frames = u1;
+	(*frames)++;
+	av_frame_free(&frame);
+	return 0;
+}
+
+// decodes and resamples 50 frames and checks that the frames and sample buffers are
+// recycled instead of being allocated for each one
+static void test_pools(void) {
+	const int num = 50;
+	struct codeclib_frame_stats before = codeclib_frame_stats;
+
+	str pcma = STR_CONST_INIT("PCMA");
+	const codec_def_t *def = codec_find(&pcma, MT_AUDIO);
+	assert(def != NULL);
+	format_t dec_fmt = {
+		.channels = 1,
+		.clockrate = 8000,
+		.format = AV_SAMPLE_FMT_S16,
+	};
+	decoder_t *dec = decoder_new_fmt(def, 8000, 1, 20, &dec_fmt);
+	assert(dec != NULL);
+	char payload[160];
+	memset(payload, 0xd5, sizeof(payload));
+	str data = STR_CONST_INIT_LEN(payload, sizeof(payload));
+	int decoded = 0;
+	for (int i = 0; i < num; i++) {
+		int ret = decoder_input_data(dec, &data, i * 160, pool_decoded, &decoded, NULL);
+		assert(ret == 0);
+	}
+	decoder_close(dec);
+
+	uint64_t frame_allocs = codeclib_frame_stats.frame_allocs - before.frame_allocs;
+	uint64_t frame_reuses = codeclib_frame_stats.frame_reuses - before.frame_reuses;
+	printf("decoder: %i frames out, %llu frames allocated, %llu recycled\n", decoded,
+			(unsigned long long) frame_allocs, (unsigned long long) frame_reuses);
+	assert(decoded == num);
+	// only the first packet allocates
+	assert(frame_allocs <= 2);
+	assert(frame_reuses >= num - 1);
+
+	// swresample output, with the previous frame still held when the next one is made
+	before = codeclib_frame_stats;
+	resample_t resampler;
+	ZERO(resampler);
+	format_t out_fmt = {
+		.channels = 1,
+		.clockrate = 16000,
+		.format = AV_SAMPLE_FMT_S16,
+	};
+	AVFrame *prev = NULL;
+	for (int i = 0; i < num; i++) {
+		AVFrame *in_f = sine_frame(160, 8000, i * 160);
+		AVFrame *out_f = resample_frame(&resampler, in_f, &out_fmt);
+		assert(out_f != NULL);
+		av_frame_free(&in_f);
+		av_frame_free(&prev);
+		prev = out_f;
+	}
+	av_frame_free(&prev);
+	resample_shutdown(&resampler);
+
+	uint64_t buffer_allocs = codeclib_frame_stats.buffer_allocs - before.buffer_allocs;
+	uint64_t buffer_gets = codeclib_frame_stats.buffer_gets - before.buffer_gets;
+	printf("resampler: %llu buffers handed out, %llu allocated\n",
+			(unsigned long long) buffer_gets, (unsigned long long) buffer_allocs);
+	assert(buffer_gets == num);
+	// two in use at a time, plus one pool resize if the output grows past the headroom
+	assert(buffer_allocs <= 4);
+}
+
 int main(void) {
 	codeclib_init(0);
 
+	test_pools();
+
 	test_1(320, AV_SAMPLE_FMT_S16, 16000, 1, false, AV_SAMPLE_FMT_S16, 8000, 1, 144);
 	test_1(160, AV_SAMPLE_FMT_S16, 8000, 1, false, AV_SAMPLE_FMT_S16, 16000, 1, 288);
 
 	test_1(320, AV_SAMPLE_FMT_S16, 16000, 1, true, AV_SAMPLE_FMT_S16, 8000, 1, 160);
 	test_1(160, AV_SAMPLE_FMT_S16, 8000, 1, true, AV_SAMPLE_FMT_S16, 16000, 1, 320);
 
+	// built-in resampler must produce the same number of samples as swresample
+	resample_fast_path = 1;
+	test_1(320, AV_SAMPLE_FMT_S16, 16000, 1, false, AV_SAMPLE_FMT_S16, 8000, 1, 144);
+	test_1(160, AV_SAMPLE_FMT_S16, 8000, 1, false, AV_SAMPLE_FMT_S16, 16000, 1, 288);
+	test_1(960, AV_SAMPLE_FMT_S16, 48000, 1, false, AV_SAMPLE_FMT_S16, 8000, 1, 144);
+	test_1(160, AV_SAMPLE_FMT_S16, 8000, 1, false, AV_SAMPLE_FMT_S16, 48000, 1, 864);
+	resample_fast_path = 0;
+
+	static const int rates[][2] = {
+		{ 16000, 8000 }, { 8000, 16000 },
+		{ 48000, 16000 }, { 16000, 48000 },
+		{ 48000, 8000 }, { 8000, 48000 },
+	};
+	for (int i = 0; i < G_N_ELEMENTS(rates); i++) {
+		test_quality(rates[i][0], rates[i][1], false);
+		test_quality(rates[i][0], rates[i][1], true);
+	}
+	for (int i = 0; i < G_N_ELEMENTS(rates); i++) {
+		test_throughput(rates[i][0], rates[i][1], false);
+		test_throughput(rates[i][0], rates[i][1], true);
+	}
+
 	return 0;
 }
 
@@ -6,6 +6,7 @@
 #include "control_ng.h"
 #include "call_interfaces.h"
 #include "ssllib.h"
+#include "kernel.h"
 
 int _log_facility_rtcp;
 int _log_facility_cdr;
@@ -57,6 +58,32 @@ static void __assert_metrics_eq(GQueue *q, const char *b, unsigned int line) {
 }
 #define assert_metrics_eq(a, b) __assert_metrics_eq(a, b, __LINE__)
 
+// like assert_metrics_eq, but only compares the metrics from the one labelled `from` up to
+// (not including) the one labelled `to`
+static void __assert_metrics_range_eq(GQueue *q, const char *from, const char *to, const char *b,
+		unsigned int line)
+{
+	GQueue *range = g_queue_new();
+	int in_range = 0;
+	GList *l = q->head;
+	while (l) {
+		GList *next = l->next;
+		struct stats_metric *m = l->data;
+		if (m->label && !strcmp(m->label, from))
+			in_range = 1;
+		else if (m->label && !strcmp(m->label, to))
+			in_range = 0;
+		if (in_range) {
+			g_queue_push_tail(range, m);
+			g_queue_delete_link(q, l);
+		}
+		l = next;
+	}
+	statistics_free_metrics(&q);
+	__assert_metrics_eq(range, b, line);
+}
+#define assert_metrics_range_eq(q, from, to, b) __assert_metrics_range_eq(q, from, to, b, __LINE__)
+
 int main(void) {
 	rtpe_common_config_ptr = &rtpe_config.common;
 
@@ -467,6 +494,22 @@ int main(void) {
 			"totalcallsduration_stddev\n"
 			"0.000000 seconds\n"
 			"0.000000\n"
+			"Total audio frames allocated for transcoding\n"
+			"transcodeframeallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio frames recycled for transcoding\n"
+			"transcodeframereuses\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers allocated for transcoding\n"
+			"transcodebufferallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers recycled for transcoding\n"
+			"transcodebufferreuses\n"
+			"0\n"
+			"0\n"
 			"\n"
 			"\n"
 			"}\n"
@@ -1094,6 +1137,11 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codeccosts\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 	RTPE_STATS_INC(ng_commands[NGC_OFFER]);
@@ -1495,6 +1543,22 @@ int main(void) {
 			"totalcallsduration_stddev\n"
 			"0.000000 seconds\n"
 			"0.000000\n"
+			"Total audio frames allocated for transcoding\n"
+			"transcodeframeallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio frames recycled for transcoding\n"
+			"transcodeframereuses\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers allocated for transcoding\n"
+			"transcodebufferallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers recycled for transcoding\n"
+			"transcodebufferreuses\n"
+			"0\n"
+			"0\n"
 			"\n"
 			"\n"
 			"}\n"
@@ -2122,6 +2186,11 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codeccosts\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 	RTPE_STATS_INC(ng_commands[NGC_ANSWER]);
@@ -2520,6 +2589,22 @@ int main(void) {
 			"totalcallsduration_stddev\n"
 			"0.000000 seconds\n"
 			"0.000000\n"
+			"Total audio frames allocated for transcoding\n"
+			"transcodeframeallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio frames recycled for transcoding\n"
+			"transcodeframereuses\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers allocated for transcoding\n"
+			"transcodebufferallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers recycled for transcoding\n"
+			"transcodebufferreuses\n"
+			"0\n"
+			"0\n"
 			"\n"
 			"\n"
 			"}\n"
@@ -3147,6 +3232,11 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codeccosts\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 	// test cmd_ps_min/max/avg
@@ -3558,6 +3648,22 @@ int main(void) {
 			"totalcallsduration_stddev\n"
 			"0.000000 seconds\n"
 			"0.000000\n"
+			"Total audio frames allocated for transcoding\n"
+			"transcodeframeallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio frames recycled for transcoding\n"
+			"transcodeframereuses\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers allocated for transcoding\n"
+			"transcodebufferallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers recycled for transcoding\n"
+			"transcodebufferreuses\n"
+			"0\n"
+			"0\n"
 			"\n"
 			"\n"
 			"}\n"
@@ -4185,6 +4291,11 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codeccosts\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 	// test average call duration
@@ -4591,6 +4702,22 @@ int main(void) {
 			"totalcallsduration_stddev\n"
 			"0.000000 seconds\n"
 			"0.000000\n"
+			"Total audio frames allocated for transcoding\n"
+			"transcodeframeallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio frames recycled for transcoding\n"
+			"transcodeframereuses\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers allocated for transcoding\n"
+			"transcodebufferallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers recycled for transcoding\n"
+			"transcodebufferreuses\n"
+			"0\n"
+			"0\n"
 			"\n"
 			"\n"
 			"}\n"
@@ -5218,6 +5345,11 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codeccosts\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 
@@ -5619,6 +5751,22 @@ int main(void) {
 			"totalcallsduration_stddev\n"
 			"0.000000 seconds\n"
 			"0.000000\n"
+			"Total audio frames allocated for transcoding\n"
+			"transcodeframeallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio frames recycled for transcoding\n"
+			"transcodeframereuses\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers allocated for transcoding\n"
+			"transcodebufferallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers recycled for transcoding\n"
+			"transcodebufferreuses\n"
+			"0\n"
+			"0\n"
 			"\n"
 			"\n"
 			"}\n"
@@ -6246,6 +6394,11 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codeccosts\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 
@@ -6649,6 +6802,22 @@ int main(void) {
 			"totalcallsduration_stddev\n"
 			"50.000000 seconds\n"
 			"50.000000\n"
+			"Total audio frames allocated for transcoding\n"
+			"transcodeframeallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio frames recycled for transcoding\n"
+			"transcodeframereuses\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers allocated for transcoding\n"
+			"transcodebufferallocs\n"
+			"0\n"
+			"0\n"
+			"Total audio sample buffers recycled for transcoding\n"
+			"transcodebufferreuses\n"
+			"0\n"
+			"0\n"
 			"\n"
 			"\n"
 			"}\n"
@@ -7276,9 +7445,229 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codeccosts\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 
+	// the kernel delay statistics are only shown with the kernel module in use.
+	// the module's per-stream histograms are summed up as in the call timer, twice
+	// to see that only the differences are added
+
+	kernel.is_open = 1;
+	struct packet_stream kps = {0};
+	struct rtpengine_stats kst = {0};
+	kst.delay_hist[0] = 2;
+	kst.delay_hist[3] = 4;
+	kst.delay_hist_sum = 50;
+	call_kernel_delay_stats(&kps, &kst);
+	kst.delay_hist[0] = 5;
+	kst.delay_hist[10] = 1;
+	kst.delay_hist_sum = 1553;
+	call_kernel_delay_stats(&kps, &kst);
+
+	stats = statistics_gather_metrics();
+	assert_metrics_range_eq(stats, "kerneldelay_p50", "zerowaystreams",
+			"Kernel forwarding delay 50th percentile (us)\n"
+			"kerneldelay_p50\n"
+			"2\n"
+			"2\n"
+			"Kernel forwarding delay 90th percentile (us)\n"
+			"kerneldelay_p90\n"
+			"16\n"
+			"16\n"
+			"Kernel forwarding delay 99th percentile (us)\n"
+			"kerneldelay_p99\n"
+			"2048\n"
+			"2048\n"
+			"Packets with measured kernel forwarding delay\n"
+			"kerneldelay_count\n"
+			"10\n"
+			"10\n"
+			"Sum of kernel forwarding delays\n"
+			"kerneldelay_sum\n"
+			"0.001553 seconds\n"
+			"0.001553\n"
+			"kerneldelay\n"
+			"[\n"
+			"{\n"
+			"le_us\n"
+			"2\n"
+			"packets\n"
+			"5\n"
+			"le=\"0.000002\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"4\n"
+			"packets\n"
+			"5\n"
+			"le=\"0.000004\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"8\n"
+			"packets\n"
+			"5\n"
+			"le=\"0.000008\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"16\n"
+			"packets\n"
+			"9\n"
+			"le=\"0.000016\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"32\n"
+			"packets\n"
+			"9\n"
+			"le=\"0.000032\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"64\n"
+			"packets\n"
+			"9\n"
+			"le=\"0.000064\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"128\n"
+			"packets\n"
+			"9\n"
+			"le=\"0.000128\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"256\n"
+			"packets\n"
+			"9\n"
+			"le=\"0.000256\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"512\n"
+			"packets\n"
+			"9\n"
+			"le=\"0.000512\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"1024\n"
+			"packets\n"
+			"9\n"
+			"le=\"0.001024\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"2048\n"
+			"packets\n"
+			"10\n"
+			"le=\"0.002048\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"4096\n"
+			"packets\n"
+			"10\n"
+			"le=\"0.004096\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"8192\n"
+			"packets\n"
+			"10\n"
+			"le=\"0.008192\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"16384\n"
+			"packets\n"
+			"10\n"
+			"le=\"0.016384\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"32768\n"
+			"packets\n"
+			"10\n"
+			"le=\"0.032768\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"65536\n"
+			"packets\n"
+			"10\n"
+			"le=\"0.065536\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"131072\n"
+			"packets\n"
+			"10\n"
+			"le=\"0.131072\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"262144\n"
+			"packets\n"
+			"10\n"
+			"le=\"0.262144\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"524288\n"
+			"packets\n"
+			"10\n"
+			"le=\"0.524288\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"1048576\n"
+			"packets\n"
+			"10\n"
+			"le=\"1.048576\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"2097152\n"
+			"packets\n"
+			"10\n"
+			"le=\"2.097152\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"4194304\n"
+			"packets\n"
+			"10\n"
+			"le=\"4.194304\"\n"
+			"}\n"
+			"{\n"
+			"le_us\n"
+			"8388608\n"
+			"packets\n"
+			"10\n"
+			"le=\"8.388608\"\n"
+			"}\n"
+			"{\n"
+			"packets\n"
+			"10\n"
+			"le=\"+Inf\"\n"
+			"}\n"
+			"]\n");
+
+	kernel.xdp = 1;
+	stats = statistics_gather_metrics();
+	assert_metrics_range_eq(stats, "kerneldelay_p50", "zerowaystreams", "");
+
+	kernel.xdp = 0;
+	kernel.is_open = 0;
+
 	// cleanup
 
 	statistics_free();
@@ -353,6 +353,25 @@ static void __packet_seq_ts(const char *file, int line, struct call_media *media
 #define packet_seq_nf(side, pt_in, pload, rtp_ts, rtp_seq, pt_out, pload_exp) \
 	packet_seq_ts(side, pt_in, pload, rtp_ts, rtp_seq, pt_out, pload_exp, -1, 0)
 
+#define check_audio_level(side, ssrc, min, max) \
+	__check_audio_level(__FILE__, __LINE__, &ml_ ## side, ssrc, min, max)
+
+static void __check_audio_level(const char *file, int line, struct call_monologue *ml, uint32_t ssrc,
+		int min, int max)
+{
+	printf("running test %s:%i\n", file, line);
+	struct ssrc_entry_call *se = get_ssrc(ssrc, ml->ssrc_hash);
+	assert(se != NULL);
+	if (se->audio_level < min || se->audio_level > max) {
+		printf("test failed: %s:%i\n", file, line);
+		printf("expected: %i..%i\n", min, max);
+		printf("received: %i\n", se->audio_level);
+		abort();
+	}
+	obj_put(&se->h);
+	printf("test ok: %s:%i\n\n", file, line);
+}
+
 static void end(void) {
 	g_hash_table_destroy(rtp_ts_ht);
 	g_hash_table_destroy(rtp_seq_ht);
@@ -1434,6 +1453,37 @@ int main(void) {
 	packet_seq(A, 13, "\x20", 320, 2, 8, "\xf5\x5c\x4b\xc2\xde\xf4\x5e\xd4\x47\x70\x5d\x77\x45\x51\xc5\xcd\xd7\x77\x5a\xf5\xcf\x4a\x4c\x40\xc3\x47\x74\x49\x59\xc4\x76\x57\x71\x57\x40\xc5\xf4\x5a\x47\xd6\xc4\xf6\xc7\xf3\x40\x58\x74\x54\x4b\xd7\x5c\xc7\x41\x49\xf5\x5b\x53\xd9\x70\x44\xcd\xc4\xce\xcb\xc7\x58\xcd\x45\xc6\x71\xf5\x70\x43\xca\x43\xd5\x52\x5c\x75\x74\xc6\xc3\x4f\xda\x56\xc3\x46\xf5\x49\xdf\x56\x4f\x71\x5b\x52\xc6\x4e\xd0\x43\xc2\xcd\xd5\xdf\x40\x43\x4a\xf7\xf6\xd9\xdf\xde\x45\xc9\xd9\xc2\xf0\xc1\x4a\x40\x52\xd1\x5b\xd0\x54\xc9\x5e\xde\xd5\x74\x5c\x5d\x59\x71\xc1\xc1\x71\xd2\xcb\x50\x50\x54\x53\x75\xdc\x4b\xcf\xc2\xd7\x4a\xcc\x58\xc7\xdb\xd8\x48\x4a\xd6\x58\xf0\x46");
 	packet_seq(B, 8, PCMA_silence, 320, 2, 13, "\x40");
 	end();
+	// CN transcoding - silence start and end events
+	start();
+	sdp_pt(8, PCMA, 8000);
+	transcode(CN);
+	offer();
+	expect(B, "8/PCMA/8000 13/CN/8000");
+	sdp_pt(8, PCMA, 8000);
+	sdp_pt(13, CN, 8000);
+	answer();
+	expect(A, "8/PCMA/8000");
+	packet_seq(A, 8, PCMA_silence, 160, 1, 13, "\x40");
+	check_audio_level(A, ssrc_A, 60, 127);
+	packet_seq(A, 8, PCMA_silence, 320, 2, 13, "\x40");
+	packet_seq(A, 8, PCMA_payload, 480, 3, 8, PCMA_payload);
+	check_audio_level(A, ssrc_A, 0, 3);
+	packet_seq(A, 8, PCMA_payload, 640, 4, 8, PCMA_payload);
+	packet_seq(A, 8, PCMA_silence, 800, 5, 13, "\x40");
+	packet_seq(A, 8, PCMA_payload, 960, 6, 8, PCMA_payload);
+	end();
+	// CN transcoding - no CN output, so no silence detection or audio level
+	start();
+	sdp_pt(8, PCMA, 8000);
+	transcode(PCMU);
+	offer();
+	expect(B, "8/PCMA/8000 0/PCMU/8000");
+	sdp_pt(0, PCMU, 8000);
+	answer();
+	packet_seq_nf(A, 8, PCMA_silence, 160, 1, 0, PCMU_silence);
+	packet_seq_nf(A, 8, PCMA_payload, 320, 2, 0, PCMU_payload);
+	check_audio_level(A, ssrc_A, -1, -1);
+	end();
 	// DTMF PT TC
 	start();
 	sdp_pt(9, G722, 8000);
@@ -0,0 +1,55 @@
+#!/bin/bash
+# Runs one of the basic media tests against the XDP data plane, using a veth
+# pair with the test clients in a separate network namespace. Needs root and a
+# daemon built with XDP support. Set XDP_QUEUES=0 to test the forwarding done
+# by the XDP program alone, without the AF_XDP sockets.
+#
+# Usage: $0 [test script]
+# Ex:    $0
+# Ex:    $0 test-basic-ipv4-6.pl
+# Ex:    XDP_QUEUES=0 $0
+
+set -e
+
+TEST=${1:-test-basic-ipv4.pl}
+XDP_QUEUES=${XDP_QUEUES:-1}
+NS=rtpe-xdp-test
+RTPE_BIN=${RTPE_BIN:-../daemon/rtpengine}
+CTL=../utils/rtpengine-ctl
+
+cleanup() {
+	test -n "$RTPE_PID" && kill "$RTPE_PID" 2> /dev/null && wait "$RTPE_PID" || true
+	ip link del rtpe-xdp0 2> /dev/null || true
+	ip netns del "$NS" 2> /dev/null || true
+}
+trap cleanup EXIT
+
+ip netns add "$NS"
+ip link add rtpe-xdp0 type veth peer name rtpe-xdp1
+ip link set rtpe-xdp1 netns "$NS"
+ip addr add 10.99.0.1/24 dev rtpe-xdp0
+ip addr add fd99::1/64 dev rtpe-xdp0 nodad
+ip link set rtpe-xdp0 up
+ip netns exec "$NS" ip addr add 10.99.0.2/24 dev rtpe-xdp1
+ip netns exec "$NS" ip addr add 10.99.0.3/24 dev rtpe-xdp1
+ip netns exec "$NS" ip addr add fd99::2/64 dev rtpe-xdp1 nodad
+ip netns exec "$NS" ip addr add fd99::3/64 dev rtpe-xdp1 nodad
+ip netns exec "$NS" ip link set rtpe-xdp1 up
+ip netns exec "$NS" ip link set lo up
+# native XDP on veth needs GRO on the receiving peer for redirected frames
+ip netns exec "$NS" ethtool -K rtpe-xdp1 gro on > /dev/null 2>&1 || true
+
+"$RTPE_BIN" --foreground --log-stderr --table=-1 --xdp-interface=rtpe-xdp0 --xdp-queues="$XDP_QUEUES" \
+	--interface=10.99.0.1 --interface=fd99::1 \
+	--listen-ng=10.99.0.1:2223 --listen-cli=127.0.0.1:9900 &
+RTPE_PID=$!
+sleep 1
+
+ip netns exec "$NS" env RTPENGINE_HOST=10.99.0.1 RTPENGINE_PORT=2223 \
+	RTPE_TEST_V4_ADDRS="10.99.0.2 10.99.0.3" RTPE_TEST_V6_ADDRS="fd99::2 fd99::3" \
+	perl -I../perl "$TEST"
+
+relayed=$("$CTL" -ip 127.0.0.1 -port 9900 list totals | \
+	awk -F: '/Total relayed packets \(kernel\)/ { gsub(/ /, "", $2); print $2 }')
+echo "packets relayed through XDP: ${relayed:-0}"
+test "${relayed:-0}" -gt 0
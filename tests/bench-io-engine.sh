@@ -0,0 +1,69 @@
+#!/bin/bash
+# Compares the epoll and io_uring media socket engines. Runs the daemon once
+# per engine in userspace-only mode, loads it with simulator-ng.pl and reports
+# the packets relayed per second of daemon CPU time. Needs a daemon built with
+# liburing support.
+#
+# Usage: $0 [number of calls] [runtime in seconds] [extra daemon options...]
+# Ex:    $0
+# Ex:    $0 2000 60 --num-threads=4
+
+set -e
+
+CALLS=${1:-1000}
+RUNTIME=${2:-30}
+shift 2 2> /dev/null || shift $#
+RTPE_BIN=${RTPE_BIN:-../daemon/rtpengine}
+CTL=../utils/rtpengine-ctl
+IP=${IP:-127.0.0.1}
+
+cleanup() {
+	test -n "$RTPE_PID" && kill "$RTPE_PID" 2> /dev/null && wait "$RTPE_PID" || true
+}
+trap cleanup EXIT
+
+relayed() {
+	"$CTL" -ip 127.0.0.1 -port 9900 list totals | \
+		awk -F: '/Total relayed packets \(userspace\)/ { gsub(/ /, "", $2); print $2 }'
+}
+
+# utime + stime of the daemon, in clock ticks
+cputicks() {
+	awk '{ print $14 + $15 }' "/proc/$RTPE_PID/stat"
+}
+
+run() {
+	local name=$1
+	shift
+
+	"$RTPE_BIN" --foreground --log-stderr --log-level=4 --table=-1 \
+		--interface="$IP" --listen-ng="$IP:2223" --listen-cli=127.0.0.1:9900 \
+		"$@" &
+	RTPE_PID=$!
+	sleep 1
+
+	local pkts0 ticks0 pkts1 ticks1
+	pkts0=$(relayed)
+	ticks0=$(cputicks)
+
+	perl -I../perl simulator-ng.pl --local-ip="$IP" --destination="$IP:2223" \
+		--num-calls="$CALLS" --runtime="$RUNTIME" --protocols=RTP/AVP --no-encrypt \
+		--stats-interval="$RUNTIME" > /dev/null
+
+	pkts1=$(relayed)
+	ticks1=$(cputicks)
+
+	kill "$RTPE_PID"
+	wait "$RTPE_PID" || true
+	RTPE_PID=
+
+	awk -v name="$name" -v pkts=$((pkts1 - pkts0)) -v ticks=$((ticks1 - ticks0)) \
+		-v hz="$(getconf CLK_TCK)" -v runtime="$RUNTIME" 'BEGIN {
+			cpu = ticks / hz
+			printf("%-10s %12d packets %8.2f s CPU %10.0f pps %12.0f pps/core\n",
+				name, pkts, cpu, pkts / runtime, cpu > 0 ? pkts / cpu : 0)
+		}'
+}
+
+run epoll "$@"
+run io_uring --io-uring "$@"
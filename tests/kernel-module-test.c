@@ -9,12 +9,16 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/wait.h>
 #include "../kernel-module/xt_RTPENGINE.h"
 
 #define NUM_SOCKETS 41
 #define PORT_BASE 37526
 #define LOCALHOST htonl(0x7f000001)
 #define LEN(x) (sizeof(x)-1)
+#define LOAD_PORT_BASE (PORT_BASE + 1000)
 
 #define MSG(op, args...) \
 	printf("exec %s:%i\n", __FILE__, __LINE__); \
@@ -73,7 +77,146 @@
 		assert(sin.sin_port == htons(PORT_BASE + port)); \
 	}
 
-int main(void) {
+static void load_target(int fd, int flow) {
+	struct rtpengine_message rm;
+	int ret;
+
+	MSG(REMG_ADD_TARGET,
+		.target = {
+			.local = {
+				.family = AF_INET,
+				.u = {
+					.ipv4 = LOCALHOST,
+				},
+				.port = LOAD_PORT_BASE + flow * 2,
+			},
+			.decrypt = {
+				.cipher = REC_NULL,
+				.hmac = REH_NULL,
+			},
+			.src_mismatch = MSM_IGNORE,
+			.num_destinations = 1,
+		},
+	);
+	MSG(REMG_ADD_DESTINATION,
+		.destination = {
+			.local = {
+				.family = AF_INET,
+				.u = {
+					.ipv4 = LOCALHOST,
+				},
+				.port = LOAD_PORT_BASE + flow * 2,
+			},
+			.num = 0,
+			.output = {
+				.src_addr = {
+					.family = AF_INET,
+					.u = {
+						.ipv4 = LOCALHOST,
+					},
+					.port = LOAD_PORT_BASE + flow * 2,
+				},
+				.dst_addr = {
+					.family = AF_INET,
+					.u = {
+						.ipv4 = LOCALHOST,
+					},
+					.port = LOAD_PORT_BASE + flow * 2 + 1,
+				},
+				.encrypt = {
+					.cipher = REC_NULL,
+					.hmac = REH_NULL,
+				},
+			},
+		},
+	);
+}
+
+static uint64_t load_forwarded(void) {
+	int fd = open("/proc/rtpengine/0/blist", O_RDONLY);
+	assert(fd != -1);
+
+	struct rtpengine_list_entry le;
+	uint64_t packets = 0;
+
+	while (read(fd, &le, sizeof(le)) == sizeof(le)) {
+		if (le.target.local.port < LOAD_PORT_BASE)
+			continue;
+		packets += le.stats.packets;
+	}
+
+	close(fd);
+	return packets;
+}
+
+static void load_sender(int flow, int seconds) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	assert(fd != -1);
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(LOAD_PORT_BASE + flow * 2),
+		.sin_addr = { LOCALHOST },
+	};
+	// RTP header plus 160 bytes of payload
+	static const char pkt[172] = { 0x80, 0x08, };
+
+	time_t end = time(NULL) + seconds;
+	unsigned int n = 0;
+	while (1) {
+		sendto(fd, pkt, sizeof(pkt), 0, (struct sockaddr *) &sin, sizeof(sin));
+		if ((++n & 0x3ff) == 0 && time(NULL) >= end)
+			break;
+	}
+	exit(0);
+}
+
+// Forwarding throughput: each flow gets its own target and its own sending
+// process, and the kernel's own packet counters determine the result. Run
+// once against each module build to compare.
+static void load_test(int fd, int seconds, int flows) {
+	int sinks[flows];
+
+	for (int i = 0; i < flows; i++) {
+		// the forwarded packets must go somewhere, but nobody reads them
+		sinks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		assert(sinks[i] != -1);
+		struct sockaddr_in sin = {
+			.sin_family = AF_INET,
+			.sin_port = htons(LOAD_PORT_BASE + i * 2 + 1),
+			.sin_addr = { LOCALHOST },
+		};
+		int ret = bind(sinks[i], (struct sockaddr *) &sin, sizeof(sin));
+		assert(ret == 0);
+
+		load_target(fd, i);
+	}
+
+	uint64_t before = load_forwarded();
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = 0; i < flows; i++) {
+		pid_t pid = fork();
+		assert(pid != -1);
+		if (pid == 0)
+			load_sender(i, seconds);
+	}
+	for (int i = 0; i < flows; i++)
+		wait(NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	uint64_t packets = load_forwarded() - before;
+	double secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("load: %i flows, %.2f s, %llu packets forwarded, %.0f pps\n",
+			flows, secs, (unsigned long long) packets, packets / secs);
+	assert(packets > 0);
+
+	for (int i = 0; i < flows; i++)
+		close(sinks[i]);
+}
+
+int main(int argc, char **argv) {
 	int fd = open("/proc/rtpengine/0/control", O_RDWR);
 	assert(fd != -1);
 
@@ -876,5 +1019,109 @@ int main(void) {
 	SND(40, 27, "\x80\x08\x44\x0d\xc2\x3e\xd8\xc0\x21\x9f\x0b\x2e\xd0\x42\xf4\x50\xbb\x7d\x73\xab\xb9\x4e\xd8\x65\xe8\xbf\xeb\xfb\xdc\xdf\xf3\xa6\x63\x58\x84\x37\x49\xc9\xc9\x61\xd9\x43\x51\xde\xfa\x1f\xe5\x34\x9d\x05\x30\x0f\x06\x4f\xb1\x81\x13\x8c\x84\xb2\x26\x93\x0c\x8f\xf1\x6a\x97\x7b\x8c\xe0\xc8\x0a\x66\xe3\xdc\xe4\xd3\xec\x4e\xa5\x8d\x58\x55\x71\x2a\x19\x7c\xad\x55\x46\xe9\xcb\xb4\x79\xde\x8c\x2f\x33\xea\x70\x1b\x08\x4f\xf4\xf4\x2f\x2c\xe6\xb8\x5e\x2a\x65\xab\x06\x74\xbf\xc4\xb1\xc8\x27\x54\x53\xaf\xe8\xca\x1f\x75\xfa\x23\xe9\x6b\x2b\x3e\xed\x4d\x67\x4c\x71\x4c\x53\x74\x4b\x1e\xa7\x5b\x75\x49\x6b\xb3\x64\x6b\x0e\xa5\x12\x8f\x46\x2b\x7d\x17\x54\x2a\x75\xd1\x42\x6b\x7a\xbf\x0e\xd7\x19\x4a\x96\xea\xd9\xd1\xc8\x12\x30\xc3\x33\x4f\xc6\xa6\x0e\x36\xe0\x1f\x0c");
 	EXPF(29, "\x80\x08\x44\x0d\xc2\x3e\xd8\xc0\x21\x9f\x0b\x2e\x57\x55\x55\xd5\xd6\xd1\xd1\xd1\xd4\x55\x57\x56\x54\xd5\xd6\xd4\x55\xd5\xd4\xd1\xd0\xd7\xd4\x54\x54\x55\x55\x57\x51\x56\x56\x55\xd7\xd1\xd6\xd7\xd7\xd7\xd0\xd1\xd1\xd7\x55\x56\x51\x50\x51\x56\x50\x50\x52\x53\xd5\xdc\xdc\xd1\x55\x56\xd5\xdd\xdc\xd3\x57\x53\x53\x54\x57\x54\x54\x54\x54\xd5\x55\xd4\xd6\xd7\x54\x57\x56\x54\x55\x57\x5d\x5c\x53\x56\xd7\xd6\xd4\xd5\xd4\xd6\xd1\xd6\xd7\xd4\x55\x55\xd5\x55\x55\xd1\xd3\xd0\xd3\xdd\xd1\xd0\xd0\xd1\xd6\xd6\xd5\x55\x55\x56\x50\x53\x5f\x5e\x5f\x5d\x50\x56\x50\x56\x54\xd4\xd7\xd6\x55\x53\x5d\x56\xd6\xd0\xd6\x56\x5d\x5f\x51\xd0\xd3\xd4\x54\x54\xd4\xd1\xd6\xd6\xd1\xd1\xd6\xd4\xd5\x55\xd6\xd7\x55\x57", 26);
 
+
+	// batched: target plus destination in one write, then removal
+	{
+		struct {
+			struct rtpengine_message msg;
+			struct rtpengine_batch_op ops[2];
+		} batch;
+
+		memset(&batch, 0, sizeof(batch));
+		batch.msg.cmd = REMG_BATCH;
+		batch.msg.u.batch.num_ops = 2;
+		batch.ops[0] = (struct rtpengine_batch_op) {
+			.cmd = REMG_ADD_TARGET,
+			.u.target = {
+				.local = {
+					.family = AF_INET,
+					.u = {
+						.ipv4 = LOCALHOST,
+					},
+					.port = PORT_BASE + 30,
+				},
+				.decrypt = {
+					.cipher = REC_NULL,
+					.hmac = REH_NULL,
+				},
+				.src_mismatch = MSM_IGNORE,
+				.num_destinations = 1,
+			},
+		};
+		batch.ops[1] = (struct rtpengine_batch_op) {
+			.cmd = REMG_ADD_DESTINATION,
+			.u.destination = {
+				.local = {
+					.family = AF_INET,
+					.u = {
+						.ipv4 = LOCALHOST,
+					},
+					.port = PORT_BASE + 30,
+				},
+				.num = 0,
+				.output = {
+					.src_addr = {
+						.family = AF_INET,
+						.u = {
+							.ipv4 = LOCALHOST,
+						},
+						.port = PORT_BASE + 30,
+					},
+					.dst_addr = {
+						.family = AF_INET,
+						.u = {
+							.ipv4 = LOCALHOST,
+						},
+						.port = PORT_BASE + 31,
+					},
+					.encrypt = {
+						.cipher = REC_NULL,
+						.hmac = REH_NULL,
+					},
+				},
+			},
+		};
+
+		printf("exec %s:%i\n", __FILE__, __LINE__);
+		ret = read(fd, &batch, sizeof(batch));
+		printf("ret = %i\n", ret);
+		assert(ret == sizeof(batch));
+		assert(batch.ops[0].result == 0);
+		assert(batch.ops[1].result == 0);
+
+		SND(40, 30, "batch");
+		EXPF(31, "batch", 30);
+
+		memset(&batch, 0, sizeof(batch));
+		batch.msg.cmd = REMG_BATCH;
+		batch.msg.u.batch.num_ops = 1;
+		batch.ops[0].cmd = REMG_DEL_TARGET;
+		batch.ops[0].u.target.local = (struct re_address) {
+			.family = AF_INET,
+			.u = {
+				.ipv4 = LOCALHOST,
+			},
+			.port = PORT_BASE + 30,
+		};
+
+		printf("exec %s:%i\n", __FILE__, __LINE__);
+		ret = read(fd, &batch, sizeof(batch.msg) + sizeof(batch.ops[0]));
+		printf("ret = %i\n", ret);
+		assert(ret == sizeof(batch.msg) + sizeof(batch.ops[0]));
+		assert(batch.ops[0].result == 0);
+
+		SND(40, 30, "unbatched");
+		EXP(30, "unbatched");
+	}
+
+	// optional: kernel-module-test <seconds> [<flows>]
+	if (argc > 1) {
+		int seconds = atoi(argv[1]);
+		int flows = argc > 2 ? atoi(argv[2]) : 4;
+		assert(seconds > 0);
+		assert(flows > 0 && flows < 500);
+		load_test(fd, seconds, flows);
+	}
+
 	return 0;
 }
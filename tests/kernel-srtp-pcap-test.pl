@@ -0,0 +1,302 @@
+#!/usr/bin/perl
+
+# Checks the kernel module's SRTP encryption and decryption against the Perl
+# reference implementation, using RTP taken from a pcap file. Only the first
+# SSRC found in the capture is used.
+#
+# Requires the module to be loaded with table 0 present and an iptables rule
+# like `iptables -I INPUT -p udp -d 127.0.0.1 -j RTPENGINE --id 0` in place.
+#
+# Usage: $0 <file> [crypto suite]
+# Ex:    $0 foo.pcap
+# Ex:    $0 foo.pcap AES_256_CM_HMAC_SHA1_32
+#
+# Message layouts and constants are taken from kernel-module/xt_RTPENGINE.h
+# by compiling a small helper at startup, which needs a C compiler ($CC or cc).
+use strict;
+use warnings;
+use Socket;
+use IO::Select;
+use FindBin;
+use File::Temp qw(tempdir);
+use NGCP::Rtpclient::SRTP;
+use NGCP::Rtpengine::Pcap;
+
+my $table = 0;
+my $port_base = 3500;
+my ($port_send, $port_local, $port_recv) = ($port_base, $port_base + 2, $port_base + 4);
+
+my %abi = kernel_abi();
+
+my %ciphers = (
+	AES_CM_128_HMAC_SHA1_80 => $abi{REC_AES_CM_128},
+	AES_CM_128_HMAC_SHA1_32 => $abi{REC_AES_CM_128},
+	F8_128_HMAC_SHA1_80 => $abi{REC_AES_F8},
+	AES_192_CM_HMAC_SHA1_80 => $abi{REC_AES_CM_192},
+	AES_192_CM_HMAC_SHA1_32 => $abi{REC_AES_CM_192},
+	AES_256_CM_HMAC_SHA1_80 => $abi{REC_AES_CM_256},
+	AES_256_CM_HMAC_SHA1_32 => $abi{REC_AES_CM_256},
+);
+
+my $suite_name = $ARGV[1] // 'AES_CM_128_HMAC_SHA1_80';
+my $suite = $NGCP::Rtpclient::SRTP::crypto_suites{$suite_name} or die "unknown suite $suite_name";
+exists($ciphers{$suite_name}) or die "suite $suite_name not supported by the kernel module";
+
+my $kfd;
+open($kfd, '+>', "/proc/rtpengine/$table/control") or die $!;
+
+my @packets;
+my $ssrc;
+my %pts;
+
+print("reading pcap\n");
+add_packet($_->{udp}->{payload}) for NGCP::Rtpengine::Pcap::read_udp($ARGV[0] // die("no pcap file given"));
+@packets or die "no RTP packets found";
+printf("%u packets with SSRC %08x, payload types %s\n", scalar(@packets), $ssrc,
+	join(',', sort { $a <=> $b } keys(%pts)));
+
+my $master_key = join('', map { chr(int(rand(256))) } 1 .. $suite->{key_length});
+my $master_salt = join('', map { chr(int(rand(256))) } 1 .. $suite->{salt_length});
+my @session_keys = NGCP::Rtpclient::SRTP::gen_rtp_session_keys($master_key, $master_salt);
+
+my $send_sock = udp_socket($port_send);
+my $local_sock = udp_socket($port_local);
+my $recv_sock = udp_socket($port_recv);
+
+my $fails = 0;
+
+print("testing decryption\n");
+add_target(1, 0);
+$fails += run(sub { srtp_encrypt(@_) }, sub { $_[0] });
+del_target();
+
+print("testing encryption\n");
+add_target(0, 1);
+$fails += run(sub { $_[0] }, sub { srtp_encrypt(@_) });
+del_target();
+
+print($fails ? "$fails packets mismatched\n" : "all packets matched\n");
+exit($fails ? 1 : 0);
+
+sub run {
+	my ($to_kernel, $expected) = @_;
+	my $mismatch = 0;
+	my ($roc_in, $roc_out) = (0, 0);
+	my $dst = sockaddr_in($port_local, inet_aton('127.0.0.1'));
+
+	for my $pkt (@packets) {
+		my ($in, $out);
+		($in, $roc_in) = $to_kernel->($pkt, $roc_in);
+		($out, $roc_out) = $expected->($pkt, $roc_out);
+		send($send_sock, $in, 0, $dst) or die $!;
+
+		my $got = '';
+		if (IO::Select->new($recv_sock)->can_read(1)) {
+			recv($recv_sock, $got, 65535, 0) // die $!;
+		}
+		next if $got eq $out;
+		printf("packet seq %u mismatch:\n  expected %s\n  received %s\n", unpack('x2n', $pkt),
+			unpack('H*', $out), unpack('H*', $got));
+		$mismatch++;
+	}
+
+	return $mismatch;
+}
+
+sub srtp_encrypt {
+	my ($pkt, $roc) = @_;
+	return NGCP::Rtpclient::SRTP::encrypt_rtp($suite, @session_keys, $roc, undef, 0, 0, 0, $pkt);
+}
+
+sub udp_socket {
+	my ($port) = @_;
+	my $fd;
+	socket($fd, AF_INET, SOCK_DGRAM, 0) or die $!;
+	bind($fd, sockaddr_in($port, inet_aton('127.0.0.1'))) or die $!;
+	return $fd;
+}
+
+sub kernel_abi {
+	my $dir = tempdir(CLEANUP => 1);
+	my $fh;
+	open($fh, '>', "$dir/abi.c") or die $!;
+	print $fh <<'EOC';
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "xt_RTPENGINE.h"
+
+#define C(name) printf(#name " %lu\n", (unsigned long) (name))
+#define O(name, type, member) printf(#name " %lu\n", (unsigned long) offsetof(type, member))
+
+int main(void) {
+	C(REMG_ADD_TARGET);
+	C(REMG_DEL_TARGET);
+	C(REMG_ADD_DESTINATION);
+	C(REC_NULL);
+	C(REC_AES_CM_128);
+	C(REC_AES_F8);
+	C(REC_AES_CM_192);
+	C(REC_AES_CM_256);
+	C(REH_NULL);
+	C(REH_HMAC_SHA1);
+
+	printf("msg_size %lu\n", (unsigned long) sizeof(struct rtpengine_message));
+	O(msg_u, struct rtpengine_message, u);
+
+	O(addr_family, struct re_address, family);
+	O(addr_ipv4, struct re_address, u.ipv4);
+	O(addr_port, struct re_address, port);
+
+	O(srtp_cipher, struct rtpengine_srtp, cipher);
+	O(srtp_hmac, struct rtpengine_srtp, hmac);
+	O(srtp_master_key, struct rtpengine_srtp, master_key);
+	O(srtp_master_key_len, struct rtpengine_srtp, master_key_len);
+	O(srtp_master_salt, struct rtpengine_srtp, master_salt);
+	O(srtp_master_salt_len, struct rtpengine_srtp, master_salt_len);
+	O(srtp_session_key_len, struct rtpengine_srtp, session_key_len);
+	O(srtp_session_salt_len, struct rtpengine_srtp, session_salt_len);
+	O(srtp_auth_tag_len, struct rtpengine_srtp, auth_tag_len);
+	O(srtp_mki_len, struct rtpengine_srtp, mki_len);
+
+	O(tgt_local, struct rtpengine_target_info, local);
+	O(tgt_num_destinations, struct rtpengine_target_info, num_destinations);
+	O(tgt_decrypt, struct rtpengine_target_info, decrypt);
+	O(tgt_ssrc, struct rtpengine_target_info, ssrc);
+	O(tgt_payload_types, struct rtpengine_target_info, payload_types);
+	O(tgt_num_payload_types, struct rtpengine_target_info, num_payload_types);
+	printf("pt_size %lu\n", (unsigned long) sizeof(struct rtpengine_payload_type));
+	O(pt_num, struct rtpengine_payload_type, pt_num);
+	O(pt_clock_rate, struct rtpengine_payload_type, clock_rate);
+
+	// bit fields have no offset: locate the byte that the flag sets
+	struct rtpengine_target_info t;
+	memset(&t, 0, sizeof(t));
+	t.rtp = 1;
+	for (size_t i = 0; i < sizeof(t); i++) {
+		unsigned char c = ((unsigned char *) &t)[i];
+		if (c)
+			printf("tgt_rtp_byte %lu\ntgt_rtp_bits %u\n", (unsigned long) i, c);
+	}
+
+	O(dst_local, struct rtpengine_destination_info, local);
+	O(dst_num, struct rtpengine_destination_info, num);
+	O(dst_output, struct rtpengine_destination_info, output);
+	O(out_src_addr, struct rtpengine_output_info, src_addr);
+	O(out_dst_addr, struct rtpengine_output_info, dst_addr);
+	O(out_encrypt, struct rtpengine_output_info, encrypt);
+
+	return 0;
+}
+EOC
+	close($fh);
+
+	system($ENV{CC} // 'cc', '-I', "$FindBin::Bin/../kernel-module", '-o', "$dir/abi", "$dir/abi.c") == 0
+		or die "failed to build ABI helper";
+
+	my %ret;
+	open($fh, '-|', "$dir/abi") or die $!;
+	while (my $line = <$fh>) {
+		my ($key, $val) = split(' ', $line);
+		$ret{$key} = $val;
+	}
+	close($fh) or die "ABI helper failed";
+	return %ret;
+}
+
+sub put {
+	my ($msg, $off, $packer, @vals) = @_;
+	my $bin = pack($packer, @vals);
+	substr($$msg, $off, length($bin)) = $bin;
+}
+
+sub put_address {
+	my ($msg, $off, $port) = @_;
+	put($msg, $off + $abi{addr_family}, 'i', AF_INET);
+	put($msg, $off + $abi{addr_ipv4}, 'a4', inet_aton('127.0.0.1'));
+	put($msg, $off + $abi{addr_port}, 'S', $port);
+}
+
+sub put_srtp {
+	my ($msg, $off, $enable) = @_;
+	if (!$enable) {
+		put($msg, $off + $abi{srtp_cipher}, 'I', $abi{REC_NULL});
+		put($msg, $off + $abi{srtp_hmac}, 'I', $abi{REH_NULL});
+		return;
+	}
+	put($msg, $off + $abi{srtp_cipher}, 'I', $ciphers{$suite_name});
+	put($msg, $off + $abi{srtp_hmac}, 'I', $abi{REH_HMAC_SHA1});
+	put($msg, $off + $abi{srtp_master_key}, 'a*', $master_key);
+	put($msg, $off + $abi{srtp_master_key_len}, 'I', length($master_key));
+	put($msg, $off + $abi{srtp_master_salt}, 'a*', $master_salt);
+	put($msg, $off + $abi{srtp_master_salt_len}, 'I', length($master_salt));
+	put($msg, $off + $abi{srtp_session_key_len}, 'I', length($master_key));
+	put($msg, $off + $abi{srtp_session_salt_len}, 'I', length($master_salt));
+	put($msg, $off + $abi{srtp_auth_tag_len}, 'I', $suite->{auth_tag});
+	put($msg, $off + $abi{srtp_mki_len}, 'I', 0);
+}
+
+sub new_msg {
+	my ($cmd) = @_;
+	my $msg = "\0" x $abi{msg_size};
+	put(\$msg, 0, 'I', $cmd);
+	return $msg;
+}
+
+sub write_msg {
+	my ($msg) = @_;
+	my $ret = syswrite($kfd, $msg);
+	defined($ret) && $ret == length($msg) or die "write to control file failed: $!";
+}
+
+sub add_target {
+	my ($decrypt, $encrypt) = @_;
+
+	my $tgt = $abi{msg_u};
+	my $msg = new_msg($abi{REMG_ADD_TARGET});
+	put_address(\$msg, $tgt + $abi{tgt_local}, $port_local);
+	put(\$msg, $tgt + $abi{tgt_num_destinations}, 'I', 1);
+	put_srtp(\$msg, $tgt + $abi{tgt_decrypt}, $decrypt);
+	put(\$msg, $tgt + $abi{tgt_ssrc}, 'N', $ssrc);				# ssrc[0], network order
+	my @pt_list = sort { $a <=> $b } keys(%pts);
+	for my $i (0 .. $#pt_list) {
+		my $pt = $tgt + $abi{tgt_payload_types} + $i * $abi{pt_size};
+		put(\$msg, $pt + $abi{pt_num}, 'C', $pt_list[$i]);
+		put(\$msg, $pt + $abi{pt_clock_rate}, 'I', 8000);
+	}
+	put(\$msg, $tgt + $abi{tgt_num_payload_types}, 'I', scalar(@pt_list));
+	put(\$msg, $tgt + $abi{tgt_rtp_byte}, 'C', $abi{tgt_rtp_bits});
+	write_msg($msg);
+
+	my $dst = $abi{msg_u};
+	my $out = $dst + $abi{dst_output};
+	$msg = new_msg($abi{REMG_ADD_DESTINATION});
+	put_address(\$msg, $dst + $abi{dst_local}, $port_local);
+	put(\$msg, $dst + $abi{dst_num}, 'I', 0);
+	put_address(\$msg, $out + $abi{out_src_addr}, $port_local);
+	put_address(\$msg, $out + $abi{out_dst_addr}, $port_recv);
+	put_srtp(\$msg, $out + $abi{out_encrypt}, $encrypt);
+	write_msg($msg);
+}
+
+sub del_target {
+	my $msg = new_msg($abi{REMG_DEL_TARGET});
+	put_address(\$msg, $abi{msg_u} + $abi{tgt_local}, $port_local);
+	write_msg($msg);
+}
+
+sub add_packet {
+	my ($payload) = @_;
+
+	return if length($payload) < 12;
+	my ($vpx, $mpt, $pssrc) = unpack('C C x6 N', $payload);
+	return if ($vpx & 0xc0) != 0x80;
+	my $pt = $mpt & 0x7f;
+	return if $pt >= 72 && $pt <= 76;				# RTCP
+	$ssrc //= $pssrc;
+	return if $pssrc != $ssrc;
+	return if keys(%pts) >= 32 && !$pts{$pt};
+	$pts{$pt} = 1;
+	push(@packets, $payload);
+}
@@ -0,0 +1,241 @@
+// Load generator for rtpengine-recording. Creates intercept streams in a kernel
+// table, writes a metadata file for each call into the spool directory and then
+// feeds every stream 50 RTP packets per second (PCMA, 20 ms), the same way the
+// daemon hands over packets it relays itself. If the PID of the recording daemon
+// is given, the CPU time it used is reported at the end.
+//
+// The table must exist and rtpengine-recording must be watching the spool
+// directory (--spool-dir) and reading from the same table (--table).
+//
+// Usage: recording-replay TABLE SPOOL-DIR [STREAMS] [SECONDS] [PID]
+// Ex:    gcc -O2 -o recording-replay recording-replay.c
+//        ./recording-replay 0 /var/spool/rtpengine/metadata 2000 60 $(pidof rtpengine-recording)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include "../kernel-module/xt_RTPENGINE.h"
+
+#define PAYLOAD_LEN 160
+#define PTIME_NS 20000000LL
+
+struct stream {
+	unsigned int idx;
+	uint16_t seq;
+	uint32_t ts;
+	uint32_t ssrc;
+};
+
+struct packet {
+	struct rtpengine_message msg;
+	struct iphdr ip;
+	struct udphdr udp;
+	unsigned char rtp[12];
+	unsigned char payload[PAYLOAD_LEN];
+} __attribute__ ((packed));
+
+static int ctl_fd = -1;
+
+static void die(const char *msg) {
+	fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+	exit(1);
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned int add_call(const char *id) {
+	struct rtpengine_message msg = { .cmd = REMG_ADD_CALL };
+	snprintf(msg.u.call.call_id, sizeof(msg.u.call.call_id), "%s", id);
+	if (read(ctl_fd, &msg, sizeof(msg)) != sizeof(msg))
+		die("failed to add call");
+	return msg.u.call.call_idx;
+}
+
+static unsigned int add_stream(unsigned int call_idx, const char *name) {
+	struct rtpengine_message msg = { .cmd = REMG_ADD_STREAM };
+	msg.u.stream.call_idx = call_idx;
+	snprintf(msg.u.stream.stream_name, sizeof(msg.u.stream.stream_name), "%s", name);
+	if (read(ctl_fd, &msg, sizeof(msg)) != sizeof(msg))
+		die("failed to add stream");
+	return msg.u.stream.stream_idx;
+}
+
+static void del_call(unsigned int call_idx) {
+	struct rtpengine_message msg = { .cmd = REMG_DEL_CALL };
+	msg.u.call.call_idx = call_idx;
+	if (write(ctl_fd, &msg, sizeof(msg)) != sizeof(msg))
+		fprintf(stderr, "failed to delete call %u: %s\n", call_idx, strerror(errno));
+}
+
+static void chunk(FILE *fp, const char *section, const char *content) {
+	fprintf(fp, "%s\n%zu:\n%s\n\n", section, strlen(content), content);
+}
+
+static void write_meta(const char *dir, const char *id, const struct stream *s) {
+	char path[4096], section[64], content[128];
+
+	snprintf(path, sizeof(path), "%s/%s.meta", dir, id);
+	FILE *fp = fopen(path, "w");
+	if (!fp)
+		die("failed to create metadata file");
+
+	chunk(fp, "CALL-ID", id);
+	chunk(fp, "PARENT", id);
+	chunk(fp, "RECORDING 1", "");
+	chunk(fp, "TAG 0", "caller");
+	chunk(fp, "TAG 1", "callee");
+	for (unsigned int i = 0; i < 2; i++) {
+		snprintf(section, sizeof(section), "MEDIA %u PAYLOAD TYPE 8", i + 1);
+		chunk(fp, section, "PCMA/8000");
+		snprintf(section, sizeof(section), "STREAM %u details", i);
+		snprintf(content, sizeof(content),
+				"TAG %u MEDIA %u TAG-MEDIA 1 COMPONENT 1 FLAGS 0", i, i + 1);
+		chunk(fp, section, content);
+		snprintf(section, sizeof(section), "STREAM %u KERNEL-INDEX %u", i, s[i].idx);
+		chunk(fp, section, "");
+		snprintf(section, sizeof(section), "STREAM %u interface", i);
+		snprintf(content, sizeof(content), "%s-%u", id, i);
+		chunk(fp, section, content);
+	}
+
+	fclose(fp);
+}
+
+static void send_packet(struct stream *s) {
+	struct packet p = {
+		.msg = { .cmd = REMG_PACKET, .u = { .packet = { .stream_idx = s->idx } } },
+		.ip = {
+			.version = 4,
+			.ihl = 5,
+			.ttl = 64,
+			.protocol = IPPROTO_UDP,
+			.tot_len = htons(sizeof(p) - sizeof(p.msg)),
+			.saddr = htonl(0x7f000001),
+			.daddr = htonl(0x7f000001),
+		},
+		.udp = {
+			.source = htons(40000),
+			.dest = htons(30000),
+			.len = htons(sizeof(p) - sizeof(p.msg) - sizeof(p.ip)),
+		},
+	};
+	p.rtp[0] = 0x80;
+	p.rtp[1] = 8;
+	*(uint16_t *) &p.rtp[2] = htons(s->seq++);
+	*(uint32_t *) &p.rtp[4] = htonl(s->ts);
+	*(uint32_t *) &p.rtp[8] = htonl(s->ssrc);
+	s->ts += PAYLOAD_LEN;
+	memset(p.payload, 0xd5, sizeof(p.payload));
+
+	if (write(ctl_fd, &p, sizeof(p)) != sizeof(p))
+		die("failed to submit packet");
+}
+
+// utime + stime of a process, in clock ticks
+static long long cputicks(int pid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%i/stat", pid);
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	unsigned long long ut, st;
+	int ret = fscanf(fp, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &ut, &st);
+	fclose(fp);
+	if (ret != 2)
+		return -1;
+	return ut + st;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s TABLE SPOOL-DIR [STREAMS] [SECONDS] [PID]\n", argv[0]);
+		return 1;
+	}
+
+	unsigned int table = atoi(argv[1]);
+	const char *spool = argv[2];
+	unsigned int num_streams = argc > 3 ? atoi(argv[3]) : 2000;
+	unsigned int runtime = argc > 4 ? atoi(argv[4]) : 30;
+	int pid = argc > 5 ? atoi(argv[5]) : 0;
+	unsigned int num_calls = (num_streams + 1) / 2;
+
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/rtpengine/%u/control", table);
+	ctl_fd = open(path, O_RDWR);
+	if (ctl_fd == -1)
+		die("failed to open kernel table");
+
+	struct stream *streams = calloc(num_calls * 2, sizeof(*streams));
+	unsigned int *calls = calloc(num_calls, sizeof(*calls));
+	char id[64];
+
+	for (unsigned int c = 0; c < num_calls; c++) {
+		snprintf(id, sizeof(id), "replay-%i-%u", getpid(), c);
+		calls[c] = add_call(id);
+		for (unsigned int i = 0; i < 2; i++) {
+			char name[80];
+			snprintf(name, sizeof(name), "%s-%u", id, i);
+			struct stream *s = &streams[c * 2 + i];
+			s->idx = add_stream(calls[c], name);
+			s->ssrc = random();
+			s->seq = random();
+			s->ts = random();
+		}
+		write_meta(spool, id, &streams[c * 2]);
+	}
+
+	// give the recording daemon time to open everything
+	sleep(2);
+
+	long long ticks = pid ? cputicks(pid) : -1;
+	long long start = now_ns(), next = start;
+	unsigned long long sent = 0, late = 0;
+
+	while (next - start < runtime * 1000000000LL) {
+		for (unsigned int i = 0; i < num_streams; i++)
+			send_packet(&streams[i]);
+		sent += num_streams;
+
+		next += PTIME_NS;
+		long long now = now_ns();
+		if (now > next) {
+			late++;
+			continue;
+		}
+		struct timespec ts = { (next - now) / 1000000000LL, (next - now) % 1000000000LL };
+		nanosleep(&ts, NULL);
+	}
+
+	if (pid && ticks >= 0) {
+		long long ticks1 = cputicks(pid);
+		double cpu = (double) (ticks1 - ticks) / sysconf(_SC_CLK_TCK);
+		printf("%u streams, %llu packets in %u s, recording daemon CPU time %.2f s (%.1f%%)\n",
+				num_streams, sent, runtime, cpu, cpu * 100.0 / runtime);
+	}
+	else
+		printf("%u streams, %llu packets in %u s\n", num_streams, sent, runtime);
+	if (late)
+		printf("fell behind schedule in %llu of %llu intervals\n", late, sent / num_streams);
+
+	for (unsigned int c = 0; c < num_calls; c++) {
+		char fn[4096];
+		del_call(calls[c]);
+		snprintf(fn, sizeof(fn), "%s/replay-%i-%u.meta", spool, getpid(), c);
+		unlink(fn);
+	}
+
+	return 0;
+}
@@ -5,9 +5,9 @@
 # Ex:    $0 foo.pcap 97 opus/48000
 use strict;
 use warnings;
-use Net::Pcap;
 use Data::Dumper;
 use Time::HiRes qw(usleep);
+use NGCP::Rtpengine::Pcap;
 
 my $spool_dir = '/var/spool/rtpengine';
 my $table = 0;
@@ -15,18 +15,13 @@ my $table = 0;
 my $kfd;
 open($kfd, '+>', "/proc/rtpengine/$table/control") or die $!;
 
-my $err;
-my $p = pcap_open_offline($ARGV[0], \$err) or die $err;
-my $linktype = pcap_datalink($p);
-
 my @packets;
 my %src_ips;
 my $tags = 0;
 my $streams = 0;
 
 print("reading pcap\n");
-my $ret = pcap_loop($p, -1, \&loop_cb, '');
-$ret == 0 or die $ret;
+add_packet($_) for NGCP::Rtpengine::Pcap::read_udp($ARGV[0]);
 
 my $meta_file = "$spool_dir/" . rand() . '.meta';
 
@@ -73,7 +68,7 @@ for my $key (@tag_keys) {
 
 print("sending packets\n");
 foreach my $pack (@packets) {
-	msg_ret(9, $pack->{eth}->{rest}, '', 'I I', $cid, $pack->{media}->{sid});
+	msg_ret(9, $pack->{ip}, '', 'I I', $cid, $pack->{media}->{sid});
 	usleep(5000);
 }
 
@@ -84,79 +79,33 @@ unlink($meta_file);
 print("done\n");
 exit;
 
-sub loop_cb {
-	my ($user_data, $header, $packet) = @_;
-	my %eth;
-	if ($linktype == DLT_EN10MB) {
-		@eth{qw(src dst type rest)} = unpack('a6 a6 n a*', $packet);
-	}
-	elsif ($linktype == DLT_LINUX_SLL) {
-		@eth{qw(direction arphdr addrlen addr type rest)} = unpack('nnn a8 n a*', $packet);
-	}
-	else {
-		die($linktype);
-	}
-	if ($eth{type} == 0x0800) {
-		my $ip = ip($eth{rest});
-		my $rtp = rtp($ip->{udp}->{payload});
-
-		my %pkt = ( eth => \%eth, ip => $ip, rtp => $rtp );
-
-		my $src_ip = $ip->{src};
-		my $tag = ($src_ips{$src_ip} //= {
-				id => $tags++,
-				ports => { },
-				medias => 0,
-			});
-		$pkt{tag} = $tag;
-
-		my $component = $ip->{udp}->{src} & 1;
-		my $base_port = $ip->{udp}->{src} - $component;
-		my $base_media = ($tag->{ports}->{$base_port} //= {
-				media_id => $tag->{medias}++,
-				component => 0,
-				stream_id => $streams++,
-			});
-
-		my $media = ($tag->{ports}->{$ip->{udp}->{src}} //= {
-				media_id => $base_media->{media_id},
-				component => $component,
-				stream_id => $streams++,
-			});
-		$pkt{media} =  $media;
-
-		push(@packets, \%pkt);
-	}
-	else {
-		die($eth{type});
-	}
-}
-
-sub ip {
-	my ($p) = @_;
-	my %ret;
-	@ret{qw(hv diffserv totlen id flags_foff ttl proto csum src dst rest)} = unpack('C C n n n C C n N N a*', $p);
-	if ($ret{proto} == 17) {
-		$ret{udp} = udp($ret{rest});
-	}
-	else {
-		die $ret{proto};
-	}
-	return \%ret;
-}
-
-sub udp {
-	my ($p) = @_;
-	my %ret;
-	@ret{qw(src dst len csum payload)} = unpack('nnnn a*', $p);
-	return \%ret;
-}
-
-sub rtp {
-	my ($p) = @_;
-	my %ret;
-	@ret{qw(vpx pt seq ts ssrc payload)} = unpack('CC n N N', $p);
-	return \%ret;
+sub add_packet {
+	my ($pkt) = @_;
+
+	my $src_ip = $pkt->{src};
+	my $tag = ($src_ips{$src_ip} //= {
+			id => $tags++,
+			ports => { },
+			medias => 0,
+		});
+	$pkt->{tag} = $tag;
+
+	my $component = $pkt->{udp}->{src} & 1;
+	my $base_port = $pkt->{udp}->{src} - $component;
+	my $base_media = ($tag->{ports}->{$base_port} //= {
+			media_id => $tag->{medias}++,
+			component => 0,
+			stream_id => $streams++,
+		});
+
+	my $media = ($tag->{ports}->{$pkt->{udp}->{src}} //= {
+			media_id => $base_media->{media_id},
+			component => $component,
+			stream_id => $streams++,
+		});
+	$pkt->{media} = $media;
+
+	push(@packets, $pkt);
 }
 
 sub put_meta {